@@ -124,6 +124,36 @@ struct Mem
     uint8_t* hram;
 };
 
+enum Event
+{
+    Event_FRAME_SEQUENCER,
+    Event_VSYNC,
+    Event_TIMER,
+    Event_END_FRAME,
+    Event_CAPTURE,
+    Event_MAX,
+};
+
+#if GBS_ENABLE_REGLOG
+// what the cpu reads back from the apu while it isn't synthesized.
+struct ApuShadow
+{
+    // 0xFF10-0xFF3F as written.
+    uint8_t io[0x30];
+    // length clocks left for each channel.
+    uint16_t length[4];
+    // channels that are on, as read from nr52.
+    uint8_t active;
+    // the next frame sequencer step.
+    uint8_t step;
+    // pulse 1 sweep.
+    uint16_t sweep_freq;
+    uint8_t sweep_timer;
+    bool sweep_enabled;
+    bool sweep_negated;
+};
+#endif
+
 struct Gbs
 {
     struct LR35902 cpu;
@@ -139,21 +169,402 @@ struct Gbs
     uint8_t song;
     bool waiting_vsync;
     bool end_frame;
+
+#ifndef __GBA__
+    // when each pending event fires, used to save and restore the scheduler.
+    unsigned event_cycles[Event_MAX];
+#endif
+
+#if GBS_ENABLE_SNAPSHOT
+    GbsSnapshotCache* snapshot_cache;
+    // set while running init, cleared by the first halt in the player loop.
+    bool stop_on_halt;
+#endif
+
+    double sample_rate;
+
+#if GBS_ENABLE_STEMS
+    // NULL unless enabled, each mirrors apu with only its channel audible.
+    GbApu* stems[GbsStem_MAX];
+#endif
+
+#if GBS_ENABLE_CAPTURE
+    // NULL unless enabled.
+    struct GbsCaptureRing* capture;
+    unsigned capture_interval;
+    // cycles since the song started, at scheduler tick 0. negative as init isn't counted.
+    int64_t capture_base;
+#endif
+
+#if GBS_ENABLE_SNAPSHOT
+    // cycles since the song started, at scheduler tick 0. kept in snapshots.
+    uint64_t cycles_base;
+#endif
+
+#if GBS_ENABLE_REGLOG
+    // NULL unless recording, next_recorder is used from the next song start.
+    GbsRecorder* recorder;
+    GbsRecorder* next_recorder;
+    // cycles since the song started, at scheduler tick 0.
+    uint64_t record_base;
+    // set if the apu isn't synthesized, next_no_synth is used from the next song start.
+    bool no_synth;
+    bool next_no_synth;
+    struct ApuShadow shadow;
+#endif
 };
 
-enum { FRAME_SEQUENCER_CLOCK = 8192 };
-enum { VSYNC_CLOCK = 70224 };
+#if GBS_ENABLE_STEMS
+    #ifdef __GBA__
+        #error "stems are not supported on the gba, the apu is hardware."
+    #endif
 
-enum Event
+    // repeats an apu call on every stem apu.
+    #define STEMS_CALL(gbs, func, ...) do { \
+        if ((gbs)->stems[0]) { \
+            for (unsigned stem_ = 0; stem_ < GbsStem_MAX; stem_++) { \
+                func((gbs)->stems[stem_], __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+#else
+    #define STEMS_CALL(gbs, func, ...) do { } while (0)
+#endif
+
+#if GBS_ENABLE_CAPTURE && defined(__GBA__)
+    #error "capture is not supported on the gba, the apu is hardware."
+#endif
+
+#if GBS_ENABLE_REGLOG
+#ifdef __GBA__
+    #error "register logs are not supported on the gba, the timers are hardware."
+#endif
+
+struct GbsRecorder
 {
-    Event_FRAME_SEQUENCER,
-    Event_VSYNC,
-    Event_TIMER,
-    Event_END_FRAME,
-    Event_MAX,
+    // native command stream, without the header or end.
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    // cycle of the last command, and of the end of the last gbs_run().
+    uint64_t time;
+    uint64_t end_time;
+    // set if an alloc failed, the log is incomplete.
+    bool error;
 };
 
+// room for the longest wait and a write.
+enum { RECORDER_MAX_COMMAND_SIZE = 1 + 10 + 2 };
+
+static void recorder_start(Gbs* gbs)
+{
+    GbsRecorder* rec = gbs->recorder;
+    rec->size = 0;
+    rec->time = 0;
+    rec->end_time = 0;
+    rec->error = false;
+    gbs->record_base = 0;
+}
+
+static void recorder_write(Gbs* gbs, uint8_t reg, uint8_t value)
+{
+    GbsRecorder* rec = gbs->recorder;
+    const uint64_t time = gbs->record_base + scheduler_get_ticks(&gbs->scheduler);
+
+    if (rec->size + RECORDER_MAX_COMMAND_SIZE > rec->capacity)
+    {
+        const size_t capacity = rec->capacity ? rec->capacity * 2 : 1024 * 64;
+        uint8_t* data = realloc(rec->data, capacity);
+        if (!data)
+        {
+            rec->error = true;
+            return;
+        }
+        rec->data = data;
+        rec->capacity = capacity;
+    }
+
+    uint64_t wait = time - rec->time;
+    if (wait > 64)
+    {
+        rec->data[rec->size++] = GbsRegLogCmd_WAIT;
+        do
+        {
+            rec->data[rec->size++] = (wait & 0x7F) | (wait > 0x7F ? 0x80 : 0);
+            wait >>= 7;
+        } while (wait);
+    }
+    else if (wait)
+    {
+        rec->data[rec->size++] = GbsRegLogCmd_WAIT_SHORT | (wait - 1);
+    }
+
+    rec->data[rec->size++] = reg - 0x10;
+    rec->data[rec->size++] = value;
+    rec->time = time;
+}
+#endif
+
+enum { FRAME_SEQUENCER_CLOCK = 8192 };
+enum { VSYNC_CLOCK = 70224 };
+
 static const uint16_t TAC_FREQ[4] = { 1024, 16, 64, 256 };
+#if GBS_ENABLE_REGLOG
+// unused bits read back as 1, from 0xFF10.
+static const uint8_t SHADOW_READ_MASK[0x30] =
+{
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // nr10-nr14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // nr20-nr24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // nr30-nr34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // nr40-nr44
+    0x00, 0x00, 0x70, // nr50-nr52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // unused
+    // wave ram is read as is.
+};
+
+enum { SHADOW_NR10 = 0x00, SHADOW_NR13 = 0x03, SHADOW_NR14 = 0x04, SHADOW_NR30 = 0x0A, SHADOW_NR52 = 0x16 };
+
+static unsigned shadow_length_max(unsigned channel)
+{
+    return channel == 2 ? 256 : 64;
+}
+
+static bool shadow_dac_on(const struct ApuShadow* s, unsigned channel)
+{
+    return channel == 2 ? s->io[SHADOW_NR30] & 0x80 : s->io[channel * 5 + 2] & 0xF8;
+}
+
+static void shadow_off(struct ApuShadow* s, unsigned channel)
+{
+    s->active &= ~(1 << channel);
+}
+
+// the frequency after the next sweep, pulse 1 is turned off above 2047.
+static unsigned shadow_sweep_calc(struct ApuShadow* s)
+{
+    const uint8_t nr10 = s->io[SHADOW_NR10];
+    const unsigned delta = s->sweep_freq >> (nr10 & 0x7);
+
+    if (nr10 & 0x8)
+    {
+        s->sweep_negated = true;
+        return s->sweep_freq - delta;
+    }
+    return s->sweep_freq + delta;
+}
+
+static void shadow_reset(struct ApuShadow* s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+static void shadow_nrx4(struct ApuShadow* s, unsigned channel, uint8_t old_value, uint8_t value)
+{
+    const bool enable = value & 0x40;
+    // lengths are clocked on even steps, so enabling it before an odd one clocks it once now.
+    const bool extra_clock = s->step & 1;
+
+    if (extra_clock && enable && !(old_value & 0x40) && s->length[channel])
+    {
+        if (!--s->length[channel] && !(value & 0x80))
+        {
+            shadow_off(s, channel);
+        }
+    }
+
+    if (!(value & 0x80))
+    {
+        return;
+    }
+
+    if (shadow_dac_on(s, channel))
+    {
+        s->active |= 1 << channel;
+    }
+
+    if (!s->length[channel])
+    {
+        s->length[channel] = shadow_length_max(channel);
+        if (enable && extra_clock)
+        {
+            s->length[channel]--;
+        }
+    }
+
+    if (channel == 0)
+    {
+        const unsigned period = s->io[SHADOW_NR10] >> 4 & 0x7;
+        s->sweep_freq = s->io[SHADOW_NR13] | (s->io[SHADOW_NR14] & 0x7) << 8;
+        s->sweep_timer = period ? period : 8;
+        s->sweep_enabled = period || (s->io[SHADOW_NR10] & 0x7);
+        s->sweep_negated = false;
+
+        if ((s->io[SHADOW_NR10] & 0x7) && shadow_sweep_calc(s) > 2047)
+        {
+            shadow_off(s, 0);
+        }
+    }
+}
+
+static void shadow_write(struct ApuShadow* s, uint8_t addr, uint8_t value)
+{
+    const unsigned index = addr - 0x10;
+
+    // wave ram.
+    if (addr >= 0x30)
+    {
+        s->io[index] = value;
+        return;
+    }
+
+    if (addr == 0x26)
+    {
+        if (!(value & 0x80))
+        {
+            // everything but wave ram is cleared.
+            memset(s->io, 0, 0x20);
+            memset(s->length, 0, sizeof(s->length));
+            s->active = 0;
+            s->sweep_enabled = false;
+        }
+        else if (!(s->io[SHADOW_NR52] & 0x80))
+        {
+            s->step = 0;
+        }
+        s->io[SHADOW_NR52] = value & 0x80;
+        return;
+    }
+
+    // the rest are ignored while powered off.
+    if (!(s->io[SHADOW_NR52] & 0x80))
+    {
+        return;
+    }
+
+    const uint8_t old_value = s->io[index];
+    s->io[index] = value;
+
+    // nr50 and nr51 only hold their value.
+    if (index >= 0x14)
+    {
+        return;
+    }
+
+    const unsigned channel = index / 5;
+    switch (index % 5)
+    {
+        case 0:
+            // leaving negate after a sweep used it turns pulse 1 off.
+            if (channel == 0 && !(value & 0x8) && s->sweep_negated)
+            {
+                shadow_off(s, 0);
+            }
+            else if (channel == 2 && !(value & 0x80))
+            {
+                shadow_off(s, 2);
+            }
+            break;
+
+        case 1:
+            s->length[channel] = shadow_length_max(channel) - (channel == 2 ? value : value & 0x3F);
+            break;
+
+        case 2:
+            if (channel != 2 && !(value & 0xF8))
+            {
+                shadow_off(s, channel);
+            }
+            break;
+
+        case 4:
+            shadow_nrx4(s, channel, old_value, value);
+            break;
+    }
+}
+
+static uint8_t shadow_read(const struct ApuShadow* s, uint8_t addr)
+{
+    const unsigned index = addr - 0x10;
+
+    if (addr == 0x26)
+    {
+        return s->io[SHADOW_NR52] | SHADOW_READ_MASK[index] | s->active;
+    }
+    return s->io[index] | SHADOW_READ_MASK[index];
+}
+
+static void shadow_clock(struct ApuShadow* s)
+{
+    if (!(s->io[SHADOW_NR52] & 0x80))
+    {
+        return;
+    }
+
+    const unsigned step = s->step;
+    s->step = (step + 1) & 7;
+
+    if (!(step & 1))
+    {
+        for (unsigned channel = 0; channel < 4; channel++)
+        {
+            if ((s->io[channel * 5 + 4] & 0x40) && s->length[channel] && !--s->length[channel])
+            {
+                shadow_off(s, channel);
+            }
+        }
+    }
+
+    if ((step == 2 || step == 6) && s->sweep_timer && !--s->sweep_timer)
+    {
+        const unsigned period = s->io[SHADOW_NR10] >> 4 & 0x7;
+        s->sweep_timer = period ? period : 8;
+
+        if (s->sweep_enabled && period)
+        {
+            const unsigned freq = shadow_sweep_calc(s);
+            if (freq > 2047)
+            {
+                shadow_off(s, 0);
+            }
+            else if (s->io[SHADOW_NR10] & 0x7)
+            {
+                s->sweep_freq = freq;
+                if (shadow_sweep_calc(s) > 2047)
+                {
+                    shadow_off(s, 0);
+                }
+            }
+        }
+    }
+}
+#endif
+
+// low byte of the register and value, written after the apu is reset.
+static const uint8_t APU_RESET_WRITES[][2] =
+{
+    { 0x26, 0x00 },
+    { 0x26, 0xF1 },
+    { 0x10, 0x80 },
+    { 0x11, 0xBF },
+    { 0x12, 0xF3 },
+    { 0x13, 0xFF },
+    { 0x14, 0xBF },
+    { 0x16, 0x3F },
+    { 0x17, 0x00 },
+    { 0x18, 0xFF },
+    { 0x19, 0xBF },
+    { 0x1A, 0x7F },
+    { 0x1B, 0xFF },
+    { 0x1C, 0x9F },
+    { 0x1D, 0xFF },
+    { 0x1E, 0xBF },
+    { 0x20, 0xFF },
+    { 0x21, 0x00 },
+    { 0x22, 0x00 },
+    { 0x23, 0xBF },
+    { 0x24, 0x77 },
+    { 0x25, 0xF3 },
+};
 static const uint8_t GBS_MAGIC[3] = {'G', 'B', 'S' };
 #if GBS_LOGS
 static const uint32_t timer_rate[4] = { 4096, 262144, 65536, 16384 };
@@ -181,19 +592,50 @@ static enum GbsTimingType get_timing_type(const Gbs* gbs)
 static void schedule_vsync_event(Gbs* gbs, unsigned late);
 static void schedule_timer_event(Gbs* gbs, unsigned late);
 
+static void add_event(Gbs* gbs, enum Event id, unsigned cycles, scheduler_callback cb)
+{
+    gbs->event_cycles[id] = scheduler_get_ticks(&gbs->scheduler) + cycles;
+    scheduler_add(&gbs->scheduler, id, cycles, cb, gbs);
+}
+
 static void on_timeout_event(void* user, unsigned id, unsigned late)
 {
     Gbs* gbs = user;
     apu_update_timestamp(gbs->apu, -SCHEDULER_TIMEOUT_CYCLES);
+    STEMS_CALL(gbs, apu_update_timestamp, -SCHEDULER_TIMEOUT_CYCLES);
+#if GBS_ENABLE_SNAPSHOT
+    gbs->cycles_base += SCHEDULER_TIMEOUT_CYCLES;
+#endif
+#if GBS_ENABLE_REGLOG
+    gbs->record_base += SCHEDULER_TIMEOUT_CYCLES;
+#endif
+#if GBS_ENABLE_CAPTURE
+    gbs->capture_base += SCHEDULER_TIMEOUT_CYCLES;
+#endif
     scheduler_reset_event(&gbs->scheduler);
     scheduler_add_absolute(&gbs->scheduler, id, SCHEDULER_TIMEOUT_CYCLES, on_timeout_event, user);
+
+    for (unsigned i = 0; i < Event_MAX; i++)
+    {
+        gbs->event_cycles[i] -= SCHEDULER_TIMEOUT_CYCLES;
+    }
 }
 
 static void on_fs_event(void* user, unsigned id, unsigned late)
 {
     Gbs* gbs = user;
-    apu_frame_sequencer_clock(gbs->apu, scheduler_get_ticks(&gbs->scheduler) - late);
-    scheduler_add(&gbs->scheduler, id, FRAME_SEQUENCER_CLOCK - late, on_fs_event, user);
+#if GBS_ENABLE_REGLOG
+    if (gbs->no_synth)
+    {
+        shadow_clock(&gbs->shadow);
+    }
+    else
+#endif
+    {
+        apu_frame_sequencer_clock(gbs->apu, scheduler_get_ticks(&gbs->scheduler) - late);
+        STEMS_CALL(gbs, apu_frame_sequencer_clock, scheduler_get_ticks(&gbs->scheduler) - late);
+    }
+    add_event(gbs, Event_FRAME_SEQUENCER, FRAME_SEQUENCER_CLOCK - late, on_fs_event);
 }
 
 static void on_vsync_event(void* user, unsigned id, unsigned late)
@@ -226,9 +668,60 @@ static void on_endframe_event(void* user, unsigned id, unsigned late)
     gbs->end_frame = true;
 }
 
+#if GBS_ENABLE_CAPTURE
+static void capture_frame(Gbs* gbs, unsigned late)
+{
+    struct GbsCaptureRing* ring = gbs->capture;
+    const unsigned time = scheduler_get_ticks(&gbs->scheduler) - late;
+    const uint8_t pcm12 = apu_cgb_read_pcm12(gbs->apu, time);
+    const uint8_t pcm34 = apu_cgb_read_pcm34(gbs->apu, time);
+
+    struct GbsCaptureFrame* frame = &ring->frames[ring->head & (ring->size - 1)];
+    frame->sample = (uint64_t)((double)(gbs->capture_base + time) * gbs->sample_rate / GBS_CPU_CLOCK);
+    frame->pcm.channel[0] = (pcm12 & 0x0F) >> 0;
+    frame->pcm.channel[1] = (pcm12 & 0xF0) >> 4;
+    frame->pcm.channel[2] = (pcm34 & 0x0F) >> 0;
+    frame->pcm.channel[3] = (pcm34 & 0xF0) >> 4;
+    ring->head++;
+}
+
+static void on_capture_event(void* user, unsigned id, unsigned late)
+{
+    Gbs* gbs = user;
+
+    // a long instruction can be late by more than one interval.
+    while (late >= gbs->capture_interval)
+    {
+        capture_frame(gbs, late);
+        late -= gbs->capture_interval;
+    }
+
+    capture_frame(gbs, late);
+    add_event(gbs, Event_CAPTURE, gbs->capture_interval - late, on_capture_event);
+}
+
+// captures from now if a ring is set.
+static void capture_schedule(Gbs* gbs)
+{
+    scheduler_remove(&gbs->scheduler, Event_CAPTURE);
+
+    if (gbs->capture)
+    {
+        add_event(gbs, Event_CAPTURE, 0, on_capture_event);
+    }
+}
+
+// the song starts now, as far as the timestamps go.
+static void capture_start(Gbs* gbs)
+{
+    gbs->capture_base = -(int64_t)scheduler_get_ticks(&gbs->scheduler);
+    capture_schedule(gbs);
+}
+#endif
+
 static void schedule_vsync_event(Gbs* gbs, unsigned late)
 {
-    scheduler_add(&gbs->scheduler, Event_VSYNC, VSYNC_CLOCK - late, on_vsync_event, gbs);
+    add_event(gbs, Event_VSYNC, VSYNC_CLOCK - late, on_vsync_event);
 }
 
 static void schedule_timer_event(Gbs* gbs, unsigned late)
@@ -241,7 +734,7 @@ static void schedule_timer_event(Gbs* gbs, unsigned late)
         late -= freq;
     }
     assert(!scheduler_has_event(&gbs->scheduler, Event_TIMER));
-    scheduler_add(&gbs->scheduler, Event_TIMER, freq - late, on_timer_event, gbs);
+    add_event(gbs, Event_TIMER, freq - late, on_timer_event);
 }
 
 static void LR35902_on_halt(void* user)
@@ -249,6 +742,15 @@ static void LR35902_on_halt(void* user)
     Gbs* gbs = user;
     assert(gbs->cpu.SP == gbs->header.stack_pointer);
     gbs->waiting_vsync = true;
+
+#if GBS_ENABLE_SNAPSHOT
+    // init has returned to the player loop.
+    if (gbs->stop_on_halt && gbs->cpu.SP == gbs->header.stack_pointer)
+    {
+        gbs->stop_on_halt = false;
+        gbs->end_frame = true;
+    }
+#endif
 }
 #else
 static irqMASK EWRAM_BSS irq_timeout = false;
@@ -482,6 +984,12 @@ static uint8_t FAST_CODE io_read(Gbs* gbs, uint16_t addr)
         case 0x34: case 0x35: case 0x36: case 0x37: // WAVE RAM
         case 0x38: case 0x39: case 0x3A: case 0x3B: // WAVE RAM
         case 0x3C: case 0x3D: case 0x3E: case 0x3F: // WAVE RAM
+        #if GBS_ENABLE_REGLOG
+            if (gbs->no_synth)
+            {
+                return shadow_read(&gbs->shadow, addr);
+            }
+        #endif
             return apu_read_io(gbs->apu, addr, scheduler_get_ticks(&gbs->scheduler));
     }
 
@@ -547,7 +1055,26 @@ static void FAST_CODE io_write(Gbs* gbs, uint16_t addr, uint8_t value)
         case 0x34: case 0x35: case 0x36: case 0x37: // WAVE RAM
         case 0x38: case 0x39: case 0x3A: case 0x3B: // WAVE RAM
         case 0x3C: case 0x3D: case 0x3E: case 0x3F: // WAVE RAM
+        #if GBS_ENABLE_REGLOG
+            // only recorded, to be synthesized elsewhere.
+            if (gbs->no_synth)
+            {
+                shadow_write(&gbs->shadow, addr, value);
+                if (gbs->recorder)
+                {
+                    recorder_write(gbs, addr, value);
+                }
+                break;
+            }
+        #endif
             apu_write_io(gbs->apu, addr, value, scheduler_get_ticks(&gbs->scheduler));
+            STEMS_CALL(gbs, apu_write_io, addr, value, scheduler_get_ticks(&gbs->scheduler));
+        #if GBS_ENABLE_REGLOG
+            if (gbs->recorder)
+            {
+                recorder_write(gbs, addr, value);
+            }
+        #endif
             break;
     }
 }
@@ -761,6 +1288,8 @@ Gbs* gbs_init(double sample_rate)
 
     apu_set_highpass_filter(gbs->apu, GbApuFilter_DMG, 4194304, sample_rate);
 
+    gbs->sample_rate = sample_rate;
+
     return gbs;
 
 fail:
@@ -774,6 +1303,9 @@ void gbs_quit(Gbs* gbs)
     {
         scheduler_quit(&gbs->scheduler);
         apu_quit(gbs->apu);
+    #if GBS_ENABLE_STEMS
+        gbs_enable_stems(gbs, false);
+    #endif
         gbs_free_mem(gbs);
     #if !defined(__GBA__)
         free(gbs);
@@ -781,15 +1313,48 @@ void gbs_quit(Gbs* gbs)
     }
 }
 
-void gbs_reset(Gbs* gbs, uint8_t song)
+#if GBS_ENABLE_STEMS
+static void stems_mute(Gbs* gbs)
 {
-    gbs->song = song;
+    for (unsigned i = 0; i < GbsStem_MAX; i++)
+    {
+        for (unsigned channel = 0; channel < GbsStem_MAX; channel++)
+        {
+            apu_set_channel_volume(gbs->stems[i], channel, channel == i ? 1.0f : 0.0f);
+        }
+    }
+}
 
-    LR35902_reset_cgb(&gbs->cpu);
-    apu_reset(gbs->apu, GbApuType_CGB);
-    gbs->waiting_vsync = false;
+// brings the stems to the state of apu, which must have just been reset.
+static void stems_reset(Gbs* gbs)
+{
+    STEMS_CALL(gbs, apu_reset, GbApuType_CGB);
+
+    for (unsigned i = 0; i < sizeof(APU_RESET_WRITES) / sizeof(APU_RESET_WRITES[0]); i++)
+    {
+        STEMS_CALL(gbs, apu_write_io, 0xFF00 | APU_RESET_WRITES[i][0], APU_RESET_WRITES[i][1], 0);
+    }
+
+    for (unsigned i = 0; i < GbsStem_MAX; i++)
+    {
+        apu_clear_samples(gbs->stems[i]);
+    }
+    stems_mute(gbs);
+}
+#endif
+
+void gbs_reset(Gbs* gbs, uint8_t song)
+{
+    gbs->song = song;
+
+    LR35902_reset_cgb(&gbs->cpu);
+    apu_reset(gbs->apu, GbApuType_CGB);
+    gbs->waiting_vsync = false;
     #ifndef __GBA__
     scheduler_reset(&gbs->scheduler, 0, on_timeout_event, gbs);
+    #if GBS_ENABLE_SNAPSHOT
+    gbs->cycles_base = 0;
+    #endif
     #else
     irq_timeout = 0;
     #endif
@@ -830,30 +1395,47 @@ void gbs_reset(Gbs* gbs, uint8_t song)
     gbs->mem.bank0[addr++] = 0x18; // JR
     gbs->mem.bank0[addr++] = -3; // loop
 
-    apu_write_io(gbs->apu, 0xFF26, 0x00, 0);
-    apu_write_io(gbs->apu, 0xFF26, 0xF1, 0);
-    apu_write_io(gbs->apu, 0xFF10, 0x80, 0);
-    apu_write_io(gbs->apu, 0xFF11, 0xBF, 0);
-    apu_write_io(gbs->apu, 0xFF12, 0xF3, 0);
-    apu_write_io(gbs->apu, 0xFF13, 0xFF, 0);
-    apu_write_io(gbs->apu, 0xFF14, 0xBF, 0);
-    apu_write_io(gbs->apu, 0xFF16, 0x3F, 0);
-    apu_write_io(gbs->apu, 0xFF17, 0x00, 0);
-    apu_write_io(gbs->apu, 0xFF18, 0xFF, 0);
-    apu_write_io(gbs->apu, 0xFF19, 0xBF, 0);
-    apu_write_io(gbs->apu, 0xFF1A, 0x7F, 0);
-    apu_write_io(gbs->apu, 0xFF1B, 0xFF, 0);
-    apu_write_io(gbs->apu, 0xFF1C, 0x9F, 0);
-    apu_write_io(gbs->apu, 0xFF1D, 0xFF, 0);
-    apu_write_io(gbs->apu, 0xFF1E, 0xBF, 0);
-    apu_write_io(gbs->apu, 0xFF20, 0xFF, 0);
-    apu_write_io(gbs->apu, 0xFF21, 0x00, 0);
-    apu_write_io(gbs->apu, 0xFF22, 0x00, 0);
-    apu_write_io(gbs->apu, 0xFF23, 0xBF, 0);
-    apu_write_io(gbs->apu, 0xFF24, 0x77, 0);
-    apu_write_io(gbs->apu, 0xFF25, 0xF3, 0);
+#if GBS_ENABLE_REGLOG
+    if ((gbs->recorder = gbs->next_recorder))
+    {
+        recorder_start(gbs);
+    }
+    if ((gbs->no_synth = gbs->next_no_synth))
+    {
+        shadow_reset(&gbs->shadow);
+    }
+#endif
+
+    for (unsigned i = 0; i < sizeof(APU_RESET_WRITES) / sizeof(APU_RESET_WRITES[0]); i++)
+    {
+        apu_write_io(gbs->apu, 0xFF00 | APU_RESET_WRITES[i][0], APU_RESET_WRITES[i][1], 0);
+    #if GBS_ENABLE_REGLOG
+        if (gbs->recorder)
+        {
+            recorder_write(gbs, APU_RESET_WRITES[i][0], APU_RESET_WRITES[i][1]);
+        }
+        if (gbs->no_synth)
+        {
+            shadow_write(&gbs->shadow, APU_RESET_WRITES[i][0], APU_RESET_WRITES[i][1]);
+        }
+    #endif
+    }
+
+#if GBS_ENABLE_STEMS
+    if (gbs->stems[0])
+    {
+        stems_reset(gbs);
+    }
+#endif
 
+#ifndef __GBA__
+    add_event(gbs, Event_FRAME_SEQUENCER, FRAME_SEQUENCER_CLOCK, on_fs_event);
+    #if GBS_ENABLE_CAPTURE
+    capture_start(gbs);
+    #endif
+#else
     scheduler_add(&gbs->scheduler, Event_FRAME_SEQUENCER, FRAME_SEQUENCER_CLOCK, on_fs_event, gbs);
+#endif
 
     switch (get_timing_type(gbs))
     {
@@ -1150,6 +1732,10 @@ uint8_t gbs_get_song(const Gbs* gbs)
     return gbs->song;
 }
 
+#if GBS_ENABLE_SNAPSHOT
+static void snapshot_cache_start(Gbs* gbs, uint8_t song);
+#endif
+
 bool gbs_set_song(Gbs* gbs, uint8_t song)
 {
     if (song < gbs->header.first_song || song >= gbs->header.number_of_songs)
@@ -1157,6 +1743,19 @@ bool gbs_set_song(Gbs* gbs, uint8_t song)
         return false;
     }
 
+#if GBS_ENABLE_SNAPSHOT
+    // a recording needs the writes made by init, and the shadow can't be restored.
+    #if GBS_ENABLE_REGLOG
+    if (gbs->snapshot_cache && !gbs->next_recorder && !gbs->next_no_synth)
+    #else
+    if (gbs->snapshot_cache)
+    #endif
+    {
+        snapshot_cache_start(gbs, song);
+        return true;
+    }
+#endif
+
     gbs_reset(gbs, song);
     return true;
 }
@@ -1188,8 +1787,21 @@ void gbs_run(Gbs* gbs, unsigned cycles)
         }
     }
 
-    // make samples available
-    apu_end_frame(gbs->apu, scheduler_get_ticks(&gbs->scheduler));
+#if GBS_ENABLE_REGLOG
+    if (!gbs->no_synth)
+#endif
+    {
+        // make samples available
+        apu_end_frame(gbs->apu, scheduler_get_ticks(&gbs->scheduler));
+        STEMS_CALL(gbs, apu_end_frame, scheduler_get_ticks(&gbs->scheduler));
+    }
+
+#if GBS_ENABLE_REGLOG
+    if (gbs->recorder)
+    {
+        gbs->recorder->end_time = gbs->record_base + scheduler_get_ticks(&gbs->scheduler);
+    }
+#endif
 }
 #else
 void IWRAM_CODE gbs_run(Gbs* gbs, unsigned cycles)
@@ -1215,16 +1827,19 @@ void gbs_set_channel_volume(Gbs* gbs, unsigned channel_num, float volume)
 void gbs_set_master_volume(Gbs* gbs, float volume)
 {
    apu_set_master_volume(gbs->apu, volume);
+   STEMS_CALL(gbs, apu_set_master_volume, volume);
 }
 
 void gbs_set_bass(Gbs* gbs, int frequency)
 {
    apu_set_bass(gbs->apu, frequency);
+   STEMS_CALL(gbs, apu_set_bass, frequency);
 }
 
 void gbs_set_treble(Gbs* gbs, double treble_db)
 {
    apu_set_treble(gbs->apu, treble_db);
+   STEMS_CALL(gbs, apu_set_treble, treble_db);
 }
 
 int gbs_clocks_needed(Gbs* gbs, int sample_count)
@@ -1245,6 +1860,15 @@ int gbs_read_samples(Gbs* gbs, short out[], int count)
 void gbs_clear_samples(Gbs* gbs)
 {
    apu_clear_samples(gbs->apu);
+#if GBS_ENABLE_STEMS
+   if (gbs->stems[0])
+   {
+      for (unsigned i = 0; i < GbsStem_MAX; i++)
+      {
+         apu_clear_samples(gbs->stems[i]);
+      }
+   }
+#endif
 }
 
 void gbs_read_pcm(Gbs* gbs, struct GbsPcm* pcm)
@@ -1258,6 +1882,999 @@ void gbs_read_pcm(Gbs* gbs, struct GbsPcm* pcm)
     pcm->channel[3] = (pcm34 & 0xF0) >> 4;
 }
 
+#if GBS_ENABLE_CAPTURE
+bool gbs_set_capture(Gbs* gbs, struct GbsCaptureRing* ring, unsigned rate)
+{
+    if (ring && (!ring->frames || !ring->size || (ring->size & (ring->size - 1)) || !rate))
+    {
+        return false;
+    }
+
+    gbs->capture = ring;
+    if (ring)
+    {
+        gbs->capture_interval = GBS_CPU_CLOCK / rate;
+        if (gbs->capture_interval < GBS_CAPTURE_MIN_INTERVAL)
+        {
+            gbs->capture_interval = GBS_CAPTURE_MIN_INTERVAL;
+        }
+    }
+
+    // the song carries on, so the timestamps do too.
+    capture_schedule(gbs);
+    return true;
+}
+#endif
+
+#if GBS_ENABLE_STEMS
+bool gbs_enable_stems(Gbs* gbs, bool enable)
+{
+    if (!enable || gbs->stems[0])
+    {
+        for (unsigned i = 0; i < GbsStem_MAX && !enable; i++)
+        {
+            apu_quit(gbs->stems[i]);
+            gbs->stems[i] = NULL;
+        }
+        return true;
+    }
+
+    for (unsigned i = 0; i < GbsStem_MAX; i++)
+    {
+        if (!(gbs->stems[i] = apu_init(GbApuClockRate_DMG, gbs->sample_rate)))
+        {
+            gbs_enable_stems(gbs, false);
+            return false;
+        }
+        apu_set_highpass_filter(gbs->stems[i], GbApuFilter_DMG, 4194304, gbs->sample_rate);
+    }
+
+    stems_mute(gbs);
+    return true;
+}
+
+int gbs_read_stem_samples(Gbs* gbs, enum GbsStem stem, short out[], int count)
+{
+    if (!gbs->stems[0] || stem >= GbsStem_MAX)
+    {
+        return 0;
+    }
+    return apu_read_samples(gbs->stems[stem], out, count);
+}
+#endif
+
+#if GBS_ENABLE_REGLOG
+enum { VGM_HEADER_SIZE = 0x100 };
+enum { VGM_VERSION = 0x161 };
+enum { VGM_SAMPLE_RATE = 44100 };
+
+// writes to data while there is room, pos is the size needed either way.
+struct ExportOut
+{
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+};
+
+static void export_bytes(struct ExportOut* o, const void* data, size_t size)
+{
+    if (o->data && o->pos + size <= o->size)
+    {
+        memcpy(o->data + o->pos, data, size);
+    }
+    o->pos += size;
+}
+
+static void export_u8(struct ExportOut* o, uint8_t v)
+{
+    export_bytes(o, &v, 1);
+}
+
+static void export_le(struct ExportOut* o, uint64_t v, unsigned size)
+{
+    uint8_t bytes[8];
+    for (unsigned i = 0; i < size; i++)
+    {
+        bytes[i] = v >> (i * 8);
+    }
+    export_bytes(o, bytes, size);
+}
+
+static void export_native(const GbsRecorder* rec, struct ExportOut* o)
+{
+    export_le(o, GBS_REGLOG_MAGIC, 4);
+    export_le(o, GBS_REGLOG_VERSION, 2);
+    export_le(o, 0, 2);
+    export_le(o, GBS_CPU_CLOCK, 4);
+    export_le(o, FRAME_SEQUENCER_CLOCK, 4);
+    export_le(o, rec->end_time, 8);
+    export_bytes(o, rec->data, rec->size);
+    export_u8(o, GbsRegLogCmd_END);
+}
+
+static void export_vgm_wait(struct ExportOut* o, uint64_t samples)
+{
+    while (samples)
+    {
+        if (samples <= 16)
+        {
+            export_u8(o, 0x70 + samples - 1);
+            samples = 0;
+        }
+        else if (samples == 735 || samples == 882)
+        {
+            export_u8(o, samples == 735 ? 0x62 : 0x63);
+            samples = 0;
+        }
+        else
+        {
+            const uint16_t n = samples > 0xFFFF ? 0xFFFF : samples;
+            export_u8(o, 0x61);
+            export_le(o, n, 2);
+            samples -= n;
+        }
+    }
+}
+
+static void export_vgm(const GbsRecorder* rec, struct ExportOut* o)
+{
+    const uint64_t total_samples = rec->end_time * VGM_SAMPLE_RATE / GBS_CPU_CLOCK;
+    uint8_t header[VGM_HEADER_SIZE] = { 'V', 'g', 'm', ' ' };
+    // eof is patched in at the end.
+    header[0x08] = VGM_VERSION & 0xFF;
+    header[0x09] = VGM_VERSION >> 8;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        header[0x18 + i] = total_samples >> (i * 8);
+        header[0x34 + i] = (VGM_HEADER_SIZE - 0x34) >> (i * 8);
+        header[0x80 + i] = (uint32_t)GBS_CPU_CLOCK >> (i * 8);
+    }
+    const size_t start = o->pos;
+    export_bytes(o, header, sizeof(header));
+
+    uint64_t time = 0;
+    uint64_t samples = 0;
+    for (size_t i = 0; i < rec->size;)
+    {
+        const uint8_t cmd = rec->data[i++];
+        if (cmd <= GbsRegLogCmd_WRITE_MAX)
+        {
+            const uint64_t now = time * VGM_SAMPLE_RATE / GBS_CPU_CLOCK;
+            export_vgm_wait(o, now - samples);
+            samples = now;
+
+            export_u8(o, 0xB3);
+            export_u8(o, cmd);
+            export_u8(o, rec->data[i++]);
+        }
+        else if (cmd == GbsRegLogCmd_WAIT)
+        {
+            uint64_t wait = 0;
+            for (unsigned shift = 0; ; shift += 7)
+            {
+                const uint8_t byte = rec->data[i++];
+                wait |= (uint64_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                {
+                    break;
+                }
+            }
+            time += wait;
+        }
+        else
+        {
+            time += (cmd & 0x3F) + 1;
+        }
+    }
+
+    export_vgm_wait(o, total_samples - samples);
+    export_u8(o, 0x66);
+
+    // offset relative to itself.
+    const uint32_t eof = o->pos - start - 0x04;
+    if (o->data && o->pos <= o->size)
+    {
+        for (unsigned i = 0; i < 4; i++)
+        {
+            o->data[start + 0x04 + i] = eof >> (i * 8);
+        }
+    }
+}
+
+GbsRecorder* gbs_recorder_init(void)
+{
+    return calloc(1, sizeof(GbsRecorder));
+}
+
+void gbs_recorder_quit(GbsRecorder* rec)
+{
+    if (rec)
+    {
+        free(rec->data);
+        free(rec);
+    }
+}
+
+void gbs_set_recorder(Gbs* gbs, GbsRecorder* recorder)
+{
+    gbs->next_recorder = recorder;
+    if (!recorder)
+    {
+        gbs->recorder = NULL;
+    }
+}
+
+void gbs_set_synthesis(Gbs* gbs, bool enable)
+{
+    gbs->next_no_synth = !enable;
+}
+
+bool gbs_recorder_take(GbsRecorder* rec, void* out, size_t capacity, size_t* size)
+{
+    if (rec->error)
+    {
+        return false;
+    }
+
+    *size = rec->size;
+    if (out && capacity >= rec->size)
+    {
+        memcpy(out, rec->data, rec->size);
+        rec->size = 0;
+    }
+
+    return true;
+}
+
+uint64_t gbs_recorder_get_end_time(const GbsRecorder* rec)
+{
+    return rec->end_time;
+}
+
+size_t gbs_recorder_export(const GbsRecorder* rec, enum GbsRegLogFormat format, void* out, size_t size)
+{
+    if (rec->error)
+    {
+        return 0;
+    }
+
+    struct ExportOut o = { out, size, 0 };
+    switch (format)
+    {
+        case GbsRegLogFormat_NATIVE:
+            export_native(rec, &o);
+            return o.pos;
+        case GbsRegLogFormat_VGM:
+            export_vgm(rec, &o);
+            return o.pos;
+    }
+
+    return 0;
+}
+
+// a checkpoint is saved every this many cycles of the log.
+enum { PLAYER_CHECKPOINT_CYCLES = GBS_CPU_CLOCK * 10 };
+// the apu's times are kept relative to base, and rebased once past this.
+enum { PLAYER_REBASE_CYCLES = 0x1000000 };
+
+struct RegLogEvent
+{
+    uint64_t time;
+    uint8_t reg;
+    uint8_t value;
+};
+
+struct RegLogCheckpoint
+{
+    uint64_t base;
+    uint64_t next_fs;
+    size_t event;
+    void* state;
+};
+
+struct GbsRegLogPlayer
+{
+    GbApu* apu;
+
+    struct RegLogEvent* events;
+    size_t event_count;
+    size_t event_capacity;
+    uint64_t length;
+    uint32_t fs_offset;
+    // time of the last decoded command.
+    uint64_t decode_time;
+    // fed as it is recorded, without checkpoints.
+    bool stream;
+
+    // position, in absolute cycles.
+    uint64_t time;
+    // absolute cycle of the apu's time 0.
+    uint64_t base;
+    uint64_t next_fs;
+    // next event to write.
+    size_t event;
+
+    // checkpoint i is at i * PLAYER_CHECKPOINT_CYCLES.
+    struct RegLogCheckpoint* checkpoints;
+    size_t checkpoint_count;
+};
+
+static bool player_add_event(GbsRegLogPlayer* p, uint64_t time, uint8_t reg, uint8_t value)
+{
+    if (p->event_count == p->event_capacity)
+    {
+        const size_t capacity = p->event_capacity ? p->event_capacity * 2 : 1024;
+        struct RegLogEvent* events = realloc(p->events, capacity * sizeof(*events));
+        if (!events)
+        {
+            return false;
+        }
+        p->events = events;
+        p->event_capacity = capacity;
+    }
+
+    p->events[p->event_count++] = (struct RegLogEvent){ time, reg, value };
+    return true;
+}
+
+static uint64_t read_le(const uint8_t* data, unsigned size)
+{
+    uint64_t v = 0;
+    for (unsigned i = 0; i < size; i++)
+    {
+        v |= (uint64_t)data[i] << (i * 8);
+    }
+    return v;
+}
+
+// decodes native commands, continuing from the time of the last call.
+static bool player_decode_native(GbsRegLogPlayer* p, const uint8_t* data, size_t size, bool* ended)
+{
+    *ended = false;
+
+    for (size_t i = 0; i < size;)
+    {
+        const uint8_t cmd = data[i++];
+        if (cmd <= GbsRegLogCmd_WRITE_MAX)
+        {
+            if (i >= size || !player_add_event(p, p->decode_time, 0x10 + cmd, data[i++]))
+            {
+                return false;
+            }
+        }
+        else if (cmd >= GbsRegLogCmd_WAIT_SHORT && cmd <= GbsRegLogCmd_WAIT_SHORT_MAX)
+        {
+            p->decode_time += (cmd & 0x3F) + 1;
+        }
+        else if (cmd == GbsRegLogCmd_WAIT)
+        {
+            uint64_t wait = 0;
+            unsigned shift = 0;
+            uint8_t byte;
+            do
+            {
+                if (i >= size || shift > 63)
+                {
+                    return false;
+                }
+                byte = data[i++];
+                wait |= (uint64_t)(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            p->decode_time += wait;
+        }
+        else if (cmd == GbsRegLogCmd_END)
+        {
+            *ended = true;
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool player_parse_native(GbsRegLogPlayer* p, const uint8_t* data, size_t size)
+{
+    enum { HEADER_SIZE = 24 };
+    if (size < HEADER_SIZE || read_le(data + 4, 2) != GBS_REGLOG_VERSION || read_le(data + 8, 4) != GBS_CPU_CLOCK)
+    {
+        return false;
+    }
+
+    p->fs_offset = read_le(data + 12, 4);
+    p->length = read_le(data + 16, 8);
+
+    bool ended;
+    // fails if the end is missing.
+    return player_decode_native(p, data + HEADER_SIZE, size - HEADER_SIZE, &ended) && ended;
+}
+
+static bool player_parse_vgm(GbsRegLogPlayer* p, const uint8_t* data, size_t size)
+{
+    if (size < 0x40)
+    {
+        return false;
+    }
+
+    const uint32_t version = read_le(data + 0x08, 4);
+    const uint32_t data_offset = version >= 0x150 && read_le(data + 0x34, 4) ? 0x34 + read_le(data + 0x34, 4) : 0x40;
+    // the dmg clock was added in 1.61, and must be in the header.
+    if (version < 0x161 || data_offset < 0x84 || data_offset > size || !(read_le(data + 0x80, 4) & 0x3FFFFFFF))
+    {
+        return false;
+    }
+
+    p->fs_offset = FRAME_SEQUENCER_CLOCK;
+    p->length = read_le(data + 0x18, 4) * GBS_CPU_CLOCK / VGM_SAMPLE_RATE;
+
+    uint64_t samples = 0;
+    for (size_t i = data_offset; i < size;)
+    {
+        const uint8_t cmd = data[i++];
+        if (cmd == 0xB3)
+        {
+            if (i + 2 > size)
+            {
+                return false;
+            }
+            // the top bit selects the second chip, which isn't supported.
+            if (!(data[i] & 0x80) && data[i] <= GbsRegLogCmd_WRITE_MAX && !player_add_event(p, samples * GBS_CPU_CLOCK / VGM_SAMPLE_RATE, 0x10 + data[i], data[i + 1]))
+            {
+                return false;
+            }
+            i += 2;
+        }
+        else if (cmd == 0x61)
+        {
+            if (i + 2 > size)
+            {
+                return false;
+            }
+            samples += read_le(data + i, 2);
+            i += 2;
+        }
+        else if (cmd == 0x62 || cmd == 0x63)
+        {
+            samples += cmd == 0x62 ? 735 : 882;
+        }
+        else if (cmd >= 0x70 && cmd <= 0x7F)
+        {
+            samples += (cmd & 0xF) + 1;
+        }
+        else if (cmd == 0x66)
+        {
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// applies every event and frame sequencer clock before until.
+static void player_advance(GbsRegLogPlayer* p, uint64_t until)
+{
+    for (;;)
+    {
+        const uint64_t event_time = p->event < p->event_count ? p->events[p->event].time : UINT64_MAX;
+
+        // writes on the same cycle as a clock happen after it, like in gbs_run().
+        if (p->next_fs <= event_time && p->next_fs < until)
+        {
+            apu_frame_sequencer_clock(p->apu, p->next_fs - p->base);
+            p->next_fs += FRAME_SEQUENCER_CLOCK;
+        }
+        else if (event_time < until)
+        {
+            const struct RegLogEvent* e = &p->events[p->event++];
+            apu_write_io(p->apu, 0xFF00 | e->reg, e->value, e->time - p->base);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    p->time = until;
+}
+
+static void player_end_frame(GbsRegLogPlayer* p)
+{
+    apu_end_frame(p->apu, p->time - p->base);
+
+    if (p->time - p->base >= PLAYER_REBASE_CYCLES)
+    {
+        apu_update_timestamp(p->apu, -(int)(p->time - p->base));
+        p->base = p->time;
+    }
+}
+
+static bool player_save_checkpoint(GbsRegLogPlayer* p)
+{
+    struct RegLogCheckpoint* checkpoints = realloc(p->checkpoints, (p->checkpoint_count + 1) * sizeof(*checkpoints));
+    if (!checkpoints)
+    {
+        return false;
+    }
+    p->checkpoints = checkpoints;
+
+    struct RegLogCheckpoint* c = &checkpoints[p->checkpoint_count];
+    if (!(c->state = malloc(apu_state_size())) || apu_save_state(p->apu, c->state, apu_state_size()))
+    {
+        free(c->state);
+        return false;
+    }
+
+    c->base = p->base;
+    c->next_fs = p->next_fs;
+    c->event = p->event;
+    p->checkpoint_count++;
+    return true;
+}
+
+static bool player_start(GbsRegLogPlayer* p, double sample_rate)
+{
+    if (!(p->apu = apu_init(GbApuClockRate_DMG, sample_rate)))
+    {
+        return false;
+    }
+
+    apu_set_highpass_filter(p->apu, GbApuFilter_DMG, 4194304, sample_rate);
+    apu_reset(p->apu, GbApuType_CGB);
+    p->next_fs = p->fs_offset;
+    return true;
+}
+
+GbsRegLogPlayer* gbs_reglog_player_init(const void* data, size_t size, double sample_rate)
+{
+    GbsRegLogPlayer* p = calloc(1, sizeof(*p));
+    if (!p)
+    {
+        return NULL;
+    }
+
+    const uint8_t* bytes = data;
+    bool parsed = false;
+    if (size >= 4 && read_le(bytes, 4) == GBS_REGLOG_MAGIC)
+    {
+        parsed = player_parse_native(p, bytes, size);
+    }
+    else if (size >= 4 && !memcmp(bytes, "Vgm ", 4))
+    {
+        parsed = player_parse_vgm(p, bytes, size);
+    }
+
+    if (!parsed || !player_start(p, sample_rate) || !player_save_checkpoint(p))
+    {
+        gbs_reglog_player_quit(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+GbsRegLogPlayer* gbs_reglog_player_init_stream(double sample_rate)
+{
+    GbsRegLogPlayer* p = calloc(1, sizeof(*p));
+    if (!p)
+    {
+        return NULL;
+    }
+
+    p->stream = true;
+    p->fs_offset = FRAME_SEQUENCER_CLOCK;
+
+    if (!player_start(p, sample_rate))
+    {
+        gbs_reglog_player_quit(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+bool gbs_reglog_player_feed(GbsRegLogPlayer* p, const void* data, size_t size, uint64_t end_time)
+{
+    if (!p->stream || end_time < p->length)
+    {
+        return false;
+    }
+
+    // played events are dropped, as streams can't seek.
+    if (p->event)
+    {
+        memmove(p->events, p->events + p->event, (p->event_count - p->event) * sizeof(*p->events));
+        p->event_count -= p->event;
+        p->event = 0;
+    }
+
+    bool ended;
+    if (!player_decode_native(p, data, size, &ended) || ended)
+    {
+        return false;
+    }
+
+    p->length = end_time;
+    return true;
+}
+
+void gbs_reglog_player_quit(GbsRegLogPlayer* p)
+{
+    if (p)
+    {
+        for (size_t i = 0; i < p->checkpoint_count; i++)
+        {
+            free(p->checkpoints[i].state);
+        }
+        free(p->checkpoints);
+        free(p->events);
+        apu_quit(p->apu);
+        free(p);
+    }
+}
+
+uint64_t gbs_reglog_player_get_length(const GbsRegLogPlayer* p)
+{
+    return p->length;
+}
+
+uint64_t gbs_reglog_player_get_time(const GbsRegLogPlayer* p)
+{
+    return p->time;
+}
+
+void gbs_reglog_player_run(GbsRegLogPlayer* p, unsigned cycles)
+{
+    const uint64_t target = p->time + cycles;
+
+    while (p->time < target)
+    {
+        // stops at the next checkpoint, if it hasn't been saved yet.
+        const uint64_t checkpoint = p->checkpoint_count * (uint64_t)PLAYER_CHECKPOINT_CYCLES;
+        const bool save = !p->stream && checkpoint > p->time && checkpoint <= target && checkpoint < p->length;
+
+        player_advance(p, save ? checkpoint : target);
+        player_end_frame(p);
+
+        // a failed save only makes seeking slower.
+        if (save)
+        {
+            player_save_checkpoint(p);
+        }
+    }
+}
+
+bool gbs_reglog_player_seek(GbsRegLogPlayer* p, uint64_t cycle)
+{
+    if (p->stream || cycle > p->length)
+    {
+        return false;
+    }
+
+    size_t index = cycle / PLAYER_CHECKPOINT_CYCLES;
+    if (index >= p->checkpoint_count)
+    {
+        index = p->checkpoint_count - 1;
+    }
+
+    const struct RegLogCheckpoint* c = &p->checkpoints[index];
+    if (apu_load_state(p->apu, c->state, apu_state_size()))
+    {
+        return false;
+    }
+
+    p->time = index * (uint64_t)PLAYER_CHECKPOINT_CYCLES;
+    p->base = c->base;
+    p->next_fs = c->next_fs;
+    p->event = c->event;
+
+    // synthesized and thrown away, saving any checkpoints on the way.
+    while (p->time < cycle)
+    {
+        const uint64_t left = cycle - p->time;
+        gbs_reglog_player_run(p, left < PLAYER_CHECKPOINT_CYCLES ? (unsigned)left : PLAYER_CHECKPOINT_CYCLES);
+        apu_clear_samples(p->apu);
+    }
+
+    apu_clear_samples(p->apu);
+    return true;
+}
+
+void gbs_reglog_player_set_master_volume(GbsRegLogPlayer* p, float volume)
+{
+    apu_set_master_volume(p->apu, volume);
+}
+
+int gbs_reglog_player_clocks_needed(GbsRegLogPlayer* p, int sample_count)
+{
+    return apu_clocks_needed(p->apu, sample_count);
+}
+
+int gbs_reglog_player_read_samples(GbsRegLogPlayer* p, short out[], int count)
+{
+    return apu_read_samples(p->apu, out, count);
+}
+#endif
+
+#if GBS_ENABLE_SNAPSHOT
+#ifdef __GBA__
+    #error "snapshots are not supported on the gba, the timers are hardware."
+#endif
+
+enum { SNAPSHOT_MAGIC = 0x53534247 }; // "GBSS"
+enum { SNAPSHOT_VERSION = 3 };
+// give up if init hasn't returned after this many frames (~60 seconds).
+enum { SNAPSHOT_MAX_INIT_FRAMES = 60 * 60 };
+
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t ticks;
+    uint64_t cycles_base;
+    // bit per pending event.
+    uint32_t events;
+    uint32_t event_cycles[Event_MAX];
+    struct LR35902 cpu;
+    uint8_t song;
+    uint8_t tima;
+    uint8_t tma;
+    uint8_t tac;
+    uint8_t key1;
+    uint8_t rom_bank;
+    uint8_t waiting_vsync;
+};
+
+struct GbsSnapshotCache
+{
+    struct GbsSnapshotIo io;
+    // indexed by song, NULL until the song is first started.
+    void* songs[0x100];
+};
+
+static const scheduler_callback SNAPSHOT_EVENT_CALLBACKS[Event_MAX] =
+{
+    [Event_FRAME_SEQUENCER] = on_fs_event,
+    [Event_VSYNC] = on_vsync_event,
+    [Event_TIMER] = on_timer_event,
+};
+
+size_t gbs_snapshot_size(const Gbs* gbs)
+{
+    (void)gbs;
+    return sizeof(struct SnapshotHeader) + 0x2000 + 0x2000 + 0x80 + apu_state_size();
+}
+
+bool gbs_save_snapshot(const Gbs* gbs, void* data, size_t size)
+{
+    if (size < gbs_snapshot_size(gbs))
+    {
+        return false;
+    }
+
+    struct SnapshotHeader h = {0};
+    h.magic = SNAPSHOT_MAGIC;
+    h.version = SNAPSHOT_VERSION;
+    h.size = gbs_snapshot_size(gbs);
+    h.ticks = scheduler_get_ticks(&gbs->scheduler);
+    h.cycles_base = gbs->cycles_base;
+    h.cpu = gbs->cpu;
+    h.cpu.userdata = NULL;
+    h.song = gbs->song;
+    h.tima = gbs->mem.tima;
+    h.tma = gbs->mem.tma;
+    h.tac = gbs->mem.tac;
+    h.key1 = gbs->mem.key1;
+    h.rom_bank = gbs->mem.rom_bank;
+    h.waiting_vsync = gbs->waiting_vsync;
+
+    for (unsigned i = 0; i < Event_MAX; i++)
+    {
+        if (SNAPSHOT_EVENT_CALLBACKS[i] && scheduler_has_event(&gbs->scheduler, i))
+        {
+            h.events |= 1 << i;
+            h.event_cycles[i] = gbs->event_cycles[i];
+        }
+    }
+
+    uint8_t* out = data;
+    memcpy(out, &h, sizeof(h)); out += sizeof(h);
+    memcpy(out, gbs->mem.sram, 0x2000); out += 0x2000;
+    memcpy(out, gbs->mem.wram, 0x2000); out += 0x2000;
+    memcpy(out, gbs->mem.hram, 0x80); out += 0x80;
+    return !apu_save_state(gbs->apu, out, apu_state_size());
+}
+
+bool gbs_load_snapshot(Gbs* gbs, const void* data, size_t size)
+{
+    struct SnapshotHeader h;
+    if (size < sizeof(h))
+    {
+        return false;
+    }
+
+    memcpy(&h, data, sizeof(h));
+    if (h.magic != SNAPSHOT_MAGIC || h.version != SNAPSHOT_VERSION || h.size != gbs_snapshot_size(gbs) || size < h.size)
+    {
+        return false;
+    }
+
+    if (h.song < gbs->header.first_song || h.song >= gbs->header.number_of_songs || !h.rom_bank || h.rom_bank >= gbs->mem.max_rom_bank)
+    {
+        return false;
+    }
+
+    // sets up everything that isn't saved, such as the trampoline.
+    gbs_reset(gbs, h.song);
+
+    const uint8_t* in = (const uint8_t*)data + sizeof(h);
+    memcpy(gbs->mem.sram, in, 0x2000); in += 0x2000;
+    memcpy(gbs->mem.wram, in, 0x2000); in += 0x2000;
+    memcpy(gbs->mem.hram, in, 0x80); in += 0x80;
+    if (apu_load_state(gbs->apu, in, apu_state_size()))
+    {
+        gbs_reset(gbs, h.song);
+        return false;
+    }
+
+#if GBS_ENABLE_STEMS
+    if (gbs->stems[0])
+    {
+        STEMS_CALL(gbs, apu_load_state, in, apu_state_size());
+        stems_mute(gbs);
+    }
+#endif
+
+    void* userdata = gbs->cpu.userdata;
+    gbs->cpu = h.cpu;
+    gbs->cpu.userdata = userdata;
+    gbs->mem.tima = h.tima;
+    gbs->mem.tma = h.tma;
+    gbs->mem.tac = h.tac;
+    gbs->mem.key1 = h.key1;
+    gbs->waiting_vsync = h.waiting_vsync;
+    set_rom_bank(gbs, h.rom_bank);
+
+    scheduler_reset(&gbs->scheduler, h.ticks, on_timeout_event, gbs);
+    gbs->cycles_base = h.cycles_base;
+    for (unsigned i = 0; i < Event_MAX; i++)
+    {
+        if (SNAPSHOT_EVENT_CALLBACKS[i] && (h.events & (1 << i)))
+        {
+            gbs->event_cycles[i] = h.event_cycles[i];
+            scheduler_add_absolute(&gbs->scheduler, i, h.event_cycles[i], SNAPSHOT_EVENT_CALLBACKS[i], gbs);
+        }
+    }
+
+#if GBS_ENABLE_CAPTURE
+    capture_start(gbs);
+#endif
+
+    gbs_clear_samples(gbs);
+    return true;
+}
+
+uint64_t gbs_get_cycles(const Gbs* gbs)
+{
+    return gbs->cycles_base + scheduler_get_ticks(&gbs->scheduler);
+}
+
+bool gbs_run_init(Gbs* gbs, uint8_t song)
+{
+    if (song < gbs->header.first_song || song >= gbs->header.number_of_songs)
+    {
+        return false;
+    }
+
+    gbs_reset(gbs, song);
+    gbs->stop_on_halt = true;
+
+#if GBS_ENABLE_CAPTURE
+    // init is skipped once restored, so isn't captured either.
+    scheduler_remove(&gbs->scheduler, Event_CAPTURE);
+#endif
+
+    // run a frame at a time, so that the samples made during init don't overflow.
+    for (unsigned i = 0; i < SNAPSHOT_MAX_INIT_FRAMES && gbs->stop_on_halt; i++)
+    {
+        gbs_run(gbs, VSYNC_CLOCK);
+        gbs_clear_samples(gbs);
+    }
+
+    if (gbs->stop_on_halt)
+    {
+        LOGE("init didn't return for song: %u\n", song);
+        gbs->stop_on_halt = false;
+        gbs_reset(gbs, song);
+        return false;
+    }
+
+    // the frame was cut short by the halt.
+    scheduler_remove(&gbs->scheduler, Event_END_FRAME);
+
+#if GBS_ENABLE_CAPTURE
+    capture_start(gbs);
+#endif
+    return true;
+}
+
+GbsSnapshotCache* gbs_snapshot_cache_init(const struct GbsSnapshotIo* io)
+{
+    GbsSnapshotCache* cache = calloc(1, sizeof(*cache));
+    if (cache && io)
+    {
+        cache->io = *io;
+    }
+    return cache;
+}
+
+void gbs_snapshot_cache_quit(GbsSnapshotCache* cache)
+{
+    if (cache)
+    {
+        for (unsigned i = 0; i < 0x100; i++)
+        {
+            free(cache->songs[i]);
+        }
+        free(cache);
+    }
+}
+
+void gbs_set_snapshot_cache(Gbs* gbs, GbsSnapshotCache* cache)
+{
+    gbs->snapshot_cache = cache;
+}
+
+static void snapshot_cache_start(Gbs* gbs, uint8_t song)
+{
+    GbsSnapshotCache* cache = gbs->snapshot_cache;
+    const size_t size = gbs_snapshot_size(gbs);
+
+    if (cache->songs[song] && gbs_load_snapshot(gbs, cache->songs[song], size))
+    {
+        return;
+    }
+
+    uint8_t* data = cache->songs[song] ? cache->songs[song] : malloc(size);
+    cache->songs[song] = NULL;
+    if (!data)
+    {
+        gbs_reset(gbs, song);
+        return;
+    }
+
+    if (cache->io.load && cache->io.load(cache->io.user, song, data, size) && gbs_load_snapshot(gbs, data, size))
+    {
+        cache->songs[song] = data;
+        return;
+    }
+
+    if (!gbs_run_init(gbs, song) || !gbs_save_snapshot(gbs, data, size))
+    {
+        free(data);
+        return;
+    }
+
+    cache->songs[song] = data;
+    if (cache->io.store)
+    {
+        cache->io.store(cache->io.user, song, data, size);
+    }
+
+    // parts of the apu, such as the resampler phase, aren't saved.
+    // restoring here means every start of the song sounds the same.
+    gbs_load_snapshot(gbs, data, size);
+}
+#endif
+
 #if GBS_ENABLE_LRU
 // 33 banks is the most any game uses (Hanasaka Tenshi Tenten-kun no Beat Breaker)
 enum { ZROM_MAX_BANKS = 33 };
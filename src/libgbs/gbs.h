@@ -16,6 +16,8 @@ enum { GBS_VERSION_MICRO = 0 };
 enum { GBS_MAGIC_SIZE = 0x03 };
 enum { GBS_HEADER_SIZE = 0x70 };
 enum { GBS_BANK_SIZE = 1024 * 16 };
+// rate of the cycles that the apu and timers are timed in.
+enum { GBS_CPU_CLOCK = 4194304 };
 
 #ifndef GBS_ENABLE_LRU
     #define GBS_ENABLE_LRU 1
@@ -25,6 +27,22 @@ enum { GBS_BANK_SIZE = 1024 * 16 };
     #define GBS_ENABLE_GBS2GB 0
 #endif
 
+#ifndef GBS_ENABLE_SNAPSHOT
+    #define GBS_ENABLE_SNAPSHOT 0
+#endif
+
+#ifndef GBS_ENABLE_STEMS
+    #define GBS_ENABLE_STEMS 0
+#endif
+
+#ifndef GBS_ENABLE_CAPTURE
+    #define GBS_ENABLE_CAPTURE 0
+#endif
+
+#ifndef GBS_ENABLE_REGLOG
+    #define GBS_ENABLE_REGLOG 0
+#endif
+
 typedef struct Gbs Gbs;
 
 struct GbsIo
@@ -134,6 +152,243 @@ bool gbs_lru_init(const struct GbsIo* io_in, struct GbsIo* io_out, uint8_t* pool
 void gbs_lru_quit(struct GbsIo* io);
 #endif
 
+/*
+* snapshots of a song taken right after its init routine returns, at the
+* first halt in the player loop. some init routines run for hundreds of ms
+* before the first note, restoring a snapshot skips that.
+
+* the emulated time spent in init is skipped, interrupts are disabled
+* during init so this is normally silence.
+
+* the snapshot cache keeps a snapshot per song, the first start of a song
+* runs init and saves it, later starts restore it. once a cache is set,
+* gbs_set_song() uses it. the cache can be shared between instances that
+* loaded the same file, but they must be used from one thread.
+
+* the optional io is a backing store, such as a directory on disk. a
+* snapshot is only valid for the same file, sample rate and build.
+*/
+#if GBS_ENABLE_SNAPSHOT
+struct GbsSnapshotIo
+{
+    /* user data passed into the below functions. */
+    void* user;
+    /* fills data with the snapshot of song, returns false if there isn't one. */
+    bool(*load)(void* user, uint8_t song, void* data, size_t size);
+    /* called after a new snapshot of song was taken. */
+    void(*store)(void* user, uint8_t song, const void* data, size_t size);
+};
+
+typedef struct GbsSnapshotCache GbsSnapshotCache;
+
+/* returns the size needed for a snapshot. */
+size_t gbs_snapshot_size(const Gbs*);
+bool gbs_save_snapshot(const Gbs*, void* data, size_t size);
+/* returns false if the snapshot is invalid or was taken from a different gbs. */
+bool gbs_load_snapshot(Gbs*, const void* data, size_t size);
+/*
+* cycles since the song started, which carries over to a snapshot. a gbs_run()
+* ends once the cycles are reached, but may go a little past them when the cpu
+* is mid instruction.
+*/
+uint64_t gbs_get_cycles(const Gbs*);
+/* resets to song and runs until init returns, returns false if it never did. */
+bool gbs_run_init(Gbs*, uint8_t song);
+
+/* io can be NULL to only cache in memory. */
+GbsSnapshotCache* gbs_snapshot_cache_init(const struct GbsSnapshotIo* io);
+void gbs_snapshot_cache_quit(GbsSnapshotCache*);
+/* the cache isn't owned by gbs, pass NULL to stop using it. */
+void gbs_set_snapshot_cache(Gbs*, GbsSnapshotCache* cache);
+#endif
+
+/*
+* stems are each channel rendered on its own, from the same emulation as
+* the mix. an apu per channel is fed every register write that the mixed
+* apu is, with the other channels muted, so the cpu and timers are only
+* emulated once for the mix and all of the stems.
+
+* stems are stereo at the same rate as the mix. they are filled by
+* gbs_run(), read the same number of samples from each stem as from
+* gbs_read_samples() to keep them in step.
+
+* enabling takes effect from the next song start, including one restored
+* from a snapshot. set the volume, bass and treble after enabling, so
+* that they also apply to the stems.
+*/
+#if GBS_ENABLE_STEMS
+enum GbsStem
+{
+    GbsStem_PULSE1,
+    GbsStem_PULSE2,
+    GbsStem_WAVE,
+    GbsStem_NOISE,
+    GbsStem_MAX,
+};
+
+/* returns false if the stem apus could not be allocated. */
+bool gbs_enable_stems(Gbs*, bool enable);
+int gbs_read_stem_samples(Gbs*, enum GbsStem stem, short out[], int count);
+#endif
+
+/*
+* captures the 4-bit level of each channel at a fixed rate while gbs_run()
+* emulates, without polling gbs_read_pcm(). nothing is scheduled unless a
+* ring is set, so it costs nothing when off.
+
+* each frame is timestamped with the output sample it lines up with,
+* counted from the start of the song, also when the ring is set part way
+* through it. the ring is owned by the caller, gbs only advances head and
+* overwrites the oldest frames once it is full. keep a read position and
+* compare it to head, if head is more than size ahead then frames were
+* dropped. head isn't atomic, so read the ring from the thread calling
+* gbs_run() or synchronise with it.
+
+* the capture restarts at each song start, the time spent in an init that
+* was skipped by a snapshot isn't captured.
+*/
+#if GBS_ENABLE_CAPTURE
+// ~65khz, the fastest capture rate.
+enum { GBS_CAPTURE_MIN_INTERVAL = 64 };
+
+struct GbsCaptureFrame
+{
+    uint64_t sample;
+    struct GbsPcm pcm;
+};
+
+struct GbsCaptureRing
+{
+    /* size must be a power of 2. */
+    struct GbsCaptureFrame* frames;
+    uint32_t size;
+    /* frames captured so far, the newest is at (head - 1) & (size - 1). */
+    uint32_t head;
+};
+
+/* rate is in frames per second, pass a NULL ring to stop capturing. */
+bool gbs_set_capture(Gbs*, struct GbsCaptureRing* ring, unsigned rate);
+#endif
+
+/*
+* records every apu register write of a song with its cycle, so that the
+* song can be synthesized again without the cpu.
+
+* the recorder is started by the next song start, which then always runs
+* init rather than restoring a snapshot, so that init's writes are in the
+* log. gbs_run() appends to it, it can be exported at any point.
+
+* the native log is a header then a delta coded command stream:
+* - 0x00-0x2F: write the next byte to register 0xFF10 + cmd.
+* - 0x40-0x7F: wait (cmd & 0x3F) + 1 cycles.
+* - 0x80: wait a LEB128 number of cycles.
+* - 0xFF: end of the log.
+* the frame sequencer isn't logged, it is clocked every 8192 cycles from
+* fs_offset in the header.
+
+* vgm exports are version 1.61 with the dmg chip, timed at 44100hz.
+*/
+#if GBS_ENABLE_REGLOG
+enum { GBS_REGLOG_MAGIC = 0x4C524247 }; // "GBRL"
+enum { GBS_REGLOG_VERSION = 1 };
+
+enum GbsRegLogCmd
+{
+    GbsRegLogCmd_WRITE_MAX = 0x2F,
+    GbsRegLogCmd_WAIT_SHORT = 0x40,
+    GbsRegLogCmd_WAIT_SHORT_MAX = 0x7F,
+    GbsRegLogCmd_WAIT = 0x80,
+    GbsRegLogCmd_END = 0xFF,
+};
+
+// all little endian.
+struct GbsRegLogHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t clock;
+    // cycles from the start to the first frame sequencer clock.
+    uint32_t fs_offset;
+    // length of the log in cycles.
+    uint64_t cycles;
+};
+
+enum GbsRegLogFormat
+{
+    GbsRegLogFormat_NATIVE,
+    GbsRegLogFormat_VGM,
+};
+
+typedef struct GbsRecorder GbsRecorder;
+
+GbsRecorder* gbs_recorder_init(void);
+void gbs_recorder_quit(GbsRecorder*);
+/* the recorder isn't owned by gbs, pass NULL to stop recording. */
+void gbs_set_recorder(Gbs*, GbsRecorder* recorder);
+/*
+* with synthesis off the apu isn't run and gbs_run() makes no samples, the
+* writes are only recorded, for a log that is synthesized somewhere else.
+* the cpu's reads are answered by a model of the registers, which has the
+* length counters and sweep that turn channels off. it doesn't follow the
+* wave channel, so wave ram reads while it plays return what was written.
+* like the recorder, it takes effect from the next song start.
+*/
+void gbs_set_synthesis(Gbs*, bool enable);
+/*
+* exports what was recorded so far into out, if size is large enough.
+* returns the size of the export, or 0 on error, such as a failed alloc
+* while recording.
+*/
+size_t gbs_recorder_export(const GbsRecorder*, enum GbsRegLogFormat format, void* out, size_t size);
+/*
+* for streaming, copies the native commands recorded since the song start
+* or the last take into out, without a header or end, and forgets them.
+* size is set to how much there is, nothing is taken if capacity is too
+* small. returns false if an alloc failed while recording.
+*/
+bool gbs_recorder_take(GbsRecorder*, void* out, size_t capacity, size_t* size);
+/* cycle that the last gbs_run() ended on. */
+uint64_t gbs_recorder_get_end_time(const GbsRecorder*);
+
+/*
+* plays a native or vgm register log straight into an apu, without the
+* cpu, scheduler or rom. it is used like a gbs, run then read samples.
+
+* the apu state is saved every 10 seconds of the log as it plays, seeking
+* restores the nearest one at or before the target and synthesizes from
+* there, so that envelopes and length counters are exact.
+
+* vgm logs must only use the dmg chip, the frame sequencer is assumed to
+* start 8192 cycles in as after a reset.
+*/
+typedef struct GbsRegLogPlayer GbsRegLogPlayer;
+
+/* the log is decoded, data isn't used after this returns. */
+GbsRegLogPlayer* gbs_reglog_player_init(const void* data, size_t size, double sample_rate);
+/*
+* a player that is fed from gbs_recorder_take() while the song is being
+* recorded, possibly on another thread. it can only run up to the end time
+* it was last fed, and can't seek.
+*/
+GbsRegLogPlayer* gbs_reglog_player_init_stream(double sample_rate);
+bool gbs_reglog_player_feed(GbsRegLogPlayer*, const void* data, size_t size, uint64_t end_time);
+void gbs_reglog_player_quit(GbsRegLogPlayer*);
+
+/* length and position, in cycles of GBS_CPU_CLOCK. */
+uint64_t gbs_reglog_player_get_length(const GbsRegLogPlayer*);
+uint64_t gbs_reglog_player_get_time(const GbsRegLogPlayer*);
+
+/* runs for cycles, past the end of the log is silence. */
+void gbs_reglog_player_run(GbsRegLogPlayer*, unsigned cycles);
+/* moves to cycle, any samples not yet read are dropped. */
+bool gbs_reglog_player_seek(GbsRegLogPlayer*, uint64_t cycle);
+
+void gbs_reglog_player_set_master_volume(GbsRegLogPlayer*, float volume);
+int gbs_reglog_player_clocks_needed(GbsRegLogPlayer*, int sample_count);
+int gbs_reglog_player_read_samples(GbsRegLogPlayer*, short out[], int count);
+#endif
+
 /*
 * converts a gbs file to a gbc file.
 * very basic impl, change songs using the A buttons.
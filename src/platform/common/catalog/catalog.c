@@ -0,0 +1,672 @@
+#include "catalog.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+static const char CATALOG_MAGIC[8] = { 'G', 'B', 'S', 'C', 'A', 'T', 'L', 'G' };
+
+struct CatalogHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t song_count;
+    uint32_t string_size;
+    uint32_t files_offset;
+    uint32_t songs_offset;
+    uint32_t strings_offset;
+    uint32_t reserved;
+};
+
+struct Catalog
+{
+    const uint8_t* map;
+    size_t map_size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    const struct CatalogFile* files;
+    const struct CatalogSong* songs;
+    const char* strings;
+    struct CatalogHeader header;
+};
+
+struct CatalogBuilder
+{
+    struct CatalogFile* files;
+    size_t file_count;
+    size_t file_capacity;
+
+    struct CatalogSong* songs;
+    size_t song_count;
+    size_t song_capacity;
+
+    char* strings;
+    size_t string_size;
+    size_t string_capacity;
+
+    // open addressing table of string offsets, used to deduplicate.
+    uint32_t* table;
+    size_t table_capacity;
+    size_t table_count;
+};
+
+static bool catalog_map(Catalog* c, const char* path)
+{
+#if defined(_WIN32)
+    c->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (c->file == INVALID_HANDLE_VALUE)
+    {
+        c->file = NULL;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(c->file, &size) || !size.QuadPart)
+    {
+        return false;
+    }
+
+    c->mapping = CreateFileMappingA(c->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!c->mapping)
+    {
+        return false;
+    }
+
+    c->map = MapViewOfFile(c->mapping, FILE_MAP_READ, 0, 0, 0);
+    c->map_size = (size_t)size.QuadPart;
+    return c->map != NULL;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    c->map = map;
+    c->map_size = st.st_size;
+    return true;
+#endif
+}
+
+static void catalog_unmap(Catalog* c)
+{
+#if defined(_WIN32)
+    if (c->map)
+    {
+        UnmapViewOfFile(c->map);
+    }
+    if (c->mapping)
+    {
+        CloseHandle(c->mapping);
+    }
+    if (c->file)
+    {
+        CloseHandle(c->file);
+    }
+#else
+    if (c->map)
+    {
+        munmap((void*)c->map, c->map_size);
+    }
+#endif
+}
+
+static bool catalog_table_fits(const Catalog* c, uint32_t offset, size_t count, size_t size, size_t align)
+{
+    return !(offset % align) && offset <= c->map_size && count <= (c->map_size - offset) / size;
+}
+
+static bool catalog_validate(Catalog* c)
+{
+    if (c->map_size < sizeof(c->header))
+    {
+        return false;
+    }
+
+    memcpy(&c->header, c->map, sizeof(c->header));
+    const struct CatalogHeader* h = &c->header;
+
+    if (memcmp(h->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) || h->version != CATALOG_VERSION)
+    {
+        return false;
+    }
+
+    if (!catalog_table_fits(c, h->files_offset, h->file_count, sizeof(struct CatalogFile), 8) ||
+        !catalog_table_fits(c, h->songs_offset, h->song_count, sizeof(struct CatalogSong), 4) ||
+        !catalog_table_fits(c, h->strings_offset, h->string_size, 1, 1))
+    {
+        return false;
+    }
+
+    c->files = (const struct CatalogFile*)(c->map + h->files_offset);
+    c->songs = (const struct CatalogSong*)(c->map + h->songs_offset);
+    c->strings = (const char*)(c->map + h->strings_offset);
+
+    // every string must be terminated, so checking the last byte is enough.
+    if (!h->string_size || c->strings[h->string_size - 1] != '\0')
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < h->file_count; i++)
+    {
+        const struct CatalogFile* f = &c->files[i];
+        if (f->path >= h->string_size || f->title >= h->string_size ||
+            f->author >= h->string_size || f->copyright >= h->string_size ||
+            f->song_index > h->song_count || f->song_count > h->song_count - f->song_index)
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < h->song_count; i++)
+    {
+        if (c->songs[i].title >= h->string_size)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Catalog* catalog_open(const char* path)
+{
+    Catalog* c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        return NULL;
+    }
+
+    if (!catalog_map(c, path) || !catalog_validate(c))
+    {
+        catalog_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void catalog_close(Catalog* c)
+{
+    if (c)
+    {
+        catalog_unmap(c);
+        free(c);
+    }
+}
+
+size_t catalog_get_file_count(const Catalog* c)
+{
+    return c->header.file_count;
+}
+
+const struct CatalogFile* catalog_get_file(const Catalog* c, size_t index)
+{
+    if (index >= c->header.file_count)
+    {
+        return NULL;
+    }
+
+    return &c->files[index];
+}
+
+const struct CatalogSong* catalog_get_songs(const Catalog* c, const struct CatalogFile* file)
+{
+    return &c->songs[file->song_index];
+}
+
+const char* catalog_get_string(const Catalog* c, uint32_t offset)
+{
+    if (offset >= c->header.string_size)
+    {
+        return "";
+    }
+
+    return c->strings + offset;
+}
+
+const struct CatalogFile* catalog_find_file(const Catalog* c, const char* path)
+{
+    size_t lo = 0;
+    size_t hi = c->header.file_count;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        const int cmp = strcmp(path, c->strings + c->files[mid].path);
+
+        if (!cmp)
+        {
+            return &c->files[mid];
+        }
+        else if (cmp < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+static bool catalog_match_string(const char* str, const char* query, bool prefix)
+{
+    do
+    {
+        size_t i = 0;
+        while (query[i] && tolower((unsigned char)str[i]) == tolower((unsigned char)query[i]))
+        {
+            i++;
+        }
+
+        if (!query[i])
+        {
+            return true;
+        }
+    } while (!prefix && *str++);
+
+    return false;
+}
+
+bool catalog_match(const Catalog* c, const struct CatalogFile* file, const char* query, unsigned flags)
+{
+    const bool prefix = flags & CatalogMatch_PREFIX;
+
+    if (!(flags & (CatalogMatch_TITLE | CatalogMatch_AUTHOR)))
+    {
+        flags |= CatalogMatch_TITLE | CatalogMatch_AUTHOR;
+    }
+
+    if ((flags & CatalogMatch_TITLE) && catalog_match_string(c->strings + file->title, query, prefix))
+    {
+        return true;
+    }
+
+    if ((flags & CatalogMatch_AUTHOR) && catalog_match_string(c->strings + file->author, query, prefix))
+    {
+        return true;
+    }
+
+    return false;
+}
+
+static uint32_t builder_hash(const char* str)
+{
+    // fnv-1a
+    uint32_t hash = 0x811C9DC5;
+    while (*str)
+    {
+        hash ^= (uint8_t)*str++;
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static bool builder_grow_table(CatalogBuilder* b)
+{
+    const size_t capacity = b->table_capacity ? b->table_capacity * 2 : 1024;
+    uint32_t* table = malloc(capacity * sizeof(*table));
+    if (!table)
+    {
+        return false;
+    }
+
+    // UINT32_MAX marks an empty slot.
+    memset(table, 0xFF, capacity * sizeof(*table));
+
+    for (size_t i = 0; i < b->table_capacity; i++)
+    {
+        const uint32_t offset = b->table[i];
+        if (offset != UINT32_MAX)
+        {
+            size_t slot = builder_hash(b->strings + offset) & (capacity - 1);
+            while (table[slot] != UINT32_MAX)
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot] = offset;
+        }
+    }
+
+    free(b->table);
+    b->table = table;
+    b->table_capacity = capacity;
+    return true;
+}
+
+// returns UINT32_MAX on failure.
+static uint32_t builder_intern(CatalogBuilder* b, const char* str)
+{
+    if (!str || !*str)
+    {
+        return 0;
+    }
+
+    if (b->table_count * 2 >= b->table_capacity && !builder_grow_table(b))
+    {
+        return UINT32_MAX;
+    }
+
+    size_t slot = builder_hash(str) & (b->table_capacity - 1);
+    while (b->table[slot] != UINT32_MAX)
+    {
+        if (!strcmp(b->strings + b->table[slot], str))
+        {
+            return b->table[slot];
+        }
+        slot = (slot + 1) & (b->table_capacity - 1);
+    }
+
+    const size_t len = strlen(str) + 1;
+    if (b->string_size + len > UINT32_MAX - 1)
+    {
+        return UINT32_MAX;
+    }
+
+    if (b->string_size + len > b->string_capacity)
+    {
+        size_t capacity = b->string_capacity ? b->string_capacity : 1024 * 64;
+        while (capacity < b->string_size + len)
+        {
+            capacity *= 2;
+        }
+
+        char* strings = realloc(b->strings, capacity);
+        if (!strings)
+        {
+            return UINT32_MAX;
+        }
+        b->strings = strings;
+        b->string_capacity = capacity;
+    }
+
+    const uint32_t offset = (uint32_t)b->string_size;
+    memcpy(b->strings + offset, str, len);
+    b->string_size += len;
+    b->table[slot] = offset;
+    b->table_count++;
+    return offset;
+}
+
+CatalogBuilder* catalog_builder_init(void)
+{
+    CatalogBuilder* b = calloc(1, sizeof(*b));
+    if (!b)
+    {
+        return NULL;
+    }
+
+    // offset 0 is the empty string.
+    if (!(b->strings = calloc(1, 1024 * 64)))
+    {
+        free(b);
+        return NULL;
+    }
+    b->string_size = 1;
+    b->string_capacity = 1024 * 64;
+
+    return b;
+}
+
+void catalog_builder_quit(CatalogBuilder* b)
+{
+    if (b)
+    {
+        free(b->files);
+        free(b->songs);
+        free(b->strings);
+        free(b->table);
+        free(b);
+    }
+}
+
+static bool builder_reserve(CatalogBuilder* b, size_t song_count)
+{
+    if (b->file_count == b->file_capacity)
+    {
+        const size_t capacity = b->file_capacity ? b->file_capacity * 2 : 256;
+        struct CatalogFile* files = realloc(b->files, capacity * sizeof(*files));
+        if (!files)
+        {
+            return false;
+        }
+        b->files = files;
+        b->file_capacity = capacity;
+    }
+
+    if (b->song_count + song_count > b->song_capacity)
+    {
+        size_t capacity = b->song_capacity ? b->song_capacity : 1024;
+        while (capacity < b->song_count + song_count)
+        {
+            capacity *= 2;
+        }
+
+        struct CatalogSong* songs = realloc(b->songs, capacity * sizeof(*songs));
+        if (!songs)
+        {
+            return false;
+        }
+        b->songs = songs;
+        b->song_capacity = capacity;
+    }
+
+    return b->song_count + song_count <= UINT32_MAX && b->file_count < UINT32_MAX;
+}
+
+bool catalog_builder_add(CatalogBuilder* b, const struct CatalogBuilderFile* file)
+{
+    if (!file->path || !*file->path || file->song_count > UINT16_MAX || !builder_reserve(b, file->song_count))
+    {
+        return false;
+    }
+
+    struct CatalogFile f = {0};
+    f.mtime = file->mtime;
+    f.size = file->size;
+    f.path = builder_intern(b, file->path);
+    f.title = builder_intern(b, file->title);
+    f.author = builder_intern(b, file->author);
+    f.copyright = builder_intern(b, file->copyright);
+    f.song_index = (uint32_t)b->song_count;
+    f.song_count = (uint16_t)file->song_count;
+    f.first_song = file->first_song;
+    f.max_song = file->max_song;
+
+    if (f.path == UINT32_MAX || f.title == UINT32_MAX || f.author == UINT32_MAX || f.copyright == UINT32_MAX)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < file->song_count; i++)
+    {
+        const struct CatalogBuilderSong* src = &file->songs[i];
+        struct CatalogSong* s = &b->songs[b->song_count + i];
+
+        s->title = builder_intern(b, src->title);
+        s->time = src->time;
+        s->loop = src->loop;
+        s->fade = src->fade;
+        s->songno = src->songno;
+        s->loopcount = src->loopcount;
+
+        if (s->title == UINT32_MAX)
+        {
+            return false;
+        }
+    }
+
+    b->song_count += file->song_count;
+    b->files[b->file_count++] = f;
+    return true;
+}
+
+bool catalog_builder_add_from(CatalogBuilder* b, const Catalog* c, const struct CatalogFile* file)
+{
+    if (!builder_reserve(b, file->song_count))
+    {
+        return false;
+    }
+
+    struct CatalogFile f = *file;
+    f.path = builder_intern(b, c->strings + file->path);
+    f.title = builder_intern(b, c->strings + file->title);
+    f.author = builder_intern(b, c->strings + file->author);
+    f.copyright = builder_intern(b, c->strings + file->copyright);
+    f.song_index = (uint32_t)b->song_count;
+
+    if (f.path == UINT32_MAX || f.title == UINT32_MAX || f.author == UINT32_MAX || f.copyright == UINT32_MAX)
+    {
+        return false;
+    }
+
+    const struct CatalogSong* songs = catalog_get_songs(c, file);
+    for (size_t i = 0; i < file->song_count; i++)
+    {
+        struct CatalogSong* s = &b->songs[b->song_count + i];
+        *s = songs[i];
+        s->title = builder_intern(b, c->strings + songs[i].title);
+
+        if (s->title == UINT32_MAX)
+        {
+            return false;
+        }
+    }
+
+    b->song_count += file->song_count;
+    b->files[b->file_count++] = f;
+    return true;
+}
+
+size_t catalog_builder_get_file_count(const CatalogBuilder* b)
+{
+    return b->file_count;
+}
+
+struct SortEntry
+{
+    const char* path;
+    size_t index;
+};
+
+static int sort_entry_cmp(const void* a, const void* b)
+{
+    const struct SortEntry* entry_a = a;
+    const struct SortEntry* entry_b = b;
+    return strcmp(entry_a->path, entry_b->path);
+}
+
+bool catalog_builder_write(CatalogBuilder* b, const char* path)
+{
+    // files are sorted by path so that lookups can binary search.
+    struct SortEntry* order = malloc((b->file_count ? b->file_count : 1) * sizeof(*order));
+    if (!order)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < b->file_count; i++)
+    {
+        order[i].path = b->strings + b->files[i].path;
+        order[i].index = i;
+    }
+    qsort(order, b->file_count, sizeof(*order), sort_entry_cmp);
+
+    struct CatalogHeader h = {0};
+    memcpy(h.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    h.version = CATALOG_VERSION;
+    h.file_count = (uint32_t)b->file_count;
+    h.song_count = (uint32_t)b->song_count;
+    h.string_size = (uint32_t)b->string_size;
+    h.files_offset = sizeof(h);
+    h.songs_offset = h.files_offset + h.file_count * sizeof(struct CatalogFile);
+    h.strings_offset = h.songs_offset + h.song_count * sizeof(struct CatalogSong);
+
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (!file)
+    {
+        free(order);
+        return false;
+    }
+
+    bool result = fwrite(&h, sizeof(h), 1, file) == 1;
+
+    // duplicate paths (e.g. a directory scanned twice) are only written once.
+    size_t written = 0;
+    for (size_t i = 0; i < b->file_count && result; i++)
+    {
+        if (i && !strcmp(order[i].path, order[i - 1].path))
+        {
+            continue;
+        }
+        result = fwrite(&b->files[order[i].index], sizeof(struct CatalogFile), 1, file) == 1;
+        written++;
+    }
+
+    result = result && fwrite(b->songs, sizeof(struct CatalogSong), b->song_count, file) == b->song_count;
+    result = result && fwrite(b->strings, 1, b->string_size, file) == b->string_size;
+
+    // fixup the header if any duplicates were skipped.
+    if (result && written != b->file_count)
+    {
+        h.file_count = (uint32_t)written;
+        h.songs_offset = h.files_offset + h.file_count * sizeof(struct CatalogFile);
+        h.strings_offset = h.songs_offset + h.song_count * sizeof(struct CatalogSong);
+        result = !fseek(file, 0, SEEK_SET) && fwrite(&h, sizeof(h), 1, file) == 1;
+    }
+
+    result = !fclose(file) && result;
+    free(order);
+
+    if (result)
+    {
+    #if defined(_WIN32)
+        remove(path);
+    #endif
+        result = !rename(tmp_path, path);
+    }
+
+    if (!result)
+    {
+        remove(tmp_path);
+    }
+
+    return result;
+}
@@ -0,0 +1,114 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* persistent metadata index for a gbs library.
+*
+* the file is a fixed little endian layout which is memory mapped on open
+* and used in place, there is no parsing or allocation per record.
+*
+* layout: header, file records (sorted by path), song records, string table.
+* strings are stored as offsets into the string table and are deduplicated,
+* offset 0 is always the empty string.
+*/
+
+enum { CATALOG_VERSION = 1 };
+
+struct CatalogFile
+{
+    uint64_t mtime; // used for incremental rescans.
+    uint64_t size;
+    uint32_t path;
+    uint32_t title;
+    uint32_t author;
+    uint32_t copyright;
+    uint32_t song_index; // index of the first song record.
+    uint16_t song_count; // number of song records (m3u entries).
+    uint8_t first_song;
+    uint8_t max_song;
+};
+
+struct CatalogSong
+{
+    uint32_t title;
+    uint16_t time;
+    uint16_t loop;
+    uint16_t fade;
+    uint8_t songno;
+    uint8_t loopcount;
+};
+
+enum CatalogMatch
+{
+    CatalogMatch_TITLE = 1 << 0,
+    CatalogMatch_AUTHOR = 1 << 1,
+    // match the start of the string, otherwise matches anywhere.
+    CatalogMatch_PREFIX = 1 << 2,
+};
+
+typedef struct Catalog Catalog;
+typedef struct CatalogBuilder CatalogBuilder;
+
+Catalog* catalog_open(const char* path);
+void catalog_close(Catalog*);
+
+size_t catalog_get_file_count(const Catalog*);
+const struct CatalogFile* catalog_get_file(const Catalog*, size_t index);
+/* returns file->song_count records. */
+const struct CatalogSong* catalog_get_songs(const Catalog*, const struct CatalogFile* file);
+const char* catalog_get_string(const Catalog*, uint32_t offset);
+/* binary search by path, returns NULL if not found. */
+const struct CatalogFile* catalog_find_file(const Catalog*, const char* path);
+/* case insensitive (ascii) match of the title and / or author. */
+bool catalog_match(const Catalog*, const struct CatalogFile* file, const char* query, unsigned flags);
+
+/*
+* builds a new catalog in memory, strings passed in are copied.
+* the builder isn't thread safe, scan in parallel and add from one thread.
+*/
+struct CatalogBuilderSong
+{
+    const char* title;
+    uint16_t time;
+    uint16_t loop;
+    uint16_t fade;
+    uint8_t songno;
+    uint8_t loopcount;
+};
+
+struct CatalogBuilderFile
+{
+    const char* path;
+    uint64_t mtime;
+    uint64_t size;
+    const char* title;
+    const char* author;
+    const char* copyright;
+    uint8_t first_song;
+    uint8_t max_song;
+    const struct CatalogBuilderSong* songs;
+    size_t song_count;
+};
+
+CatalogBuilder* catalog_builder_init(void);
+void catalog_builder_quit(CatalogBuilder*);
+bool catalog_builder_add(CatalogBuilder*, const struct CatalogBuilderFile* file);
+/* copies an unchanged record from an existing catalog. */
+bool catalog_builder_add_from(CatalogBuilder*, const Catalog* catalog, const struct CatalogFile* file);
+size_t catalog_builder_get_file_count(const CatalogBuilder*);
+/* writes to a temp file which then replaces path. */
+bool catalog_builder_write(CatalogBuilder*, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CATALOG_H
@@ -0,0 +1,994 @@
+#include "flac.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { BITS_PER_SAMPLE = 16 };
+enum { MAX_FIXED_ORDER = 4 };
+enum { MAX_LPC_ORDER = 8 };
+enum { MAX_LPC_SHIFT = 15 };
+enum { MAX_PARTITION_ORDER = 8 };
+// 4-bit rice params go up to 14 (15 is the escape code), 5-bit to 30.
+enum { MAX_RICE4_PARAM = 14 };
+enum { MAX_RICE5_PARAM = 30 };
+// zero bit, type and wasted bits flag.
+enum { SUBFRAME_HEADER_BITS = 8 };
+
+enum SubframeType
+{
+    SubframeType_CONSTANT,
+    SubframeType_VERBATIM,
+    SubframeType_FIXED,
+    SubframeType_LPC,
+};
+
+enum ChannelAssignment
+{
+    ChannelAssignment_LEFT_SIDE = 8,
+    ChannelAssignment_SIDE_RIGHT = 9,
+    ChannelAssignment_MID_SIDE = 10,
+};
+
+// signals used for stereo, after the input channels.
+enum { SIGNAL_SIDE = 2, SIGNAL_MID = 3 };
+
+struct Rice
+{
+    unsigned method; // 0 = 4-bit params, 1 = 5-bit params.
+    unsigned order;
+    uint8_t params[1 << MAX_PARTITION_ORDER];
+};
+
+struct Subframe
+{
+    enum SubframeType type;
+    unsigned order;
+    unsigned precision;
+    int shift;
+    bool use_32bit;
+    int32_t qlp[MAX_LPC_ORDER];
+    struct Rice rice;
+    uint64_t bits;
+};
+
+struct BitWriter
+{
+    uint8_t* out;
+    size_t pos;
+    uint64_t acc;
+    unsigned bits;
+};
+
+struct FlacEncoder
+{
+    struct FlacFormat format;
+    size_t max_frame_size;
+
+    // deinterleaved channels, followed by side and mid for stereo.
+    int32_t* signal[FLAC_MAX_CHANNELS + 2];
+    int32_t* residual;
+    double* window;
+    double* windowed;
+    unsigned window_size;
+
+    struct Subframe subframe[FLAC_MAX_CHANNELS + 2];
+    struct Subframe candidate;
+    uint16_t crc16_table[256];
+};
+
+static void put_bits(struct BitWriter* b, uint32_t value, unsigned count)
+{
+    b->acc = (b->acc << count) | (value & (uint32_t)((UINT64_C(1) << count) - 1));
+    b->bits += count;
+
+    while (b->bits >= 8)
+    {
+        b->bits -= 8;
+        b->out[b->pos++] = (uint8_t)(b->acc >> b->bits);
+    }
+}
+
+static void put_signed(struct BitWriter* b, int32_t value, unsigned count)
+{
+    put_bits(b, (uint32_t)value, count);
+}
+
+static void put_rice(struct BitWriter* b, uint32_t value, unsigned k)
+{
+    uint32_t q = value >> k;
+
+    // unary quotient, then the low k bits, in one write if it fits.
+    if (q + 1 + k <= 32)
+    {
+        put_bits(b, (UINT32_C(1) << k) | (value & ((UINT32_C(1) << k) - 1)), q + 1 + k);
+        return;
+    }
+
+    while (q >= 32)
+    {
+        put_bits(b, 0, 32);
+        q -= 32;
+    }
+
+    put_bits(b, 1, q + 1);
+    put_bits(b, value, k);
+}
+
+static void put_utf8(struct BitWriter* b, uint32_t value)
+{
+    if (value < 0x80)
+    {
+        put_bits(b, value, 8);
+        return;
+    }
+
+    const unsigned count = value < 0x800 ? 2 : value < 0x10000 ? 3 : value < 0x200000 ? 4 : value < 0x4000000 ? 5 : 6;
+    put_bits(b, ((0xFF00 >> count) & 0xFF) | (value >> (6 * (count - 1))), 8);
+
+    for (unsigned i = count - 1; i-- > 0;)
+    {
+        put_bits(b, 0x80 | ((value >> (6 * i)) & 0x3F), 8);
+    }
+}
+
+static void align_bits(struct BitWriter* b)
+{
+    if (b->bits)
+    {
+        put_bits(b, 0, 8 - b->bits);
+    }
+}
+
+static uint8_t crc8(const uint8_t* data, size_t size)
+{
+    uint8_t crc = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (unsigned j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+static uint16_t crc16(const uint16_t* table, const uint8_t* data, size_t size)
+{
+    uint16_t crc = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = (uint16_t)(crc << 8) ^ table[(crc >> 8) ^ data[i]];
+    }
+
+    return crc;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static unsigned get_block_size_code(unsigned frames)
+{
+    switch (frames)
+    {
+        case 192: return 1;
+        case 576: return 2;
+        case 1152: return 3;
+        case 2304: return 4;
+        case 4608: return 5;
+        case 256: return 8;
+        case 512: return 9;
+        case 1024: return 10;
+        case 2048: return 11;
+        case 4096: return 12;
+        case 8192: return 13;
+        case 16384: return 14;
+        case 32768: return 15;
+    }
+
+    // stored after the frame number as 8 or 16 bits.
+    return frames <= 256 ? 6 : 7;
+}
+
+static unsigned get_sample_rate_code(uint32_t sample_rate)
+{
+    switch (sample_rate)
+    {
+        case 88200: return 1;
+        case 176400: return 2;
+        case 192000: return 3;
+        case 8000: return 4;
+        case 16000: return 5;
+        case 22050: return 6;
+        case 24000: return 7;
+        case 32000: return 8;
+        case 44100: return 9;
+        case 48000: return 10;
+        case 96000: return 11;
+    }
+
+    // taken from STREAMINFO.
+    return 0;
+}
+
+// same as libFLAC, longer blocks can use more precise coefficients.
+static unsigned get_lpc_precision(unsigned frames)
+{
+    if (frames <= 192) return 7;
+    if (frames <= 384) return 8;
+    if (frames <= 576) return 9;
+    if (frames <= 1152) return 10;
+    if (frames <= 2304) return 11;
+    if (frames <= 4608) return 12;
+    return 13;
+}
+
+static uint64_t rice_cost(uint64_t sum, unsigned count, unsigned k)
+{
+    return (uint64_t)count * (k + 1) + (sum >> k);
+}
+
+// the cost is an upper bound of the real size, as sum >> k >= sum of each >> k.
+static unsigned get_rice_param(uint64_t sum, unsigned count, uint64_t* bits)
+{
+    if (!count)
+    {
+        *bits = 0;
+        return 0;
+    }
+
+    // start near log2 of the mean.
+    unsigned k = 0;
+    while (k < MAX_RICE5_PARAM && ((uint64_t)count << (k + 1)) <= sum)
+    {
+        k++;
+    }
+
+    unsigned best_k = k;
+    uint64_t best = rice_cost(sum, count, k);
+
+    if (k > 0 && rice_cost(sum, count, k - 1) < best)
+    {
+        best_k = k - 1;
+        best = rice_cost(sum, count, k - 1);
+    }
+
+    if (k < MAX_RICE5_PARAM && rice_cost(sum, count, k + 1) < best)
+    {
+        best_k = k + 1;
+        best = rice_cost(sum, count, k + 1);
+    }
+
+    *bits = best;
+    return best_k;
+}
+
+// returns the bits needed for the residual, including the partition headers.
+static uint64_t compute_rice(const int32_t* residual, unsigned frames, unsigned order, struct Rice* rice)
+{
+    uint64_t sums[1 << MAX_PARTITION_ORDER];
+
+    unsigned max_order = 0;
+    while (max_order < MAX_PARTITION_ORDER && !(frames & ((2u << max_order) - 1)) && (frames >> (max_order + 1)) > order)
+    {
+        max_order++;
+    }
+
+    const unsigned size = frames >> max_order;
+    for (unsigned p = 0; p < (1u << max_order); p++)
+    {
+        uint64_t sum = 0;
+        for (unsigned i = p ? p * size : order; i < (p + 1) * size; i++)
+        {
+            sum += zigzag(residual[i]);
+        }
+        sums[p] = sum;
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (int porder = (int)max_order;; porder--)
+    {
+        const unsigned count = 1u << porder;
+        const unsigned psize = frames >> porder;
+        uint8_t params[1 << MAX_PARTITION_ORDER];
+        uint64_t bits = 0;
+        unsigned max_k = 0;
+
+        for (unsigned p = 0; p < count; p++)
+        {
+            uint64_t part_bits;
+            params[p] = (uint8_t)get_rice_param(sums[p], psize - (p ? 0 : order), &part_bits);
+            max_k = params[p] > max_k ? params[p] : max_k;
+            bits += part_bits;
+        }
+
+        const unsigned method = max_k > MAX_RICE4_PARAM;
+        bits += 2 + 4 + (uint64_t)count * (method ? 5 : 4);
+
+        if (bits < best)
+        {
+            best = bits;
+            rice->method = method;
+            rice->order = porder;
+            memcpy(rice->params, params, count);
+        }
+
+        if (!porder)
+        {
+            break;
+        }
+
+        // merge pairs for the next order down.
+        for (unsigned p = 0; p < count / 2; p++)
+        {
+            sums[p] = sums[p * 2] + sums[p * 2 + 1];
+        }
+    }
+
+    return best;
+}
+
+static void compute_fixed_residual(const int32_t* x, unsigned frames, unsigned order, int32_t* r)
+{
+    switch (order)
+    {
+        case 0:
+            for (unsigned i = 0; i < frames; i++)
+            {
+                r[i] = x[i];
+            }
+            break;
+
+        case 1:
+            for (unsigned i = 1; i < frames; i++)
+            {
+                r[i] = x[i] - x[i - 1];
+            }
+            break;
+
+        case 2:
+            for (unsigned i = 2; i < frames; i++)
+            {
+                r[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+            }
+            break;
+
+        case 3:
+            for (unsigned i = 3; i < frames; i++)
+            {
+                r[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+            }
+            break;
+
+        case 4:
+            for (unsigned i = 4; i < frames; i++)
+            {
+                r[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+            }
+            break;
+    }
+}
+
+// returns false if a residual is too large to be rice coded.
+static bool compute_lpc_residual(const int32_t* x, unsigned frames, const struct Subframe* s, int32_t* r)
+{
+    const unsigned order = s->order;
+    const int32_t* qlp = s->qlp;
+
+    // the sum can't overflow 32 bits, which is the common case for 16-bit input.
+    if (s->use_32bit)
+    {
+        for (unsigned i = order; i < frames; i++)
+        {
+            int32_t sum = 0;
+            for (unsigned j = 0; j < order; j++)
+            {
+                sum += qlp[j] * x[i - j - 1];
+            }
+            r[i] = x[i] - (sum >> s->shift);
+        }
+
+        return true;
+    }
+
+    for (unsigned i = order; i < frames; i++)
+    {
+        int64_t sum = 0;
+        for (unsigned j = 0; j < order; j++)
+        {
+            sum += (int64_t)qlp[j] * x[i - j - 1];
+        }
+
+        const int64_t value = x[i] - (sum >> s->shift);
+        if (value < -(INT64_C(1) << 30) || value > (INT64_C(1) << 30))
+        {
+            return false;
+        }
+        r[i] = (int32_t)value;
+    }
+
+    return true;
+}
+
+// tukey(0.5) window.
+static void make_window(double* w, unsigned frames)
+{
+    const double PI = 3.14159265358979323846;
+    const unsigned taper = frames / 4;
+
+    for (unsigned i = 0; i < frames; i++)
+    {
+        w[i] = 1.0;
+    }
+
+    for (unsigned i = 0; i < taper; i++)
+    {
+        w[i] = w[frames - 1 - i] = 0.5 - 0.5 * cos(PI * i / taper);
+    }
+}
+
+// levinson-durbin, lp[order - 1] holds the coefficients for each order
+// and error[order - 1] the prediction error.
+// returns the max order that could be computed.
+static unsigned compute_lpc(const double* autoc, unsigned max_order, double lp[MAX_LPC_ORDER][MAX_LPC_ORDER], double* error)
+{
+    double lpc[MAX_LPC_ORDER];
+    double err = autoc[0];
+
+    for (unsigned i = 0; i < max_order; i++)
+    {
+        double r = -autoc[i + 1];
+        for (unsigned j = 0; j < i; j++)
+        {
+            r -= lpc[j] * autoc[i - j];
+        }
+        r /= err;
+
+        lpc[i] = r;
+        unsigned j = 0;
+        for (; j < (i >> 1); j++)
+        {
+            const double tmp = lpc[j];
+            lpc[j] += r * lpc[i - 1 - j];
+            lpc[i - 1 - j] += r * tmp;
+        }
+        if (i & 1)
+        {
+            lpc[j] += lpc[j] * r;
+        }
+
+        err *= 1.0 - r * r;
+
+        for (j = 0; j <= i; j++)
+        {
+            lp[i][j] = -lpc[j];
+        }
+        error[i] = err;
+
+        if (err <= 0.0)
+        {
+            return i + 1;
+        }
+    }
+
+    return max_order;
+}
+
+static bool quantize_lpc(const double* lp, unsigned order, unsigned precision, struct Subframe* s)
+{
+    double cmax = 0.0;
+    for (unsigned i = 0; i < order; i++)
+    {
+        cmax = fabs(lp[i]) > cmax ? fabs(lp[i]) : cmax;
+    }
+
+    if (cmax <= 0.0)
+    {
+        return false;
+    }
+
+    int exponent;
+    frexp(cmax, &exponent);
+
+    // negative shifts are not allowed.
+    int shift = (int)precision - 1 - exponent;
+    if (shift > MAX_LPC_SHIFT)
+    {
+        shift = MAX_LPC_SHIFT;
+    }
+    else if (shift < 0)
+    {
+        return false;
+    }
+
+    const long qmax = (1L << (precision - 1)) - 1;
+    const long qmin = -qmax - 1;
+    double error = 0.0;
+
+    // carry the rounding error into the next coefficient.
+    for (unsigned i = 0; i < order; i++)
+    {
+        error += lp[i] * (1 << shift);
+        long q = lround(error);
+        q = q > qmax ? qmax : q < qmin ? qmin : q;
+        error -= q;
+        s->qlp[i] = (int32_t)q;
+    }
+
+    s->type = SubframeType_LPC;
+    s->order = order;
+    s->precision = precision;
+    s->shift = shift;
+    return true;
+}
+
+static void compute_residual(const struct Subframe* s, const int32_t* x, unsigned frames, int32_t* r)
+{
+    if (s->type == SubframeType_FIXED)
+    {
+        compute_fixed_residual(x, frames, s->order, r);
+    }
+    else if (s->type == SubframeType_LPC)
+    {
+        compute_lpc_residual(x, frames, s, r);
+    }
+}
+
+static void analyse_lpc(FlacEncoder* e, const int32_t* x, unsigned frames, unsigned bps, struct Subframe* best)
+{
+    if (e->window_size != frames)
+    {
+        make_window(e->window, frames);
+        e->window_size = frames;
+    }
+
+    for (unsigned i = 0; i < frames; i++)
+    {
+        e->windowed[i] = x[i] * e->window[i];
+    }
+
+    double autoc[MAX_LPC_ORDER + 1];
+    for (unsigned lag = 0; lag <= MAX_LPC_ORDER; lag++)
+    {
+        double sum = 0.0;
+        for (unsigned i = lag; i < frames; i++)
+        {
+            sum += e->windowed[i] * e->windowed[i - lag];
+        }
+        autoc[lag] = sum;
+    }
+
+    if (autoc[0] <= 0.0)
+    {
+        return;
+    }
+
+    double lp[MAX_LPC_ORDER][MAX_LPC_ORDER];
+    double error[MAX_LPC_ORDER];
+    const unsigned max_order = compute_lpc(autoc, MAX_LPC_ORDER, lp, error);
+    const unsigned precision = get_lpc_precision(frames);
+
+    // only the order with the smallest estimated size is encoded, same as
+    // libFLAC without exhaustive search.
+    unsigned order = 1;
+    double best_estimate = 0.0;
+    for (unsigned i = 0; i < max_order; i++)
+    {
+        const double bits_per_residual = error[i] > 0.0 ? 0.5 * log2(0.5 * error[i] / frames) : 0.0;
+        const double estimate = (bits_per_residual > 0.0 ? bits_per_residual : 0.0) * (frames - i - 1) + (i + 1) * (bps + precision);
+        if (!i || estimate < best_estimate)
+        {
+            order = i + 1;
+            best_estimate = estimate;
+        }
+    }
+
+    struct Subframe* c = &e->candidate;
+    if (!quantize_lpc(lp[order - 1], order, precision, c))
+    {
+        return;
+    }
+
+    // the sum of order products of bps and precision bits fits in 32 bits.
+    unsigned order_bits = 0;
+    while ((1u << order_bits) < order)
+    {
+        order_bits++;
+    }
+    c->use_32bit = bps + precision + order_bits <= 32;
+
+    if (!compute_lpc_residual(x, frames, c, e->residual))
+    {
+        return;
+    }
+
+    c->bits = SUBFRAME_HEADER_BITS + order * bps + 4 + 5 + order * precision + compute_rice(e->residual, frames, order, &c->rice);
+    if (c->bits < best->bits)
+    {
+        *best = *c;
+    }
+}
+
+// picks the order with the smallest sum of absolute residuals, like libFLAC.
+static unsigned get_fixed_order(const int32_t* x, unsigned frames)
+{
+    uint64_t total[MAX_FIXED_ORDER + 1] = { 0 };
+
+    for (unsigned i = MAX_FIXED_ORDER; i < frames; i++)
+    {
+        const int32_t e0 = x[i];
+        const int32_t e1 = e0 - x[i - 1];
+        const int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+        const int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+        const int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+        total[0] += (uint32_t)abs(e0);
+        total[1] += (uint32_t)abs(e1);
+        total[2] += (uint32_t)abs(e2);
+        total[3] += (uint32_t)abs(e3);
+        total[4] += (uint32_t)abs(e4);
+    }
+
+    unsigned order = 0;
+    for (unsigned i = 1; i <= MAX_FIXED_ORDER; i++)
+    {
+        if (total[i] < total[order])
+        {
+            order = i;
+        }
+    }
+
+    return order;
+}
+
+static void analyse(FlacEncoder* e, const int32_t* x, unsigned frames, unsigned bps, struct Subframe* best)
+{
+    best->type = SubframeType_VERBATIM;
+    best->order = 0;
+    best->bits = SUBFRAME_HEADER_BITS + (uint64_t)frames * bps;
+
+    bool constant = true;
+    for (unsigned i = 1; i < frames && constant; i++)
+    {
+        constant = x[i] == x[0];
+    }
+
+    if (constant)
+    {
+        best->type = SubframeType_CONSTANT;
+        best->bits = SUBFRAME_HEADER_BITS + bps;
+        return;
+    }
+
+    // short frames try every order.
+    const bool estimate = frames > MAX_FIXED_ORDER * 2;
+    const unsigned fixed_order = estimate ? get_fixed_order(x, frames) : 0;
+
+    struct Subframe* c = &e->candidate;
+    for (unsigned order = 0; order <= MAX_FIXED_ORDER && order < frames; order++)
+    {
+        if (estimate && order != fixed_order)
+        {
+            continue;
+        }
+
+        c->type = SubframeType_FIXED;
+        c->order = order;
+        compute_fixed_residual(x, frames, order, e->residual);
+        c->bits = SUBFRAME_HEADER_BITS + order * bps + compute_rice(e->residual, frames, order, &c->rice);
+
+        if (c->bits < best->bits)
+        {
+            *best = *c;
+        }
+    }
+
+    // too short for lpc to be worth it.
+    if (frames > MAX_LPC_ORDER * 4)
+    {
+        analyse_lpc(e, x, frames, bps, best);
+    }
+}
+
+static void write_residual(struct BitWriter* b, const int32_t* residual, unsigned frames, unsigned order, const struct Rice* rice)
+{
+    const unsigned param_bits = rice->method ? 5 : 4;
+    const unsigned psize = frames >> rice->order;
+
+    put_bits(b, rice->method, 2);
+    put_bits(b, rice->order, 4);
+
+    for (unsigned p = 0; p < (1u << rice->order); p++)
+    {
+        const unsigned k = rice->params[p];
+        put_bits(b, k, param_bits);
+
+        for (unsigned i = p ? p * psize : order; i < (p + 1) * psize; i++)
+        {
+            put_rice(b, zigzag(residual[i]), k);
+        }
+    }
+}
+
+static void write_subframe(FlacEncoder* e, struct BitWriter* b, const struct Subframe* s, const int32_t* x, unsigned frames, unsigned bps)
+{
+    put_bits(b, 0, 1);
+
+    switch (s->type)
+    {
+        case SubframeType_CONSTANT:
+            put_bits(b, 0, 6);
+            put_bits(b, 0, 1);
+            put_signed(b, x[0], bps);
+            break;
+
+        case SubframeType_VERBATIM:
+            put_bits(b, 1, 6);
+            put_bits(b, 0, 1);
+            for (unsigned i = 0; i < frames; i++)
+            {
+                put_signed(b, x[i], bps);
+            }
+            break;
+
+        case SubframeType_FIXED:
+        case SubframeType_LPC:
+            if (s->type == SubframeType_FIXED)
+            {
+                put_bits(b, 0x08 | s->order, 6);
+            }
+            else
+            {
+                put_bits(b, 0x20 | (s->order - 1), 6);
+            }
+            put_bits(b, 0, 1);
+
+            for (unsigned i = 0; i < s->order; i++)
+            {
+                put_signed(b, x[i], bps);
+            }
+
+            if (s->type == SubframeType_LPC)
+            {
+                put_bits(b, s->precision - 1, 4);
+                put_signed(b, s->shift, 5);
+                for (unsigned i = 0; i < s->order; i++)
+                {
+                    put_signed(b, s->qlp[i], s->precision);
+                }
+            }
+
+            compute_residual(s, x, frames, e->residual);
+            write_residual(b, e->residual, frames, s->order, &s->rice);
+            break;
+    }
+}
+
+static bool is_format_valid(const struct FlacFormat* format)
+{
+    return format->channels >= 1 && format->channels <= FLAC_MAX_CHANNELS &&
+        format->sample_rate >= 1 && format->sample_rate < (1 << 20) &&
+        format->block_size >= FLAC_MIN_BLOCK_SIZE;
+}
+
+FlacEncoder* flac_encoder_init(const struct FlacFormat* format)
+{
+    if (!is_format_valid(format))
+    {
+        return NULL;
+    }
+
+    FlacEncoder* e = calloc(1, sizeof(*e));
+    if (!e)
+    {
+        return NULL;
+    }
+
+    e->format = *format;
+    const unsigned frames = format->block_size;
+    const unsigned signals = format->channels == 2 ? 4 : format->channels;
+
+    for (unsigned i = 0; i < signals; i++)
+    {
+        if (!(e->signal[i] = malloc(frames * sizeof(int32_t))))
+        {
+            goto fail;
+        }
+    }
+
+    if (!(e->residual = malloc(frames * sizeof(int32_t))) ||
+        !(e->window = malloc(frames * sizeof(double))) ||
+        !(e->windowed = malloc(frames * sizeof(double))))
+    {
+        goto fail;
+    }
+
+    for (unsigned i = 0; i < 256; i++)
+    {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (unsigned j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+        }
+        e->crc16_table[i] = crc;
+    }
+
+    // header, then each subframe is at most verbatim (side is 17-bit), then the crc.
+    e->max_frame_size = 16 + format->channels * (2 + ((size_t)frames * (BITS_PER_SAMPLE + 1) + 7) / 8) + 2;
+    return e;
+
+fail:
+    flac_encoder_quit(e);
+    return NULL;
+}
+
+void flac_encoder_quit(FlacEncoder* e)
+{
+    if (e)
+    {
+        for (unsigned i = 0; i < FLAC_MAX_CHANNELS + 2; i++)
+        {
+            free(e->signal[i]);
+        }
+        free(e->residual);
+        free(e->window);
+        free(e->windowed);
+        free(e);
+    }
+}
+
+size_t flac_encoder_get_max_frame_size(const FlacEncoder* e)
+{
+    return e->max_frame_size;
+}
+
+size_t flac_encoder_encode_frame(FlacEncoder* e, const int16_t* samples, unsigned frames, uint32_t frame_number, uint8_t* out)
+{
+    const unsigned channels = e->format.channels;
+
+    if (!frames || frames > e->format.block_size || frame_number >= (UINT32_C(1) << 31))
+    {
+        return 0;
+    }
+
+    for (unsigned i = 0; i < frames; i++)
+    {
+        for (unsigned c = 0; c < channels; c++)
+        {
+            e->signal[c][i] = samples[i * channels + c];
+        }
+    }
+
+    // which signal is stored in each subframe, and its bits per sample.
+    unsigned assignment = channels - 1;
+    unsigned source[FLAC_MAX_CHANNELS];
+    unsigned bps[FLAC_MAX_CHANNELS];
+
+    for (unsigned c = 0; c < channels; c++)
+    {
+        source[c] = c;
+        bps[c] = BITS_PER_SAMPLE;
+    }
+
+    if (channels == 2)
+    {
+        int32_t* left = e->signal[0];
+        int32_t* right = e->signal[1];
+        for (unsigned i = 0; i < frames; i++)
+        {
+            e->signal[SIGNAL_SIDE][i] = left[i] - right[i];
+            e->signal[SIGNAL_MID][i] = (left[i] + right[i]) >> 1;
+        }
+
+        analyse(e, e->signal[0], frames, BITS_PER_SAMPLE, &e->subframe[0]);
+        analyse(e, e->signal[1], frames, BITS_PER_SAMPLE, &e->subframe[1]);
+        analyse(e, e->signal[SIGNAL_SIDE], frames, BITS_PER_SAMPLE + 1, &e->subframe[SIGNAL_SIDE]);
+        analyse(e, e->signal[SIGNAL_MID], frames, BITS_PER_SAMPLE, &e->subframe[SIGNAL_MID]);
+
+        const uint64_t l = e->subframe[0].bits;
+        const uint64_t r = e->subframe[1].bits;
+        const uint64_t s = e->subframe[SIGNAL_SIDE].bits;
+        const uint64_t m = e->subframe[SIGNAL_MID].bits;
+        uint64_t best = l + r;
+
+        if (l + s < best)
+        {
+            best = l + s;
+            assignment = ChannelAssignment_LEFT_SIDE;
+            source[1] = SIGNAL_SIDE;
+            bps[1] = BITS_PER_SAMPLE + 1;
+        }
+
+        if (s + r < best)
+        {
+            best = s + r;
+            assignment = ChannelAssignment_SIDE_RIGHT;
+            source[0] = SIGNAL_SIDE;
+            source[1] = 1;
+            bps[0] = BITS_PER_SAMPLE + 1;
+            bps[1] = BITS_PER_SAMPLE;
+        }
+
+        if (m + s < best)
+        {
+            assignment = ChannelAssignment_MID_SIDE;
+            source[0] = SIGNAL_MID;
+            source[1] = SIGNAL_SIDE;
+            bps[0] = BITS_PER_SAMPLE;
+            bps[1] = BITS_PER_SAMPLE + 1;
+        }
+    }
+    else
+    {
+        for (unsigned c = 0; c < channels; c++)
+        {
+            analyse(e, e->signal[c], frames, BITS_PER_SAMPLE, &e->subframe[c]);
+        }
+    }
+
+    struct BitWriter b = { .out = out };
+    const unsigned block_size_code = get_block_size_code(frames);
+
+    // sync code, reserved bit and fixed block size.
+    put_bits(&b, 0xFFF8, 16);
+    put_bits(&b, block_size_code, 4);
+    put_bits(&b, get_sample_rate_code(e->format.sample_rate), 4);
+    put_bits(&b, assignment, 4);
+    put_bits(&b, 4, 3); // 16 bits per sample.
+    put_bits(&b, 0, 1);
+    put_utf8(&b, frame_number);
+
+    if (block_size_code == 6)
+    {
+        put_bits(&b, frames - 1, 8);
+    }
+    else if (block_size_code == 7)
+    {
+        put_bits(&b, frames - 1, 16);
+    }
+
+    put_bits(&b, crc8(out, b.pos), 8);
+
+    for (unsigned c = 0; c < channels; c++)
+    {
+        write_subframe(e, &b, &e->subframe[source[c]], e->signal[source[c]], frames, bps[c]);
+    }
+
+    align_bits(&b);
+    put_bits(&b, crc16(e->crc16_table, out, b.pos), 16);
+
+    return b.pos;
+}
+
+void flac_write_header(const struct FlacStreamInfo* info, uint8_t* out)
+{
+    struct BitWriter b = { .out = out };
+
+    memcpy(out, "fLaC", 4);
+    b.pos = 4;
+
+    // last metadata block, STREAMINFO, 34 bytes.
+    put_bits(&b, 0x80, 8);
+    put_bits(&b, 34, 24);
+
+    put_bits(&b, info->format.block_size, 16);
+    put_bits(&b, info->format.block_size, 16);
+    put_bits(&b, info->min_frame_size, 24);
+    put_bits(&b, info->max_frame_size, 24);
+    put_bits(&b, info->format.sample_rate, 20);
+    put_bits(&b, info->format.channels - 1, 3);
+    put_bits(&b, BITS_PER_SAMPLE - 1, 5);
+    put_bits(&b, (uint32_t)(info->total_samples >> 32), 4);
+    put_bits(&b, (uint32_t)info->total_samples, 32);
+
+    // md5 of the samples, all zero means not set.
+    for (unsigned i = 0; i < 16; i++)
+    {
+        put_bits(&b, 0, 8);
+    }
+}
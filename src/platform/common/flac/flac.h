@@ -0,0 +1,69 @@
+#ifndef FLAC_H
+#define FLAC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* flac encoder for 16-bit pcm.
+*
+* every frame is independent, so frames can be encoded on any number of
+* threads at once, each with its own FlacEncoder. the caller writes the
+* stream header and then the encoded frames in frame_number order.
+*
+* each subframe uses the smallest of constant, verbatim, fixed (order 0-4)
+* and lpc prediction, stereo also tries left/side, side/right and mid/side.
+* residuals are rice coded, with the partition order picked per subframe.
+*/
+
+enum { FLAC_DEFAULT_BLOCK_SIZE = 4096 };
+enum { FLAC_MIN_BLOCK_SIZE = 16 };
+enum { FLAC_MAX_BLOCK_SIZE = 65535 };
+enum { FLAC_MAX_CHANNELS = 8 };
+// "fLaC" followed by the STREAMINFO block.
+enum { FLAC_HEADER_SIZE = 42 };
+
+struct FlacFormat
+{
+    uint32_t sample_rate;
+    uint8_t channels;
+    // frames per block, every block but the last must be this size.
+    uint16_t block_size;
+};
+
+struct FlacStreamInfo
+{
+    struct FlacFormat format;
+    uint32_t min_frame_size; // in bytes, 0 if unknown.
+    uint32_t max_frame_size; // in bytes, 0 if unknown.
+    uint64_t total_samples; // per channel, 0 if unknown.
+};
+
+typedef struct FlacEncoder FlacEncoder;
+
+/* returns NULL if the format is not supported. */
+FlacEncoder* flac_encoder_init(const struct FlacFormat* format);
+void flac_encoder_quit(FlacEncoder*);
+
+/* size of the out buffer needed by flac_encoder_encode_frame(). */
+size_t flac_encoder_get_max_frame_size(const FlacEncoder*);
+
+/*
+* encodes up to block_size interleaved frames into out.
+* returns the size of the encoded frame, or 0 on error.
+*/
+size_t flac_encoder_encode_frame(FlacEncoder*, const int16_t* samples, unsigned frames, uint32_t frame_number, uint8_t* out);
+
+/* writes FLAC_HEADER_SIZE bytes, the md5 is left unset. */
+void flac_write_header(const struct FlacStreamInfo* info, uint8_t* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLAC_H
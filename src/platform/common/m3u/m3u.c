@@ -1,6 +1,5 @@
 #include <ctype.h>
 #include <stdbool.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "m3u.h"
@@ -41,155 +40,268 @@ NEZplug extend M3U playlist format(v0.9) for Winamp
 
 static const char GBS_MAGIC[] = { 'G', 'B', 'S' };
 
-static size_t m3u_get_time(const char* str, size_t size, size_t offset, unsigned short* t)
+// shortest line that can hold an entry, "::GBS,0" plus a line break.
+enum { M3U_MIN_ENTRY_SIZE = 8 };
+
+struct M3uBlock
+{
+    struct M3uBlock* next;
+};
+
+struct M3uLine
+{
+    const char* str;
+    size_t size;
+    size_t offset;
+};
+
+static bool m3u_line_end(const struct M3uLine* line)
+{
+    return line->offset >= line->size;
+}
+
+static bool m3u_line_skip(struct M3uLine* line, char c)
 {
-    if (str[offset] != ',')
+    if (!m3u_line_end(line) && line->str[line->offset] == c)
     {
-        for (size_t i = 0; i < 3; i++)
-        {
-            const size_t start_offset = offset;
-            while (isalnum(str[offset]))
-            {
-                offset++; if (offset >= size) { goto early_end; }
-            }
+        line->offset++;
+        return true;
+    }
 
-            *t *= 60;
-            *t += atoi(str + start_offset);
+    return false;
+}
 
-            if (str[offset] == ',')
-            {
-                goto early_end;
-            }
+// h:m:s, stops at the next comma, anything that isn't a digit or colon is ignored (such as the loop "-").
+static unsigned short m3u_parse_time(struct M3uLine* line)
+{
+    unsigned long t = 0;
+    unsigned long group = 0;
 
-            // skip over colon
-            offset += 1; if (offset >= size) { goto early_end; }
+    for (; !m3u_line_end(line) && line->str[line->offset] != ','; line->offset++)
+    {
+        const char c = line->str[line->offset];
+        if (isdigit((unsigned char)c))
+        {
+            group = group * 10 + (c - '0');
+        }
+        else if (c == ':')
+        {
+            t = t * 60 + group;
+            group = 0;
+        }
+
+        if (group > 0xFFFF || t > 0xFFFF)
+        {
+            return 0xFFFF;
         }
     }
 
-early_end:
-    return offset;
+    t = t * 60 + group;
+    return t > 0xFFFF ? 0xFFFF : (unsigned short)t;
 }
 
-// this by all means isn't good code, however, it works well enough for now.
-bool m3u_info_parse(const char* str, size_t size, struct M3uSongInfo* info)
+static bool m3u_parse_songno(struct M3uLine* line, unsigned char* songno)
 {
-    memset(info, 0, sizeof(*info));
-
-    // starting offset
-    size_t start_offset = 0;
-    size_t offset = 0;
+    // $ prefix is hex.
+    const unsigned base = m3u_line_skip(line, '$') ? 16 : 10;
+    unsigned value = 0;
+    size_t digits = 0;
 
-    // get the filename.
-    while (!(str[offset] == ':' && str[offset + 1] == ':'))
+    for (; !m3u_line_end(line); line->offset++, digits++)
     {
-        offset++; if (offset >= size) { goto fail; }
+        const char c = line->str[line->offset];
+        unsigned d;
+
+        if (isdigit((unsigned char)c))
+        {
+            d = c - '0';
+        }
+        else if (base == 16 && isxdigit((unsigned char)c))
+        {
+            d = tolower((unsigned char)c) - 'a' + 10;
+        }
+        else
+        {
+            break;
+        }
+
+        value = value * base + d;
+        if (value > 0xFF)
+        {
+            return false;
+        }
     }
 
-    // confirm that this is a gbs file.
-    if (memcmp(str + offset + 2, GBS_MAGIC, sizeof(GBS_MAGIC)))
+    *songno = value;
+    return digits > 0;
+}
+
+// copies the (possibly escaped) title up to the next unescaped comma.
+static char* m3u_parse_title(struct M3uLine* line, char* dst)
+{
+    while (!m3u_line_end(line) && line->str[line->offset] != ',')
     {
-        printf("bad magic, got: %.*s and: %s\n", 3, str + offset + 2, str + offset);
-        goto fail;
+        char c = line->str[line->offset++];
+        if (c == '\\')
+        {
+            if (m3u_line_end(line))
+            {
+                break;
+            }
+            c = line->str[line->offset++];
+        }
+
+        // non ascii (usually shift-jis) can't be displayed, so it's dropped.
+        if ((unsigned char)c < 0x80)
+        {
+            *dst++ = c;
+        }
     }
 
-    info->filename = calloc(offset + 1, sizeof(char));
-    memcpy(info->filename, str, offset);
+    *dst++ = '\0';
+    return dst;
+}
 
-    // skip over the dots, magic and comma
-    offset += 2 + sizeof(GBS_MAGIC) + 1; if (offset >= size) { goto fail; }
+// strings are written to *strings, which is advanced past them.
+static bool m3u_parse_line(const char* str, size_t size, struct M3uEntry* entry, char** strings)
+{
+    struct M3uLine line = { .str = str, .size = size };
+    memset(entry, 0, sizeof(*entry));
 
-    // get the song num.
-    start_offset = offset;
-    while (str[offset] != ',')
+    // get the filename.
+    while (line.offset + 1 < size && !(str[line.offset] == ':' && str[line.offset + 1] == ':'))
     {
-        // some m3u prepend with $
-        if (str[start_offset] == '$') start_offset++;
-        offset++; if (offset >= size) { goto fail; }
+        line.offset++;
     }
-    info->songno = atoi(str + start_offset);
 
-    // skip over comma
-    offset += 1; if (offset >= size) { goto fail; }
+    const size_t filename_size = line.offset;
+    line.offset += 2;
 
-    // get the song name.
-    start_offset = offset;
-    while (!(str[offset] == ',' && str[offset - 1] != '\\'))
+    // confirm that this is a gbs entry.
+    if (line.offset + sizeof(GBS_MAGIC) > size || memcmp(str + line.offset, GBS_MAGIC, sizeof(GBS_MAGIC)))
     {
-        offset++; if (offset >= size) { goto fail; }
+        return false;
     }
+    line.offset += sizeof(GBS_MAGIC);
 
-    // copy over name, skipping any backslashes
-    info->song_tile = calloc((offset - start_offset) + 1, sizeof(char));
-    for (size_t i = start_offset, j = 0; i < offset; i++)
+    if (!m3u_line_skip(&line, ',') || !m3u_parse_songno(&line, &entry->songno))
     {
-        if (isascii(str[i]) && str[i] != '\\')
+        return false;
+    }
+
+    char* dst = *strings;
+    entry->filename = dst;
+    memcpy(dst, str, filename_size);
+    dst += filename_size;
+    *dst++ = '\0';
+
+    entry->title = dst;
+    *dst = '\0';
+
+    // every field after the songno is optional.
+    if (m3u_line_skip(&line, ','))
+    {
+        dst = m3u_parse_title(&line, dst);
+
+        if (m3u_line_skip(&line, ','))
+        {
+            entry->time = m3u_parse_time(&line);
+        }
+        if (m3u_line_skip(&line, ','))
+        {
+            entry->loop = m3u_parse_time(&line);
+        }
+        if (m3u_line_skip(&line, ','))
         {
-            info->song_tile[j++] = str[i];
+            entry->fade = m3u_parse_time(&line);
+        }
+        if (m3u_line_skip(&line, ','))
+        {
+            const unsigned short loopcount = m3u_parse_time(&line);
+            entry->loopcount = loopcount > 0xFF ? 0xFF : loopcount;
         }
     }
+    else
+    {
+        dst++;
+    }
 
-    // skip over comma
-    offset += 1; if (offset >= size) { goto early_end; }
-
-    // get time if available
-    offset = m3u_get_time(str, size, offset, &info->time);
-
-    // skip over comma
-    offset += 1; if (offset >= size) { goto early_end; }
-
-    // get loop if available
-    offset = m3u_get_time(str, size, offset, &info->loop);
-    // const char* aaa = "Zen-Nippon Shounen Soccer Taikai";
-
-    // skip over comma
-    offset += 1; if (offset >= size) { goto early_end; }
-
-    // get fade if available
-    // offset = m3u_get_time(str, size, offset, &info->fade);
-
-    // skip over comma
-    // offset += 1; if (offset >= size) { goto early_end; }
-
-    // get loopcount
-    info->loopcount = atoi(str + offset);
-
-early_end:
-    #if 0
-    printf("\tfilename: %s\n", info->filename);
-    printf("\tsong_tile: %s\n", info->song_tile);
-    printf("\ttime:\n");
-        printf("\t\th: %u\n", info->time.h);
-        printf("\t\tm: %u\n", info->time.m);
-        printf("\t\ts: %u\n", info->time.s);
-    printf("\tloop:\n");
-        printf("\t\th: %u\n", info->loop.h);
-        printf("\t\tm: %u\n", info->loop.m);
-        printf("\t\ts: %u\n", info->loop.s);
-    printf("\tfade:\n");
-        printf("\t\th: %u\n", info->fade.h);
-        printf("\t\tm: %u\n", info->fade.m);
-        printf("\t\ts: %u\n", info->fade.s);
-    printf("\tsongno: %u\n", info->songno);
-    printf("\tloopcount: %u\n", info->loopcount);
-    #endif
-    // printf("got: [%.*s] and: [%s]\n", offset - start_offset, str + start_offset, str + offset);
-    // m3u_info_free(info);
+    *strings = dst;
     return true;
+}
 
-fail:
-    m3u_info_free(info);
-    return false;
+void m3u_playlist_init(struct M3uPlaylist* playlist)
+{
+    memset(playlist, 0, sizeof(*playlist));
+}
+
+void m3u_playlist_free(struct M3uPlaylist* playlist)
+{
+    struct M3uBlock* block = playlist->blocks;
+    while (block)
+    {
+        struct M3uBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    memset(playlist, 0, sizeof(*playlist));
 }
 
-void m3u_info_free(struct M3uSongInfo* info)
+size_t m3u_playlist_parse(struct M3uPlaylist* playlist, const char* str, size_t size)
 {
-    if (info->filename)
+    if (!str || !size)
+    {
+        return 0;
+    }
+
+    // sized for the worst case so that a single allocation is enough.
+    // strings from a line always fit in the line, so size bytes are enough for them.
+    const size_t max_entries = (size + 1) / M3U_MIN_ENTRY_SIZE + 1;
+    const size_t header_size = (sizeof(struct M3uBlock) + sizeof(struct M3uEntry) - 1) / sizeof(struct M3uEntry) * sizeof(struct M3uEntry);
+    struct M3uBlock* block = malloc(header_size + max_entries * sizeof(struct M3uEntry) + size + 1);
+    if (!block)
+    {
+        return 0;
+    }
+
+    struct M3uEntry* entries = (struct M3uEntry*)((char*)block + header_size);
+    char* strings = (char*)(entries + max_entries);
+    size_t count = 0;
+
+    for (size_t offset = 0; offset < size && count < max_entries;)
     {
-        free(info->filename);
+        size_t end = offset;
+        while (end < size && str[end] != '\n' && str[end] != '\r' && str[end] != '\0')
+        {
+            end++;
+        }
+
+        // skip empty lines and comments.
+        if (end > offset && str[offset] != '#')
+        {
+            struct M3uEntry* entry = &entries[count];
+            if (m3u_parse_line(str + offset, end - offset, entry, &strings))
+            {
+                if (!playlist->songs[entry->songno])
+                {
+                    playlist->songs[entry->songno] = entry;
+                    playlist->count++;
+                }
+                count++;
+            }
+        }
+
+        offset = end + 1;
     }
-    if (info->song_tile)
+
+    if (!count)
     {
-        free(info->song_tile);
+        free(block);
+        return 0;
     }
-    memset(info, 0, sizeof(*info));
+
+    block->next = playlist->blocks;
+    playlist->blocks = block;
+    return count;
 }
@@ -8,20 +8,46 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 
-struct M3uSongInfo
+struct M3uEntry
 {
-    char* filename;
-    char* song_tile;
-    unsigned short time;
+    const char* filename;
+    const char* title;
+    unsigned short time; // seconds, 0 if not set.
     unsigned short loop;
     unsigned short fade;
     unsigned char songno;
     unsigned char loopcount;
 };
 
-bool m3u_info_parse(const char* str, size_t size, struct M3uSongInfo* info);
+/*
+* songs from one or more playlists, indexed by songno.
+* each parsed buffer is a single allocation which holds every entry
+* and string from it, the source buffer isn't referenced after parsing.
+*/
+struct M3uPlaylist
+{
+    // songno -> entry, NULL if there's no entry for that song.
+    const struct M3uEntry* songs[256];
+    // number of songs with an entry.
+    size_t count;
+    struct M3uBlock* blocks;
+};
+
+void m3u_playlist_init(struct M3uPlaylist* playlist);
+void m3u_playlist_free(struct M3uPlaylist* playlist);
 
-void m3u_info_free(struct M3uSongInfo* info);
+/*
+* parses every entry of a NEZplug playlist in one pass.
+* lines can be separated by \n, \r\n or \0, and str doesn't need to be
+* NULL terminated. if a songno appears more than once the first entry is kept.
+* returns the number of entries parsed.
+*/
+size_t m3u_playlist_parse(struct M3uPlaylist* playlist, const char* str, size_t size);
+
+static inline const struct M3uEntry* m3u_playlist_find(const struct M3uPlaylist* playlist, unsigned songno)
+{
+    return songno < 256 ? playlist->songs[songno] : NULL;
+}
 
 #ifdef __cplusplus
 }
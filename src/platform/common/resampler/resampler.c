@@ -0,0 +1,427 @@
+#include "resampler.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define RESAMPLER_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
+#if defined(RESAMPLER_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define RESAMPLER_SSE2 1
+#endif
+
+// avx2 is compiled per function and picked at runtime.
+#if defined(RESAMPLER_X86) && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+    #define RESAMPLER_AVX2 1
+#endif
+
+// taps at 1:1, more are used when downsampling.
+enum { BASE_TAPS = 64 };
+// taps are padded to a multiple of this, the widest kernel.
+enum { TAPS_ALIGN = 8 };
+enum { COEF_ALIGN = 64 };
+enum { MAX_PHASES = 512 };
+// input frames buffered at once, on top of the taps.
+enum { CHUNK_FRAMES = 4096 };
+
+#define KAISER_BETA 8.0
+// passband as a fraction of the lower nyquist.
+#define ROLLOFF 0.95
+
+typedef float (*DotFunc)(const float* coefs, const float* samples, unsigned taps);
+
+struct Resampler
+{
+    unsigned channels;
+    // out_rate / in_rate, reduced.
+    unsigned l;
+    unsigned m;
+
+    unsigned phases;
+    unsigned taps;
+    unsigned half;
+    // phases + 1 rows of taps, then a row for interpolated coefs.
+    void* coefs_alloc;
+    float* coefs;
+    float* lerp;
+
+    float* buffer[RESAMPLER_MAX_CHANNELS];
+    size_t capacity;
+    size_t length;
+    // input position of the next output: index + phase / l.
+    size_t index;
+    unsigned phase;
+
+    uint64_t in_total;
+    uint64_t out_total;
+
+    DotFunc dot;
+    const char* kernel_name;
+};
+
+static float dot_scalar(const float* coefs, const float* samples, unsigned taps)
+{
+    float sum[4] = { 0 };
+
+    for (unsigned i = 0; i < taps; i += 4)
+    {
+        sum[0] += coefs[i + 0] * samples[i + 0];
+        sum[1] += coefs[i + 1] * samples[i + 1];
+        sum[2] += coefs[i + 2] * samples[i + 2];
+        sum[3] += coefs[i + 3] * samples[i + 3];
+    }
+
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+#if defined(RESAMPLER_SSE2)
+static float dot_sse2(const float* coefs, const float* samples, unsigned taps)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    for (unsigned i = 0; i < taps; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(coefs + i), _mm_loadu_ps(samples + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(coefs + i + 4), _mm_loadu_ps(samples + i + 4)));
+    }
+
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+}
+#endif
+
+#if defined(RESAMPLER_AVX2)
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static float dot_avx2(const float* coefs, const float* samples, unsigned taps)
+{
+    __m256 acc = _mm256_setzero_ps();
+
+    for (unsigned i = 0; i < taps; i += 8)
+    {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_load_ps(coefs + i), _mm256_loadu_ps(samples + i)));
+    }
+
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+static bool has_avx2(void)
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    // the os must save the ymm registers.
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b)
+    {
+        const uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified bessel function of the first kind.
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (unsigned k = 1; k < 64; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+        {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+static void make_coefs(Resampler* r, double cutoff)
+{
+    const double PI = 3.14159265358979323846;
+    const double i0_beta = bessel_i0(KAISER_BETA);
+
+    for (unsigned p = 0; p <= r->phases; p++)
+    {
+        float* row = r->coefs + (size_t)p * r->taps;
+        const double frac = (double)p / r->phases;
+        double sum = 0.0;
+
+        for (unsigned k = 0; k < r->taps; k++)
+        {
+            // distance from the output position, tap half - 1 is the sample before it.
+            const double t = (double)k - (r->half - 1) - frac;
+            const double x = t / r->half;
+            double value = 0.0;
+
+            if (x > -1.0 && x < 1.0)
+            {
+                const double window = bessel_i0(KAISER_BETA * sqrt(1.0 - x * x)) / i0_beta;
+                const double sinc = t == 0.0 ? 1.0 : sin(2.0 * PI * cutoff * t) / (2.0 * PI * cutoff * t);
+                value = 2.0 * cutoff * sinc * window;
+            }
+
+            row[k] = (float)value;
+            sum += value;
+        }
+
+        // unity gain at dc for every phase.
+        for (unsigned k = 0; k < r->taps; k++)
+        {
+            row[k] = (float)(row[k] / sum);
+        }
+    }
+}
+
+Resampler* resampler_init(uint32_t in_rate, uint32_t out_rate, unsigned channels)
+{
+    if (!in_rate || !out_rate || !channels || channels > RESAMPLER_MAX_CHANNELS)
+    {
+        return NULL;
+    }
+
+    Resampler* r = calloc(1, sizeof(*r));
+    if (!r)
+    {
+        return NULL;
+    }
+
+    const uint32_t g = gcd(in_rate, out_rate);
+    r->channels = channels;
+    r->l = out_rate / g;
+    r->m = in_rate / g;
+    r->phases = r->l < MAX_PHASES ? r->l : MAX_PHASES;
+
+    // widen the filter when downsampling, so that the cutoff stays as sharp.
+    const double ratio = (double)r->m / r->l;
+    unsigned taps = ratio > 1.0 ? (unsigned)ceil(BASE_TAPS * ratio) : BASE_TAPS;
+    r->taps = (taps + TAPS_ALIGN - 1) / TAPS_ALIGN * TAPS_ALIGN;
+    r->half = r->taps / 2;
+
+    const size_t coefs_size = (size_t)(r->phases + 2) * r->taps * sizeof(float);
+    if (!(r->coefs_alloc = malloc(coefs_size + COEF_ALIGN - 1)))
+    {
+        goto fail;
+    }
+    r->coefs = (float*)(((uintptr_t)r->coefs_alloc + COEF_ALIGN - 1) & ~(uintptr_t)(COEF_ALIGN - 1));
+    r->lerp = r->coefs + (size_t)(r->phases + 1) * r->taps;
+
+    // cutoff in cycles per input sample, below the lower of the two nyquists.
+    const double nyquist = ratio > 1.0 ? 0.5 / ratio : 0.5;
+    make_coefs(r, nyquist * ROLLOFF);
+
+    // the buffers have room past capacity for the silence that resampler_flush() adds.
+    r->capacity = r->taps + CHUNK_FRAMES;
+    for (unsigned c = 0; c < channels; c++)
+    {
+        if (!(r->buffer[c] = calloc(r->capacity + r->half, sizeof(float))))
+        {
+            goto fail;
+        }
+    }
+
+    // silence before the first sample, so the first output is centred on it.
+    r->length = r->half - 1;
+    r->index = r->half - 1;
+
+    r->dot = dot_scalar;
+    r->kernel_name = "scalar";
+#if defined(RESAMPLER_SSE2)
+    r->dot = dot_sse2;
+    r->kernel_name = "sse2";
+#endif
+#if defined(RESAMPLER_AVX2)
+    if (has_avx2())
+    {
+        r->dot = dot_avx2;
+        r->kernel_name = "avx2";
+    }
+#endif
+
+    return r;
+
+fail:
+    resampler_quit(r);
+    return NULL;
+}
+
+void resampler_quit(Resampler* r)
+{
+    if (r)
+    {
+        for (unsigned c = 0; c < RESAMPLER_MAX_CHANNELS; c++)
+        {
+            free(r->buffer[c]);
+        }
+        free(r->coefs_alloc);
+        free(r);
+    }
+}
+
+size_t resampler_get_max_output(const Resampler* r, size_t in_frames)
+{
+    // includes the padding added by resampler_flush().
+    return (size_t)(((uint64_t)(r->length - r->index + r->half + in_frames) * r->l) / r->m) + 1;
+}
+
+static int16_t to_s16(float value)
+{
+    if (value >= 32767.0f)
+    {
+        return 32767;
+    }
+    if (value <= -32768.0f)
+    {
+        return -32768;
+    }
+    return (int16_t)(value >= 0.0f ? value + 0.5f : value - 0.5f);
+}
+
+// coefs for the current phase, interpolated between two rows when the table is smaller than l.
+static const float* get_coefs(Resampler* r)
+{
+    if (r->phases == r->l)
+    {
+        return r->coefs + (size_t)r->phase * r->taps;
+    }
+
+    const uint64_t pos = (uint64_t)r->phase * r->phases;
+    const unsigned row = (unsigned)(pos / r->l);
+    const float t = (float)(pos % r->l) / r->l;
+    const float* a = r->coefs + (size_t)row * r->taps;
+    const float* b = a + r->taps;
+
+    for (unsigned k = 0; k < r->taps; k++)
+    {
+        r->lerp[k] = a[k] + (b[k] - a[k]) * t;
+    }
+
+    return r->lerp;
+}
+
+// outputs every frame that the buffer has enough input for, up to limit.
+static size_t generate(Resampler* r, int16_t* out, uint64_t limit)
+{
+    size_t count = 0;
+
+    while (r->index + r->half < r->length && r->out_total < limit)
+    {
+        const float* coefs = get_coefs(r);
+        const size_t start = r->index - (r->half - 1);
+
+        for (unsigned c = 0; c < r->channels; c++)
+        {
+            out[count * r->channels + c] = to_s16(r->dot(coefs, r->buffer[c] + start, r->taps));
+        }
+
+        r->phase += r->m;
+        r->index += r->phase / r->l;
+        r->phase %= r->l;
+        r->out_total++;
+        count++;
+    }
+
+    return count;
+}
+
+// drops input that no output needs anymore.
+static void compact(Resampler* r)
+{
+    const size_t keep_from = r->index - (r->half - 1);
+    if (!keep_from)
+    {
+        return;
+    }
+
+    const size_t keep = r->length > keep_from ? r->length - keep_from : 0;
+    for (unsigned c = 0; c < r->channels; c++)
+    {
+        memmove(r->buffer[c], r->buffer[c] + keep_from, keep * sizeof(float));
+    }
+
+    r->length = keep;
+    r->index -= keep_from;
+}
+
+size_t resampler_process(Resampler* r, const int16_t* in, size_t in_frames, int16_t* out)
+{
+    size_t count = 0;
+
+    while (in_frames)
+    {
+        compact(r);
+
+        const size_t n = in_frames < r->capacity - r->length ? in_frames : r->capacity - r->length;
+        for (size_t i = 0; i < n; i++)
+        {
+            for (unsigned c = 0; c < r->channels; c++)
+            {
+                r->buffer[c][r->length + i] = in[i * r->channels + c];
+            }
+        }
+
+        r->length += n;
+        r->in_total += n;
+        in += n * r->channels;
+        in_frames -= n;
+
+        count += generate(r, out + count * r->channels, UINT64_MAX);
+    }
+
+    return count;
+}
+
+size_t resampler_flush(Resampler* r, int16_t* out)
+{
+    compact(r);
+
+    // silence after the last sample, enough for the last output's taps.
+    for (unsigned c = 0; c < r->channels; c++)
+    {
+        memset(r->buffer[c] + r->length, 0, r->half * sizeof(float));
+    }
+    r->length += r->half;
+
+    const uint64_t total = (r->in_total * r->l + r->m - 1) / r->m;
+    const size_t count = generate(r, out, total);
+
+    // anything after this starts from silence again.
+    r->length -= r->half;
+    return count;
+}
+
+const char* resampler_get_kernel_name(const Resampler* r)
+{
+    return r->kernel_name;
+}
@@ -0,0 +1,57 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* polyphase windowed-sinc resampler for 16-bit pcm.
+*
+* the ratio is kept as an exact fraction of the two rates, so the output
+* never drifts. when the reduced fraction has more phases than fit in the
+* table, the coefs are interpolated between the two nearest phases.
+*
+* the filter is a kaiser windowed sinc, which is widened when downsampling
+* so that the cutoff is below the output nyquist. the dot products use
+* avx2 or sse2 when the cpu has them, with a scalar fallback.
+*
+* several resamplers can be fed the same input to make several rates
+* from one render.
+*/
+
+enum { RESAMPLER_MAX_CHANNELS = 16 };
+
+typedef struct Resampler Resampler;
+
+Resampler* resampler_init(uint32_t in_rate, uint32_t out_rate, unsigned channels);
+void resampler_quit(Resampler*);
+
+/* max frames that resampler_process() can output for in_frames. */
+size_t resampler_get_max_output(const Resampler*, size_t in_frames);
+
+/*
+* resamples interleaved in_frames into out, which must have room for
+* resampler_get_max_output(in_frames) frames. returns the frames output.
+*/
+size_t resampler_process(Resampler*, const int16_t* in, size_t in_frames, int16_t* out);
+
+/*
+* outputs what is left once the input has ended, so that the total output
+* is in_frames * out_rate / in_rate (rounded up).
+* out must have room for resampler_get_max_output(0) frames.
+*/
+size_t resampler_flush(Resampler*, int16_t* out);
+
+/* name of the kernel in use, "avx2", "sse2" or "scalar". */
+const char* resampler_get_kernel_name(const Resampler*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RESAMPLER_H
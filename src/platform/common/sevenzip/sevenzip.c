@@ -0,0 +1,1582 @@
+#include "sevenzip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* lzma decoder, based on the reference decoder described in the lzma sdk
+* (LzmaSpec.cpp). the output buffer is used as the dictionary, which works
+* because each folder is decoded into a single buffer from the start.
+*/
+
+enum { LZMA_NUM_BIT_MODEL_BITS = 11 };
+enum { LZMA_BIT_MODEL_TOTAL = 1 << LZMA_NUM_BIT_MODEL_BITS };
+enum { LZMA_NUM_MOVE_BITS = 5 };
+enum { LZMA_TOP_VALUE = 1 << 24 };
+
+enum { LZMA_NUM_STATES = 12 };
+enum { LZMA_NUM_POS_BITS_MAX = 4 };
+enum { LZMA_NUM_LEN_TO_POS_STATES = 4 };
+enum { LZMA_NUM_ALIGN_BITS = 4 };
+enum { LZMA_START_POS_MODEL_INDEX = 4 };
+enum { LZMA_END_POS_MODEL_INDEX = 14 };
+enum { LZMA_NUM_FULL_DISTANCES = 1 << (LZMA_END_POS_MODEL_INDEX >> 1) };
+enum { LZMA_MATCH_MIN_LEN = 2 };
+
+// length decoder layout.
+enum { LZMA_LEN_CHOICE = 0 };
+enum { LZMA_LEN_CHOICE2 = 1 };
+enum { LZMA_LEN_LOW = 2 };
+enum { LZMA_LEN_MID = LZMA_LEN_LOW + (LZMA_NUM_POS_BITS_MAX << 4) * 8 };
+enum { LZMA_LEN_HIGH = LZMA_LEN_MID + (LZMA_NUM_POS_BITS_MAX << 4) * 8 };
+enum { LZMA_LEN_SIZE = LZMA_LEN_HIGH + 256 };
+
+// probability model layout.
+enum { LZMA_IS_MATCH = 0 };
+enum { LZMA_IS_REP = LZMA_IS_MATCH + (LZMA_NUM_STATES << LZMA_NUM_POS_BITS_MAX) };
+enum { LZMA_IS_REP_G0 = LZMA_IS_REP + LZMA_NUM_STATES };
+enum { LZMA_IS_REP_G1 = LZMA_IS_REP_G0 + LZMA_NUM_STATES };
+enum { LZMA_IS_REP_G2 = LZMA_IS_REP_G1 + LZMA_NUM_STATES };
+enum { LZMA_IS_REP0_LONG = LZMA_IS_REP_G2 + LZMA_NUM_STATES };
+enum { LZMA_POS_SLOT = LZMA_IS_REP0_LONG + (LZMA_NUM_STATES << LZMA_NUM_POS_BITS_MAX) };
+enum { LZMA_SPEC_POS = LZMA_POS_SLOT + (LZMA_NUM_LEN_TO_POS_STATES << 6) };
+enum { LZMA_ALIGN = LZMA_SPEC_POS + LZMA_NUM_FULL_DISTANCES - LZMA_END_POS_MODEL_INDEX };
+enum { LZMA_LEN_CODER = LZMA_ALIGN + (1 << LZMA_NUM_ALIGN_BITS) };
+enum { LZMA_REP_LEN_CODER = LZMA_LEN_CODER + LZMA_LEN_SIZE };
+enum { LZMA_LITERAL = LZMA_REP_LEN_CODER + LZMA_LEN_SIZE };
+
+struct LzmaDec
+{
+    const uint8_t* in;
+    size_t in_size;
+    size_t in_pos;
+
+    uint32_t range;
+    uint32_t code;
+
+    unsigned lc, lp, pb;
+    uint16_t* probs;
+    size_t probs_count;
+
+    unsigned state;
+    uint32_t reps[4];
+    // bytes of the current match that didn't fit before the output limit.
+    unsigned remain;
+
+    bool finished;
+    bool error;
+};
+
+static uint8_t lzma_in_byte(struct LzmaDec* d)
+{
+    if (d->in_pos >= d->in_size)
+    {
+        d->error = true;
+        return 0;
+    }
+
+    return d->in[d->in_pos++];
+}
+
+static bool lzma_rc_init(struct LzmaDec* d)
+{
+    d->range = 0xFFFFFFFF;
+    d->code = 0;
+
+    if (lzma_in_byte(d) != 0)
+    {
+        return false;
+    }
+
+    for (unsigned i = 0; i < 4; i++)
+    {
+        d->code = (d->code << 8) | lzma_in_byte(d);
+    }
+
+    return !d->error && d->code != d->range;
+}
+
+static void lzma_rc_normalize(struct LzmaDec* d)
+{
+    if (d->range < LZMA_TOP_VALUE)
+    {
+        d->range <<= 8;
+        d->code = (d->code << 8) | lzma_in_byte(d);
+    }
+}
+
+static unsigned lzma_decode_bit(struct LzmaDec* d, uint16_t* prob)
+{
+    const uint32_t bound = (d->range >> LZMA_NUM_BIT_MODEL_BITS) * *prob;
+    unsigned bit;
+
+    if (d->code < bound)
+    {
+        *prob += (LZMA_BIT_MODEL_TOTAL - *prob) >> LZMA_NUM_MOVE_BITS;
+        d->range = bound;
+        bit = 0;
+    }
+    else
+    {
+        *prob -= *prob >> LZMA_NUM_MOVE_BITS;
+        d->code -= bound;
+        d->range -= bound;
+        bit = 1;
+    }
+
+    lzma_rc_normalize(d);
+    return bit;
+}
+
+static uint32_t lzma_decode_direct_bits(struct LzmaDec* d, unsigned num_bits)
+{
+    uint32_t res = 0;
+
+    do
+    {
+        d->range >>= 1;
+        d->code -= d->range;
+        const uint32_t t = 0 - (d->code >> 31);
+        d->code += d->range & t;
+        res = (res << 1) + (t + 1);
+        lzma_rc_normalize(d);
+    } while (--num_bits);
+
+    return res;
+}
+
+static unsigned lzma_bit_tree_decode(struct LzmaDec* d, uint16_t* probs, unsigned num_bits)
+{
+    unsigned m = 1;
+
+    for (unsigned i = 0; i < num_bits; i++)
+    {
+        m = (m << 1) + lzma_decode_bit(d, &probs[m]);
+    }
+
+    return m - (1U << num_bits);
+}
+
+static unsigned lzma_bit_tree_reverse_decode(struct LzmaDec* d, uint16_t* probs, unsigned num_bits)
+{
+    unsigned m = 1;
+    unsigned symbol = 0;
+
+    for (unsigned i = 0; i < num_bits; i++)
+    {
+        const unsigned bit = lzma_decode_bit(d, &probs[m]);
+        m = (m << 1) + bit;
+        symbol |= bit << i;
+    }
+
+    return symbol;
+}
+
+static unsigned lzma_decode_len(struct LzmaDec* d, uint16_t* probs, unsigned pos_state)
+{
+    if (!lzma_decode_bit(d, &probs[LZMA_LEN_CHOICE]))
+    {
+        return lzma_bit_tree_decode(d, &probs[LZMA_LEN_LOW + (pos_state << 3)], 3);
+    }
+
+    if (!lzma_decode_bit(d, &probs[LZMA_LEN_CHOICE2]))
+    {
+        return 8 + lzma_bit_tree_decode(d, &probs[LZMA_LEN_MID + (pos_state << 3)], 3);
+    }
+
+    return 16 + lzma_bit_tree_decode(d, &probs[LZMA_LEN_HIGH], 8);
+}
+
+static uint32_t lzma_decode_distance(struct LzmaDec* d, unsigned len)
+{
+    const unsigned len_state = len > LZMA_NUM_LEN_TO_POS_STATES - 1 ? LZMA_NUM_LEN_TO_POS_STATES - 1 : len;
+    const unsigned pos_slot = lzma_bit_tree_decode(d, &d->probs[LZMA_POS_SLOT + (len_state << 6)], 6);
+
+    if (pos_slot < LZMA_START_POS_MODEL_INDEX)
+    {
+        return pos_slot;
+    }
+
+    const unsigned num_direct_bits = (pos_slot >> 1) - 1;
+    uint32_t dist = (2 | (pos_slot & 1)) << num_direct_bits;
+
+    if (pos_slot < LZMA_END_POS_MODEL_INDEX)
+    {
+        dist += lzma_bit_tree_reverse_decode(d, &d->probs[LZMA_SPEC_POS + dist - pos_slot], num_direct_bits);
+    }
+    else
+    {
+        dist += lzma_decode_direct_bits(d, num_direct_bits - LZMA_NUM_ALIGN_BITS) << LZMA_NUM_ALIGN_BITS;
+        dist += lzma_bit_tree_reverse_decode(d, &d->probs[LZMA_ALIGN], LZMA_NUM_ALIGN_BITS);
+    }
+
+    return dist;
+}
+
+static bool lzma_set_props(struct LzmaDec* d, unsigned lc, unsigned lp, unsigned pb)
+{
+    if (lc > 8 || lp > 4 || pb > 4)
+    {
+        return false;
+    }
+
+    const size_t count = LZMA_LITERAL + ((size_t)0x300 << (lc + lp));
+    if (count > d->probs_count)
+    {
+        uint16_t* probs = realloc(d->probs, count * sizeof(*probs));
+        if (!probs)
+        {
+            return false;
+        }
+        d->probs = probs;
+        d->probs_count = count;
+    }
+
+    d->lc = lc;
+    d->lp = lp;
+    d->pb = pb;
+    return true;
+}
+
+static void lzma_reset_state(struct LzmaDec* d)
+{
+    const size_t count = LZMA_LITERAL + ((size_t)0x300 << (d->lc + d->lp));
+    for (size_t i = 0; i < count; i++)
+    {
+        d->probs[i] = LZMA_BIT_MODEL_TOTAL >> 1;
+    }
+
+    d->state = 0;
+    d->reps[0] = d->reps[1] = d->reps[2] = d->reps[3] = 0;
+    d->remain = 0;
+}
+
+static void lzma_copy_match(struct LzmaDec* d, uint8_t* out, size_t* out_pos, size_t limit)
+{
+    size_t pos = *out_pos;
+    const size_t src = pos - d->reps[0] - 1;
+
+    // byte by byte as the match may overlap itself.
+    size_t i = 0;
+    while (d->remain && pos < limit)
+    {
+        out[pos++] = out[src + i++];
+        d->remain--;
+    }
+
+    *out_pos = pos;
+}
+
+// decodes until out_pos reaches limit, the end marker or an error.
+static void lzma_decode(struct LzmaDec* d, uint8_t* out, size_t* out_pos, size_t limit)
+{
+    const unsigned pb_mask = (1U << d->pb) - 1;
+    const unsigned lp_mask = (1U << d->lp) - 1;
+
+    if (d->remain)
+    {
+        lzma_copy_match(d, out, out_pos, limit);
+    }
+
+    while (*out_pos < limit && !d->finished && !d->error)
+    {
+        const size_t pos = *out_pos;
+        const unsigned pos_state = pos & pb_mask;
+        const unsigned state2 = (d->state << LZMA_NUM_POS_BITS_MAX) + pos_state;
+
+        if (!lzma_decode_bit(d, &d->probs[LZMA_IS_MATCH + state2]))
+        {
+            const unsigned prev_byte = pos ? out[pos - 1] : 0;
+            const unsigned lit_state = ((pos & lp_mask) << d->lc) + (prev_byte >> (8 - d->lc));
+            uint16_t* probs = &d->probs[LZMA_LITERAL + 0x300 * lit_state];
+            unsigned symbol = 1;
+
+            if (d->state >= 7)
+            {
+                if (d->reps[0] >= pos)
+                {
+                    d->error = true;
+                    break;
+                }
+
+                unsigned match_byte = out[pos - d->reps[0] - 1];
+                do
+                {
+                    const unsigned match_bit = (match_byte >> 7) & 1;
+                    match_byte <<= 1;
+                    const unsigned bit = lzma_decode_bit(d, &probs[((1 + match_bit) << 8) + symbol]);
+                    symbol = (symbol << 1) | bit;
+                    if (match_bit != bit)
+                    {
+                        break;
+                    }
+                } while (symbol < 0x100);
+            }
+
+            while (symbol < 0x100)
+            {
+                symbol = (symbol << 1) | lzma_decode_bit(d, &probs[symbol]);
+            }
+
+            out[(*out_pos)++] = symbol - 0x100;
+            d->state = d->state < 4 ? 0 : d->state < 10 ? d->state - 3 : d->state - 6;
+            continue;
+        }
+
+        unsigned len;
+
+        if (lzma_decode_bit(d, &d->probs[LZMA_IS_REP + d->state]))
+        {
+            if (!pos)
+            {
+                d->error = true;
+                break;
+            }
+
+            if (!lzma_decode_bit(d, &d->probs[LZMA_IS_REP_G0 + d->state]))
+            {
+                // short rep, a single byte at rep0.
+                if (!lzma_decode_bit(d, &d->probs[LZMA_IS_REP0_LONG + state2]))
+                {
+                    if (d->reps[0] >= pos)
+                    {
+                        d->error = true;
+                        break;
+                    }
+                    d->state = d->state < 7 ? 9 : 11;
+                    out[pos] = out[pos - d->reps[0] - 1];
+                    (*out_pos)++;
+                    continue;
+                }
+            }
+            else
+            {
+                uint32_t dist;
+                if (!lzma_decode_bit(d, &d->probs[LZMA_IS_REP_G1 + d->state]))
+                {
+                    dist = d->reps[1];
+                }
+                else
+                {
+                    if (!lzma_decode_bit(d, &d->probs[LZMA_IS_REP_G2 + d->state]))
+                    {
+                        dist = d->reps[2];
+                    }
+                    else
+                    {
+                        dist = d->reps[3];
+                        d->reps[3] = d->reps[2];
+                    }
+                    d->reps[2] = d->reps[1];
+                }
+                d->reps[1] = d->reps[0];
+                d->reps[0] = dist;
+            }
+
+            len = lzma_decode_len(d, &d->probs[LZMA_REP_LEN_CODER], pos_state);
+            d->state = d->state < 7 ? 8 : 11;
+        }
+        else
+        {
+            d->reps[3] = d->reps[2];
+            d->reps[2] = d->reps[1];
+            d->reps[1] = d->reps[0];
+            len = lzma_decode_len(d, &d->probs[LZMA_LEN_CODER], pos_state);
+            d->state = d->state < 7 ? 7 : 10;
+            d->reps[0] = lzma_decode_distance(d, len);
+
+            if (d->reps[0] == 0xFFFFFFFF)
+            {
+                d->finished = true;
+                break;
+            }
+        }
+
+        if (d->reps[0] >= pos)
+        {
+            d->error = true;
+            break;
+        }
+
+        d->remain = len + LZMA_MATCH_MIN_LEN;
+        lzma_copy_match(d, out, out_pos, limit);
+    }
+}
+
+/*
+* 7z container.
+*/
+
+static const uint8_t SEVENZIP_SIGNATURE[6] = { '7', 'z', 0xBC, 0xAF, 0x27, 0x1C };
+enum { SEVENZIP_SIGNATURE_HEADER_SIZE = 32 };
+
+enum SevenZipId
+{
+    SevenZipId_End = 0x00,
+    SevenZipId_Header = 0x01,
+    SevenZipId_ArchiveProperties = 0x02,
+    SevenZipId_AdditionalStreamsInfo = 0x03,
+    SevenZipId_MainStreamsInfo = 0x04,
+    SevenZipId_FilesInfo = 0x05,
+    SevenZipId_PackInfo = 0x06,
+    SevenZipId_UnpackInfo = 0x07,
+    SevenZipId_SubStreamsInfo = 0x08,
+    SevenZipId_Size = 0x09,
+    SevenZipId_CRC = 0x0A,
+    SevenZipId_Folder = 0x0B,
+    SevenZipId_CodersUnpackSize = 0x0C,
+    SevenZipId_NumUnpackStream = 0x0D,
+    SevenZipId_EmptyStream = 0x0E,
+    SevenZipId_EmptyFile = 0x0F,
+    SevenZipId_Name = 0x11,
+    SevenZipId_EncodedHeader = 0x17,
+};
+
+enum SevenZipCoder
+{
+    SevenZipCoder_UNSUPPORTED,
+    SevenZipCoder_COPY,
+    SevenZipCoder_LZMA,
+    SevenZipCoder_LZMA2,
+};
+
+struct SevenZipFolder
+{
+    enum SevenZipCoder coder;
+    uint8_t props[5];
+    size_t props_size;
+    uint64_t pack_offset; // absolute file offset.
+    uint64_t pack_size;
+    uint64_t unpack_size;
+    bool crc_defined;
+    size_t num_substreams;
+
+    // decode state, the output is shared by every entry in the folder.
+    uint8_t* packed;
+    uint8_t* data;
+    size_t decoded;
+    bool failed;
+    struct LzmaDec lzma;
+    // lzma2 chunk state.
+    size_t chunk_left;
+    bool chunk_is_lzma;
+    size_t chunk_end;
+    bool need_props;
+};
+
+struct StreamsInfo
+{
+    struct SevenZipFolder* folders;
+    size_t folder_count;
+    // only needed while parsing.
+    uint64_t* substream_sizes;
+    size_t substream_count;
+};
+
+struct SevenZip
+{
+    FILE* file;
+    struct StreamsInfo si;
+    struct SevenZipEntry* entries;
+    size_t entry_count;
+    char* names;
+};
+
+struct Reader
+{
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    bool error;
+};
+
+static uint8_t read_byte(struct Reader* r)
+{
+    if (r->pos >= r->size)
+    {
+        r->error = true;
+        return 0;
+    }
+
+    return r->data[r->pos++];
+}
+
+static uint64_t read_number(struct Reader* r)
+{
+    const uint8_t first = read_byte(r);
+    uint8_t mask = 0x80;
+    uint64_t value = 0;
+
+    for (unsigned i = 0; i < 8; i++)
+    {
+        if (!(first & mask))
+        {
+            const uint64_t high = first & (mask - 1);
+            return value | (high << (8 * i));
+        }
+        value |= (uint64_t)read_byte(r) << (8 * i);
+        mask >>= 1;
+    }
+
+    return value;
+}
+
+static uint32_t read_u32(struct Reader* r)
+{
+    uint32_t value = 0;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        value |= (uint32_t)read_byte(r) << (8 * i);
+    }
+    return value;
+}
+
+static void skip_bytes(struct Reader* r, uint64_t size)
+{
+    if (size > r->size - r->pos)
+    {
+        r->error = true;
+        r->pos = r->size;
+    }
+    else
+    {
+        r->pos += size;
+    }
+}
+
+// reads a msb first bit vector, out may be NULL.
+static size_t read_bits(struct Reader* r, size_t count, bool* out)
+{
+    size_t set = 0;
+    uint8_t byte = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!(i & 7))
+        {
+            byte = read_byte(r);
+        }
+        const bool bit = byte & (0x80 >> (i & 7));
+        set += bit;
+        if (out)
+        {
+            out[i] = bit;
+        }
+    }
+
+    return set;
+}
+
+static void read_digests(struct Reader* r, size_t count, bool* defined)
+{
+    const bool all_defined = read_byte(r);
+    size_t defined_count = count;
+
+    if (!all_defined)
+    {
+        defined_count = read_bits(r, count, defined);
+    }
+    else if (defined)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            defined[i] = true;
+        }
+    }
+
+    skip_bytes(r, defined_count * 4);
+}
+
+static void streams_info_free(struct StreamsInfo* si)
+{
+    if (si->folders)
+    {
+        for (size_t i = 0; i < si->folder_count; i++)
+        {
+            free(si->folders[i].packed);
+            free(si->folders[i].data);
+            free(si->folders[i].lzma.probs);
+        }
+        free(si->folders);
+    }
+
+    free(si->substream_sizes);
+    memset(si, 0, sizeof(*si));
+}
+
+static bool read_pack_info(struct Reader* r, uint64_t** sizes, size_t* count, uint64_t* pack_pos)
+{
+    *pack_pos = read_number(r);
+    *count = read_number(r);
+    if (r->error || *count > r->size)
+    {
+        return false;
+    }
+
+    *sizes = calloc(*count ? *count : 1, sizeof(**sizes));
+    if (!*sizes)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        const uint64_t id = read_number(r);
+        if (r->error)
+        {
+            return false;
+        }
+        else if (id == SevenZipId_End)
+        {
+            return true;
+        }
+        else if (id == SevenZipId_Size)
+        {
+            for (size_t i = 0; i < *count; i++)
+            {
+                (*sizes)[i] = read_number(r);
+            }
+        }
+        else if (id == SevenZipId_CRC)
+        {
+            read_digests(r, *count, NULL);
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+static bool read_folder(struct Reader* r, struct SevenZipFolder* f, size_t* num_out_streams, size_t* num_packed)
+{
+    const uint64_t num_coders = read_number(r);
+    size_t total_in = 0;
+    size_t total_out = 0;
+
+    if (!num_coders || num_coders > 64)
+    {
+        return false;
+    }
+
+    f->coder = SevenZipCoder_UNSUPPORTED;
+
+    for (uint64_t i = 0; i < num_coders; i++)
+    {
+        const uint8_t flags = read_byte(r);
+        const unsigned id_size = flags & 0xF;
+        uint32_t id = 0;
+
+        if (flags & 0x80)
+        {
+            // alternative methods are not used by any known encoder.
+            return false;
+        }
+
+        for (unsigned j = 0; j < id_size; j++)
+        {
+            id = (id << 8) | read_byte(r);
+        }
+
+        size_t in = 1;
+        size_t out = 1;
+        if (flags & 0x10)
+        {
+            in = read_number(r);
+            out = read_number(r);
+        }
+        total_in += in;
+        total_out += out;
+
+        size_t props_size = 0;
+        const uint8_t* props = NULL;
+        if (flags & 0x20)
+        {
+            props_size = read_number(r);
+            props = r->data + r->pos;
+            skip_bytes(r, props_size);
+        }
+
+        if (num_coders == 1 && in == 1 && out == 1 && !r->error)
+        {
+            if (id == 0x00)
+            {
+                f->coder = SevenZipCoder_COPY;
+            }
+            else if (id == 0x030101 && props_size == 5)
+            {
+                f->coder = SevenZipCoder_LZMA;
+            }
+            else if (id == 0x21 && props_size == 1)
+            {
+                f->coder = SevenZipCoder_LZMA2;
+            }
+
+            if (props && props_size <= sizeof(f->props))
+            {
+                memcpy(f->props, props, props_size);
+                f->props_size = props_size;
+            }
+        }
+    }
+
+    if (!total_out || r->error)
+    {
+        return false;
+    }
+
+    // bind pairs.
+    for (size_t i = 0; i < total_out - 1; i++)
+    {
+        read_number(r);
+        read_number(r);
+    }
+
+    if (total_in < total_out - 1)
+    {
+        return false;
+    }
+
+    *num_packed = total_in - (total_out - 1);
+    if (*num_packed > 1)
+    {
+        for (size_t i = 0; i < *num_packed; i++)
+        {
+            read_number(r);
+        }
+    }
+
+    *num_out_streams = total_out;
+    return !r->error;
+}
+
+static bool read_unpack_info(struct Reader* r, struct StreamsInfo* si, size_t** packed_per_folder)
+{
+    if (read_number(r) != SevenZipId_Folder)
+    {
+        return false;
+    }
+
+    si->folder_count = read_number(r);
+    if (r->error || si->folder_count > r->size || read_byte(r) != 0)
+    {
+        return false;
+    }
+
+    const size_t count = si->folder_count ? si->folder_count : 1;
+    si->folders = calloc(count, sizeof(*si->folders));
+    size_t* out_streams = calloc(count, sizeof(*out_streams));
+    *packed_per_folder = calloc(count, sizeof(**packed_per_folder));
+    if (!si->folders || !out_streams || !*packed_per_folder)
+    {
+        free(out_streams);
+        return false;
+    }
+
+    bool result = true;
+    for (size_t i = 0; i < si->folder_count && result; i++)
+    {
+        si->folders[i].num_substreams = 1;
+        result = read_folder(r, &si->folders[i], &out_streams[i], &(*packed_per_folder)[i]);
+    }
+
+    if (result && read_number(r) != SevenZipId_CodersUnpackSize)
+    {
+        result = false;
+    }
+
+    // the folder output is the last unpack size, as only single coders are decoded.
+    for (size_t i = 0; i < si->folder_count && result; i++)
+    {
+        for (size_t j = 0; j < out_streams[i]; j++)
+        {
+            si->folders[i].unpack_size = read_number(r);
+        }
+    }
+
+    free(out_streams);
+
+    while (result)
+    {
+        const uint64_t id = read_number(r);
+        if (r->error)
+        {
+            result = false;
+        }
+        else if (id == SevenZipId_End)
+        {
+            break;
+        }
+        else if (id == SevenZipId_CRC)
+        {
+            bool* defined = calloc(count, sizeof(*defined));
+            if (!defined)
+            {
+                return false;
+            }
+            read_digests(r, si->folder_count, defined);
+            for (size_t i = 0; i < si->folder_count; i++)
+            {
+                si->folders[i].crc_defined = defined[i];
+            }
+            free(defined);
+        }
+        else
+        {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+static bool read_substreams_info(struct Reader* r, struct StreamsInfo* si)
+{
+    uint64_t id = read_number(r);
+
+    if (id == SevenZipId_NumUnpackStream)
+    {
+        for (size_t i = 0; i < si->folder_count; i++)
+        {
+            si->folders[i].num_substreams = read_number(r);
+        }
+        id = read_number(r);
+    }
+
+    si->substream_count = 0;
+    for (size_t i = 0; i < si->folder_count; i++)
+    {
+        si->substream_count += si->folders[i].num_substreams;
+        if (si->substream_count > r->size * 8 + si->folder_count)
+        {
+            return false;
+        }
+    }
+
+    si->substream_sizes = calloc(si->substream_count ? si->substream_count : 1, sizeof(*si->substream_sizes));
+    if (!si->substream_sizes || r->error)
+    {
+        return false;
+    }
+
+    // every size is stored apart from the last of each folder, which is the remainder.
+    size_t idx = 0;
+    for (size_t i = 0; i < si->folder_count; i++)
+    {
+        const struct SevenZipFolder* f = &si->folders[i];
+        uint64_t sum = 0;
+
+        if (!f->num_substreams)
+        {
+            continue;
+        }
+
+        if (id == SevenZipId_Size)
+        {
+            for (size_t j = 1; j < f->num_substreams; j++)
+            {
+                const uint64_t size = read_number(r);
+                si->substream_sizes[idx++] = size;
+                sum += size;
+            }
+        }
+
+        if (sum > f->unpack_size)
+        {
+            return false;
+        }
+        si->substream_sizes[idx++] = f->unpack_size - sum;
+    }
+
+    if (id == SevenZipId_Size)
+    {
+        id = read_number(r);
+    }
+
+    while (!r->error && id != SevenZipId_End)
+    {
+        if (id == SevenZipId_CRC)
+        {
+            size_t digests = 0;
+            for (size_t i = 0; i < si->folder_count; i++)
+            {
+                const struct SevenZipFolder* f = &si->folders[i];
+                if (f->num_substreams != 1 || !f->crc_defined)
+                {
+                    digests += f->num_substreams;
+                }
+            }
+            read_digests(r, digests, NULL);
+        }
+        else
+        {
+            return false;
+        }
+        id = read_number(r);
+    }
+
+    return !r->error;
+}
+
+static bool read_streams_info(struct Reader* r, struct StreamsInfo* si)
+{
+    uint64_t* pack_sizes = NULL;
+    size_t pack_count = 0;
+    uint64_t pack_pos = 0;
+    size_t* packed_per_folder = NULL;
+    bool result = true;
+    bool has_substreams = false;
+
+    while (result)
+    {
+        const uint64_t id = read_number(r);
+        if (r->error)
+        {
+            result = false;
+        }
+        else if (id == SevenZipId_End)
+        {
+            break;
+        }
+        else if (id == SevenZipId_PackInfo && !pack_sizes)
+        {
+            result = read_pack_info(r, &pack_sizes, &pack_count, &pack_pos);
+        }
+        else if (id == SevenZipId_UnpackInfo && !si->folders)
+        {
+            result = read_unpack_info(r, si, &packed_per_folder);
+        }
+        else if (id == SevenZipId_SubStreamsInfo && si->folders)
+        {
+            has_substreams = true;
+            result = read_substreams_info(r, si);
+        }
+        else
+        {
+            result = false;
+        }
+    }
+
+    if (result && si->folders && !has_substreams)
+    {
+        struct Reader empty = { .data = (const uint8_t*)"", .size = 1 };
+        result = read_substreams_info(&empty, si);
+    }
+
+    // assign pack streams to folders, they are stored back to back.
+    uint64_t offset = SEVENZIP_SIGNATURE_HEADER_SIZE + pack_pos;
+    size_t pack_index = 0;
+    for (size_t i = 0; i < si->folder_count && result; i++)
+    {
+        struct SevenZipFolder* f = &si->folders[i];
+        if (pack_index + packed_per_folder[i] > pack_count)
+        {
+            result = false;
+            break;
+        }
+
+        f->pack_offset = offset;
+        f->pack_size = pack_sizes[pack_index];
+        for (size_t j = 0; j < packed_per_folder[i]; j++)
+        {
+            offset += pack_sizes[pack_index++];
+        }
+    }
+
+    free(pack_sizes);
+    free(packed_per_folder);
+    return result;
+}
+
+static bool folder_load_packed(SevenZip* sz, struct SevenZipFolder* f)
+{
+    if (f->packed)
+    {
+        return true;
+    }
+
+    if (f->pack_size > SIZE_MAX - 1 || !(f->packed = malloc(f->pack_size + 1)))
+    {
+        return false;
+    }
+
+    if (fseek(sz->file, (long)f->pack_offset, SEEK_SET) || fread(f->packed, 1, f->pack_size, sz->file) != f->pack_size)
+    {
+        free(f->packed);
+        f->packed = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static bool folder_decode_lzma2(struct SevenZipFolder* f, size_t limit)
+{
+    struct LzmaDec* d = &f->lzma;
+
+    while (f->decoded < limit)
+    {
+        if (!f->chunk_left)
+        {
+            d->in_pos = f->chunk_end;
+            const uint8_t control = lzma_in_byte(d);
+
+            if (d->error || control == 0x00)
+            {
+                return false;
+            }
+
+            if (control == 0x01 || control == 0x02)
+            {
+                f->chunk_left = ((size_t)lzma_in_byte(d) << 8) + lzma_in_byte(d) + 1;
+                f->chunk_is_lzma = false;
+                f->chunk_end = d->in_pos + f->chunk_left;
+            }
+            else if (control >= 0x80)
+            {
+                f->chunk_left = ((size_t)(control & 0x1F) << 16) + ((size_t)lzma_in_byte(d) << 8) + lzma_in_byte(d) + 1;
+                const size_t packed = ((size_t)lzma_in_byte(d) << 8) + lzma_in_byte(d) + 1;
+                const unsigned reset = (control >> 5) & 0x3;
+
+                if (reset >= 2)
+                {
+                    unsigned props = lzma_in_byte(d);
+                    if (props >= 9 * 5 * 5)
+                    {
+                        return false;
+                    }
+                    const unsigned lc = props % 9; props /= 9;
+                    const unsigned lp = props % 5;
+                    const unsigned pb = props / 5;
+                    if (lc + lp > 4 || !lzma_set_props(d, lc, lp, pb))
+                    {
+                        return false;
+                    }
+                    f->need_props = false;
+                }
+
+                if (f->need_props)
+                {
+                    return false;
+                }
+
+                if (reset >= 1)
+                {
+                    lzma_reset_state(d);
+                }
+
+                f->chunk_is_lzma = true;
+                f->chunk_end = d->in_pos + packed;
+                d->finished = false;
+                if (!lzma_rc_init(d))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+
+            if (d->error || f->chunk_end > d->in_size)
+            {
+                return false;
+            }
+        }
+
+        size_t end = f->decoded + f->chunk_left;
+        if (end > limit)
+        {
+            end = limit;
+        }
+
+        const size_t start = f->decoded;
+        if (f->chunk_is_lzma)
+        {
+            lzma_decode(d, f->data, &f->decoded, end);
+            if (d->error || (d->finished && f->decoded != end))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            memcpy(f->data + f->decoded, d->in + d->in_pos, end - start);
+            d->in_pos += end - start;
+            f->decoded = end;
+        }
+
+        f->chunk_left -= f->decoded - start;
+    }
+
+    return true;
+}
+
+// decodes the folder until at least limit bytes are available.
+static bool folder_decode(SevenZip* sz, struct SevenZipFolder* f, size_t limit)
+{
+    if (f->decoded >= limit)
+    {
+        return true;
+    }
+
+    if (f->failed || f->coder == SevenZipCoder_UNSUPPORTED || limit > f->unpack_size)
+    {
+        return false;
+    }
+
+    if (!f->data)
+    {
+        if (f->unpack_size > SIZE_MAX - 1 || !folder_load_packed(sz, f))
+        {
+            goto fail;
+        }
+
+        // padded so that text entries can be safely read one past the end.
+        if (!(f->data = calloc(1, f->unpack_size + 1)))
+        {
+            goto fail;
+        }
+
+        struct LzmaDec* d = &f->lzma;
+        d->in = f->packed;
+        d->in_size = f->pack_size;
+
+        if (f->coder == SevenZipCoder_LZMA)
+        {
+            unsigned props = f->props[0];
+            if (props >= 9 * 5 * 5)
+            {
+                goto fail;
+            }
+            const unsigned lc = props % 9; props /= 9;
+            const unsigned lp = props % 5;
+            const unsigned pb = props / 5;
+            if (!lzma_set_props(d, lc, lp, pb) || !lzma_rc_init(d))
+            {
+                goto fail;
+            }
+            lzma_reset_state(d);
+        }
+        else if (f->coder == SevenZipCoder_LZMA2)
+        {
+            f->need_props = true;
+        }
+    }
+
+    switch (f->coder)
+    {
+        case SevenZipCoder_COPY:
+            if (limit > f->pack_size)
+            {
+                goto fail;
+            }
+            memcpy(f->data + f->decoded, f->packed + f->decoded, limit - f->decoded);
+            f->decoded = limit;
+            break;
+
+        case SevenZipCoder_LZMA:
+            lzma_decode(&f->lzma, f->data, &f->decoded, limit);
+            if (f->lzma.error || f->decoded < limit)
+            {
+                goto fail;
+            }
+            break;
+
+        case SevenZipCoder_LZMA2:
+            if (!folder_decode_lzma2(f, limit))
+            {
+                goto fail;
+            }
+            break;
+
+        case SevenZipCoder_UNSUPPORTED:
+            goto fail;
+    }
+
+    // the packed data is no longer needed once everything is decoded.
+    if (f->decoded == f->unpack_size)
+    {
+        free(f->packed);
+        f->packed = NULL;
+        f->lzma.in = NULL;
+        free(f->lzma.probs);
+        f->lzma.probs = NULL;
+        f->lzma.probs_count = 0;
+    }
+
+    return true;
+
+fail:
+    f->failed = true;
+    return false;
+}
+
+// converts utf16le to utf8, returns the number of bytes written (excluding NULL).
+static size_t utf16_to_utf8(const uint8_t* src, size_t units, char* dst)
+{
+    size_t out = 0;
+
+    for (size_t i = 0; i < units; i++)
+    {
+        uint32_t c = src[i * 2] | (src[i * 2 + 1] << 8);
+
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < units)
+        {
+            const uint32_t lo = src[(i + 1) * 2] | (src[(i + 1) * 2 + 1] << 8);
+            if (lo >= 0xDC00 && lo <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                i++;
+            }
+        }
+
+        if (c < 0x80)
+        {
+            dst[out++] = c;
+        }
+        else if (c < 0x800)
+        {
+            dst[out++] = 0xC0 | (c >> 6);
+            dst[out++] = 0x80 | (c & 0x3F);
+        }
+        else if (c < 0x10000)
+        {
+            dst[out++] = 0xE0 | (c >> 12);
+            dst[out++] = 0x80 | ((c >> 6) & 0x3F);
+            dst[out++] = 0x80 | (c & 0x3F);
+        }
+        else
+        {
+            dst[out++] = 0xF0 | (c >> 18);
+            dst[out++] = 0x80 | ((c >> 12) & 0x3F);
+            dst[out++] = 0x80 | ((c >> 6) & 0x3F);
+            dst[out++] = 0x80 | (c & 0x3F);
+        }
+    }
+
+    dst[out] = '\0';
+    return out;
+}
+
+static bool read_names(struct Reader* r, SevenZip* sz, uint64_t size)
+{
+    if (read_byte(r) != 0 || !size)
+    {
+        // external names are not supported.
+        return false;
+    }
+
+    const uint8_t* src = r->data + r->pos;
+    const size_t len = size - 1;
+    skip_bytes(r, len);
+    if (r->error)
+    {
+        return false;
+    }
+
+    // worst case, each utf16 unit expands to 3 bytes of utf8.
+    if (!(sz->names = malloc(len / 2 * 3 + sz->entry_count + 1)))
+    {
+        return false;
+    }
+
+    char* dst = sz->names;
+    size_t start = 0;
+    size_t entry = 0;
+    for (size_t i = 0; i + 1 < len && entry < sz->entry_count; i += 2)
+    {
+        if (!src[i] && !src[i + 1])
+        {
+            sz->entries[entry++].name = dst;
+            dst += utf16_to_utf8(src + start, (i - start) / 2, dst) + 1;
+            start = i + 2;
+        }
+    }
+
+    return entry == sz->entry_count;
+}
+
+static bool read_files_info(struct Reader* r, SevenZip* sz)
+{
+    sz->entry_count = read_number(r);
+    if (r->error || sz->entry_count > r->size)
+    {
+        return false;
+    }
+
+    const size_t count = sz->entry_count ? sz->entry_count : 1;
+    sz->entries = calloc(count, sizeof(*sz->entries));
+    bool* empty_stream = calloc(count, sizeof(*empty_stream));
+    if (!sz->entries || !empty_stream)
+    {
+        free(empty_stream);
+        return false;
+    }
+
+    bool result = true;
+    while (result)
+    {
+        const uint64_t type = read_number(r);
+        if (r->error)
+        {
+            result = false;
+            break;
+        }
+        else if (type == SevenZipId_End)
+        {
+            break;
+        }
+
+        const uint64_t size = read_number(r);
+        const size_t next = r->pos + size;
+        if (r->error || size > r->size - r->pos)
+        {
+            result = false;
+            break;
+        }
+
+        if (type == SevenZipId_EmptyStream)
+        {
+            read_bits(r, sz->entry_count, empty_stream);
+        }
+        else if (type == SevenZipId_Name)
+        {
+            result = read_names(r, sz, size);
+        }
+
+        // everything else (times, attributes, padding) is skipped.
+        r->pos = next;
+    }
+
+    // map entries with data onto folder substreams, in order.
+    size_t folder = 0;
+    size_t substream = 0;
+    size_t size_index = 0;
+    uint64_t offset = 0;
+
+    for (size_t i = 0; i < sz->entry_count && result; i++)
+    {
+        struct SevenZipEntry* e = &sz->entries[i];
+        if (!e->name)
+        {
+            e->name = "";
+        }
+
+        if (empty_stream[i])
+        {
+            continue;
+        }
+
+        while (folder < sz->si.folder_count && substream >= sz->si.folders[folder].num_substreams)
+        {
+            folder++;
+            substream = 0;
+            offset = 0;
+        }
+
+        if (folder >= sz->si.folder_count || size_index >= sz->si.substream_count)
+        {
+            result = false;
+            break;
+        }
+
+        e->has_stream = true;
+        e->folder = folder;
+        e->offset = offset;
+        e->size = sz->si.substream_sizes[size_index++];
+        offset += e->size;
+        substream++;
+    }
+
+    free(empty_stream);
+    return result;
+}
+
+static bool read_header(struct Reader* r, SevenZip* sz)
+{
+    bool result = true;
+
+    while (result)
+    {
+        const uint64_t id = read_number(r);
+        if (r->error)
+        {
+            result = false;
+        }
+        else if (id == SevenZipId_End)
+        {
+            break;
+        }
+        else if (id == SevenZipId_ArchiveProperties)
+        {
+            for (;;)
+            {
+                const uint64_t type = read_number(r);
+                if (!type || r->error)
+                {
+                    break;
+                }
+                skip_bytes(r, read_number(r));
+            }
+        }
+        else if (id == SevenZipId_AdditionalStreamsInfo)
+        {
+            struct StreamsInfo si = {0};
+            result = read_streams_info(r, &si);
+            streams_info_free(&si);
+        }
+        else if (id == SevenZipId_MainStreamsInfo && !sz->si.folders)
+        {
+            result = read_streams_info(r, &sz->si);
+        }
+        else if (id == SevenZipId_FilesInfo && !sz->entries)
+        {
+            result = read_files_info(r, sz);
+        }
+        else
+        {
+            result = false;
+        }
+    }
+
+    return result && !r->error;
+}
+
+SevenZip* sevenzip_open(const char* path)
+{
+    uint8_t* header = NULL;
+    SevenZip* sz = calloc(1, sizeof(*sz));
+    if (!sz)
+    {
+        return NULL;
+    }
+
+    if (!(sz->file = fopen(path, "rb")))
+    {
+        goto fail;
+    }
+
+    uint8_t sig[SEVENZIP_SIGNATURE_HEADER_SIZE];
+    if (fread(sig, 1, sizeof(sig), sz->file) != sizeof(sig) || memcmp(sig, SEVENZIP_SIGNATURE, sizeof(SEVENZIP_SIGNATURE)))
+    {
+        goto fail;
+    }
+
+    struct Reader sr = { .data = sig + 12, .size = 20 };
+    const uint64_t next_offset = (uint64_t)read_u32(&sr) | ((uint64_t)read_u32(&sr) << 32);
+    const uint64_t next_size = (uint64_t)read_u32(&sr) | ((uint64_t)read_u32(&sr) << 32);
+
+    if (!next_size || next_size > 1024 * 1024 * 64)
+    {
+        goto fail;
+    }
+
+    if (!(header = malloc(next_size)))
+    {
+        goto fail;
+    }
+
+    if (fseek(sz->file, (long)(SEVENZIP_SIGNATURE_HEADER_SIZE + next_offset), SEEK_SET) || fread(header, 1, next_size, sz->file) != next_size)
+    {
+        goto fail;
+    }
+
+    struct Reader r = { .data = header, .size = next_size };
+
+    // the header itself is usually compressed, decode it and parse again.
+    for (;;)
+    {
+        const uint64_t id = read_number(&r);
+        if (id == SevenZipId_Header)
+        {
+            break;
+        }
+        else if (id != SevenZipId_EncodedHeader)
+        {
+            goto fail;
+        }
+
+        struct StreamsInfo si = {0};
+        if (!read_streams_info(&r, &si) || !si.folder_count)
+        {
+            streams_info_free(&si);
+            goto fail;
+        }
+
+        struct SevenZipFolder* f = &si.folders[0];
+        if (!folder_decode(sz, f, f->unpack_size))
+        {
+            streams_info_free(&si);
+            goto fail;
+        }
+
+        free(header);
+        header = f->data;
+        f->data = NULL;
+        r.data = header;
+        r.size = f->unpack_size;
+        r.pos = 0;
+        streams_info_free(&si);
+    }
+
+    if (!read_header(&r, sz))
+    {
+        goto fail;
+    }
+
+    free(header);
+    return sz;
+
+fail:
+    free(header);
+    sevenzip_close(sz);
+    return NULL;
+}
+
+void sevenzip_close(SevenZip* sz)
+{
+    if (sz)
+    {
+        if (sz->file)
+        {
+            fclose(sz->file);
+        }
+        streams_info_free(&sz->si);
+        free(sz->entries);
+        free(sz->names);
+        free(sz);
+    }
+}
+
+size_t sevenzip_get_entry_count(const SevenZip* sz)
+{
+    return sz->entry_count;
+}
+
+const struct SevenZipEntry* sevenzip_get_entry(const SevenZip* sz, size_t index)
+{
+    if (index >= sz->entry_count)
+    {
+        return NULL;
+    }
+
+    return &sz->entries[index];
+}
+
+const uint8_t* sevenzip_entry_data(SevenZip* sz, const struct SevenZipEntry* entry)
+{
+    if (!entry->has_stream || entry->folder >= sz->si.folder_count)
+    {
+        return NULL;
+    }
+
+    struct SevenZipFolder* f = &sz->si.folders[entry->folder];
+    if (!folder_decode(sz, f, entry->offset + entry->size))
+    {
+        return NULL;
+    }
+
+    return f->data + entry->offset;
+}
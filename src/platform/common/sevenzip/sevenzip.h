@@ -0,0 +1,52 @@
+#ifndef SEVENZIP_H
+#define SEVENZIP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* minimal 7z reader with a built in lzma / lzma2 decoder, no dependencies.
+*
+* the header is parsed once into an index on open.
+* entries in the same solid block (folder) share a single output buffer,
+* the folder is decoded only once, and only as far as the furthest
+* entry that has been requested so far.
+*
+* supported coders are copy, lzma and lzma2 (single coder folders).
+* crcs are not verified.
+*/
+
+struct SevenZipEntry
+{
+    const char* name; // utf8, NULL terminated.
+    size_t size;
+    size_t folder;
+    size_t offset; // offset within the folder output.
+    bool has_stream; // false for directories and empty files.
+};
+
+typedef struct SevenZip SevenZip;
+
+SevenZip* sevenzip_open(const char* path);
+void sevenzip_close(SevenZip*);
+
+size_t sevenzip_get_entry_count(const SevenZip*);
+const struct SevenZipEntry* sevenzip_get_entry(const SevenZip*, size_t index);
+
+/*
+* decodes the entry (if not already) and returns a pointer to its data.
+* the pointer is valid until sevenzip_close().
+* returns NULL on error, or if the coder is unsupported.
+*/
+const uint8_t* sevenzip_entry_data(SevenZip*, const struct SevenZipEntry* entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SEVENZIP_H
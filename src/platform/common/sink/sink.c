@@ -0,0 +1,448 @@
+#include "sink.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+    #include <fcntl.h>
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+struct Sink
+{
+    struct SinkInterface iface;
+    void* user;
+    struct SinkConfig config;
+
+    // buffer is aligned inside of alloc, unless it's lent by the backend.
+    void* alloc;
+    int16_t* own;
+    int16_t* buffer;
+    size_t batch; // in samples.
+    size_t capacity;
+    size_t used;
+
+    bool error;
+};
+
+struct RawSink
+{
+    FILE* file;
+};
+
+struct TeeSink
+{
+    Sink** sinks;
+    size_t count;
+};
+
+struct ResampleSink
+{
+    Resampler* resampler;
+    Sink* target;
+    uint8_t channels;
+    int16_t* out;
+    size_t out_frames;
+};
+
+static bool sink_flush(Sink* s)
+{
+    if (s->used)
+    {
+        if (!s->iface.write(s->user, s->buffer, s->used))
+        {
+            s->error = true;
+        }
+        s->used = 0;
+    }
+
+    return !s->error;
+}
+
+// passes samples to the backend without copying, keeping anything buffered in order.
+static bool sink_write_direct(Sink* s, const int16_t* samples, size_t count)
+{
+    sink_flush(s);
+
+    if (!s->iface.write(s->user, samples, count))
+    {
+        s->error = true;
+    }
+
+    return !s->error;
+}
+
+Sink* sink_open(const struct SinkInterface* iface, void* user, const struct SinkConfig* config)
+{
+    Sink* s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        iface->close(user);
+        return NULL;
+    }
+
+    s->iface = *iface;
+    s->user = user;
+    s->config = *config;
+
+    const size_t frames = config->batch_frames ? config->batch_frames : SINK_DEFAULT_BATCH_FRAMES;
+    s->batch = frames * (config->channels ? config->channels : 1);
+    s->capacity = s->batch;
+
+    // still needed by a lending backend, for when it fails.
+    if (!(s->alloc = malloc(s->batch * sizeof(int16_t) + SINK_BUFFER_ALIGN - 1)))
+    {
+        iface->close(user);
+        free(s);
+        return NULL;
+    }
+
+    const uintptr_t addr = (uintptr_t)s->alloc;
+    s->own = (int16_t*)((addr + SINK_BUFFER_ALIGN - 1) & ~(uintptr_t)(SINK_BUFFER_ALIGN - 1));
+    s->buffer = s->own;
+    return s;
+}
+
+bool sink_close(Sink* s)
+{
+    if (!s)
+    {
+        return false;
+    }
+
+    sink_flush(s);
+    const bool result = s->iface.close(s->user) && !s->error;
+
+    free(s->alloc);
+    free(s);
+    return result;
+}
+
+// takes the next batch buffer from the backend, or falls back to our own.
+static void sink_borrow_buffer(Sink* s)
+{
+    size_t count = s->batch;
+    int16_t* buffer = s->error ? NULL : s->iface.get_buffer(s->user, &count);
+
+    if (buffer && count)
+    {
+        s->buffer = buffer;
+        s->capacity = count;
+    }
+    else
+    {
+        s->error |= !buffer;
+        s->buffer = s->own;
+        s->capacity = s->batch;
+    }
+}
+
+int16_t* sink_get_buffer(Sink* s, size_t* count)
+{
+    if (s->used == s->capacity)
+    {
+        sink_flush(s);
+    }
+
+    if (!s->used && s->iface.get_buffer)
+    {
+        sink_borrow_buffer(s);
+    }
+
+    *count = s->capacity - s->used;
+    return s->buffer + s->used;
+}
+
+void sink_commit(Sink* s, size_t count)
+{
+    s->used += count;
+
+    if (s->used >= s->capacity)
+    {
+        sink_flush(s);
+    }
+}
+
+bool sink_write(Sink* s, const int16_t* samples, size_t count)
+{
+    // whole batches skip the copy.
+    if (!s->used && count >= s->capacity)
+    {
+        return sink_write_direct(s, samples, count);
+    }
+
+    while (count)
+    {
+        size_t room;
+        int16_t* buffer = sink_get_buffer(s, &room);
+        const size_t n = count < room ? count : room;
+
+        memcpy(buffer, samples, n * sizeof(int16_t));
+        sink_commit(s, n);
+        samples += n;
+        count -= n;
+    }
+
+    return !s->error;
+}
+
+static bool wav_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    return wav_writer_write_s16(user, samples, count) == count;
+}
+
+static bool wav_sink_close(void* user)
+{
+    return wav_writer_close(user);
+}
+
+Sink* sink_open_wav(const char* path, enum WavFormat format, const struct SinkConfig* config)
+{
+    static const struct SinkInterface iface = {
+        .write = wav_sink_write,
+        .close = wav_sink_close,
+    };
+
+    const struct WavConfig wav_config = {
+        .sample_rate = config->sample_rate,
+        .channels = config->channels,
+        .format = format,
+    };
+
+    WavWriter* wav = wav_writer_open(path, &wav_config);
+    if (!wav)
+    {
+        return NULL;
+    }
+
+    return sink_open(&iface, wav, config);
+}
+
+// returns a stream for the real stdout, and points stdout at stderr.
+static FILE* take_stdout(void)
+{
+    fflush(stdout);
+
+#if defined(_WIN32)
+    const int fd = _dup(_fileno(stdout));
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    _setmode(fd, _O_BINARY);
+    FILE* file = _fdopen(fd, "wb");
+    if (!file)
+    {
+        _close(fd);
+        return NULL;
+    }
+
+    _dup2(_fileno(stderr), _fileno(stdout));
+#else
+    const int fd = dup(STDOUT_FILENO);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    FILE* file = fdopen(fd, "wb");
+    if (!file)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+
+    return file;
+}
+
+static bool raw_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    struct RawSink* raw = user;
+    return fwrite(samples, sizeof(int16_t), count, raw->file) == count;
+}
+
+static bool raw_sink_close(void* user)
+{
+    struct RawSink* raw = user;
+    const bool result = !fclose(raw->file);
+    free(raw);
+    return result;
+}
+
+Sink* sink_open_raw(const char* path, const struct SinkConfig* config)
+{
+    static const struct SinkInterface iface = {
+        .write = raw_sink_write,
+        .close = raw_sink_close,
+    };
+
+    struct RawSink* raw = calloc(1, sizeof(*raw));
+    if (!raw)
+    {
+        return NULL;
+    }
+
+    raw->file = !strcmp(path, "-") ? take_stdout() : fopen(path, "wb");
+    if (!raw->file)
+    {
+        free(raw);
+        return NULL;
+    }
+
+    // writes are already batched.
+    setvbuf(raw->file, NULL, _IONBF, 0);
+    return sink_open(&iface, raw, config);
+}
+
+static bool null_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    (void)user; (void)samples; (void)count;
+    return true;
+}
+
+static bool null_sink_close(void* user)
+{
+    (void)user;
+    return true;
+}
+
+Sink* sink_open_null(const struct SinkConfig* config)
+{
+    static const struct SinkInterface iface = {
+        .write = null_sink_write,
+        .close = null_sink_close,
+    };
+
+    return sink_open(&iface, NULL, config);
+}
+
+static bool tee_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    struct TeeSink* tee = user;
+    bool result = true;
+
+    for (size_t i = 0; i < tee->count; i++)
+    {
+        result &= sink_write_direct(tee->sinks[i], samples, count);
+    }
+
+    return result;
+}
+
+static bool tee_sink_close(void* user)
+{
+    struct TeeSink* tee = user;
+    free(tee->sinks);
+    free(tee);
+    return true;
+}
+
+Sink* sink_open_tee(Sink* const* sinks, size_t count, const struct SinkConfig* config)
+{
+    static const struct SinkInterface iface = {
+        .write = tee_sink_write,
+        .close = tee_sink_close,
+    };
+
+    struct TeeSink* tee = calloc(1, sizeof(*tee));
+    if (!tee)
+    {
+        return NULL;
+    }
+
+    if (count)
+    {
+        if (!(tee->sinks = malloc(count * sizeof(*tee->sinks))))
+        {
+            free(tee);
+            return NULL;
+        }
+        memcpy(tee->sinks, sinks, count * sizeof(*tee->sinks));
+    }
+
+    tee->count = count;
+    return sink_open(&iface, tee, config);
+}
+
+// grows the output buffer to fit whatever in_frames can produce.
+static bool resample_sink_reserve(struct ResampleSink* rs, size_t in_frames)
+{
+    const size_t frames = resampler_get_max_output(rs->resampler, in_frames);
+    if (frames <= rs->out_frames)
+    {
+        return true;
+    }
+
+    int16_t* out = realloc(rs->out, frames * rs->channels * sizeof(int16_t));
+    if (!out)
+    {
+        return false;
+    }
+
+    rs->out = out;
+    rs->out_frames = frames;
+    return true;
+}
+
+static bool resample_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    struct ResampleSink* rs = user;
+    const size_t frames = count / rs->channels;
+
+    if (!resample_sink_reserve(rs, frames))
+    {
+        return false;
+    }
+
+    const size_t out = resampler_process(rs->resampler, samples, frames, rs->out);
+    return sink_write(rs->target, rs->out, out * rs->channels);
+}
+
+static bool resample_sink_close(void* user)
+{
+    struct ResampleSink* rs = user;
+    bool result = resample_sink_reserve(rs, 0);
+
+    if (result)
+    {
+        const size_t out = resampler_flush(rs->resampler, rs->out);
+        result = sink_write(rs->target, rs->out, out * rs->channels);
+    }
+
+    resampler_quit(rs->resampler);
+    free(rs->out);
+    free(rs);
+    return result;
+}
+
+Sink* sink_open_resample(Sink* target, const struct SinkConfig* config)
+{
+    static const struct SinkInterface iface = {
+        .write = resample_sink_write,
+        .close = resample_sink_close,
+    };
+
+    struct ResampleSink* rs = calloc(1, sizeof(*rs));
+    if (!rs)
+    {
+        return NULL;
+    }
+
+    rs->target = target;
+    rs->channels = config->channels;
+
+    if (config->channels != target->config.channels || !(rs->resampler = resampler_init(config->sample_rate, target->config.sample_rate, config->channels)))
+    {
+        free(rs);
+        return NULL;
+    }
+
+    return sink_open(&iface, rs, config);
+}
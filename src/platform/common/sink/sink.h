@@ -0,0 +1,85 @@
+#ifndef SINK_H
+#define SINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wav_writer/wav_writer.h"
+#include "resampler/resampler.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* output for rendered 16-bit pcm.
+*
+* every sink has an aligned batch buffer, the caller renders straight into
+* it with sink_get_buffer() / sink_commit() and the backend only sees full
+* batches. a tee passes each batch on to several sinks, so one emulation
+* pass can feed all of them. a backend can also lend the batch buffer out
+* of its own memory, such as a shared ring, so nothing is copied at all.
+*
+* a sink is only used by one thread at a time.
+*/
+
+enum { SINK_DEFAULT_BATCH_FRAMES = 4096 };
+enum { SINK_BUFFER_ALIGN = 64 };
+
+struct SinkConfig
+{
+    uint32_t sample_rate;
+    uint8_t channels;
+    // frames passed to the backend at once, 0 uses the default.
+    size_t batch_frames;
+};
+
+// backend of a sink, count is in samples.
+struct SinkInterface
+{
+    bool (*write)(void* user, const int16_t* samples, size_t count);
+    // flushes and frees user, returns false if anything failed.
+    bool (*close)(void* user);
+    // optional, returns space for up to count samples that the next batch is
+    // written into, write() is then passed it back. may shrink count, NULL
+    // is an error.
+    int16_t* (*get_buffer)(void* user, size_t* count);
+};
+
+typedef struct Sink Sink;
+
+/* user is owned by the sink and closed with it. */
+Sink* sink_open(const struct SinkInterface* iface, void* user, const struct SinkConfig* config);
+Sink* sink_open_wav(const char* path, enum WavFormat format, const struct SinkConfig* config);
+/*
+* native endian pcm with no header. a path of "-" writes to stdout, in which
+* case the process stdout is pointed at stderr, so that logging can't end up
+* in the stream.
+*/
+Sink* sink_open_raw(const char* path, const struct SinkConfig* config);
+/* discards everything, for timing emulation alone. */
+Sink* sink_open_null(const struct SinkConfig* config);
+/* the sinks are not owned by the tee, and must be closed after it. */
+Sink* sink_open_tee(Sink* const* sinks, size_t count, const struct SinkConfig* config);
+/*
+* resamples from config->sample_rate to the rate of target. the target is
+* not owned, and must be closed after this, which writes out the tail.
+*/
+Sink* sink_open_resample(Sink* target, const struct SinkConfig* config);
+
+/* flushes and closes, returns false if any write failed. */
+bool sink_close(Sink*);
+
+/* returns space for up to count samples in the batch buffer. */
+int16_t* sink_get_buffer(Sink*, size_t* count);
+/* count samples were written to the buffer returned by sink_get_buffer(). */
+void sink_commit(Sink*, size_t count);
+/* copies count samples into the sink, returns false if a write failed. */
+bool sink_write(Sink*, const int16_t* samples, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SINK_H
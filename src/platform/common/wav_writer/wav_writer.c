@@ -1,15 +1,28 @@
-#include <stdbool.h>
-#include <stddef.h>
-#include <stdint.h>
+#include "wav_writer.h"
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static FILE* file;
-static size_t number_of_samples;
-static uint32_t sample_rate;
-static uint8_t channels;
-static uint8_t bits_per_sample;
-static uint8_t wav_header[44];
+// the riff and data sizes are 32-bit, larger files store them in ds64.
+#define RIFF_MAX_SIZE UINT64_C(0xFFFFFFFF)
+
+enum { DS64_SIZE = 28 };
+enum { WAVE_FORMAT_PCM = 1 };
+enum { WAVE_FORMAT_IEEE_FLOAT = 3 };
+// riff + ds64 + fmt (with cbSize) + fact + data.
+enum { MAX_HEADER_SIZE = 12 + (8 + DS64_SIZE) + (8 + 18) + (8 + 4) + 8 };
+
+struct WavWriter {
+    FILE* file;
+    struct WavConfig config;
+    uint64_t data_size;
+    uint8_t* buffer;
+    size_t buffer_size;
+    size_t buffer_used;
+    // set if any write failed, reported by wav_writer_close().
+    bool error;
+};
 
 static void w16(uint8_t* data, uint16_t value) {
     data[0] = value >> 0;
@@ -23,70 +36,244 @@ static void w32(uint8_t* data, uint32_t value) {
     data[3] = value >> 24;
 }
 
-bool wav_open(const char* path, uint32_t _sample_rate, uint8_t _channels, uint8_t _bits_per_sample) {
-    file = fopen(path, "wb");
-    if (!file) {
-        return false;
+static void w64(uint8_t* data, uint64_t value) {
+    w32(data + 0, (uint32_t)value);
+    w32(data + 4, (uint32_t)(value >> 32));
+}
+
+unsigned wav_format_get_sample_size(enum WavFormat format) {
+    switch (format) {
+        case WavFormat_S16: return 2;
+        case WavFormat_S24: return 3;
+        case WavFormat_F32: return 4;
+    }
+    return 0;
+}
+
+// returns the size of the header, which is the same for any data size.
+static size_t build_header(const WavWriter* w, uint8_t* header) {
+    const bool is_float = w->config.format == WavFormat_F32;
+    const uint16_t AudioFormat = is_float ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+    // non-pcm formats have a cbSize and fact chunk.
+    const uint32_t Subchunk1Size = is_float ? 18 : 16;
+    const uint16_t NumChannels = w->config.channels;
+    const uint32_t SampleRate = w->config.sample_rate;
+    const uint16_t BitsPerSample = wav_format_get_sample_size(w->config.format) * 8;
+    const uint32_t ByteRate = SampleRate * NumChannels * BitsPerSample / 8;
+    const uint16_t BlockAlign = NumChannels * BitsPerSample / 8;
+
+    const size_t header_size = 12 + (8 + DS64_SIZE) + (8 + Subchunk1Size) + (is_float ? 8 + 4 : 0) + 8;
+    const uint64_t DataSize = w->data_size;
+    const uint64_t SampleCount = DataSize / BlockAlign;
+    // chunks are word aligned.
+    const uint64_t ChunkSize = header_size - 8 + DataSize + (DataSize & 1);
+    const bool rf64 = ChunkSize > RIFF_MAX_SIZE;
+
+    uint8_t* h = header;
+    memset(header, 0, MAX_HEADER_SIZE);
+
+    memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+    w32(h + 4, rf64 ? 0xFFFFFFFF : (uint32_t)ChunkSize);
+    memcpy(h + 8, "WAVE", 4);
+    h += 12;
+
+    // reserved as JUNK, so that the file can become RF64 without moving the data.
+    memcpy(h, rf64 ? "ds64" : "JUNK", 4);
+    w32(h + 4, DS64_SIZE);
+    if (rf64) {
+        w64(h + 8, ChunkSize);
+        w64(h + 16, DataSize);
+        w64(h + 24, SampleCount);
+        w32(h + 32, 0); // table length
+    }
+    h += 8 + DS64_SIZE;
+
+    memcpy(h, "fmt ", 4);
+    w32(h + 4, Subchunk1Size);
+    w16(h + 8, AudioFormat);
+    w16(h + 10, NumChannels);
+    w32(h + 12, SampleRate);
+    w32(h + 16, ByteRate);
+    w16(h + 20, BlockAlign);
+    w16(h + 22, BitsPerSample);
+    if (is_float) {
+        w16(h + 24, 0); // cbSize
     }
+    h += 8 + Subchunk1Size;
 
-    // write empty 44 bytes, this is filled in wave_close().
-    fwrite(wav_header, 1, sizeof(wav_header), file);
+    if (is_float) {
+        memcpy(h, "fact", 4);
+        w32(h + 4, 4);
+        w32(h + 8, rf64 ? 0xFFFFFFFF : (uint32_t)SampleCount);
+        h += 8 + 4;
+    }
+
+    memcpy(h, "data", 4);
+    w32(h + 4, rf64 ? 0xFFFFFFFF : (uint32_t)DataSize);
+    h += 8;
 
-    number_of_samples = 0;
-    sample_rate = _sample_rate;
-    channels = _channels;
-    bits_per_sample = _bits_per_sample;
-    return true;
+    return h - header;
 }
 
-void wav_close(void) {
-    if (!file) {
-        return;
-    }
-
-    // header data
-    const char* ChunkID = "RIFF";
-    const char* Format = "WAVE";
-    const char* Subchunk1ID = "fmt ";
-    const char* Subchunk2ID = "data";
-    const uint32_t Subchunk1Size = 16; // 16 for PCM
-    const uint16_t AudioFormat = 1; // PCM (uncompressed)
-    const uint16_t NumChannels = channels;
-    const uint32_t SampleRate = sample_rate;
-    const uint16_t BitsPerSample = bits_per_sample;
-    const uint32_t ByteRate = SampleRate * NumChannels * BitsPerSample / 8;
-    const uint32_t BlockAlign = NumChannels * BitsPerSample / 8;
-    const uint32_t Subchunk2Size = number_of_samples * BitsPerSample / 8;
-    const uint32_t ChunkSize = 4 + (8 + Subchunk1Size) + (8 + Subchunk2Size);
-
-    // big endian
-    memcpy(wav_header + 0, ChunkID, 4);
-    memcpy(wav_header + 8, Format, 4);
-    memcpy(wav_header + 12, Subchunk1ID, 4);
-    memcpy(wav_header + 36, Subchunk2ID, 4);
-    // little endian
-    w32(wav_header + 4, ChunkSize);
-    w32(wav_header + 16, Subchunk1Size);
-    w16(wav_header + 20, AudioFormat);
-    w16(wav_header + 22, NumChannels);
-    w32(wav_header + 24, SampleRate);
-    w32(wav_header + 28, ByteRate);
-    w16(wav_header + 32, BlockAlign);
-    w16(wav_header + 34, BitsPerSample);
-    w32(wav_header + 40, Subchunk2Size);
-
-    rewind(file); // go to beginning
-    fwrite(wav_header, 1, sizeof(wav_header), file); // write header
-    fclose(file); // finished!
-    file = NULL;
+static void flush(WavWriter* w) {
+    if (w->buffer_used && fwrite(w->buffer, 1, w->buffer_used, w->file) != w->buffer_used) {
+        w->error = true;
+    }
+    w->buffer_used = 0;
+}
+
+WavWriter* wav_writer_open(const char* path, const struct WavConfig* config) {
+    if (!wav_format_get_sample_size(config->format) || !config->channels || !config->sample_rate) {
+        return NULL;
+    }
+
+    WavWriter* w = calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+
+    w->config = *config;
+    w->buffer_size = config->buffer_size ? config->buffer_size : WAV_WRITER_DEFAULT_BUFFER_SIZE;
+    // always room for at least one sample of any format.
+    if (w->buffer_size < 4) {
+        w->buffer_size = 4;
+    }
+
+    if (!(w->buffer = malloc(w->buffer_size))) {
+        goto fail;
+    }
+
+    if (!(w->file = fopen(path, "wb"))) {
+        goto fail;
+    }
+
+    // writes are already buffered.
+    setvbuf(w->file, NULL, _IONBF, 0);
+
+    // the sizes are filled in by wav_writer_close().
+    uint8_t header[MAX_HEADER_SIZE];
+    const size_t header_size = build_header(w, header);
+    if (fwrite(header, 1, header_size, w->file) != header_size) {
+        goto fail;
+    }
+
+    return w;
+
+fail:
+    if (w->file) {
+        fclose(w->file);
+    }
+    free(w->buffer);
+    free(w);
+    return NULL;
 }
 
-size_t wav_write(const void* data, size_t size_in_bytes) {
-    if (!file || !data || !size_in_bytes) {
+bool wav_writer_close(WavWriter* w) {
+    if (!w) {
         return false;
     }
 
-    const size_t nwritten = fwrite(data, 1, size_in_bytes, file);
-    number_of_samples += nwritten;
-    return nwritten;
+    flush(w);
+
+    if (w->data_size & 1) {
+        const uint8_t pad = 0;
+        if (fwrite(&pad, 1, 1, w->file) != 1) {
+            w->error = true;
+        }
+    }
+
+    uint8_t header[MAX_HEADER_SIZE];
+    const size_t header_size = build_header(w, header);
+    rewind(w->file); // go to beginning
+    if (fwrite(header, 1, header_size, w->file) != header_size) {
+        w->error = true;
+    }
+
+    if (fclose(w->file)) {
+        w->error = true;
+    }
+
+    const bool result = !w->error;
+    free(w->buffer);
+    free(w);
+    return result;
+}
+
+size_t wav_writer_write(WavWriter* w, const void* data, size_t size_in_bytes) {
+    if (!w || !data || !size_in_bytes) {
+        return 0;
+    }
+
+    // large writes skip the buffer.
+    if (size_in_bytes >= w->buffer_size) {
+        flush(w);
+        const size_t nwritten = fwrite(data, 1, size_in_bytes, w->file);
+        if (nwritten != size_in_bytes) {
+            w->error = true;
+        }
+        w->data_size += nwritten;
+        return nwritten;
+    }
+
+    if (w->buffer_used + size_in_bytes > w->buffer_size) {
+        flush(w);
+    }
+
+    memcpy(w->buffer + w->buffer_used, data, size_in_bytes);
+    w->buffer_used += size_in_bytes;
+    w->data_size += size_in_bytes;
+    return size_in_bytes;
+}
+
+size_t wav_writer_write_s16(WavWriter* w, const int16_t* samples, size_t count) {
+    if (!w || !samples) {
+        return 0;
+    }
+
+    const unsigned sample_size = wav_format_get_sample_size(w->config.format);
+    size_t done = 0;
+
+    // converts straight into the buffer.
+    while (done < count) {
+        if (w->buffer_used + sample_size > w->buffer_size) {
+            flush(w);
+        }
+
+        const size_t room = (w->buffer_size - w->buffer_used) / sample_size;
+        const size_t n = room < count - done ? room : count - done;
+        const int16_t* in = samples + done;
+        uint8_t* out = w->buffer + w->buffer_used;
+
+        switch (w->config.format) {
+            case WavFormat_S16:
+                for (size_t i = 0; i < n; i++, out += 2) {
+                    w16(out, (uint16_t)in[i]);
+                }
+                break;
+
+            case WavFormat_S24:
+                for (size_t i = 0; i < n; i++, out += 3) {
+                    const uint16_t value = (uint16_t)in[i];
+                    out[0] = 0;
+                    out[1] = value >> 0;
+                    out[2] = value >> 8;
+                }
+                break;
+
+            case WavFormat_F32:
+                for (size_t i = 0; i < n; i++, out += 4) {
+                    const float value = in[i] / 32768.0f;
+                    uint32_t bits;
+                    memcpy(&bits, &value, sizeof(bits));
+                    w32(out, bits);
+                }
+                break;
+        }
+
+        w->buffer_used += n * sample_size;
+        w->data_size += n * sample_size;
+        done += n;
+    }
+
+    return done;
 }
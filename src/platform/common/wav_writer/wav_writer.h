@@ -9,12 +9,46 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
-bool wav_open(const char* path, uint32_t sample_rate, uint8_t channels, uint8_t bits_per_sample);
-void wav_close(void);
-size_t wav_write(const void* data, size_t size_in_bytes);
+/*
+* each WavWriter owns its file and buffer, so any number can be open at
+* once, as long as each one is only used by one thread at a time.
+*
+* space for a ds64 chunk is reserved in the header as a JUNK chunk, if the
+* data ends up larger than 4GiB the file is finished as RF64 instead.
+*/
+
+enum { WAV_WRITER_DEFAULT_BUFFER_SIZE = 1024 * 1024 };
+
+enum WavFormat {
+    WavFormat_S16, // 16-bit signed pcm.
+    WavFormat_S24, // 24-bit signed pcm, packed.
+    WavFormat_F32, // 32-bit ieee float.
+};
+
+struct WavConfig {
+    uint32_t sample_rate;
+    uint8_t channels;
+    enum WavFormat format;
+    // bytes buffered before writing to the file, 0 uses the default.
+    size_t buffer_size;
+};
+
+typedef struct WavWriter WavWriter;
+
+WavWriter* wav_writer_open(const char* path, const struct WavConfig* config);
+/* writes the header and closes, returns false if any write failed. */
+bool wav_writer_close(WavWriter*);
+
+/* data must already be in the output format, returns the bytes written. */
+size_t wav_writer_write(WavWriter*, const void* data, size_t size_in_bytes);
+/* converts count 16-bit samples to the output format, returns the samples written. */
+size_t wav_writer_write_s16(WavWriter*, const int16_t* samples, size_t count);
+
+/* returns the size of one sample in bytes. */
+unsigned wav_format_get_sample_size(enum WavFormat format);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // WAV_WRITER_H
\ No newline at end of file
+#endif // WAV_WRITER_H
@@ -0,0 +1,615 @@
+#include "zip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+enum { ZIP_LOCAL_HEADER_SIG = 0x04034B50 };
+enum { ZIP_CENTRAL_HEADER_SIG = 0x02014B50 };
+enum { ZIP_EOCD_SIG = 0x06054B50 };
+enum { ZIP_LOCAL_HEADER_SIZE = 30 };
+enum { ZIP_CENTRAL_HEADER_SIZE = 46 };
+enum { ZIP_EOCD_SIZE = 22 };
+enum { ZIP_MAX_COMMENT_SIZE = 0xFFFF };
+
+// distance between seek checkpoints in the uncompressed data.
+// each checkpoint holds a copy of the inflate state (~40k).
+enum { ZIP_CHECKPOINT_INTERVAL = 1024 * 128 };
+
+struct Zip
+{
+    const uint8_t* map;
+    size_t map_size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    struct ZipEntry* entries;
+    size_t entry_count;
+    char* names;
+};
+
+struct ZipCheckpoint
+{
+    z_stream strm;
+    bool valid;
+};
+
+struct ZipWindow
+{
+    uint8_t* data;
+    size_t offset;
+    unsigned last_used;
+    bool valid;
+};
+
+struct ZipStream
+{
+    const uint8_t* src;
+    size_t src_size;
+    size_t size;
+    uint16_t method;
+
+    // inflate state, pos is the uncompressed offset of strm.
+    z_stream strm;
+    bool strm_init;
+    size_t pos;
+
+    struct ZipCheckpoint* checkpoints;
+    size_t checkpoint_count;
+
+    struct ZipWindow* windows;
+    size_t window_count;
+    size_t window_size;
+    unsigned tick;
+};
+
+static uint16_t r16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t r32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool zip_map(Zip* zip, const char* path)
+{
+#if defined(_WIN32)
+    zip->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (zip->file == INVALID_HANDLE_VALUE)
+    {
+        zip->file = NULL;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(zip->file, &size) || !size.QuadPart)
+    {
+        return false;
+    }
+
+    zip->mapping = CreateFileMappingA(zip->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!zip->mapping)
+    {
+        return false;
+    }
+
+    zip->map = MapViewOfFile(zip->mapping, FILE_MAP_READ, 0, 0, 0);
+    zip->map_size = (size_t)size.QuadPart;
+    return zip->map != NULL;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    zip->map = map;
+    zip->map_size = st.st_size;
+    return true;
+#endif
+}
+
+static void zip_unmap(Zip* zip)
+{
+#if defined(_WIN32)
+    if (zip->map)
+    {
+        UnmapViewOfFile(zip->map);
+    }
+    if (zip->mapping)
+    {
+        CloseHandle(zip->mapping);
+    }
+    if (zip->file)
+    {
+        CloseHandle(zip->file);
+    }
+#else
+    if (zip->map)
+    {
+        munmap((void*)zip->map, zip->map_size);
+    }
+#endif
+}
+
+static const uint8_t* find_eocd(const Zip* zip)
+{
+    if (zip->map_size < ZIP_EOCD_SIZE)
+    {
+        return NULL;
+    }
+
+    // the eocd is at the end, followed by an optional comment.
+    const size_t end = zip->map_size - ZIP_EOCD_SIZE;
+    const size_t start = end > ZIP_MAX_COMMENT_SIZE ? end - ZIP_MAX_COMMENT_SIZE : 0;
+
+    for (size_t i = end + 1; i-- > start;)
+    {
+        if (r32(zip->map + i) == ZIP_EOCD_SIG)
+        {
+            return zip->map + i;
+        }
+    }
+
+    return NULL;
+}
+
+static bool parse_central_directory(Zip* zip)
+{
+    const uint8_t* eocd = find_eocd(zip);
+    if (!eocd)
+    {
+        return false;
+    }
+
+    const size_t count = r16(eocd + 10);
+    const size_t cd_size = r32(eocd + 12);
+    const size_t cd_offset = r32(eocd + 16);
+
+    if (cd_offset > zip->map_size || cd_size > zip->map_size - cd_offset)
+    {
+        return false;
+    }
+
+    // names are at most cd_size in total, so size the pool once.
+    zip->entries = calloc(count ? count : 1, sizeof(*zip->entries));
+    zip->names = malloc(cd_size + count + 1);
+    if (!zip->entries || !zip->names)
+    {
+        return false;
+    }
+
+    const uint8_t* p = zip->map + cd_offset;
+    const uint8_t* end = p + cd_size;
+    char* name_pool = zip->names;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (end - p < ZIP_CENTRAL_HEADER_SIZE || r32(p) != ZIP_CENTRAL_HEADER_SIG)
+        {
+            return false;
+        }
+
+        const size_t name_len = r16(p + 28);
+        const size_t extra_len = r16(p + 30);
+        const size_t comment_len = r16(p + 32);
+        const size_t record_size = ZIP_CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+
+        if ((size_t)(end - p) < record_size)
+        {
+            return false;
+        }
+
+        struct ZipEntry* entry = &zip->entries[zip->entry_count++];
+        entry->method = r16(p + 10);
+        entry->crc32 = r32(p + 16);
+        entry->compressed_size = r32(p + 20);
+        entry->uncompressed_size = r32(p + 24);
+        entry->local_offset = r32(p + 42);
+
+        memcpy(name_pool, p + ZIP_CENTRAL_HEADER_SIZE, name_len);
+        name_pool[name_len] = '\0';
+        entry->name = name_pool;
+        name_pool += name_len + 1;
+
+        p += record_size;
+    }
+
+    return true;
+}
+
+Zip* zip_open(const char* path)
+{
+    Zip* zip = calloc(1, sizeof(*zip));
+    if (!zip)
+    {
+        return NULL;
+    }
+
+    if (!zip_map(zip, path) || !parse_central_directory(zip))
+    {
+        zip_close(zip);
+        return NULL;
+    }
+
+    return zip;
+}
+
+void zip_close(Zip* zip)
+{
+    if (zip)
+    {
+        zip_unmap(zip);
+        free(zip->entries);
+        free(zip->names);
+        free(zip);
+    }
+}
+
+size_t zip_get_entry_count(const Zip* zip)
+{
+    return zip->entry_count;
+}
+
+const struct ZipEntry* zip_get_entry(const Zip* zip, size_t index)
+{
+    if (index >= zip->entry_count)
+    {
+        return NULL;
+    }
+
+    return &zip->entries[index];
+}
+
+// returns the start of the (possibly compressed) entry data.
+static const uint8_t* entry_raw_data(const Zip* zip, const struct ZipEntry* entry)
+{
+    const size_t off = entry->local_offset;
+    if (off > zip->map_size || zip->map_size - off < ZIP_LOCAL_HEADER_SIZE)
+    {
+        return NULL;
+    }
+
+    const uint8_t* lh = zip->map + off;
+    if (r32(lh) != ZIP_LOCAL_HEADER_SIG)
+    {
+        return NULL;
+    }
+
+    // the local extra field can differ from the central one.
+    const size_t data_off = off + ZIP_LOCAL_HEADER_SIZE + r16(lh + 26) + r16(lh + 28);
+    if (data_off > zip->map_size || zip->map_size - data_off < entry->compressed_size)
+    {
+        return NULL;
+    }
+
+    return zip->map + data_off;
+}
+
+const void* zip_entry_data(const Zip* zip, const struct ZipEntry* entry)
+{
+    if (entry->method != ZipMethod_STORED)
+    {
+        return NULL;
+    }
+
+    return entry_raw_data(zip, entry);
+}
+
+size_t zip_entry_read(const Zip* zip, const struct ZipEntry* entry, void* dst, size_t size)
+{
+    const uint8_t* src = entry_raw_data(zip, entry);
+    if (!src)
+    {
+        return 0;
+    }
+
+    if (size > entry->uncompressed_size)
+    {
+        size = entry->uncompressed_size;
+    }
+
+    if (entry->method == ZipMethod_STORED)
+    {
+        memcpy(dst, src, size);
+        return size;
+    }
+    else if (entry->method != ZipMethod_DEFLATE)
+    {
+        return 0;
+    }
+
+    z_stream strm = {0};
+    if (Z_OK != inflateInit2(&strm, -MAX_WBITS))
+    {
+        return 0;
+    }
+
+    strm.next_in = (Bytef*)src;
+    strm.avail_in = entry->compressed_size;
+    strm.next_out = dst;
+    strm.avail_out = size;
+
+    const int result = inflate(&strm, Z_FINISH);
+    const size_t read = size - strm.avail_out;
+    inflateEnd(&strm);
+
+    return (result == Z_STREAM_END || result == Z_OK || result == Z_BUF_ERROR) ? read : 0;
+}
+
+static bool stream_restart(ZipStream* s, size_t target)
+{
+    size_t cp = target / ZIP_CHECKPOINT_INTERVAL;
+    while (cp && !s->checkpoints[cp].valid)
+    {
+        cp--;
+    }
+
+    // already closer to the target than the checkpoint is.
+    if (s->strm_init && s->pos <= target && s->pos >= cp * ZIP_CHECKPOINT_INTERVAL)
+    {
+        return true;
+    }
+
+    if (s->strm_init)
+    {
+        inflateEnd(&s->strm);
+        s->strm_init = false;
+    }
+
+    if (cp)
+    {
+        if (Z_OK != inflateCopy(&s->strm, &s->checkpoints[cp].strm))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        memset(&s->strm, 0, sizeof(s->strm));
+        if (Z_OK != inflateInit2(&s->strm, -MAX_WBITS))
+        {
+            return false;
+        }
+        s->strm.next_in = (Bytef*)s->src;
+        s->strm.avail_in = s->src_size;
+    }
+
+    s->strm_init = true;
+    s->pos = cp * ZIP_CHECKPOINT_INTERVAL;
+    return true;
+}
+
+// inflates up to size bytes from the current position, dst may be NULL to skip.
+static size_t stream_inflate(ZipStream* s, uint8_t* dst, size_t size)
+{
+    uint8_t scratch[1024 * 4];
+    size_t total = 0;
+
+    while (total < size && s->pos < s->size)
+    {
+        // stop on checkpoint boundaries so that the state can be saved.
+        const size_t next_cp = (s->pos / ZIP_CHECKPOINT_INTERVAL + 1) * ZIP_CHECKPOINT_INTERVAL;
+        size_t chunk = size - total;
+        if (chunk > next_cp - s->pos)
+        {
+            chunk = next_cp - s->pos;
+        }
+        if (!dst && chunk > sizeof(scratch))
+        {
+            chunk = sizeof(scratch);
+        }
+
+        s->strm.next_out = dst ? dst + total : scratch;
+        s->strm.avail_out = chunk;
+
+        const int result = inflate(&s->strm, Z_NO_FLUSH);
+        const size_t produced = chunk - s->strm.avail_out;
+        s->pos += produced;
+        total += produced;
+
+        if (s->pos % ZIP_CHECKPOINT_INTERVAL == 0 && s->pos < s->size)
+        {
+            struct ZipCheckpoint* cp = &s->checkpoints[s->pos / ZIP_CHECKPOINT_INTERVAL];
+            if (!cp->valid && Z_OK == inflateCopy(&cp->strm, &s->strm))
+            {
+                cp->valid = true;
+            }
+        }
+
+        if (!produced || (result != Z_OK && result != Z_STREAM_END))
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
+ZipStream* zip_stream_open(const Zip* zip, const struct ZipEntry* entry, size_t window_size, size_t window_count)
+{
+    if (!window_size || !window_count)
+    {
+        return NULL;
+    }
+
+    if (entry->method != ZipMethod_STORED && entry->method != ZipMethod_DEFLATE)
+    {
+        return NULL;
+    }
+
+    const uint8_t* src = entry_raw_data(zip, entry);
+    if (!src)
+    {
+        return NULL;
+    }
+
+    ZipStream* s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        return NULL;
+    }
+
+    s->src = src;
+    s->src_size = entry->compressed_size;
+    s->size = entry->uncompressed_size;
+    s->method = entry->method;
+    s->window_size = window_size;
+    s->window_count = window_count;
+    s->checkpoint_count = s->size / ZIP_CHECKPOINT_INTERVAL + 1;
+
+    s->windows = calloc(window_count, sizeof(*s->windows));
+    s->checkpoints = calloc(s->checkpoint_count, sizeof(*s->checkpoints));
+    if (!s->windows || !s->checkpoints)
+    {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < window_count; i++)
+    {
+        if (!(s->windows[i].data = malloc(window_size)))
+        {
+            goto fail;
+        }
+    }
+
+    return s;
+
+fail:
+    zip_stream_close(s);
+    return NULL;
+}
+
+void zip_stream_close(ZipStream* s)
+{
+    if (!s)
+    {
+        return;
+    }
+
+    if (s->strm_init)
+    {
+        inflateEnd(&s->strm);
+    }
+
+    if (s->checkpoints)
+    {
+        for (size_t i = 0; i < s->checkpoint_count; i++)
+        {
+            if (s->checkpoints[i].valid)
+            {
+                inflateEnd(&s->checkpoints[i].strm);
+            }
+        }
+        free(s->checkpoints);
+    }
+
+    if (s->windows)
+    {
+        for (size_t i = 0; i < s->window_count; i++)
+        {
+            free(s->windows[i].data);
+        }
+        free(s->windows);
+    }
+
+    free(s);
+}
+
+size_t zip_stream_size(const ZipStream* s)
+{
+    return s->size;
+}
+
+size_t zip_stream_read(ZipStream* s, void* dst, size_t size, size_t offset)
+{
+    if (offset >= s->size)
+    {
+        return 0;
+    }
+
+    if (size > s->size - offset)
+    {
+        size = s->size - offset;
+    }
+
+    if (s->method == ZipMethod_STORED)
+    {
+        memcpy(dst, s->src + offset, size);
+        return size;
+    }
+
+    if (!stream_restart(s, offset))
+    {
+        return 0;
+    }
+
+    // skip forward to the offset, then inflate directly into dst.
+    const size_t skip = offset - s->pos;
+    if (skip && stream_inflate(s, NULL, skip) != skip)
+    {
+        return 0;
+    }
+
+    return stream_inflate(s, dst, size);
+}
+
+const uint8_t* zip_stream_pointer(ZipStream* s, size_t offset)
+{
+    if (s->method == ZipMethod_STORED && offset <= s->size && s->size - offset >= s->window_size)
+    {
+        return s->src + offset;
+    }
+
+    struct ZipWindow* victim = &s->windows[0];
+    for (size_t i = 0; i < s->window_count; i++)
+    {
+        struct ZipWindow* w = &s->windows[i];
+        if (w->valid && w->offset == offset)
+        {
+            w->last_used = ++s->tick;
+            return w->data;
+        }
+        if (!w->valid || (victim->valid && w->last_used < victim->last_used))
+        {
+            victim = w;
+        }
+    }
+
+    const size_t read = zip_stream_read(s, victim->data, s->window_size, offset);
+    memset(victim->data + read, 0, s->window_size - read);
+
+    victim->offset = offset;
+    victim->valid = true;
+    victim->last_used = ++s->tick;
+    return victim->data;
+}
@@ -0,0 +1,71 @@
+#ifndef ZIP_H
+#define ZIP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* minimal zip reader.
+* the archive is memory mapped and the central directory is parsed once
+* into an index on open, entries are never scanned again.
+*
+* stored entries are accessed directly from the mapping (zero copy).
+* deflated entries can be read whole, or through a ZipStream which
+* inflates lazily and keeps seek checkpoints so that random access
+* doesn't require decompressing the entry from the start.
+*
+* zip64 and encrypted archives are not supported.
+*/
+
+enum ZipMethod
+{
+    ZipMethod_STORED = 0,
+    ZipMethod_DEFLATE = 8,
+};
+
+struct ZipEntry
+{
+    const char* name; // NULL terminated.
+    size_t local_offset; // offset of the local header.
+    size_t compressed_size;
+    size_t uncompressed_size;
+    uint32_t crc32;
+    uint16_t method;
+};
+
+typedef struct Zip Zip;
+typedef struct ZipStream ZipStream;
+
+Zip* zip_open(const char* path);
+void zip_close(Zip*);
+
+size_t zip_get_entry_count(const Zip*);
+const struct ZipEntry* zip_get_entry(const Zip*, size_t index);
+
+/* returns a pointer into the mapping for stored entries, NULL otherwise. */
+const void* zip_entry_data(const Zip*, const struct ZipEntry* entry);
+/* reads (and inflates) the whole entry, returns the amount read. */
+size_t zip_entry_read(const Zip*, const struct ZipEntry* entry, void* dst, size_t size);
+
+/*
+* random access reader for an entry.
+* window_size is the size returned by zip_stream_pointer(),
+* window_count is the number of windows that are kept cached.
+*/
+ZipStream* zip_stream_open(const Zip*, const struct ZipEntry* entry, size_t window_size, size_t window_count);
+void zip_stream_close(ZipStream*);
+size_t zip_stream_size(const ZipStream*);
+size_t zip_stream_read(ZipStream*, void* dst, size_t size, size_t offset);
+/* returns window_size bytes starting at offset, zero padded past the end. */
+const uint8_t* zip_stream_pointer(ZipStream*, size_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ZIP_H
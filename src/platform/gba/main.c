@@ -17,8 +17,7 @@
 
 struct Archive
 {
-    struct M3uSongInfo* infos;
-    size_t m3u_count;
+    struct M3uPlaylist playlist;
 };
 
 struct FileIo
@@ -58,7 +57,7 @@ static unsigned EWRAM_BSS g_file_count;
 
 static Gbs* EWRAM_BSS gbs;
 static struct GbsMeta EWRAM_BSS gbs_meta;
-static const struct M3uSongInfo* EWRAM_BSS m3u_info;
+static const struct M3uEntry* EWRAM_BSS m3u_info;
 static struct Archive EWRAM_BSS archive;
 static unsigned char EWRAM_BSS cursor;
 static unsigned char EWRAM_BSS lru_pool[GBS_BANK_SIZE * 8]; // 64k free.
@@ -167,13 +166,6 @@ static const struct GbsIo EWRAM_DATA MEMIO = {
     .size = io_mem_size,
 };
 
-static int cmpfunc(const void* a, const void* b)
-{
-    const struct M3uSongInfo* ea = a;
-    const struct M3uSongInfo* eb = b;
-    return (int)ea->songno - (int)eb->songno;
-}
-
 static int sortfunc(const void* a, const void* b)
 {
     const struct FileEntry* ea = a;
@@ -195,7 +187,7 @@ static int sortfunc(const void* a, const void* b)
 
 static bool load_archive(Gbs* gbs, struct GbsIo* io, struct Archive* archive)
 {
-    memset(archive, 0, sizeof(*archive));
+    m3u_playlist_free(&archive->playlist);
 
     struct GbsIo lio;
     if (!gbs_lru_init(io, &lio, lru_pool, sizeof(lru_pool)))
@@ -206,24 +198,11 @@ static bool load_archive(Gbs* gbs, struct GbsIo* io, struct Archive* archive)
     return gbs_load_io(gbs, &lio);
 }
 
-static const struct M3uSongInfo* EWRAM_CODE find_info_from_song(const struct Archive* archive, unsigned song)
-{
-    for (size_t i = 0; i < archive->m3u_count; i++)
-    {
-        if (archive->infos[i].songno == song)
-        {
-            return &archive->infos[i];
-        }
-    }
-
-    return NULL;
-}
-
 static void EWRAM_CODE play_song(unsigned song)
 {
     cursor = song % gbs_meta.max_song;
     gbs_set_song(gbs, song % gbs_meta.max_song);
-    m3u_info = find_info_from_song(&archive, gbs_get_song(gbs));
+    m3u_info = m3u_playlist_find(&archive.playlist, gbs_get_song(gbs));
 }
 
 static void EWRAM_CODE draw_menu(void)
@@ -239,7 +218,7 @@ static void EWRAM_CODE draw_menu(void)
     iprintf(CON_POS(0, 19) "%03u / %03u", cursor + 1, gbs_meta.max_song);
     if (m3u_info)
     {
-        iprintf(CON_POS(0, 10) "%s", m3u_info->song_tile);
+        iprintf(CON_POS(0, 10) "%s", m3u_info->title);
     }
 }
 
@@ -303,6 +282,8 @@ static bool load_from_mem(void)
 {
     static struct EWRAM_BSS MemIo memio;
 
+    u32 m3u_size = 0;
+
     // check if the gbs rom was cat at the end of the gba rom.
     if (gbs_validate_file_mem(GBA_ROM8 + ROM_META_OFFSET, 4))
     {
@@ -324,28 +305,7 @@ static bool load_from_mem(void)
 
         memio.data = GBA_ROM8 + rom_meta.offset;
         memio.size = rom_meta.size;
-
-        // try and load m3u data, if it exists.
-        u32 m3u_offset = ROM_M3U_OFFSET;
-        while (m3u_offset < ROM_M3U_OFFSET + rom_meta.m3u_size)
-        {
-            const char* str = (const char*)(GBA_ROM8 + m3u_offset);
-            const size_t len = strlen(str);
-            struct M3uSongInfo m3u_info;
-            if (m3u_info_parse(str, len, &m3u_info))
-            {
-                archive.m3u_count++;
-                archive.infos = realloc(archive.infos, archive.m3u_count * sizeof(*archive.infos));
-                if (!archive.infos)
-                {
-                    error_loop("m3u realloc failed\n");
-                }
-                archive.infos[archive.m3u_count-1] = m3u_info;
-            }
-            m3u_offset += len + 1;
-        }
-
-        qsort(archive.infos, archive.m3u_count, sizeof(*archive.infos), cmpfunc);
+        m3u_size = rom_meta.m3u_size;
     }
 
     struct GbsIo io = MEMIO;
@@ -356,6 +316,13 @@ static bool load_from_mem(void)
         error_loop("bad gbs mem\n");
     }
 
+    // try and load m3u data, if it exists.
+    // the strings are NULL separated, which the parser treats as line breaks.
+    if (m3u_size)
+    {
+        m3u_playlist_parse(&archive.playlist, (const char*)(GBA_ROM8 + ROM_M3U_OFFSET), m3u_size);
+    }
+
     // reset gbs header in psram
     ezflash_reset_psram();
 
@@ -0,0 +1,640 @@
+#include "audio_producer.h"
+
+#include <SDL.h>
+
+// must be a power of 2, positions are free running counters masked into the ring.
+enum { RING_FRAMES = 1024 * 64 };
+enum { RING_MASK = RING_FRAMES - 1 };
+// frames rendered per gbs_run().
+enum { CHUNK_FRAMES = 512 };
+enum { COMMAND_QUEUE_SIZE = 16 };
+// song boundaries that are in the ring but not yet heard.
+enum { SWITCH_QUEUE_SIZE = 8 };
+// how long the producer sleeps when the ring is full, if not woken sooner.
+enum { WAIT_TIMEOUT_MS = 5 };
+// seconds of audio rendered without a near miss before the depth is reduced.
+enum { SHRINK_INTERVAL = 5 };
+// seconds of a cued song that are rendered ahead of time.
+enum { CUE_SECONDS = 2 };
+
+enum CommandType {
+    CommandType_PLAY,
+    CommandType_CUE,
+};
+
+struct Command {
+    enum CommandType type;
+    unsigned slot;
+    unsigned song;
+    unsigned end_frames;
+    int seq;
+};
+
+// a song boundary in the ring.
+struct Switch {
+    unsigned pos;
+    unsigned song;
+    // set for a song change, the reader skips the rest of the previous song.
+    bool skip;
+    int play_seq;
+};
+
+// a gbs instance and the audio rendered ahead of time for it.
+struct Voice {
+    Gbs* gbs;
+    short* buffer;
+    // -1 if nothing is cued.
+    int song;
+    // set when the song was changed, but gbs_set_song() hasn't been called yet.
+    bool reset;
+    // 0 to play forever.
+    unsigned end_frames;
+    // frames output by the gbs for this song.
+    unsigned rendered;
+    // frames in buffer, and how many of those were copied into the ring.
+    unsigned buffered;
+    unsigned drained;
+};
+
+struct AudioProducer {
+    unsigned freq;
+    SDL_Thread* thread;
+    SDL_sem* wake;
+    SDL_atomic_t quit;
+    // set while the producer is sleeping, the reader posts wake once.
+    SDL_atomic_t waiting;
+
+    // RING_FRAMES stereo frames.
+    short* ring;
+    // frames written, only written by the producer.
+    SDL_atomic_t head;
+    // frames read, only written by the reader.
+    SDL_atomic_t tail;
+
+    // written by the producer (head) and reader (tail).
+    struct Switch switches[SWITCH_QUEUE_SIZE];
+    SDL_atomic_t switch_head;
+    SDL_atomic_t switch_tail;
+
+    // written by the main thread (head) and producer (tail).
+    struct Command commands[COMMAND_QUEUE_SIZE];
+    SDL_atomic_t command_head;
+    SDL_atomic_t command_tail;
+
+    // main thread state.
+    int play_seq;
+
+    // reader state.
+    bool started;
+    SDL_atomic_t song;
+    SDL_atomic_t frames;
+    SDL_atomic_t heard_play_seq;
+
+    // producer state.
+    struct Voice voice;
+    struct Voice cues[AUDIO_PRODUCER_MAX_CUES];
+    unsigned cue_count;
+    unsigned cue_frames;
+    bool playing;
+    // where the last song change starts in the ring.
+    unsigned skip_pos;
+    unsigned min_depth;
+    unsigned max_depth;
+    unsigned depth;
+    unsigned last_underruns;
+    unsigned frames_since_near_miss;
+
+    SDL_atomic_t stat_depth;
+    SDL_atomic_t stat_underruns;
+    SDL_atomic_t stat_max_render_us;
+    SDL_atomic_t stat_max_callback_us;
+    SDL_atomic_t stat_cue_hits;
+    SDL_atomic_t stat_cue_misses;
+};
+
+static unsigned ticks_to_us(Uint64 ticks)
+{
+    return (unsigned)(ticks * 1000000 / SDL_GetPerformanceFrequency());
+}
+
+static void stat_max(SDL_atomic_t* stat, unsigned value)
+{
+    if (value > (unsigned)SDL_AtomicGet(stat)) {
+        SDL_AtomicSet(stat, (int)value);
+    }
+}
+
+static bool switch_queue_full(AudioProducer* p)
+{
+    return SDL_AtomicGet(&p->switch_head) - SDL_AtomicGet(&p->switch_tail) >= SWITCH_QUEUE_SIZE;
+}
+
+static void publish_switch(AudioProducer* p, bool skip, int play_seq)
+{
+    const int index = SDL_AtomicGet(&p->switch_head);
+    struct Switch* s = &p->switches[(unsigned)index % SWITCH_QUEUE_SIZE];
+    s->pos = (unsigned)SDL_AtomicGet(&p->head);
+    s->song = (unsigned)p->voice.song;
+    s->skip = skip;
+    s->play_seq = play_seq;
+    SDL_AtomicSet(&p->switch_head, index + 1);
+
+    if (skip) {
+        p->skip_pos = s->pos;
+    }
+}
+
+static void voice_set_song(struct Voice* v, unsigned song, unsigned end_frames)
+{
+    v->song = (int)song;
+    v->reset = true;
+    v->end_frames = end_frames;
+    v->rendered = 0;
+    v->buffered = 0;
+    v->drained = 0;
+}
+
+static unsigned voice_render(struct Voice* v, short* dst, unsigned frames)
+{
+    if (v->end_frames) {
+        frames = SDL_min(frames, v->end_frames - v->rendered);
+    }
+
+    gbs_run(v->gbs, gbs_clocks_needed(v->gbs, frames * 2));
+    frames = gbs_read_samples(v->gbs, dst, frames * 2) / 2;
+    v->rendered += frames;
+    return frames;
+}
+
+static bool voice_finished(const struct Voice* v)
+{
+    return v->end_frames && v->rendered >= v->end_frames && v->drained == v->buffered;
+}
+
+// makes the cued voice in slot current, the previous voice is free to be cued again.
+// play_seq is only used for a song change (skip).
+static void start_cue(AudioProducer* p, unsigned slot, bool skip, int play_seq)
+{
+    const struct Voice tmp = p->voice;
+    p->voice = p->cues[slot];
+    p->cues[slot] = tmp;
+    p->cues[slot].song = -1;
+
+    struct Voice* v = &p->voice;
+    if (v->reset) {
+        gbs_set_song(v->gbs, (uint8_t)v->song);
+        v->reset = false;
+    }
+
+    SDL_AtomicAdd(v->buffered ? &p->stat_cue_hits : &p->stat_cue_misses, 1);
+    publish_switch(p, skip, play_seq);
+}
+
+// resets the current voice to song, used when it wasn't cued.
+static void start_song(AudioProducer* p, unsigned song, unsigned end_frames, bool skip, int play_seq)
+{
+    struct Voice* v = &p->voice;
+    voice_set_song(v, song, end_frames);
+    gbs_set_song(v->gbs, (uint8_t)song);
+    v->song = gbs_get_song(v->gbs);
+    v->reset = false;
+
+    if (p->cue_count) {
+        SDL_AtomicAdd(&p->stat_cue_misses, 1);
+    }
+    publish_switch(p, skip, play_seq);
+}
+
+static void play(AudioProducer* p, unsigned song, unsigned end_frames, int play_seq)
+{
+    for (unsigned i = 0; i < p->cue_count; i++) {
+        if (p->cues[i].song == (int)song) {
+            start_cue(p, i, true, play_seq);
+            p->voice.end_frames = end_frames;
+            return;
+        }
+    }
+
+    start_song(p, song, end_frames, true, play_seq);
+}
+
+// continues straight into the next song on the same sample.
+static void advance(AudioProducer* p)
+{
+    struct Voice* next = &p->cues[0];
+    if (next->song < 0) {
+        p->voice.end_frames = 0;
+    }
+    else if (next->gbs) {
+        start_cue(p, 0, false, 0);
+    }
+    // without a spare instance, the next song is only remembered.
+    else {
+        start_song(p, (unsigned)next->song, next->end_frames, false, 0);
+        next->song = -1;
+    }
+}
+
+static void cue(AudioProducer* p, unsigned slot, unsigned song, unsigned end_frames)
+{
+    struct Voice* v = &p->cues[slot];
+    if (v->song == (int)song) {
+        v->end_frames = end_frames;
+    }
+    else {
+        voice_set_song(v, song, end_frames);
+    }
+}
+
+static void process_commands(AudioProducer* p)
+{
+    // a song change needs room to publish where it starts.
+    if (switch_queue_full(p)) {
+        return;
+    }
+
+    const int head = SDL_AtomicGet(&p->command_head);
+    int tail = SDL_AtomicGet(&p->command_tail);
+    // copied out, as the slots can be reused once the tail is moved.
+    struct Command play_cmd = {0};
+    struct Command cue_cmds[AUDIO_PRODUCER_MAX_CUES] = {0};
+    bool has_play = false;
+    bool has_cue[AUDIO_PRODUCER_MAX_CUES] = {0};
+
+    // only the last song change matters, so a burst of them resets once.
+    for (; tail != head; tail++) {
+        const struct Command* cmd = &p->commands[(unsigned)tail % COMMAND_QUEUE_SIZE];
+        switch (cmd->type) {
+            case CommandType_PLAY:
+                play_cmd = *cmd;
+                has_play = true;
+                break;
+            case CommandType_CUE:
+                cue_cmds[cmd->slot] = *cmd;
+                has_cue[cmd->slot] = true;
+                break;
+        }
+    }
+    SDL_AtomicSet(&p->command_tail, tail);
+
+    // play first, so that it can take over a voice that was cued before it.
+    if (has_play) {
+        play(p, play_cmd.song, play_cmd.end_frames, play_cmd.seq);
+        p->playing = true;
+    }
+
+    for (unsigned i = 0; i < AUDIO_PRODUCER_MAX_CUES; i++) {
+        if (has_cue[i]) {
+            cue(p, i, cue_cmds[i].song, cue_cmds[i].end_frames);
+        }
+    }
+}
+
+static void adapt_depth(AudioProducer* p, unsigned fill, unsigned frames, unsigned render_us)
+{
+    const unsigned underruns = (unsigned)SDL_AtomicGet(&p->stat_underruns);
+    const unsigned headroom_us = (unsigned)((Uint64)fill * 1000000 / p->freq);
+
+    if (underruns != p->last_underruns) {
+        p->last_underruns = underruns;
+        p->depth *= 2;
+        p->frames_since_near_miss = 0;
+    }
+    // ignore the fill up after a song change, the ring is expected to be empty.
+    else if (fill >= p->min_depth && render_us * 2 > headroom_us) {
+        p->depth += p->depth / 2;
+        p->frames_since_near_miss = 0;
+    }
+    else {
+        p->frames_since_near_miss += frames;
+        if (p->frames_since_near_miss >= p->freq * SHRINK_INTERVAL) {
+            p->depth -= p->depth / 8;
+            p->frames_since_near_miss = 0;
+        }
+    }
+
+    p->depth = SDL_clamp(p->depth, p->min_depth, p->max_depth);
+    SDL_AtomicSet(&p->stat_depth, (int)p->depth);
+}
+
+static void wait_for_space(AudioProducer* p)
+{
+    SDL_AtomicSet(&p->waiting, 1);
+    SDL_SemWaitTimeout(p->wake, WAIT_TIMEOUT_MS);
+    SDL_AtomicSet(&p->waiting, 0);
+}
+
+// writes the next chunk of the current song into the ring.
+static void produce(AudioProducer* p, unsigned head, unsigned fill)
+{
+    struct Voice* v = &p->voice;
+
+    if (voice_finished(v)) {
+        advance(p);
+        return;
+    }
+
+    // stop at the wrap point.
+    unsigned frames = SDL_min(CHUNK_FRAMES, RING_FRAMES - (head & RING_MASK));
+    short* dst = p->ring + (head & RING_MASK) * 2;
+
+    if (v->drained < v->buffered) {
+        frames = SDL_min(frames, v->buffered - v->drained);
+        SDL_memcpy(dst, v->buffer + v->drained * 2, frames * 2 * sizeof(short));
+        v->drained += frames;
+        SDL_AtomicSet(&p->head, (int)(head + frames));
+        return;
+    }
+
+    const Uint64 render_start = SDL_GetPerformanceCounter();
+    frames = voice_render(v, dst, frames);
+    const unsigned render_us = ticks_to_us(SDL_GetPerformanceCounter() - render_start);
+
+    SDL_AtomicSet(&p->head, (int)(head + frames));
+
+    stat_max(&p->stat_max_render_us, render_us);
+    adapt_depth(p, fill, frames, render_us);
+}
+
+// does one step of pre-rendering a cued song, returns false if there was nothing to do.
+static bool prerender(AudioProducer* p)
+{
+    for (unsigned i = 0; i < p->cue_count; i++) {
+        struct Voice* v = &p->cues[i];
+        if (v->song < 0) {
+            continue;
+        }
+
+        if (v->reset) {
+            gbs_set_song(v->gbs, (uint8_t)v->song);
+            v->reset = false;
+            return true;
+        }
+
+        unsigned wanted = p->cue_frames;
+        if (v->end_frames) {
+            wanted = SDL_min(wanted, v->end_frames);
+        }
+
+        if (v->buffered < wanted) {
+            const unsigned frames = SDL_min(CHUNK_FRAMES, wanted - v->buffered);
+            v->buffered += voice_render(v, v->buffer + v->buffered * 2, frames);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int producer_thread(void* user)
+{
+    AudioProducer* p = user;
+
+    while (!SDL_AtomicGet(&p->quit)) {
+        process_commands(p);
+
+        if (!p->playing) {
+            SDL_SemWait(p->wake);
+            continue;
+        }
+
+        const unsigned head = (unsigned)SDL_AtomicGet(&p->head);
+        const unsigned tail = (unsigned)SDL_AtomicGet(&p->tail);
+
+        // samples of the previous song still in the ring don't count towards the depth.
+        const unsigned start = (int)(p->skip_pos - tail) > 0 ? p->skip_pos : tail;
+        const unsigned fill = head - start;
+        const unsigned space = RING_FRAMES - (head - tail);
+
+        if (fill < p->depth && space >= CHUNK_FRAMES && !switch_queue_full(p)) {
+            produce(p, head, fill);
+        }
+        // the ring is full enough, use the spare time to get the next songs ready.
+        else if (!prerender(p)) {
+            wait_for_space(p);
+        }
+    }
+
+    return 0;
+}
+
+AudioProducer* audio_producer_init(Gbs* gbs, Gbs* const* cue_gbs, unsigned cue_count, unsigned freq, unsigned callback_frames)
+{
+    AudioProducer* p = SDL_calloc(1, sizeof(*p));
+    if (!p) {
+        return NULL;
+    }
+
+    p->freq = freq;
+    p->min_depth = SDL_max(callback_frames * 2, CHUNK_FRAMES * 2);
+    p->max_depth = RING_FRAMES - CHUNK_FRAMES;
+    p->min_depth = SDL_min(p->min_depth, p->max_depth);
+    p->depth = SDL_min(p->min_depth * 2, p->max_depth);
+    SDL_AtomicSet(&p->stat_depth, (int)p->depth);
+
+    p->voice.gbs = gbs;
+    p->voice.song = -1;
+    for (unsigned i = 0; i < AUDIO_PRODUCER_MAX_CUES; i++) {
+        p->cues[i].song = -1;
+    }
+    p->cue_count = SDL_min(cue_count, AUDIO_PRODUCER_MAX_CUES);
+    p->cue_frames = freq * CUE_SECONDS;
+
+    // every voice gets a buffer, as the current voice swaps with the cued ones.
+    for (unsigned i = 0; i < p->cue_count; i++) {
+        p->cues[i].gbs = cue_gbs[i];
+        if (!(p->cues[i].buffer = SDL_malloc(p->cue_frames * 2 * sizeof(short)))) {
+            goto fail;
+        }
+    }
+
+    if (p->cue_count && !(p->voice.buffer = SDL_malloc(p->cue_frames * 2 * sizeof(short)))) {
+        goto fail;
+    }
+
+    if (!(p->ring = SDL_calloc(RING_FRAMES * 2, sizeof(*p->ring)))) {
+        goto fail;
+    }
+
+    if (!(p->wake = SDL_CreateSemaphore(0))) {
+        goto fail;
+    }
+
+    if (!(p->thread = SDL_CreateThread(producer_thread, "audio_producer", p))) {
+        goto fail;
+    }
+
+    return p;
+
+fail:
+    audio_producer_quit(p);
+    return NULL;
+}
+
+void audio_producer_quit(AudioProducer* p)
+{
+    if (!p) {
+        return;
+    }
+
+    if (p->thread) {
+        SDL_AtomicSet(&p->quit, 1);
+        SDL_SemPost(p->wake);
+        SDL_WaitThread(p->thread, NULL);
+    }
+
+    if (p->wake) {
+        SDL_DestroySemaphore(p->wake);
+    }
+
+    SDL_free(p->voice.buffer);
+    for (unsigned i = 0; i < p->cue_count; i++) {
+        SDL_free(p->cues[i].buffer);
+    }
+
+    SDL_free(p->ring);
+    SDL_free(p);
+}
+
+static bool push_command(AudioProducer* p, const struct Command* cmd)
+{
+    const int head = SDL_AtomicGet(&p->command_head);
+    if ((unsigned)(head - SDL_AtomicGet(&p->command_tail)) >= COMMAND_QUEUE_SIZE) {
+        return false;
+    }
+
+    p->commands[(unsigned)head % COMMAND_QUEUE_SIZE] = *cmd;
+    SDL_AtomicSet(&p->command_head, head + 1);
+
+    SDL_SemPost(p->wake);
+    return true;
+}
+
+bool audio_producer_play(AudioProducer* p, unsigned song, unsigned end_frames)
+{
+    const struct Command cmd = {
+        .type = CommandType_PLAY,
+        .song = song,
+        .end_frames = end_frames,
+        .seq = p->play_seq + 1,
+    };
+
+    if (!push_command(p, &cmd)) {
+        return false;
+    }
+
+    p->play_seq++;
+    return true;
+}
+
+bool audio_producer_cue(AudioProducer* p, unsigned slot, unsigned song, unsigned end_frames)
+{
+    if (slot >= AUDIO_PRODUCER_MAX_CUES) {
+        return false;
+    }
+
+    const struct Command cmd = {
+        .type = CommandType_CUE,
+        .slot = slot,
+        .song = song,
+        .end_frames = end_frames,
+    };
+
+    return push_command(p, &cmd);
+}
+
+// moves the heard position past every song boundary the reader has reached.
+static void apply_switches(AudioProducer* p)
+{
+    const int head = SDL_AtomicGet(&p->switch_head);
+    int index = SDL_AtomicGet(&p->switch_tail);
+    unsigned tail = (unsigned)SDL_AtomicGet(&p->tail);
+
+    // a song change drops everything queued before it.
+    int skip_to = index;
+    for (int i = index; i != head; i++) {
+        if (p->switches[(unsigned)i % SWITCH_QUEUE_SIZE].skip) {
+            skip_to = i + 1;
+        }
+    }
+
+    for (; index != head; index++) {
+        const struct Switch* s = &p->switches[(unsigned)index % SWITCH_QUEUE_SIZE];
+        if (index - skip_to >= 0 && (int)(tail - s->pos) < 0) {
+            break;
+        }
+
+        if (s->skip) {
+            // the last read may have already reached into the new song.
+            if ((int)(s->pos - tail) > 0) {
+                tail = s->pos;
+            }
+            p->started = tail != s->pos;
+            SDL_AtomicSet(&p->heard_play_seq, s->play_seq);
+        }
+
+        SDL_AtomicSet(&p->song, (int)s->song);
+        SDL_AtomicSet(&p->frames, (int)(tail - s->pos));
+    }
+
+    SDL_AtomicSet(&p->tail, (int)tail);
+    SDL_AtomicSet(&p->switch_tail, index);
+}
+
+void audio_producer_read(AudioProducer* p, short* out, size_t count)
+{
+    const Uint64 start = SDL_GetPerformanceCounter();
+
+    apply_switches(p);
+
+    const unsigned head = (unsigned)SDL_AtomicGet(&p->head);
+    const unsigned tail = (unsigned)SDL_AtomicGet(&p->tail);
+    const unsigned wanted = (unsigned)(count / 2);
+    const unsigned frames = SDL_min(head - tail, wanted);
+
+    // copy in up to two parts, as the data may wrap around the ring.
+    const unsigned offset = tail & RING_MASK;
+    const unsigned first = SDL_min(frames, RING_FRAMES - offset);
+    SDL_memcpy(out, p->ring + offset * 2, first * 2 * sizeof(short));
+    SDL_memcpy(out + first * 2, p->ring, (frames - first) * 2 * sizeof(short));
+
+    SDL_AtomicSet(&p->tail, (int)(tail + frames));
+
+    if (frames < wanted) {
+        SDL_memset(out + frames * 2, 0, (count - frames * 2) * sizeof(short));
+        // not an underrun if the first samples of a song aren't ready yet.
+        if (p->started) {
+            SDL_AtomicAdd(&p->stat_underruns, 1);
+        }
+    }
+
+    if (frames) {
+        p->started = true;
+        SDL_AtomicAdd(&p->frames, (int)frames);
+        // the read may have crossed into the next song.
+        apply_switches(p);
+    }
+
+    if (SDL_AtomicCAS(&p->waiting, 1, 0)) {
+        SDL_SemPost(p->wake);
+    }
+
+    stat_max(&p->stat_max_callback_us, ticks_to_us(SDL_GetPerformanceCounter() - start));
+}
+
+bool audio_producer_get_position(AudioProducer* p, unsigned* song, unsigned* frames)
+{
+    *song = (unsigned)SDL_AtomicGet(&p->song);
+    *frames = (unsigned)SDL_AtomicGet(&p->frames);
+    return SDL_AtomicGet(&p->heard_play_seq) == p->play_seq;
+}
+
+void audio_producer_get_stats(AudioProducer* p, struct AudioProducerStats* stats)
+{
+    stats->underruns = (unsigned)SDL_AtomicGet(&p->stat_underruns);
+    stats->depth = (unsigned)SDL_AtomicGet(&p->stat_depth);
+    stats->max_render_us = (unsigned)SDL_AtomicGet(&p->stat_max_render_us);
+    stats->max_callback_us = (unsigned)SDL_AtomicGet(&p->stat_max_callback_us);
+    stats->cue_hits = (unsigned)SDL_AtomicGet(&p->stat_cue_hits);
+    stats->cue_misses = (unsigned)SDL_AtomicGet(&p->stat_cue_misses);
+}
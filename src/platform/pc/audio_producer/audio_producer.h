@@ -0,0 +1,83 @@
+#ifndef AUDIO_PRODUCER_H
+#define AUDIO_PRODUCER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* renders a gbs on its own thread into a lock-free single producer /
+* single consumer ring, so that the audio callback only copies samples.
+*
+* song changes are sent to the thread through a command queue. samples
+* of the old song that are still in the ring are skipped by the reader.
+*
+* the ring depth adapts to how long rendering takes, it grows after an
+* underrun or a near miss and slowly shrinks back when rendering is fast.
+*
+* extra gbs instances can be given to cue the songs that are likely to be
+* played next. they are reset and the first few seconds rendered while the
+* ring is full, so that switching to them is instant. when a song reaches
+* its end, the song in the first cue slot follows on the next sample.
+*/
+
+enum { AUDIO_PRODUCER_MAX_CUES = 2 };
+
+struct AudioProducerStats {
+    unsigned underruns; // callbacks that were (partly) filled with silence.
+    unsigned depth; // current target depth, in frames.
+    unsigned max_render_us; // slowest chunk rendered.
+    unsigned max_callback_us; // slowest audio_producer_read().
+    unsigned cue_hits; // song starts that were already pre-rendered.
+    unsigned cue_misses; // song starts that had to be reset first.
+};
+
+typedef struct AudioProducer AudioProducer;
+
+/*
+* the producer owns gbs and cue_gbs until audio_producer_quit(), they must
+* not be used by any other thread in the meantime. the instances are swapped
+* around internally, so all of them must be loaded with the same file.
+* cue_count may be 0 to disable cueing.
+* callback_frames is the audio device buffer size, used as the min depth.
+*/
+AudioProducer* audio_producer_init(Gbs* gbs, Gbs* const* cue_gbs, unsigned cue_count, unsigned freq, unsigned callback_frames);
+void audio_producer_quit(AudioProducer*);
+
+/*
+* queues a song change, returns false if the queue is full.
+* end_frames is where the song ends and the first cue starts, 0 to never end.
+*/
+bool audio_producer_play(AudioProducer*, unsigned song, unsigned end_frames);
+
+/*
+* queues song to be pre-rendered in slot, replacing what was cued there.
+* slot 0 is also the song that follows when the current one ends, which
+* works without an instance for it, the song just isn't pre-rendered.
+* returns false if the queue is full or slot is out of range.
+*/
+bool audio_producer_cue(AudioProducer*, unsigned slot, unsigned song, unsigned end_frames);
+
+/*
+* called from the audio callback, fills count samples (stereo).
+* never blocks, outputs silence if not enough samples are ready.
+*/
+void audio_producer_read(AudioProducer*, short* out, size_t count);
+
+/*
+* song that is being heard and the number of frames of it played so far.
+* returns false while the last queued song change hasn't been heard yet.
+*/
+bool audio_producer_get_position(AudioProducer*, unsigned* song, unsigned* frames);
+void audio_producer_get_stats(AudioProducer*, struct AudioProducerStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUDIO_PRODUCER_H
@@ -0,0 +1,302 @@
+#include "batch_render.h"
+
+#include <SDL.h>
+
+// files loaded but not yet finished, per worker.
+enum { FILES_AHEAD_PER_WORKER = 2 };
+
+struct BatchFile {
+    void* handle;
+    size_t index;
+    // songs not yet rendered, the worker that takes it to 0 unloads the file.
+    SDL_atomic_t remaining;
+};
+
+struct Task {
+    struct BatchFile* file;
+    unsigned song;
+};
+
+// a ring of tasks, the owner pops from the bottom and thieves from the top.
+struct Deque {
+    SDL_mutex* lock;
+    struct Task* tasks;
+    size_t capacity;
+    // free running, top is the oldest task.
+    size_t top;
+    size_t bottom;
+};
+
+struct BatchRender {
+    const struct BatchRenderInterface* iface;
+    void* user;
+    unsigned worker_count;
+    struct Deque deques[BATCH_RENDER_MAX_WORKERS];
+
+    // tasks in the deques, counted before they are pushed.
+    SDL_atomic_t pending;
+    SDL_atomic_t songs;
+    SDL_atomic_t failed_songs;
+    SDL_atomic_t steals;
+
+    SDL_mutex* lock;
+    SDL_cond* changed;
+
+    // everything below is guarded by lock.
+    size_t loaded;
+    size_t max_loaded;
+    bool load_done;
+};
+
+struct Worker {
+    struct BatchRender* r;
+    unsigned index;
+};
+
+// makes room for count more tasks, called with the lock held.
+static bool deque_reserve(struct Deque* d, size_t count)
+{
+    const size_t used = d->bottom - d->top;
+    if (used + count <= d->capacity) {
+        return true;
+    }
+
+    size_t capacity = d->capacity ? d->capacity : 256;
+    while (capacity < used + count) {
+        capacity *= 2;
+    }
+
+    struct Task* tasks = SDL_malloc(capacity * sizeof(*tasks));
+    if (!tasks) {
+        return false;
+    }
+
+    for (size_t i = 0; i < used; i++) {
+        tasks[i] = d->tasks[(d->top + i) % d->capacity];
+    }
+
+    SDL_free(d->tasks);
+    d->tasks = tasks;
+    d->capacity = capacity;
+    d->top = 0;
+    d->bottom = used;
+    return true;
+}
+
+static bool deque_push_file(struct Deque* d, struct BatchFile* file, unsigned count)
+{
+    SDL_LockMutex(d->lock);
+    const bool result = deque_reserve(d, count);
+    // pushed last song first, so the owner starts on the first song.
+    for (unsigned i = 0; result && i < count; i++) {
+        d->tasks[d->bottom++ % d->capacity] = (struct Task){ .file = file, .song = count - 1 - i };
+    }
+    SDL_UnlockMutex(d->lock);
+    return result;
+}
+
+static bool deque_pop(struct Deque* d, struct Task* task)
+{
+    SDL_LockMutex(d->lock);
+    const bool result = d->bottom != d->top;
+    if (result) {
+        *task = d->tasks[--d->bottom % d->capacity];
+    }
+    SDL_UnlockMutex(d->lock);
+    return result;
+}
+
+static bool deque_steal(struct Deque* d, struct Task* task)
+{
+    SDL_LockMutex(d->lock);
+    const bool result = d->bottom != d->top;
+    if (result) {
+        *task = d->tasks[d->top++ % d->capacity];
+    }
+    SDL_UnlockMutex(d->lock);
+    return result;
+}
+
+// the next worker along is tried first, so thieves spread out over the queues.
+static bool steal(struct BatchRender* r, unsigned self, struct Task* task)
+{
+    for (unsigned i = 1; i < r->worker_count; i++) {
+        if (deque_steal(&r->deques[(self + i) % r->worker_count], task)) {
+            SDL_AtomicAdd(&r->steals, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void file_done(struct BatchRender* r, struct BatchFile* file)
+{
+    r->iface->unload(r->user, file->handle);
+    SDL_free(file);
+
+    SDL_LockMutex(r->lock);
+    r->loaded--;
+    SDL_CondBroadcast(r->changed);
+    SDL_UnlockMutex(r->lock);
+}
+
+static int worker_thread(void* user)
+{
+    struct Worker* w = user;
+    struct BatchRender* r = w->r;
+
+    for (;;) {
+        struct Task task;
+        if (!deque_pop(&r->deques[w->index], &task) && !steal(r, w->index, &task)) {
+            // pending is raised before a push, so this may briefly spin until it lands.
+            SDL_LockMutex(r->lock);
+            while (!SDL_AtomicGet(&r->pending) && !r->load_done) {
+                SDL_CondWait(r->changed, r->lock);
+            }
+            const bool done = !SDL_AtomicGet(&r->pending) && r->load_done;
+            SDL_UnlockMutex(r->lock);
+
+            if (done) {
+                break;
+            }
+            continue;
+        }
+
+        SDL_AtomicAdd(&r->pending, -1);
+
+        struct BatchFile* file = task.file;
+        if (!r->iface->render(r->user, w->index, file->index, file->handle, task.song)) {
+            SDL_AtomicAdd(&r->failed_songs, 1);
+        }
+        SDL_AtomicAdd(&r->songs, 1);
+
+        if (SDL_AtomicAdd(&file->remaining, -1) == 1) {
+            file_done(r, file);
+        }
+    }
+
+    return 0;
+}
+
+// loads the files in order, waiting while too many are unfinished.
+static void load_files(struct BatchRender* r, size_t file_count, struct BatchRenderStats* stats)
+{
+    for (size_t i = 0; i < file_count; i++) {
+        SDL_LockMutex(r->lock);
+        while (r->loaded >= r->max_loaded) {
+            SDL_CondWait(r->changed, r->lock);
+        }
+        r->loaded++;
+        SDL_UnlockMutex(r->lock);
+
+        unsigned count = 0;
+        struct BatchFile* file = NULL;
+        void* handle = r->iface->load(r->user, i, &count);
+        if (handle && count && (file = SDL_malloc(sizeof(*file)))) {
+            file->handle = handle;
+            file->index = i;
+            SDL_AtomicSet(&file->remaining, (int)count);
+
+            SDL_AtomicAdd(&r->pending, (int)count);
+            if (!deque_push_file(&r->deques[i % r->worker_count], file, count)) {
+                SDL_AtomicAdd(&r->pending, -(int)count);
+                SDL_free(file);
+                file = NULL;
+            }
+        }
+
+        SDL_LockMutex(r->lock);
+        if (file) {
+            stats->files++;
+        }
+        else {
+            if (handle) {
+                r->iface->unload(r->user, handle);
+            }
+            stats->failed_files++;
+            r->loaded--;
+        }
+        SDL_CondBroadcast(r->changed);
+        SDL_UnlockMutex(r->lock);
+    }
+
+    SDL_LockMutex(r->lock);
+    r->load_done = true;
+    SDL_CondBroadcast(r->changed);
+    SDL_UnlockMutex(r->lock);
+}
+
+bool batch_render_run(const struct BatchRenderInterface* iface, void* user, size_t file_count, unsigned worker_count, struct BatchRenderStats* stats)
+{
+    struct BatchRender* r = SDL_calloc(1, sizeof(*r));
+    SDL_memset(stats, 0, sizeof(*stats));
+    if (!r) {
+        return false;
+    }
+
+    struct Worker w[BATCH_RENDER_MAX_WORKERS];
+    SDL_Thread* threads[BATCH_RENDER_MAX_WORKERS];
+    unsigned thread_count = 0;
+    bool result = false;
+
+    r->iface = iface;
+    r->user = user;
+    r->worker_count = SDL_clamp(worker_count, 1, BATCH_RENDER_MAX_WORKERS);
+    r->max_loaded = (size_t)r->worker_count * FILES_AHEAD_PER_WORKER;
+
+    if (!(r->lock = SDL_CreateMutex()) || !(r->changed = SDL_CreateCond())) {
+        goto done;
+    }
+    for (unsigned i = 0; i < r->worker_count; i++) {
+        if (!(r->deques[i].lock = SDL_CreateMutex())) {
+            goto done;
+        }
+    }
+
+    for (unsigned i = 0; i < r->worker_count; i++) {
+        w[i] = (struct Worker){ .r = r, .index = i };
+        if (!(threads[thread_count] = SDL_CreateThread(worker_thread, "batch_render", &w[i]))) {
+            break;
+        }
+        thread_count++;
+    }
+
+    // every queue needs its owner, otherwise its songs could wait for a thief forever.
+    if (thread_count == r->worker_count) {
+        load_files(r, file_count, stats);
+        result = true;
+    }
+    else {
+        SDL_LockMutex(r->lock);
+        r->load_done = true;
+        SDL_CondBroadcast(r->changed);
+        SDL_UnlockMutex(r->lock);
+    }
+
+done:
+    if (!result) {
+        SDL_SetError("failed to start batch workers");
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+
+    stats->songs = (unsigned)SDL_AtomicGet(&r->songs);
+    stats->failed_songs = (unsigned)SDL_AtomicGet(&r->failed_songs);
+    stats->steals = (unsigned)SDL_AtomicGet(&r->steals);
+
+    for (unsigned i = 0; i < BATCH_RENDER_MAX_WORKERS; i++) {
+        if (r->deques[i].lock) {
+            SDL_DestroyMutex(r->deques[i].lock);
+        }
+        SDL_free(r->deques[i].tasks);
+    }
+    if (r->changed) {
+        SDL_DestroyCond(r->changed);
+    }
+    if (r->lock) {
+        SDL_DestroyMutex(r->lock);
+    }
+    SDL_free(r);
+    return result;
+}
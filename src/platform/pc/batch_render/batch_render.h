@@ -0,0 +1,49 @@
+#ifndef BATCH_RENDER_H
+#define BATCH_RENDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* renders every song of a list of files on a pool of worker threads.
+*
+* the calling thread loads the files in order, a few ahead of the workers,
+* so that unpacking them overlaps with rendering. each loaded file has all
+* of its songs pushed onto the queue of one worker, which takes the newest
+* first, while an idle worker steals the oldest song from another's queue.
+* so a file with many songs is spread over every worker, without them
+* fighting over a single queue.
+*
+* a file is unloaded by whichever worker finishes its last song.
+*/
+
+enum { BATCH_RENDER_MAX_WORKERS = 64 };
+
+struct BatchRenderInterface {
+    // called on the calling thread, returns NULL if the file can't be used.
+    void* (*load)(void* user, size_t index, unsigned* song_count);
+    // called on worker thread worker, song counts from 0.
+    bool (*render)(void* user, unsigned worker, size_t index, void* file, unsigned song);
+    void (*unload)(void* user, void* file);
+};
+
+struct BatchRenderStats {
+    unsigned files; // files loaded.
+    unsigned failed_files; // files that failed to load.
+    unsigned songs; // songs rendered.
+    unsigned failed_songs; // songs that failed to render.
+    unsigned steals; // songs taken from another worker's queue.
+};
+
+/* returns false if the workers could not be started, stats are still set. */
+bool batch_render_run(const struct BatchRenderInterface* iface, void* user, size_t file_count, unsigned worker_count, struct BatchRenderStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BATCH_RENDER_H
@@ -0,0 +1,513 @@
+#include "catalog_scan.h"
+#include "catalog/catalog.h"
+#include "m3u/m3u.h"
+#include "sevenzip/sevenzip.h"
+#include "zip/zip.h"
+#include "gbs.h"
+
+#include <SDL.h>
+#include <stdio.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <glob.h>
+    #include <sys/stat.h>
+#endif
+
+enum { MAX_THREADS = 64 };
+
+struct ScanJob {
+    char* path;
+    Uint64 mtime;
+    Uint64 size;
+    // set if the file is unchanged since the old catalog.
+    const struct CatalogFile* old;
+
+    bool ok;
+    struct GbsMeta meta;
+    struct M3uPlaylist playlist;
+};
+
+struct ScanList {
+    struct ScanJob* jobs;
+    size_t count;
+    size_t capacity;
+};
+
+struct ScanPool {
+    struct ScanList* list;
+    SDL_atomic_t next;
+};
+
+static bool is_supported(const char* name)
+{
+    const char* ext = SDL_strrchr(name, '.');
+    return ext && (!SDL_strcasecmp(ext, ".gbs") || !SDL_strcasecmp(ext, ".zip") || !SDL_strcasecmp(ext, ".7z"));
+}
+
+static bool list_add(struct ScanList* list, const char* path, Uint64 mtime, Uint64 size)
+{
+    if (list->count == list->capacity) {
+        const size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        struct ScanJob* jobs = SDL_realloc(list->jobs, capacity * sizeof(*jobs));
+        if (!jobs) {
+            return false;
+        }
+        list->jobs = jobs;
+        list->capacity = capacity;
+    }
+
+    struct ScanJob* job = &list->jobs[list->count];
+    SDL_memset(job, 0, sizeof(*job));
+    if (!(job->path = SDL_strdup(path))) {
+        return false;
+    }
+    job->mtime = mtime;
+    job->size = size;
+    list->count++;
+    return true;
+}
+
+static bool walk_dir(struct ScanList* list, const char* dir)
+{
+    char path[1024];
+    bool result = true;
+
+#if defined(_WIN32)
+    SDL_snprintf(path, sizeof(path), "%s\\*", dir);
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(path, &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    do {
+        if (!SDL_strcmp(data.cFileName, ".") || !SDL_strcmp(data.cFileName, "..")) {
+            continue;
+        }
+
+        SDL_snprintf(path, sizeof(path), "%s/%s", dir, data.cFileName);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            continue;
+        }
+        else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            walk_dir(list, path);
+        }
+        else if (is_supported(data.cFileName)) {
+            const Uint64 mtime = ((Uint64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+            const Uint64 size = ((Uint64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+            result = list_add(list, path, mtime, size);
+        }
+    } while (result && FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR* d = opendir(dir);
+    if (!d) {
+        return false;
+    }
+
+    struct dirent* entry;
+    while (result && (entry = readdir(d))) {
+        if (!SDL_strcmp(entry->d_name, ".") || !SDL_strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        SDL_snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        // symlinks are not followed to avoid loops.
+        struct stat st;
+        if (lstat(path, &st)) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            walk_dir(list, path);
+        }
+        else if (S_ISREG(st.st_mode) && is_supported(entry->d_name)) {
+            result = list_add(list, path, (Uint64)st.st_mtime, (Uint64)st.st_size);
+        }
+    }
+
+    closedir(d);
+#endif
+
+    return result;
+}
+
+// a dir is walked, a supported file is added as is.
+static bool add_path(struct ScanList* list, const char* path)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) {
+        return false;
+    }
+
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        return walk_dir(list, path);
+    }
+
+    const Uint64 mtime = ((Uint64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    const Uint64 size = ((Uint64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st)) {
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return walk_dir(list, path);
+    }
+
+    const Uint64 mtime = (Uint64)st.st_mtime;
+    const Uint64 size = (Uint64)st.st_size;
+#endif
+
+    // an unsupported file named directly is skipped, like one found in a dir.
+    return !is_supported(path) || list_add(list, path, mtime, size);
+}
+
+static int compare_jobs(const void* a, const void* b)
+{
+    return SDL_strcmp(((const struct ScanJob*)a)->path, ((const struct ScanJob*)b)->path);
+}
+
+static size_t file_io_read(void* user, void* dst, size_t size, size_t addr)
+{
+    if (SDL_RWseek(user, addr, RW_SEEK_SET) < 0) {
+        return 0;
+    }
+    return SDL_RWread(user, dst, 1, size);
+}
+
+static void scan_gbs(struct ScanJob* job)
+{
+    struct GbsIo io = {0};
+    if (!(io.user = SDL_RWFromFile(job->path, "rb"))) {
+        return;
+    }
+
+    io.read = file_io_read;
+    job->ok = gbs_get_meta_io(&io, &job->meta);
+    SDL_RWclose(io.user);
+}
+
+static void scan_zip(struct ScanJob* job)
+{
+    Zip* zip = zip_open(job->path);
+    if (!zip) {
+        return;
+    }
+
+    const size_t count = zip_get_entry_count(zip);
+    for (size_t i = 0; i < count && !job->ok; i++) {
+        const struct ZipEntry* entry = zip_get_entry(zip, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".gbs") && entry->uncompressed_size >= GBS_HEADER_SIZE) {
+            // only the header is inflated.
+            ZipStream* stream = zip_stream_open(zip, entry, GBS_HEADER_SIZE, 1);
+            if (stream) {
+                Uint8 header[GBS_HEADER_SIZE];
+                if (zip_stream_read(stream, header, sizeof(header), 0) == sizeof(header)) {
+                    job->ok = gbs_get_meta_data(header, sizeof(header), &job->meta);
+                }
+                zip_stream_close(stream);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count && job->ok; i++) {
+        const struct ZipEntry* entry = zip_get_entry(zip, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".m3u")) {
+            const void* data = zip_entry_data(zip, entry);
+            if (data) {
+                m3u_playlist_parse(&job->playlist, data, entry->uncompressed_size);
+                continue;
+            }
+
+            char* buffer = SDL_malloc(entry->uncompressed_size);
+            if (buffer) {
+                const size_t size = zip_entry_read(zip, entry, buffer, entry->uncompressed_size);
+                if (size == entry->uncompressed_size) {
+                    m3u_playlist_parse(&job->playlist, buffer, size);
+                }
+                SDL_free(buffer);
+            }
+        }
+    }
+
+    zip_close(zip);
+}
+
+static void scan_7z(struct ScanJob* job)
+{
+    SevenZip* sz = sevenzip_open(job->path);
+    if (!sz) {
+        return;
+    }
+
+    const size_t count = sevenzip_get_entry_count(sz);
+    for (size_t i = 0; i < count && !job->ok; i++) {
+        const struct SevenZipEntry* entry = sevenzip_get_entry(sz, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".gbs") && entry->size >= GBS_HEADER_SIZE) {
+            // solid blocks can't be seeked, so this decodes up to the end of the gbs.
+            const Uint8* data = sevenzip_entry_data(sz, entry);
+            if (data) {
+                job->ok = gbs_get_meta_data(data, entry->size, &job->meta);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count && job->ok; i++) {
+        const struct SevenZipEntry* entry = sevenzip_get_entry(sz, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".m3u")) {
+            const Uint8* data = sevenzip_entry_data(sz, entry);
+            if (data) {
+                m3u_playlist_parse(&job->playlist, (const char*)data, entry->size);
+            }
+        }
+    }
+
+    sevenzip_close(sz);
+}
+
+static int scan_thread(void* user)
+{
+    struct ScanPool* pool = user;
+
+    for (;;) {
+        const size_t index = (size_t)SDL_AtomicAdd(&pool->next, 1);
+        if (index >= pool->list->count) {
+            break;
+        }
+
+        struct ScanJob* job = &pool->list->jobs[index];
+        if (job->old) {
+            continue;
+        }
+
+        const char* ext = SDL_strrchr(job->path, '.');
+        if (!ext) {
+            continue;
+        }
+
+        if (!SDL_strcasecmp(ext, ".gbs")) {
+            scan_gbs(job);
+        }
+        else if (!SDL_strcasecmp(ext, ".zip")) {
+            scan_zip(job);
+        }
+        else if (!SDL_strcasecmp(ext, ".7z")) {
+            scan_7z(job);
+        }
+    }
+
+    return 0;
+}
+
+static bool add_job(CatalogBuilder* builder, const Catalog* old, struct ScanJob* job)
+{
+    if (job->old) {
+        return catalog_builder_add_from(builder, old, job->old);
+    }
+
+    const struct M3uPlaylist* playlist = &job->playlist;
+    struct CatalogBuilderSong* songs = NULL;
+    if (playlist->count) {
+        if (!(songs = SDL_calloc(playlist->count, sizeof(*songs)))) {
+            return false;
+        }
+
+        // walking the songno table gives the songs in order.
+        size_t count = 0;
+        for (size_t i = 0; i < SDL_arraysize(playlist->songs); i++) {
+            const struct M3uEntry* entry = playlist->songs[i];
+            if (entry) {
+                songs[count].title = entry->title;
+                songs[count].time = entry->time;
+                songs[count].loop = entry->loop;
+                songs[count].fade = entry->fade;
+                songs[count].songno = entry->songno;
+                songs[count].loopcount = entry->loopcount;
+                count++;
+            }
+        }
+    }
+
+    const struct CatalogBuilderFile file = {
+        .path = job->path,
+        .mtime = job->mtime,
+        .size = job->size,
+        .title = job->meta.title_string,
+        .author = job->meta.author_string,
+        .copyright = job->meta.copyright_string,
+        .first_song = job->meta.first_song,
+        .max_song = job->meta.max_song,
+        .songs = songs,
+        .song_count = playlist->count,
+    };
+
+    const bool result = catalog_builder_add(builder, &file);
+    SDL_free(songs);
+    return result;
+}
+
+bool catalog_scan(const char* path, const char* const* dirs, size_t dir_count, unsigned jobs, struct CatalogScanStats* stats)
+{
+    struct ScanList list = {0};
+    CatalogBuilder* builder = NULL;
+    bool result = false;
+
+    SDL_memset(stats, 0, sizeof(*stats));
+
+    for (size_t i = 0; i < dir_count; i++) {
+        if (!walk_dir(&list, dirs[i])) {
+            SDL_SetError("failed to scan dir: %s", dirs[i]);
+            goto cleanup;
+        }
+    }
+
+    // a missing or invalid catalog simply means everything is rescanned.
+    Catalog* old = catalog_open(path);
+    if (old) {
+        for (size_t i = 0; i < list.count; i++) {
+            struct ScanJob* job = &list.jobs[i];
+            const struct CatalogFile* file = catalog_find_file(old, job->path);
+            if (file && file->mtime == job->mtime && file->size == job->size) {
+                job->old = file;
+            }
+        }
+    }
+
+    if (!jobs) {
+        jobs = SDL_GetCPUCount();
+    }
+    jobs = SDL_clamp(jobs, 1, MAX_THREADS);
+
+    struct ScanPool pool = { .list = &list };
+    SDL_Thread* threads[MAX_THREADS];
+    unsigned thread_count = 0;
+
+    for (unsigned i = 1; i < jobs; i++) {
+        if (!(threads[thread_count] = SDL_CreateThread(scan_thread, "catalog_scan", &pool))) {
+            break;
+        }
+        thread_count++;
+    }
+
+    // the calling thread takes part in the scan.
+    scan_thread(&pool);
+
+    for (unsigned i = 0; i < thread_count; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+
+    if (!(builder = catalog_builder_init())) {
+        catalog_close(old);
+        goto cleanup;
+    }
+
+    result = true;
+    stats->found = list.count;
+    for (size_t i = 0; i < list.count && result; i++) {
+        struct ScanJob* job = &list.jobs[i];
+        if (job->old) {
+            stats->reused++;
+        }
+        else if (job->ok) {
+            stats->scanned++;
+        }
+        else {
+            stats->failed++;
+            continue;
+        }
+
+        result = add_job(builder, old, job);
+    }
+
+    // old must stay mapped until every reused record is copied.
+    catalog_close(old);
+
+    if (!result) {
+        SDL_SetError("failed to build catalog");
+    }
+    else if (!(result = catalog_builder_write(builder, path))) {
+        SDL_SetError("failed to write catalog: %s", path);
+    }
+
+cleanup:
+    catalog_builder_quit(builder);
+    for (size_t i = 0; i < list.count; i++) {
+        m3u_playlist_free(&list.jobs[i].playlist);
+        SDL_free(list.jobs[i].path);
+    }
+    SDL_free(list.jobs);
+    return result;
+}
+
+bool catalog_scan_find(const char* const* paths, size_t path_count, char*** files, size_t* file_count)
+{
+    struct ScanList list = {0};
+    bool result = true;
+
+    for (size_t i = 0; i < path_count && result; i++) {
+#if defined(_WIN32)
+        result = add_path(&list, paths[i]);
+#else
+        // a pattern that matches nothing is kept, so it fails as a path.
+        glob_t matches;
+        if (glob(paths[i], GLOB_NOCHECK, NULL, &matches)) {
+            result = false;
+        }
+        else {
+            for (size_t j = 0; j < matches.gl_pathc && result; j++) {
+                result = add_path(&list, matches.gl_pathv[j]);
+            }
+            globfree(&matches);
+        }
+#endif
+        if (!result) {
+            SDL_SetError("failed to find: %s", paths[i]);
+        }
+    }
+
+    char** out = NULL;
+    if (result && list.count && !(out = SDL_malloc(list.count * sizeof(*out)))) {
+        result = false;
+    }
+
+    if (!result) {
+        for (size_t i = 0; i < list.count; i++) {
+            SDL_free(list.jobs[i].path);
+        }
+        SDL_free(list.jobs);
+        return false;
+    }
+
+    // readdir() order is arbitrary, sorting keeps the output the same each run.
+    SDL_qsort(list.jobs, list.count, sizeof(*list.jobs), compare_jobs);
+    for (size_t i = 0; i < list.count; i++) {
+        out[i] = list.jobs[i].path;
+    }
+
+    *files = out;
+    *file_count = list.count;
+    SDL_free(list.jobs);
+    return true;
+}
+
+void catalog_scan_free_files(char** files, size_t file_count)
+{
+    for (size_t i = 0; i < file_count; i++) {
+        SDL_free(files[i]);
+    }
+    SDL_free(files);
+}
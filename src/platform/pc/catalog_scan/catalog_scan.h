@@ -0,0 +1,42 @@
+#ifndef CATALOG_SCAN_H
+#define CATALOG_SCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* recursively scans directories for .gbs, .zip and .7z files and writes
+* a catalog (see catalog/catalog.h) to path.
+*
+* only the gbs header and m3u entries are read, the gbs is never loaded.
+* files are scanned on a pool of threads, and if path already holds a
+* catalog, files with the same mtime and size are copied from it as is.
+*/
+
+struct CatalogScanStats {
+    unsigned found; // supported files found in the dirs.
+    unsigned scanned; // new or changed files that were read.
+    unsigned reused; // unchanged files copied from the old catalog.
+    unsigned failed; // files that did not contain a valid gbs.
+};
+
+/* jobs = 0 uses one thread per cpu. */
+bool catalog_scan(const char* path, const char* const* dirs, size_t dir_count, unsigned jobs, struct CatalogScanStats* stats);
+
+/*
+* finds the supported files in paths, each of which may be a file, a dir
+* (searched recursively) or, outside of windows, a glob pattern. files are
+* sorted by path, and freed with catalog_scan_free_files().
+*/
+bool catalog_scan_find(const char* const* paths, size_t path_count, char*** files, size_t* file_count);
+void catalog_scan_free_files(char** files, size_t file_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CATALOG_SCAN_H
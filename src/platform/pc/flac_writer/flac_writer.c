@@ -0,0 +1,299 @@
+#include "flac_writer.h"
+#include "flac/flac.h"
+
+#include <SDL.h>
+
+// blocks per thread, so that the threads have more work queued while the
+// caller waits for the oldest block to finish.
+enum { SLOTS_PER_THREAD = 2 };
+
+// a block of samples and its encoded frame.
+struct Slot {
+    int16_t* samples;
+    unsigned frames;
+    uint32_t frame_number;
+    uint8_t* out;
+    // 0 if encoding failed.
+    size_t size;
+    bool done;
+};
+
+struct Worker {
+    FlacWriter* w;
+    FlacEncoder* encoder;
+    SDL_Thread* thread;
+};
+
+struct FlacWriter {
+    SDL_RWops* rw;
+    struct FlacFormat format;
+    struct FlacStreamInfo info;
+
+    struct Slot* slots;
+    unsigned slot_count;
+    struct Worker* workers;
+    unsigned worker_count;
+
+    SDL_mutex* mutex;
+    SDL_cond* job_cond;
+    SDL_cond* done_cond;
+
+    // free running block counters: head is being filled by the caller,
+    // tail is the next to be encoded, written is the next to be written.
+    uint32_t head;
+    uint32_t tail;
+    uint32_t written;
+    // frames in the head block.
+    unsigned fill;
+
+    bool quit;
+    bool error;
+};
+
+static int worker_thread(void* user)
+{
+    struct Worker* worker = user;
+    FlacWriter* w = worker->w;
+
+    SDL_LockMutex(w->mutex);
+
+    for (;;) {
+        while (w->tail == w->head && !w->quit) {
+            SDL_CondWait(w->job_cond, w->mutex);
+        }
+
+        if (w->tail == w->head) {
+            break;
+        }
+
+        struct Slot* s = &w->slots[w->tail++ % w->slot_count];
+        SDL_UnlockMutex(w->mutex);
+
+        s->size = flac_encoder_encode_frame(worker->encoder, s->samples, s->frames, s->frame_number, s->out);
+
+        SDL_LockMutex(w->mutex);
+        s->done = true;
+        SDL_CondSignal(w->done_cond);
+    }
+
+    SDL_UnlockMutex(w->mutex);
+    return 0;
+}
+
+// writes the oldest block, returns false if it isn't encoded yet and wait is false.
+static bool write_next(FlacWriter* w, bool wait)
+{
+    struct Slot* s = &w->slots[w->written % w->slot_count];
+
+    SDL_LockMutex(w->mutex);
+    while (!s->done) {
+        if (!wait) {
+            SDL_UnlockMutex(w->mutex);
+            return false;
+        }
+        SDL_CondWait(w->done_cond, w->mutex);
+    }
+    SDL_UnlockMutex(w->mutex);
+
+    if (!s->size || SDL_RWwrite(w->rw, s->out, 1, s->size) != s->size) {
+        w->error = true;
+    }
+
+    if (!w->info.min_frame_size || s->size < w->info.min_frame_size) {
+        w->info.min_frame_size = (uint32_t)s->size;
+    }
+    if (s->size > w->info.max_frame_size) {
+        w->info.max_frame_size = (uint32_t)s->size;
+    }
+
+    w->info.total_samples += s->frames;
+    w->written++;
+    return true;
+}
+
+static void submit(FlacWriter* w)
+{
+    struct Slot* s = &w->slots[w->head % w->slot_count];
+    s->frames = w->fill;
+    s->frame_number = w->head;
+    s->done = false;
+    w->fill = 0;
+
+    SDL_LockMutex(w->mutex);
+    w->head++;
+    SDL_CondSignal(w->job_cond);
+    SDL_UnlockMutex(w->mutex);
+
+    // write whatever is already done, then wait if there's no free block.
+    while (w->written != w->head && write_next(w, false)) {
+    }
+
+    while (w->head - w->written >= w->slot_count) {
+        write_next(w, true);
+    }
+}
+
+static void destroy(FlacWriter* w)
+{
+    if (w->mutex) {
+        SDL_LockMutex(w->mutex);
+        w->quit = true;
+        SDL_CondBroadcast(w->job_cond);
+        SDL_UnlockMutex(w->mutex);
+    }
+
+    if (w->workers) {
+        for (unsigned i = 0; i < w->worker_count; i++) {
+            if (w->workers[i].thread) {
+                SDL_WaitThread(w->workers[i].thread, NULL);
+            }
+            flac_encoder_quit(w->workers[i].encoder);
+        }
+        SDL_free(w->workers);
+    }
+
+    if (w->slots) {
+        for (unsigned i = 0; i < w->slot_count; i++) {
+            SDL_free(w->slots[i].samples);
+            SDL_free(w->slots[i].out);
+        }
+        SDL_free(w->slots);
+    }
+
+    if (w->done_cond) {
+        SDL_DestroyCond(w->done_cond);
+    }
+    if (w->job_cond) {
+        SDL_DestroyCond(w->job_cond);
+    }
+    if (w->mutex) {
+        SDL_DestroyMutex(w->mutex);
+    }
+
+    SDL_free(w);
+}
+
+FlacWriter* flac_writer_open(const char* path, const struct FlacWriterConfig* config)
+{
+    FlacWriter* w = SDL_calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+
+    w->format.sample_rate = config->sample_rate;
+    w->format.channels = config->channels;
+    w->format.block_size = config->block_size ? config->block_size : FLAC_DEFAULT_BLOCK_SIZE;
+    w->info.format = w->format;
+    w->worker_count = config->jobs ? config->jobs : (unsigned)SDL_max(SDL_GetCPUCount(), 1);
+    w->slot_count = w->worker_count * SLOTS_PER_THREAD;
+
+    if (config->block_size > FLAC_MAX_BLOCK_SIZE) {
+        goto fail;
+    }
+
+    if (!(w->mutex = SDL_CreateMutex()) || !(w->job_cond = SDL_CreateCond()) || !(w->done_cond = SDL_CreateCond())) {
+        goto fail;
+    }
+
+    if (!(w->workers = SDL_calloc(w->worker_count, sizeof(*w->workers)))) {
+        goto fail;
+    }
+
+    for (unsigned i = 0; i < w->worker_count; i++) {
+        w->workers[i].w = w;
+        if (!(w->workers[i].encoder = flac_encoder_init(&w->format))) {
+            goto fail;
+        }
+    }
+
+    const size_t max_frame_size = flac_encoder_get_max_frame_size(w->workers[0].encoder);
+    if (!(w->slots = SDL_calloc(w->slot_count, sizeof(*w->slots)))) {
+        goto fail;
+    }
+
+    for (unsigned i = 0; i < w->slot_count; i++) {
+        struct Slot* s = &w->slots[i];
+        if (!(s->samples = SDL_malloc(w->format.block_size * w->format.channels * sizeof(int16_t))) || !(s->out = SDL_malloc(max_frame_size))) {
+            goto fail;
+        }
+    }
+
+    for (unsigned i = 0; i < w->worker_count; i++) {
+        if (!(w->workers[i].thread = SDL_CreateThread(worker_thread, "flac_writer", &w->workers[i]))) {
+            goto fail;
+        }
+    }
+
+    if (!(w->rw = SDL_RWFromFile(path, "wb"))) {
+        goto fail;
+    }
+
+    // the sizes are filled in by flac_writer_close().
+    uint8_t header[FLAC_HEADER_SIZE];
+    flac_write_header(&w->info, header);
+    if (SDL_RWwrite(w->rw, header, 1, sizeof(header)) != sizeof(header)) {
+        SDL_RWclose(w->rw);
+        goto fail;
+    }
+
+    return w;
+
+fail:
+    destroy(w);
+    return NULL;
+}
+
+bool flac_writer_close(FlacWriter* w)
+{
+    if (!w) {
+        return false;
+    }
+
+    if (w->fill) {
+        submit(w);
+    }
+
+    while (w->written != w->head) {
+        write_next(w, true);
+    }
+
+    uint8_t header[FLAC_HEADER_SIZE];
+    flac_write_header(&w->info, header);
+    if (SDL_RWseek(w->rw, 0, RW_SEEK_SET) != 0 || SDL_RWwrite(w->rw, header, 1, sizeof(header)) != sizeof(header)) {
+        w->error = true;
+    }
+
+    if (SDL_RWclose(w->rw)) {
+        w->error = true;
+    }
+
+    const bool result = !w->error;
+    destroy(w);
+    return result;
+}
+
+size_t flac_writer_write_s16(FlacWriter* w, const int16_t* samples, size_t count)
+{
+    if (!w || !samples) {
+        return 0;
+    }
+
+    const unsigned channels = w->format.channels;
+    const size_t frames = count / channels;
+    size_t done = 0;
+
+    while (done < frames) {
+        struct Slot* s = &w->slots[w->head % w->slot_count];
+        const size_t n = SDL_min(w->format.block_size - w->fill, frames - done);
+
+        SDL_memcpy(s->samples + w->fill * channels, samples + done * channels, n * channels * sizeof(int16_t));
+        w->fill += n;
+        done += n;
+
+        if (w->fill == w->format.block_size) {
+            submit(w);
+        }
+    }
+
+    return done * channels;
+}
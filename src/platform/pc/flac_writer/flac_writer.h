@@ -0,0 +1,43 @@
+#ifndef FLAC_WRITER_H
+#define FLAC_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* writes 16-bit pcm to a flac file (see flac/flac.h).
+*
+* samples are copied into blocks, and full blocks are encoded on a pool of
+* threads while the caller carries on producing samples. encoded frames
+* are written to the file in order, the caller only waits once every
+* block is in flight.
+*/
+
+struct FlacWriterConfig {
+    uint32_t sample_rate;
+    uint8_t channels;
+    // frames per flac frame, 0 uses FLAC_DEFAULT_BLOCK_SIZE.
+    unsigned block_size;
+    // encoder threads, 0 uses one per cpu.
+    unsigned jobs;
+};
+
+typedef struct FlacWriter FlacWriter;
+
+FlacWriter* flac_writer_open(const char* path, const struct FlacWriterConfig* config);
+/* encodes the rest, writes the header and closes, returns false if anything failed. */
+bool flac_writer_close(FlacWriter*);
+
+/* count is in samples and must be a multiple of channels, returns the samples written. */
+size_t flac_writer_write_s16(FlacWriter*, const int16_t* samples, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLAC_WRITER_H
@@ -0,0 +1,649 @@
+#include "job_runner.h"
+
+#include <SDL.h>
+
+// longest input or result line.
+enum { LINE_MAX_SIZE = 16 * 1024 };
+// raw json of an id, echoed back as it was given.
+enum { ID_MAX_SIZE = 128 };
+enum { ERROR_MAX_SIZE = 256 };
+// deepest an unknown value may nest objects and arrays, so a line can't use up the stack.
+enum { SKIP_MAX_DEPTH = 32 };
+// jobs read ahead of the workers, per worker.
+enum { QUEUE_PER_WORKER = 4 };
+
+struct Pending {
+    struct Job job;
+    char id[ID_MAX_SIZE];
+    uint64_t line;
+    Uint64 queued;
+};
+
+struct JobRunner {
+    FILE* out;
+    const struct JobRunnerInterface* iface;
+    void* user;
+
+    SDL_mutex* lock;
+    SDL_cond* changed;
+    // everything below is guarded by lock.
+    struct Pending** queue;
+    size_t capacity;
+    // free running, tail is the oldest job.
+    size_t head;
+    size_t tail;
+    bool done;
+
+    // results are written a whole line at a time.
+    SDL_mutex* out_lock;
+    SDL_atomic_t jobs;
+    SDL_atomic_t failed;
+};
+
+struct Worker {
+    struct JobRunner* r;
+    unsigned index;
+};
+
+// a result line being built.
+struct Line {
+    char data[LINE_MAX_SIZE];
+    size_t size;
+};
+
+struct Parser {
+    const char* p;
+    char error[ERROR_MAX_SIZE];
+};
+
+static double ms_since(Uint64 start)
+{
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static void line_printf(struct Line* l, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int size = SDL_vsnprintf(l->data + l->size, sizeof(l->data) - l->size, fmt, args);
+    va_end(args);
+
+    if (size > 0) {
+        l->size = SDL_min(l->size + (size_t)size, sizeof(l->data) - 1);
+    }
+}
+
+static void line_string(struct Line* l, const char* s)
+{
+    line_printf(l, "\"");
+    for (; *s; s++) {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            line_printf(l, "\\%c", c);
+        }
+        else if (c < 0x20) {
+            line_printf(l, "\\u%04x", c);
+        }
+        else {
+            line_printf(l, "%c", c);
+        }
+    }
+    line_printf(l, "\"");
+}
+
+static void write_line(struct JobRunner* r, struct Line* l)
+{
+    line_printf(l, "}\n");
+
+    SDL_LockMutex(r->out_lock);
+    fputs(l->data, r->out);
+    fflush(r->out);
+    SDL_UnlockMutex(r->out_lock);
+}
+
+static void line_begin(struct Line* l, const char* id, uint64_t line)
+{
+    l->size = 0;
+    line_printf(l, "{\"id\":%s,\"line\":%llu", *id ? id : "null", (unsigned long long)line);
+}
+
+static void write_error(struct JobRunner* r, const char* id, uint64_t line, const char* error)
+{
+    struct Line l;
+    line_begin(&l, id, line);
+    line_printf(&l, ",\"status\":\"error\",\"error\":");
+    line_string(&l, error);
+    write_line(r, &l);
+    SDL_AtomicAdd(&r->failed, 1);
+}
+
+static void write_result(struct JobRunner* r, const struct Pending* p, const struct JobResult* result, double queue_ms, double total_ms)
+{
+    struct Line l;
+    line_begin(&l, p->id, p->line);
+    line_printf(&l, ",\"status\":\"ok\",\"file\":");
+    line_string(&l, p->job.file);
+    line_printf(&l, ",\"song\":%u,\"frames\":%llu", result->song, (unsigned long long)result->frames);
+    line_printf(&l, ",\"file_cached\":%s,\"gbs_reused\":%s", result->file_cached ? "true" : "false", result->gbs_reused ? "true" : "false");
+    line_printf(&l, ",\"queue_ms\":%.3f,\"load_ms\":%.3f,\"render_ms\":%.3f,\"total_ms\":%.3f", queue_ms, result->load_ms, result->render_ms, total_ms);
+    write_line(r, &l);
+}
+
+static void skip_space(struct Parser* ps)
+{
+    while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\r' || *ps->p == '\n') {
+        ps->p++;
+    }
+}
+
+// the outermost caller has the most to say, so it replaces any error set deeper in.
+static bool parse_fail(struct Parser* ps, const char* error)
+{
+    SDL_strlcpy(ps->error, error, sizeof(ps->error));
+    return false;
+}
+
+static bool parse_hex4(const char** s, unsigned* value)
+{
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        const char c = *(*s)++;
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = (unsigned)(c - '0');
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            digit = (unsigned)((c | 0x20) - 'a' + 10);
+        }
+        else {
+            return false;
+        }
+        *value = *value << 4 | digit;
+    }
+    return true;
+}
+
+static bool put_byte(char* out, size_t size, size_t* n, unsigned c)
+{
+    if (out) {
+        if (*n + 1 >= size) {
+            return false;
+        }
+        out[*n] = (char)c;
+    }
+    (*n)++;
+    return true;
+}
+
+// decodes a string into out, which can be NULL to skip it.
+static bool parse_string(struct Parser* ps, char* out, size_t size)
+{
+    const char* s = ps->p + 1;
+    size_t n = 0;
+
+    for (;;) {
+        unsigned c = (unsigned char)*s++;
+        if (c == '"') {
+            break;
+        }
+        // also the end of the line.
+        if (c < 0x20) {
+            return parse_fail(ps, "unterminated string");
+        }
+
+        if (c != '\\') {
+            if (!put_byte(out, size, &n, c)) {
+                return parse_fail(ps, "string is too long");
+            }
+            continue;
+        }
+
+        switch (*s++) {
+            case '"': c = '"'; break;
+            case '\\': c = '\\'; break;
+            case '/': c = '/'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': {
+                unsigned low;
+                if (!parse_hex4(&s, &c) || (c >= 0xDC00 && c < 0xE000)) {
+                    return parse_fail(ps, "bad unicode escape");
+                }
+                if (c >= 0xD800 && c < 0xDC00) {
+                    if (s[0] != '\\' || s[1] != 'u' || (s += 2, !parse_hex4(&s, &low)) || low < 0xDC00 || low >= 0xE000) {
+                        return parse_fail(ps, "bad unicode escape");
+                    }
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                }
+            } break;
+            default:
+                return parse_fail(ps, "bad escape");
+        }
+
+        // utf-8.
+        bool ok;
+        if (c < 0x80) {
+            ok = put_byte(out, size, &n, c);
+        }
+        else if (c < 0x800) {
+            ok = put_byte(out, size, &n, 0xC0 | c >> 6) && put_byte(out, size, &n, 0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000) {
+            ok = put_byte(out, size, &n, 0xE0 | c >> 12) && put_byte(out, size, &n, 0x80 | (c >> 6 & 0x3F)) && put_byte(out, size, &n, 0x80 | (c & 0x3F));
+        }
+        else {
+            ok = put_byte(out, size, &n, 0xF0 | c >> 18) && put_byte(out, size, &n, 0x80 | (c >> 12 & 0x3F)) && put_byte(out, size, &n, 0x80 | (c >> 6 & 0x3F)) && put_byte(out, size, &n, 0x80 | (c & 0x3F));
+        }
+        if (!ok) {
+            return parse_fail(ps, "string is too long");
+        }
+    }
+
+    if (out) {
+        out[n] = '\0';
+    }
+    ps->p = s;
+    return true;
+}
+
+static bool parse_number(struct Parser* ps, double* value)
+{
+    // strtod() takes more than json, such as inf and hex.
+    if (*ps->p != '-' && (*ps->p < '0' || *ps->p > '9')) {
+        return parse_fail(ps, "bad value");
+    }
+
+    char* end;
+    *value = SDL_strtod(ps->p, &end);
+    if (end == ps->p) {
+        return parse_fail(ps, "bad value");
+    }
+    ps->p = end;
+    return true;
+}
+
+static bool parse_literal(struct Parser* ps, const char* literal)
+{
+    const size_t len = SDL_strlen(literal);
+    if (SDL_strncmp(ps->p, literal, len)) {
+        return false;
+    }
+    ps->p += len;
+    return true;
+}
+
+// skips any value, objects and arrays included.
+static bool skip_value(struct Parser* ps, int depth)
+{
+    double number;
+    if (*ps->p == '"') {
+        return parse_string(ps, NULL, 0);
+    }
+    if (*ps->p != '{' && *ps->p != '[') {
+        return parse_literal(ps, "true") || parse_literal(ps, "false") || parse_literal(ps, "null") || parse_number(ps, &number);
+    }
+    if (depth >= SKIP_MAX_DEPTH) {
+        return parse_fail(ps, "values are nested too deeply");
+    }
+
+    const bool object = *ps->p++ == '{';
+    const char close = object ? '}' : ']';
+
+    skip_space(ps);
+    if (*ps->p == close) {
+        ps->p++;
+        return true;
+    }
+
+    for (;;) {
+        skip_space(ps);
+        if (object) {
+            if (*ps->p != '"') {
+                return parse_fail(ps, "expected a key");
+            }
+            if (!parse_string(ps, NULL, 0)) {
+                return false;
+            }
+
+            skip_space(ps);
+            if (*ps->p++ != ':') {
+                return parse_fail(ps, "expected ':'");
+            }
+            skip_space(ps);
+        }
+
+        if (!skip_value(ps, depth + 1)) {
+            return false;
+        }
+
+        skip_space(ps);
+        const char c = *ps->p++;
+        if (c == close) {
+            return true;
+        }
+        if (c != ',') {
+            return parse_fail(ps, object ? "expected ',' or '}'" : "expected ',' or ']'");
+        }
+    }
+}
+
+static bool parse_text(struct Parser* ps, const char* key, char* out, size_t size)
+{
+    if (*ps->p != '"') {
+        char error[ERROR_MAX_SIZE];
+        SDL_snprintf(error, sizeof(error), "%s must be a string", key);
+        return parse_fail(ps, error);
+    }
+    return parse_string(ps, out, size);
+}
+
+static bool parse_range(struct Parser* ps, const char* key, double min, double max, double* value)
+{
+    if (!parse_number(ps, value) || *value < min || *value > max) {
+        char error[ERROR_MAX_SIZE];
+        SDL_snprintf(error, sizeof(error), "%s must be a number from %g to %g", key, min, max);
+        return parse_fail(ps, error);
+    }
+    return true;
+}
+
+static bool parse_field(struct Parser* ps, const char* key, struct Pending* p)
+{
+    struct Job* job = &p->job;
+    double value;
+
+    // every field can be null, which leaves its default.
+    if (parse_literal(ps, "null")) {
+        return true;
+    }
+
+    if (!SDL_strcmp(key, "id")) {
+        const char* start = ps->p;
+        if (*ps->p == '{' || *ps->p == '[' || !(*ps->p == '"' ? parse_string(ps, NULL, 0) : parse_number(ps, &value))) {
+            return parse_fail(ps, "id must be a string or number");
+        }
+        if ((size_t)(ps->p - start) >= sizeof(p->id)) {
+            return parse_fail(ps, "id is too long");
+        }
+        SDL_memcpy(p->id, start, (size_t)(ps->p - start));
+        p->id[ps->p - start] = '\0';
+        return true;
+    }
+    if (!SDL_strcmp(key, "file")) {
+        return parse_text(ps, key, job->file, sizeof(job->file));
+    }
+    if (!SDL_strcmp(key, "output")) {
+        return parse_text(ps, key, job->output, sizeof(job->output));
+    }
+    if (!SDL_strcmp(key, "sink")) {
+        static const char* const SINKS[] = { "wav", "flac", "raw", "null" };
+        char sink[16];
+        if (!parse_text(ps, key, sink, sizeof(sink))) {
+            return false;
+        }
+        for (size_t i = 0; i < SDL_arraysize(SINKS); i++) {
+            if (!SDL_strcmp(sink, SINKS[i])) {
+                job->sink = (enum JobSink)i;
+                return true;
+            }
+        }
+        return parse_fail(ps, "sink must be wav, flac, raw or null");
+    }
+    if (!SDL_strcmp(key, "song")) {
+        if (!parse_range(ps, key, 0, 255, &value)) {
+            return false;
+        }
+        job->song = (int)value;
+        return true;
+    }
+    if (!SDL_strcmp(key, "rate")) {
+        if (!parse_range(ps, key, 1000, 384000, &value)) {
+            return false;
+        }
+        job->rate = (unsigned)value;
+        return true;
+    }
+    if (!SDL_strcmp(key, "start")) {
+        return parse_range(ps, key, 0, 60 * 60 * 24, &job->start);
+    }
+    if (!SDL_strcmp(key, "duration")) {
+        return parse_range(ps, key, 0, 60 * 60 * 24, &job->duration);
+    }
+
+    // unknown keys are skipped whatever their value, so that newer callers work with older runners.
+    return skip_value(ps, 0);
+}
+
+static bool parse_job(struct Parser* ps, struct Pending* p)
+{
+    p->job = (struct Job){ .song = -1, .duration = -1, .sink = JobSink_WAV };
+
+    skip_space(ps);
+    if (*ps->p++ != '{') {
+        return parse_fail(ps, "expected an object");
+    }
+
+    skip_space(ps);
+    if (*ps->p == '}') {
+        ps->p++;
+    }
+    else {
+        for (;;) {
+            char key[32];
+            skip_space(ps);
+            if (*ps->p != '"') {
+                return parse_fail(ps, "expected a key");
+            }
+
+            // a key too long to be known is skipped as an unknown one.
+            const char* start = ps->p;
+            if (!parse_string(ps, key, sizeof(key))) {
+                ps->p = start;
+                if (!parse_string(ps, NULL, 0)) {
+                    return false;
+                }
+                key[0] = '\0';
+            }
+
+            skip_space(ps);
+            if (*ps->p++ != ':') {
+                return parse_fail(ps, "expected ':'");
+            }
+
+            skip_space(ps);
+            if (!parse_field(ps, key, p)) {
+                return false;
+            }
+
+            skip_space(ps);
+            const char c = *ps->p++;
+            if (c == '}') {
+                break;
+            }
+            if (c != ',') {
+                return parse_fail(ps, "expected ',' or '}'");
+            }
+        }
+    }
+
+    skip_space(ps);
+    if (*ps->p) {
+        return parse_fail(ps, "trailing characters");
+    }
+
+    if (!p->job.file[0]) {
+        return parse_fail(ps, "file is required");
+    }
+    if (p->job.sink != JobSink_NULL && !p->job.output[0]) {
+        return parse_fail(ps, "output is required unless sink is null");
+    }
+    // stdout carries the results.
+    if (!SDL_strcmp(p->job.output, "-")) {
+        return parse_fail(ps, "output can't be stdout");
+    }
+    return true;
+}
+
+static int worker_thread(void* user)
+{
+    struct Worker* w = user;
+    struct JobRunner* r = w->r;
+
+    for (;;) {
+        SDL_LockMutex(r->lock);
+        while (r->head == r->tail && !r->done) {
+            SDL_CondWait(r->changed, r->lock);
+        }
+        struct Pending* p = NULL;
+        if (r->head != r->tail) {
+            p = r->queue[r->tail++ % r->capacity];
+            SDL_CondBroadcast(r->changed);
+        }
+        SDL_UnlockMutex(r->lock);
+
+        if (!p) {
+            break;
+        }
+
+        const double queue_ms = ms_since(p->queued);
+        const Uint64 start = SDL_GetPerformanceCounter();
+        struct JobResult result = {0};
+        if (r->iface->run(r->user, w->index, &p->job, &result)) {
+            write_result(r, p, &result, queue_ms, ms_since(start));
+        }
+        else {
+            write_error(r, p->id, p->line, SDL_GetError());
+        }
+        SDL_free(p);
+    }
+
+    return 0;
+}
+
+// reads the rest of a line that didn't fit.
+static void skip_line(FILE* in)
+{
+    int c;
+    while ((c = fgetc(in)) != EOF && c != '\n') {
+    }
+}
+
+static void read_jobs(struct JobRunner* r, FILE* in)
+{
+    char* line = SDL_malloc(LINE_MAX_SIZE);
+    uint64_t number = 0;
+
+    while (line && fgets(line, LINE_MAX_SIZE, in)) {
+        number++;
+
+        const size_t len = SDL_strlen(line);
+        const bool whole = (len && line[len - 1] == '\n') || feof(in);
+
+        struct Parser ps = { .p = line };
+        skip_space(&ps);
+        if (!*ps.p) {
+            continue;
+        }
+
+        SDL_AtomicAdd(&r->jobs, 1);
+        if (!whole) {
+            skip_line(in);
+            write_error(r, "", number, "line is too long");
+            continue;
+        }
+
+        struct Pending* p = SDL_calloc(1, sizeof(*p));
+        if (!p) {
+            write_error(r, "", number, "out of memory");
+            continue;
+        }
+        if (!parse_job(&ps, p)) {
+            write_error(r, p->id, number, ps.error);
+            SDL_free(p);
+            continue;
+        }
+
+        p->line = number;
+        p->queued = SDL_GetPerformanceCounter();
+
+        SDL_LockMutex(r->lock);
+        while (r->head - r->tail == r->capacity) {
+            SDL_CondWait(r->changed, r->lock);
+        }
+        r->queue[r->head++ % r->capacity] = p;
+        SDL_CondBroadcast(r->changed);
+        SDL_UnlockMutex(r->lock);
+    }
+
+    SDL_free(line);
+}
+
+bool job_runner_run(FILE* in, FILE* out, const struct JobRunnerInterface* iface, void* user, unsigned worker_count, struct JobRunnerStats* stats)
+{
+    struct JobRunner* r = SDL_calloc(1, sizeof(*r));
+    SDL_memset(stats, 0, sizeof(*stats));
+    if (!r) {
+        return false;
+    }
+
+    struct Worker w[JOB_RUNNER_MAX_WORKERS];
+    SDL_Thread* threads[JOB_RUNNER_MAX_WORKERS];
+    unsigned thread_count = 0;
+    bool result = false;
+
+    worker_count = SDL_clamp(worker_count, 1, JOB_RUNNER_MAX_WORKERS);
+    r->out = out;
+    r->iface = iface;
+    r->user = user;
+    r->capacity = (size_t)worker_count * QUEUE_PER_WORKER;
+
+    if (!(r->queue = SDL_malloc(r->capacity * sizeof(*r->queue))) || !(r->lock = SDL_CreateMutex()) || !(r->changed = SDL_CreateCond()) || !(r->out_lock = SDL_CreateMutex())) {
+        goto done;
+    }
+
+    for (unsigned i = 0; i < worker_count; i++) {
+        w[i] = (struct Worker){ .r = r, .index = i };
+        if (!(threads[thread_count] = SDL_CreateThread(worker_thread, "job_runner", &w[i]))) {
+            break;
+        }
+        thread_count++;
+    }
+
+    // any worker can take any job, so it runs with the threads that started.
+    if (thread_count) {
+        read_jobs(r, in);
+        result = true;
+    }
+
+    SDL_LockMutex(r->lock);
+    r->done = true;
+    SDL_CondBroadcast(r->changed);
+    SDL_UnlockMutex(r->lock);
+
+done:
+    if (!result) {
+        SDL_SetError("failed to start job workers");
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+
+    stats->jobs = (unsigned)SDL_AtomicGet(&r->jobs);
+    stats->failed = (unsigned)SDL_AtomicGet(&r->failed);
+
+    if (r->out_lock) {
+        SDL_DestroyMutex(r->out_lock);
+    }
+    if (r->changed) {
+        SDL_DestroyCond(r->changed);
+    }
+    if (r->lock) {
+        SDL_DestroyMutex(r->lock);
+    }
+    SDL_free(r->queue);
+    SDL_free(r);
+    return result;
+}
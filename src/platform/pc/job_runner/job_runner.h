@@ -0,0 +1,86 @@
+#ifndef JOB_RUNNER_H
+#define JOB_RUNNER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+* runs render jobs read as newline delimited json, one object per line:
+*
+*   {"id": 7, "file": "a.zip", "song": 2, "start": 30, "duration": 60,
+*    "rate": 44100, "sink": "wav", "output": "a-2.wav"}
+*
+* only file is required. song defaults to the first, start to 0, duration
+* to the length in the playlist, rate to the runner's, and sink to wav.
+* sink is one of wav, flac, raw or null, which is the only one that needs
+* no output. id is any string or number, and is echoed back. keys that
+* aren't known are skipped, whatever their value.
+*
+* the song is played up to start, which takes about as long as rendering
+* it. the first job that does so leaves checkpoints along the way, so
+* later jobs of the same song only play from the nearest one.
+*
+* the jobs run on a pool of threads, and a line is written for each as it
+* finishes, so results can come back out of order:
+*
+*   {"id":7,"line":1,"status":"ok","song":2,"frames":2880000,...}
+*   {"id":8,"line":2,"status":"error","error":"failed to load: b.gbs"}
+*
+* lines that don't parse get an error result too, and the runner returns
+* once the input ends and every job has finished.
+*/
+
+enum { JOB_RUNNER_MAX_WORKERS = 64 };
+enum { JOB_RUNNER_MAX_PATH = 1024 };
+
+enum JobSink {
+    JobSink_WAV,
+    JobSink_FLAC,
+    JobSink_RAW,
+    JobSink_NULL,
+};
+
+struct Job {
+    char file[JOB_RUNNER_MAX_PATH];
+    char output[JOB_RUNNER_MAX_PATH];
+    int song; // -1 for the first song.
+    double start; // seconds.
+    double duration; // seconds, -1 for the playlist length.
+    unsigned rate; // 0 for the default.
+    enum JobSink sink;
+};
+
+struct JobResult {
+    unsigned song;
+    uint64_t frames;
+    // the file was loaded already, and the instance already had it loaded.
+    bool file_cached;
+    bool gbs_reused;
+    double load_ms;
+    double render_ms;
+};
+
+struct JobRunnerInterface {
+    // returns false with SDL_SetError() on failure, called from the workers.
+    bool (*run)(void* user, unsigned worker, const struct Job* job, struct JobResult* result);
+};
+
+struct JobRunnerStats {
+    unsigned jobs;
+    unsigned failed; // including lines that didn't parse.
+};
+
+/* returns false if the workers failed to start. */
+bool job_runner_run(FILE* in, FILE* out, const struct JobRunnerInterface* iface, void* user, unsigned worker_count, struct JobRunnerStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JOB_RUNNER_H
@@ -4,10 +4,25 @@
 #include <stdlib.h>
 
 #include <SDL.h>
-#include <minizip/unzip.h>
 #include "wav_writer/wav_writer.h"
+#include "sink/sink.h"
 #include "m3u/m3u.h"
 #include "args/args.h"
+#include "prefetch_io/prefetch_io.h"
+#include "zip/zip.h"
+#include "sevenzip/sevenzip.h"
+#include "catalog/catalog.h"
+#include "catalog_scan/catalog_scan.h"
+#include "audio_producer/audio_producer.h"
+#include "flac_writer/flac_writer.h"
+#include "render_pipeline/render_pipeline.h"
+#include "segment_render/segment_render.h"
+#include "snapshot_grid/snapshot_grid.h"
+#include "batch_render/batch_render.h"
+#include "stream_pool/stream_pool.h"
+#include "stream_server/stream_server.h"
+#include "shm_ring/shm_ring.h"
+#include "job_runner/job_runner.h"
 
 typedef enum AppResult {
     AppResult_SUCCESS,
@@ -15,12 +30,87 @@ typedef enum AppResult {
     AppResult_CONTINUE,
 } AppResult;
 
+// number of banks cached when inflating a gbs from a zip.
+enum { ZIP_IO_WINDOWS = 8 };
+// how often the main loop checks if the song moved on by itself.
+enum { POLL_INTERVAL_MS = 100 };
+// files that one render of a song can write.
+enum { RENDER_MAX_OUTPUTS = 8 };
+// threads that render songs at once.
+enum { RENDER_MAX_JOBS = 64 };
+
+// channels of a --stems multi file, the mix then each stem.
+enum { STEMS_MULTI_CHANNELS = 2 + GbsStem_MAX * 2 };
+// frames read from the mix and each stem at once.
+enum { STEMS_CHUNK_FRAMES = 1024 };
+// --levels frames kept between writes, enough for 100ms at the fastest rate.
+enum { LEVELS_RING_FRAMES = 8192 };
+// --levels are written every this many frames rendered.
+enum { LEVELS_CHUNK_DIVISOR = 10 };
+
+enum StemMode {
+    StemMode_NONE,
+    // a stereo file per stem.
+    StemMode_FILES,
+    // one file with the mix and every stem.
+    StemMode_MULTI,
+};
+
+static const char* const STEM_NAMES[GbsStem_MAX] = {
+    [GbsStem_PULSE1] = "pulse1",
+    [GbsStem_PULSE2] = "pulse2",
+    [GbsStem_WAVE] = "wave",
+    [GbsStem_NOISE] = "noise",
+};
+
+// where the stems of a song are written, either a sink per stem or multi.
+struct StemSinks {
+    Sink* stems[GbsStem_MAX];
+    Sink* multi;
+};
+
+// a file written for each song rendered.
+struct RenderOutput {
+    int freq;
+    enum WavFormat format;
+    bool flac;
+    // flac encoder threads, 0 for one per cpu. 1 when songs are rendered at once already.
+    unsigned flac_jobs;
+};
+
+// what a song is rendered with, each render thread has its own.
+struct Renderer {
+    Gbs* gbs;
+    // NULL unless recording.
+    GbsRecorder* recorder;
+    // NULL unless --null.
+    Sink* null_sink;
+    // frames is NULL unless --levels, which are written to levels_file.
+    struct GbsCaptureRing levels;
+    uint32_t levels_read;
+    SDL_RWops* levels_file;
+    uint64_t rendered_frames;
+};
+
+// the next song is also what plays once the current one ends.
+enum CueSlot {
+    CueSlot_NEXT,
+    CueSlot_RANDOM,
+};
+
 typedef struct Archive {
-    void* gbs_data;
+    // owned, unless it points into the zip mapping or 7z folder.
+    const void* gbs_data;
     size_t gbs_size;
 
-    struct M3uSongInfo* infos;
-    size_t m3u_count;
+    // set when the gbs is streamed rather than loaded into gbs_data.
+    struct GbsIo io;
+    void (*io_close)(struct GbsIo* io);
+
+    Zip* zip;
+    SevenZip* sevenzip;
+
+    struct M3uPlaylist playlist;
 } Archive;
 
 typedef struct App {
@@ -32,12 +122,45 @@ typedef struct App {
 
     SDL_AudioSpec obtained_spec;
     SDL_AudioDeviceID audio_device_id;
+    // owns gbs and cue_gbs while the audio device is open.
+    AudioProducer* producer;
+    Gbs* cue_gbs[AUDIO_PRODUCER_MAX_CUES];
+    unsigned cue_count;
+    // picked ahead of time, so that it can be cued.
+    unsigned random_song;
+    // shared by gbs and cue_gbs, only used from the producer thread.
+    GbsSnapshotCache* snapshot_cache;
+    const char* snapshot_dir;
+    enum WavFormat wav_format;
+    bool flac;
+    // every output is fed by the same render, resampled where needed.
+    struct RenderOutput outputs[RENDER_MAX_OUTPUTS];
+    unsigned output_count;
+    // written next to the first output.
+    enum StemMode stem_mode;
+    // records the register writes of each song rendered, NULL if not.
+    GbsRecorder* recorder;
+    enum GbsRegLogFormat reglog_format;
+    // the recorder feeds a synth thread instead, so no log is written.
+    bool pipeline;
+    // channel levels captured a second, 0 unless --levels.
+    unsigned levels_rate;
+    // each song is rendered in segments by these, gbs scans for the snapshots.
+    Gbs* segment_gbs[SEGMENT_RENDER_MAX_WORKERS];
+    unsigned segment_count;
+    // shared by every song rendered, unlike the per song wav / flac files.
+    Sink* raw_sink;
+    Sink* shm_sink;
+    Sink* null_sink;
+    // the first uses gbs, recorder and null_sink, the rest are for --jobs.
+    struct Renderer renderers[RENDER_MAX_JOBS];
+    unsigned renderer_count;
+    // emulation rate when rendering, resampled to the output rate if it differs.
+    int render_freq;
+    uint64_t file_hash;
     bool quit;
 
     int end_time;
-    volatile int song_internal_time_elapsed;
-    // number of seconds
-    volatile int song_time_elapsed;
 
     char output_name[512];
 } App;
@@ -51,6 +174,20 @@ enum ArgsId {
     ArgsId_freq,
     ArgsId_gbs2gb,
     ArgsId_wav,
+    ArgsId_stream,
+    ArgsId_cache,
+    ArgsId_format,
+    ArgsId_raw,
+    ArgsId_shm,
+    ArgsId_null,
+    ArgsId_render_freq,
+    ArgsId_output,
+    ArgsId_stems,
+    ArgsId_reglog,
+    ArgsId_levels,
+    ArgsId_pipeline,
+    ArgsId_segments,
+    ArgsId_jobs,
 };
 
 #define ARGS_ENTRY(_key, _type, _single) \
@@ -65,162 +202,373 @@ static const struct ArgsMeta ARGS_META[] = {
     ARGS_ENTRY(freq, ArgsValueType_INT, 'f')
     ARGS_ENTRY(wav, ArgsValueType_STR, 'w')
     ARGS_ENTRY(gbs2gb, ArgsValueType_STR, 'g')
+    ARGS_ENTRY(stream, ArgsValueType_NONE, 0)
+    ARGS_ENTRY(cache, ArgsValueType_STR, 0)
+    ARGS_ENTRY(format, ArgsValueType_STR, 0)
+    ARGS_ENTRY(raw, ArgsValueType_STR, 0)
+    ARGS_ENTRY(shm, ArgsValueType_STR, 0)
+    ARGS_ENTRY(null, ArgsValueType_NONE, 0)
+    // spelt out, as the key has a dash.
+    { .key = "render-freq", .id = ArgsId_render_freq, .type = ArgsValueType_INT },
+    ARGS_ENTRY(output, ArgsValueType_STR, 0)
+    ARGS_ENTRY(stems, ArgsValueType_STR, 0)
+    ARGS_ENTRY(reglog, ArgsValueType_STR, 0)
+    ARGS_ENTRY(levels, ArgsValueType_INT, 0)
+    ARGS_ENTRY(pipeline, ArgsValueType_NONE, 0)
+    ARGS_ENTRY(segments, ArgsValueType_INT, 0)
+    ARGS_ENTRY(jobs, ArgsValueType_INT, 'j')
+};
+
+enum CatalogArgsId {
+    CatalogArgsId_help,
+    CatalogArgsId_output,
+    CatalogArgsId_jobs,
+    CatalogArgsId_query,
+    CatalogArgsId_prefix,
+};
+
+#define CATALOG_ARGS_ENTRY(_key, _type, _single) \
+    { .key = #_key, .id = CatalogArgsId_##_key, .type = _type, .single = _single },
+
+static const struct ArgsMeta CATALOG_ARGS_META[] = {
+    CATALOG_ARGS_ENTRY(help, ArgsValueType_NONE, 'h')
+    CATALOG_ARGS_ENTRY(output, ArgsValueType_STR, 'o')
+    CATALOG_ARGS_ENTRY(jobs, ArgsValueType_INT, 'j')
+    CATALOG_ARGS_ENTRY(query, ArgsValueType_STR, 'q')
+    CATALOG_ARGS_ENTRY(prefix, ArgsValueType_NONE, 0)
+};
+
+enum ReplayArgsId {
+    ReplayArgsId_help,
+    ReplayArgsId_output,
+    ReplayArgsId_freq,
+    ReplayArgsId_start,
+    ReplayArgsId_time,
+};
+
+#define REPLAY_ARGS_ENTRY(_key, _type, _single) \
+    { .key = #_key, .id = ReplayArgsId_##_key, .type = _type, .single = _single },
+
+static const struct ArgsMeta REPLAY_ARGS_META[] = {
+    REPLAY_ARGS_ENTRY(help, ArgsValueType_NONE, 'h')
+    REPLAY_ARGS_ENTRY(output, ArgsValueType_STR, 'o')
+    REPLAY_ARGS_ENTRY(freq, ArgsValueType_INT, 'f')
+    REPLAY_ARGS_ENTRY(start, ArgsValueType_INT, 0)
+    REPLAY_ARGS_ENTRY(time, ArgsValueType_INT, 0)
+};
+
+enum BatchArgsId {
+    BatchArgsId_help,
+    BatchArgsId_output,
+    BatchArgsId_null,
+    BatchArgsId_format,
+    BatchArgsId_freq,
+    BatchArgsId_render_freq,
+    BatchArgsId_jobs,
+};
+
+#define BATCH_ARGS_ENTRY(_key, _type, _single) \
+    { .key = #_key, .id = BatchArgsId_##_key, .type = _type, .single = _single },
+
+static const struct ArgsMeta BATCH_ARGS_META[] = {
+    BATCH_ARGS_ENTRY(help, ArgsValueType_NONE, 'h')
+    BATCH_ARGS_ENTRY(output, ArgsValueType_STR, 'o')
+    BATCH_ARGS_ENTRY(null, ArgsValueType_NONE, 0)
+    BATCH_ARGS_ENTRY(format, ArgsValueType_STR, 0)
+    BATCH_ARGS_ENTRY(freq, ArgsValueType_INT, 'f')
+    // spelt out, as the key has a dash.
+    { .key = "render-freq", .id = BatchArgsId_render_freq, .type = ArgsValueType_INT },
+    BATCH_ARGS_ENTRY(jobs, ArgsValueType_INT, 'j')
+};
+
+enum ServeArgsId {
+    ServeArgsId_help,
+    ServeArgsId_unix,
+    ServeArgsId_port,
+    ServeArgsId_root,
+    ServeArgsId_freq,
+    ServeArgsId_jobs,
+};
+
+#define SERVE_ARGS_ENTRY(_key, _type, _single) \
+    { .key = #_key, .id = ServeArgsId_##_key, .type = _type, .single = _single },
+
+static const struct ArgsMeta SERVE_ARGS_META[] = {
+    SERVE_ARGS_ENTRY(help, ArgsValueType_NONE, 'h')
+    SERVE_ARGS_ENTRY(unix, ArgsValueType_STR, 0)
+    SERVE_ARGS_ENTRY(port, ArgsValueType_INT, 'p')
+    SERVE_ARGS_ENTRY(root, ArgsValueType_STR, 0)
+    SERVE_ARGS_ENTRY(freq, ArgsValueType_INT, 'f')
+    SERVE_ARGS_ENTRY(jobs, ArgsValueType_INT, 'j')
+};
+
+enum JobsArgsId {
+    JobsArgsId_help,
+    JobsArgsId_freq,
+    JobsArgsId_jobs,
 };
 
+#define JOBS_ARGS_ENTRY(_key, _type, _single) \
+    { .key = #_key, .id = JobsArgsId_##_key, .type = _type, .single = _single },
+
+static const struct ArgsMeta JOBS_ARGS_META[] = {
+    JOBS_ARGS_ENTRY(help, ArgsValueType_NONE, 'h')
+    JOBS_ARGS_ENTRY(freq, ArgsValueType_INT, 'f')
+    JOBS_ARGS_ENTRY(jobs, ArgsValueType_INT, 'j')
+};
+
+// emulation runs on the producer thread, this only copies samples out.
 static void sdl2_callback(void* user, unsigned char* data, int count)
 {
-    const int number_of_samples = count / sizeof(short);
-    short* samples = (short*)data;
-
     App* app = user;
-    gbs_run(app->gbs, gbs_clocks_needed(app->gbs, number_of_samples));
-    gbs_read_samples(app->gbs, samples, number_of_samples);
+    audio_producer_read(app->producer, (short*)data, count / sizeof(short));
+}
 
-    app->song_internal_time_elapsed += number_of_samples / 2; // for stereo.
-    if (app->song_internal_time_elapsed >= (int)app->obtained_spec.freq + number_of_samples / 2) {
-        app->song_internal_time_elapsed -= (int)app->obtained_spec.freq + number_of_samples / 2;
-        app->song_time_elapsed++;
-    }
+static unsigned wrap_song(const App* app, unsigned song)
+{
+    song %= app->gbs_meta.max_song;
+    return song < app->gbs_meta.first_song ? app->gbs_meta.first_song : song;
 }
 
-static const struct M3uSongInfo* find_info_from_song(const Archive* archive, unsigned song)
+// returns the end time in seconds.
+static int get_song_end_time(const App* app, unsigned song)
 {
-    for (size_t i = 0; i < archive->m3u_count; i++) {
-        if (archive->infos[i].songno == song) {
-            return &archive->infos[i];
+    // config stuff to save to json
+    const int song_timout_seconds = 3 * 60;
+    const bool apply_loopcount = false;
+
+    const struct M3uEntry* info = m3u_playlist_find(&app->archive.playlist, song);
+    if (info && info->time) {
+        if (apply_loopcount && info->loopcount) {
+            return info->time * info->loopcount;
         }
+        return info->time;
     }
+    return song_timout_seconds;
+}
 
-    return NULL;
+static unsigned get_song_end_frames(const App* app, unsigned song)
+{
+    return (unsigned)get_song_end_time(app, song) * (unsigned)app->obtained_spec.freq;
+}
+
+// called once the producer has been told about song, either from a key press or the song ending.
+static void on_song_changed(App* app, unsigned song)
+{
+    app->song_number = song;
+    app->end_time = get_song_end_time(app, song);
+
+    const struct M3uEntry* info = m3u_playlist_find(&app->archive.playlist, song);
+    if (info) {
+        printf("now playing [%u] %s %u\n", song, info->title, info->time);
+    }
+    else {
+        printf("now playing [%u]\n", song);
+    }
+
+    // get the songs that can be played next ready in the background.
+    const unsigned next = wrap_song(app, song + 1);
+    app->random_song = wrap_song(app, rand());
+    audio_producer_cue(app->producer, CueSlot_NEXT, next, get_song_end_frames(app, next));
+    audio_producer_cue(app->producer, CueSlot_RANDOM, app->random_song, get_song_end_frames(app, app->random_song));
 }
 
-// returns the end time
 static void play_song(App* app, unsigned song)
 {
-    song %= app->gbs_meta.max_song;
-    song = song < app->gbs_meta.first_song ? app->gbs_meta.first_song : song;
+    song = wrap_song(app, song);
 
-    SDL_LockAudioDevice(app->audio_device_id);
-        app->song_internal_time_elapsed = 0;
-        app->song_time_elapsed = 0;
-        app->song_number = song;
-        gbs_set_song(app->gbs, app->song_number);
+    // the reset happens on the producer thread, playback of the old song continues until it's done.
+    if (!audio_producer_play(app->producer, song, get_song_end_frames(app, song))) {
+        printf("song change dropped, queue is full\n");
+        return;
+    }
+    on_song_changed(app, song);
+}
 
-        const struct M3uSongInfo* info = find_info_from_song(&app->archive, song);
-        if (info) {
-            printf("now playing [%u] %s %u\n", song, info->song_tile, info->time);
-        }
-        else {
-            printf("now playing [%u]\n", song);
+// the song moves on by itself at end_time, keep track of what's being heard.
+static void check_song_advanced(App* app)
+{
+    unsigned song, frames;
+    if (audio_producer_get_position(app->producer, &song, &frames) && song != (unsigned)app->song_number) {
+        on_song_changed(app, song);
+    }
+}
+
+// getchar() blocks, so keys are read on their own thread and sent to the main loop as events.
+static int input_thread(void* user)
+{
+    (void)user;
+    int c;
+    while ((c = getchar()) != EOF) {
+        SDL_Event e = {0};
+        e.type = SDL_USEREVENT;
+        e.user.code = c;
+        SDL_PushEvent(&e);
+    }
+    return 0;
+}
+
+static size_t zip_io_read(void* user, void* dst, size_t size, size_t addr)
+{
+    return zip_stream_read(user, dst, size, addr);
+}
+
+static size_t zip_io_size(void* user)
+{
+    return zip_stream_size(user);
+}
+
+static const uint8_t* zip_io_pointer(void* user, size_t addr, uint8_t bank)
+{
+    (void)bank;
+    return zip_stream_pointer(user, addr);
+}
+
+static void zip_io_close(struct GbsIo* io)
+{
+    zip_stream_close(io->user);
+    SDL_memset(io, 0, sizeof(*io));
+}
+
+static const struct GbsIo ZIP_IO = {
+    .user = NULL,
+    .read = zip_io_read,
+    .size = zip_io_size,
+    .pointer = zip_io_pointer,
+};
+
+static bool zip_load_gbs(Archive* archive, const struct ZipEntry* entry)
+{
+    // stored entries are loaded straight from the mapping.
+    const void* data = zip_entry_data(archive->zip, entry);
+    if (data) {
+        if (!gbs_validate_file_mem(data, entry->uncompressed_size)) {
+            return false;
         }
+        archive->gbs_data = data;
+        archive->gbs_size = entry->uncompressed_size;
+        return true;
+    }
+
+    // compressed entries are inflated as banks are requested.
+    ZipStream* stream = zip_stream_open(archive->zip, entry, GBS_BANK_SIZE, ZIP_IO_WINDOWS);
+    if (!stream) {
+        return false;
+    }
 
-        // config stuff to save to json
-        const int song_timout_seconds = 3 * 60;
-        const bool apply_loopcount = false;
+    archive->io = ZIP_IO;
+    archive->io.user = stream;
+    archive->io_close = zip_io_close;
 
-        if (info && info->time) {
-            if (apply_loopcount && info->loopcount) {
-                app->end_time = info->time * info->loopcount;
-            }
-            else {
-                app->end_time = info->time;
-            }
+    if (!gbs_validate_file_io(&archive->io)) {
+        zip_io_close(&archive->io);
+        archive->io_close = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void zip_load_m3u(Archive* archive, const struct ZipEntry* entry)
+{
+    // stored entries are parsed straight from the mapping.
+    const void* data = zip_entry_data(archive->zip, entry);
+    if (data) {
+        m3u_playlist_parse(&archive->playlist, data, entry->uncompressed_size);
+        return;
+    }
+
+    char* buffer = SDL_malloc(entry->uncompressed_size);
+    if (!buffer) {
+        return;
+    }
+
+    const size_t size = zip_entry_read(archive->zip, entry, buffer, entry->uncompressed_size);
+    if (size == entry->uncompressed_size) {
+        m3u_playlist_parse(&archive->playlist, buffer, size);
+    }
+
+    SDL_free(buffer);
+}
+
+// returns true if it found a valid gbs
+static bool parse_zip(const char* path, Archive* archive)
+{
+    if (!(archive->zip = zip_open(path))) {
+        return false;
+    }
+
+    const size_t count = zip_get_entry_count(archive->zip);
+    bool found = false;
+
+    for (size_t i = 0; i < count && !found; i++) {
+        const struct ZipEntry* entry = zip_get_entry(archive->zip, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".gbs") && entry->uncompressed_size >= GBS_HEADER_SIZE) {
+            found = zip_load_gbs(archive, entry);
         }
-        else {
-            app->end_time = song_timout_seconds;
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct ZipEntry* entry = zip_get_entry(archive->zip, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".m3u")) {
+            zip_load_m3u(archive, entry);
         }
-    SDL_UnlockAudioDevice(app->audio_device_id);
+    }
+
+    return true;
+}
+
+static void sevenzip_load_m3u(Archive* archive, const struct SevenZipEntry* entry)
+{
+    const uint8_t* data = sevenzip_entry_data(archive->sevenzip, entry);
+    if (data) {
+        m3u_playlist_parse(&archive->playlist, (const char*)data, entry->size);
+    }
 }
 
 // returns true if it found a valid gbs
-static bool parse_zip(zlib_filefunc_def* ff, const char* path, Archive* archive)
-{
-    // this is safe to be NULL, it'll call stdio internally
-    unzFile* zf = unzOpen2(path, ff);
-
-    if (zf)
-    {
-        unz_global_info global_info;
-        if (UNZ_OK == unzGetGlobalInfo(zf, &global_info))
-        {
-            bool already_jumped = false;
-        start_again:
-            for (unsigned i = 0; i < global_info.number_entry; i++)
-            {
-                if (UNZ_OK == unzOpenCurrentFile(zf))
-                {
-                    unz_file_info file_info = {0};
-                    char name[256] = {0};
-
-                    if (UNZ_OK == unzGetCurrentFileInfo(zf, &file_info, name, sizeof(name), NULL, 0, NULL, 0))
-                    {
-                        const char* ext = SDL_strrchr(name, '.');
-                        if (!archive->gbs_data && !SDL_strcasecmp(ext, ".gbs") && file_info.uncompressed_size >= 0x70)
-                        {
-                            // read a chunk of data, see if it's valid
-                            char header[0x70];
-                            int result = unzReadCurrentFile(zf, header, sizeof(header));
-                            if (result > 0 && result == sizeof(header))
-                            {
-                                if (gbs_validate_file_mem(header, sizeof(header)))
-                                {
-                                    archive->gbs_data = SDL_malloc(file_info.uncompressed_size);
-                                    if (archive->gbs_data)
-                                    {
-                                        SDL_memcpy(archive->gbs_data, header, sizeof(header));
-                                        const int read_size = file_info.uncompressed_size - sizeof(header);
-                                        result = unzReadCurrentFile(zf, archive->gbs_data + sizeof(header), read_size);
-                                        if (result > 0 && result == read_size)
-                                        {
-                                            archive->gbs_size = file_info.uncompressed_size;
-                                        }
-                                        else
-                                        {
-                                            SDL_free(archive->gbs_data);
-                                            archive->gbs_data = NULL;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        else if (archive->gbs_data && !SDL_strcasecmp(ext, ".m3u") && file_info.uncompressed_size < 512)
-                        {
-                            char buffer[file_info.uncompressed_size + 1];
-                            buffer[file_info.uncompressed_size] = '\0';
-
-                            int result = unzReadCurrentFile(zf, buffer, sizeof(buffer));
-                            if (result > 0 && (unsigned)result == file_info.uncompressed_size)
-                            {
-                                struct M3uSongInfo m3u_info;
-                                if (m3u_info_parse(buffer, sizeof(buffer), &m3u_info))
-                                {
-                                    archive->m3u_count++;
-                                    archive->infos = SDL_realloc(archive->infos, archive->m3u_count * sizeof(*archive->infos));
-                                    archive->infos[archive->m3u_count-1] = m3u_info;
-                                }
-                            }
-                        }
-                    }
-                    unzCloseCurrentFile(zf);
-                }
+static bool parse_7z(const char* path, Archive* archive)
+{
+    if (!(archive->sevenzip = sevenzip_open(path))) {
+        return false;
+    }
 
-                if (archive->gbs_data && !already_jumped)
-                {
-                    already_jumped = true;
-                    unzGoToFirstFile(zf);
-                    goto start_again;
-                }
-                // advance to the next file (if there is one)
-                else if (i + 1 < global_info.number_entry)
-                {
-                    unzGoToNextFile(zf); // todo: error handling
-                }
+    const size_t count = sevenzip_get_entry_count(archive->sevenzip);
+    bool found = false;
+
+    for (size_t i = 0; i < count && !found; i++) {
+        const struct SevenZipEntry* entry = sevenzip_get_entry(archive->sevenzip, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".gbs") && entry->size >= GBS_HEADER_SIZE) {
+            // the gbs is used in place from the decoded folder.
+            const uint8_t* data = sevenzip_entry_data(archive->sevenzip, entry);
+            if (data && gbs_validate_file_mem(data, entry->size)) {
+                archive->gbs_data = data;
+                archive->gbs_size = entry->size;
+                found = true;
             }
         }
-        unzClose(zf);
     }
 
-    return archive->gbs_data != NULL;
+    if (!found) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct SevenZipEntry* entry = sevenzip_get_entry(archive->sevenzip, i);
+        const char* ext = SDL_strrchr(entry->name, '.');
+        if (ext && !SDL_strcasecmp(ext, ".m3u")) {
+            sevenzip_load_m3u(archive, entry);
+        }
+    }
+
+    return true;
 }
 
 static size_t gbs_io_write(void* user, const void* src, size_t size, size_t addr)
@@ -229,162 +577,2187 @@ static size_t gbs_io_write(void* user, const void* src, size_t size, size_t addr
     return SDL_RWwrite(user, src, 1, size);
 }
 
-static bool parse_file(const char* path, Archive* archive)
+static bool parse_file(const char* path, Archive* archive, bool stream)
+{
+    if (stream) {
+        archive->io_close = prefetch_io_close;
+        return prefetch_io_open(path, PREFETCH_IO_DEFAULT_SLOTS, &archive->io);
+    }
+
+    archive->gbs_data = SDL_LoadFile(path, &archive->gbs_size);
+    return archive->gbs_data != NULL;
+}
+
+static bool load_archive(const char* path, Archive* archive, bool stream)
+{
+    SDL_memset(archive, 0, sizeof(*archive));
+
+    const char* ext = SDL_strrchr(path, '.');
+
+    if (ext && !SDL_strcasecmp(ext, ".gbs")) {
+        return parse_file(path, archive, stream);
+    }
+    else if (ext && !SDL_strcasecmp(ext, ".zip")) {
+        return parse_zip(path, archive);
+    }
+    else if (ext && !SDL_strcasecmp(ext, ".7z")) {
+        return parse_7z(path, archive);
+    }
+
+    return false;
+}
+
+static void archive_close(Archive* archive)
+{
+    if (archive->gbs_data && !archive->zip && !archive->sevenzip) {
+        SDL_free((void*)archive->gbs_data);
+    }
+
+    if (archive->io_close) {
+        archive->io_close(&archive->io);
+    }
+
+    if (archive->zip) {
+        zip_close(archive->zip);
+    }
+
+    if (archive->sevenzip) {
+        sevenzip_close(archive->sevenzip);
+    }
+
+    m3u_playlist_free(&archive->playlist);
+    SDL_memset(archive, 0, sizeof(*archive));
+}
+
+// inflates a streamed gbs into memory, so that it can be shared between instances.
+static bool archive_inflate(Archive* archive)
+{
+    if (!archive->io.user) {
+        return true;
+    }
+
+    const size_t size = archive->io.size(archive->io.user);
+    uint8_t* data = SDL_malloc(size);
+    if (!data) {
+        return false;
+    }
+
+    // a bank at a time, the size of a window.
+    for (size_t addr = 0; addr < size; addr += GBS_BANK_SIZE) {
+        const size_t count = SDL_min(size - addr, GBS_BANK_SIZE);
+        if (archive->io.read(archive->io.user, data + addr, count, addr) != count) {
+            SDL_free(data);
+            return false;
+        }
+    }
+
+    archive->io_close(&archive->io);
+    archive->io_close = NULL;
+
+    // gbs_data is owned once the zip is gone, the m3u has already been parsed.
+    zip_close(archive->zip);
+    archive->zip = NULL;
+    archive->gbs_data = data;
+    archive->gbs_size = size;
+    return true;
+}
+
+static void convert_str_to_printable_chars(char* str)
+{
+    const size_t len = SDL_strlen(str);
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] < 32) {
+            str[i] = '-';
+        }
+    }
+}
+
+static bool do_gbs2gb(App* app, const char* dir)
+{
+    char path[512];
+    SDL_snprintf(path, sizeof(path), "%s/%s.%s", dir, app->output_name, gbs2gb_get_system_type(app->gbs) == Gbs2GbSystem_DMG ? "gb" : "gbc");
+
+    struct GbsWriteIo write_io;
+    write_io.user = SDL_RWFromFile(path, "wb");
+    if (!write_io.user){
+        return false;
+    }
+
+    write_io.write = gbs_io_write;
+    const bool result = gbs2gb_io(app->gbs, &write_io);
+    SDL_RWclose(write_io.user);
+
+    if (!result) {
+        SDL_SetError("\nfailed to write gbc file!\n");
+    }
+    else {
+        printf("output: \"%s\"\n", path);
+    }
+    return result;
+}
+
+static bool flac_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    return flac_writer_write_s16(user, samples, count) == count;
+}
+
+static bool flac_sink_close(void* user)
+{
+    return flac_writer_close(user);
+}
+
+// how long a full ring waits for a consumer to attach, or come back, before the render fails.
+enum { SHM_CONSUMER_TIMEOUT_MS = 10000 };
+
+// the batches are rendered in the ring, so only samples from elsewhere are copied.
+static int16_t* shm_sink_get_buffer(void* user, size_t* count)
+{
+    struct ShmRingConfig config;
+    shm_ring_get_config(user, &config);
+
+    size_t frames = *count / config.channels;
+    int16_t* samples = shm_ring_reserve(user, &frames, SHM_CONSUMER_TIMEOUT_MS);
+    *count = frames * config.channels;
+    return samples;
+}
+
+static bool shm_sink_write(void* user, const int16_t* samples, size_t count)
+{
+    struct ShmRingConfig config;
+    shm_ring_get_config(user, &config);
+
+    size_t remaining = count / config.channels;
+    while (remaining) {
+        size_t frames = remaining;
+        int16_t* buffer = shm_ring_reserve(user, &frames, SHM_CONSUMER_TIMEOUT_MS);
+        if (!buffer) {
+            return false;
+        }
+        if (buffer != samples) {
+            SDL_memcpy(buffer, samples, frames * config.channels * sizeof(*samples));
+        }
+        shm_ring_publish(user, frames);
+        samples += frames * config.channels;
+        remaining -= frames;
+    }
+    return true;
+}
+
+static bool shm_sink_close(void* user)
+{
+    shm_ring_close(user);
+    return true;
+}
+
+// the ring holds half a second, the render waits on the consumer while it's full.
+// it fails once the ring has had no consumer for the timeout.
+static Sink* open_shm_sink(const char* name, const struct SinkConfig* config)
+{
+    static const struct SinkInterface iface = {
+        .write = shm_sink_write,
+        .close = shm_sink_close,
+        .get_buffer = shm_sink_get_buffer,
+    };
+
+    const struct ShmRingConfig ring_config = {
+        .sample_rate = config->sample_rate,
+        .channels = config->channels,
+        .frames = config->sample_rate / 2,
+    };
+
+    ShmRing* ring = shm_ring_create(name, &ring_config);
+    if (!ring) {
+        return NULL;
+    }
+    return sink_open(&iface, ring, config);
+}
+
+// path of a file for song in dir, suffix goes after the title.
+static void get_song_path(const App* app, const char* dir, unsigned char song, const char* suffix, const char* ext, char* path, size_t size)
+{
+    const struct M3uEntry* info = m3u_playlist_find(&app->archive.playlist, song);
+    if (info) {
+        SDL_snprintf(path, size, "%s/%s - %u - %s%s.%s", dir, app->output_name, song, info->title, suffix, ext);
+    }
+    else {
+        SDL_snprintf(path, size, "%s/%s - %u%s.%s", dir, app->output_name, song, suffix, ext);
+    }
+}
+
+// opens a wav or flac file, in the format of output.
+static Sink* open_file_sink(const char* path, const struct RenderOutput* output, const struct SinkConfig* config)
+{
+    Sink* sink = NULL;
+    if (output->flac) {
+        static const struct SinkInterface iface = {
+            .write = flac_sink_write,
+            .close = flac_sink_close,
+        };
+
+        const struct FlacWriterConfig flac_config = {
+            .sample_rate = config->sample_rate,
+            .channels = config->channels,
+            .jobs = output->flac_jobs,
+        };
+
+        FlacWriter* flac = flac_writer_open(path, &flac_config);
+        if (flac) {
+            sink = sink_open(&iface, flac, config);
+        }
+    }
+    else {
+        sink = sink_open_wav(path, output->format, config);
+    }
+
+    if (!sink) {
+        SDL_SetError("failed to open %s: %s", output->flac ? "flac" : "wav", path);
+    }
+    return sink;
+}
+
+// opens the wav or flac file for a song in dir.
+// the rate is added to the name when there are several outputs, and name if set.
+static Sink* open_song_sink(App* app, const char* dir, const struct RenderOutput* output, unsigned char song, const char* name, uint8_t channels)
+{
+    const struct SinkConfig sink_config = {
+        .sample_rate = output->freq,
+        .channels = channels,
+    };
+
+    char rate[32] = "";
+    if (app->output_count > 1) {
+        SDL_snprintf(rate, sizeof(rate), " - %dhz", output->freq);
+    }
+
+    char suffix[64];
+    SDL_snprintf(suffix, sizeof(suffix), "%s%s%s", rate, name ? " - " : "", name ? name : "");
+
+    char path[512];
+    get_song_path(app, dir, song, suffix, output->flac ? "flac" : "wav", path, sizeof(path));
+    return open_file_sink(path, output, &sink_config);
+}
+
+// reads the mix and every stem in step, remaining is in samples of the mix.
+static void render_song_stems(struct Renderer* r, Sink* sink, const struct StemSinks* stems, size_t remaining)
+{
+    int16_t buffers[1 + GbsStem_MAX][STEMS_CHUNK_FRAMES * 2];
+    int16_t multi[STEMS_CHUNK_FRAMES * STEMS_MULTI_CHANNELS];
+
+    while (remaining) {
+        const size_t count = SDL_min(remaining, SDL_arraysize(buffers[0]));
+
+        gbs_run(r->gbs, gbs_clocks_needed(r->gbs, count));
+        gbs_read_samples(r->gbs, buffers[0], count);
+        for (unsigned i = 0; i < GbsStem_MAX; i++) {
+            gbs_read_stem_samples(r->gbs, i, buffers[1 + i], count);
+        }
+
+        sink_write(sink, buffers[0], count);
+        if (stems->multi) {
+            for (size_t frame = 0; frame < count / 2; frame++) {
+                for (unsigned i = 0; i < 1 + GbsStem_MAX; i++) {
+                    multi[frame * STEMS_MULTI_CHANNELS + i * 2 + 0] = buffers[i][frame * 2 + 0];
+                    multi[frame * STEMS_MULTI_CHANNELS + i * 2 + 1] = buffers[i][frame * 2 + 1];
+                }
+            }
+            sink_write(stems->multi, multi, count / 2 * STEMS_MULTI_CHANNELS);
+        }
+        else {
+            for (unsigned i = 0; i < GbsStem_MAX; i++) {
+                sink_write(stems->stems[i], buffers[1 + i], count);
+            }
+        }
+
+        remaining -= count;
+    }
+}
+
+// rendered straight into the sink's batch buffer, remaining is in samples.
+static void render_samples(Gbs* gbs, Sink* sink, size_t remaining)
+{
+    while (remaining) {
+        size_t count;
+        int16_t* samples = sink_get_buffer(sink, &count);
+        count = SDL_min(count, remaining);
+
+        gbs_run(gbs, gbs_clocks_needed(gbs, count));
+        gbs_read_samples(gbs, samples, count);
+        sink_commit(sink, count);
+        remaining -= count;
+    }
+}
+
+// captures the channel levels of every song the renderer emulates.
+static bool renderer_enable_levels(struct Renderer* r, unsigned rate)
+{
+    r->levels = (struct GbsCaptureRing){
+        .frames = SDL_calloc(LEVELS_RING_FRAMES, sizeof(*r->levels.frames)),
+        .size = LEVELS_RING_FRAMES,
+    };
+    if (!r->levels.frames || !gbs_set_capture(r->gbs, &r->levels, rate)) {
+        SDL_SetError("failed to capture levels");
+        return false;
+    }
+    return true;
+}
+
+// writes the levels captured since the last call, as a csv line per frame.
+static bool write_levels(struct Renderer* r, int freq)
+{
+    const struct GbsCaptureRing* ring = &r->levels;
+    // the oldest were overwritten if it fell behind.
+    if (ring->head - r->levels_read > ring->size) {
+        r->levels_read = ring->head - ring->size;
+    }
+
+    for (; r->levels_read != ring->head; r->levels_read++) {
+        const struct GbsCaptureFrame* frame = &ring->frames[r->levels_read & (ring->size - 1)];
+        char line[64];
+        const int size = SDL_snprintf(line, sizeof(line), "%.6f,%u,%u,%u,%u\n", (double)frame->sample / freq, frame->pcm.channel[0], frame->pcm.channel[1], frame->pcm.channel[2], frame->pcm.channel[3]);
+        if (SDL_RWwrite(r->levels_file, line, 1, (size_t)size) != (size_t)size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the ring is bounded, so it's written out between slices of the song.
+static bool render_song_levels(struct Renderer* r, Sink* sink, int freq, size_t remaining)
+{
+    const size_t chunk = (size_t)SDL_max(freq / LEVELS_CHUNK_DIVISOR, 1) * 2;
+    r->levels_read = r->levels.head;
+
+    while (remaining) {
+        const size_t count = SDL_min(remaining, chunk);
+        render_samples(r->gbs, sink, count);
+        if (!write_levels(r, freq)) {
+            SDL_SetError("failed to write levels");
+            return false;
+        }
+        remaining -= count;
+    }
+    return true;
+}
+
+// stems is NULL unless they are written.
+static bool render_song(App* app, struct Renderer* r, Sink* sink, const struct StemSinks* stems, int freq, unsigned char song)
+{
+    if (!gbs_set_song(r->gbs, song)) {
+        SDL_SetError("failed to set song: %u", song);
+        return false;
+    }
+
+    unsigned time = 60*3;
+    const struct M3uEntry* info = m3u_playlist_find(&app->archive.playlist, song);
+    if (info) {
+        time = info->time;
+    }
+
+    size_t remaining = (size_t)time * freq * 2;
+    if (app->pipeline) {
+        if (!render_pipeline_run(r->gbs, r->recorder, sink, freq, remaining)) {
+            return false;
+        }
+        remaining = 0;
+    }
+    else if (app->segment_count) {
+        if (!segment_render_song(r->gbs, app->segment_gbs, app->segment_count, sink, freq, remaining)) {
+            return false;
+        }
+        remaining = 0;
+    }
+    else if (stems) {
+        render_song_stems(r, sink, stems, remaining);
+        remaining = 0;
+    }
+    else if (r->levels_file) {
+        if (!render_song_levels(r, sink, freq, remaining)) {
+            return false;
+        }
+        remaining = 0;
+    }
+
+    render_samples(r->gbs, sink, remaining);
+
+    r->rendered_frames += (uint64_t)time * freq;
+    return true;
+}
+
+// writes the register log recorded while rendering song.
+static bool write_reglog(App* app, struct Renderer* r, const char* dir, unsigned char song)
+{
+    const bool vgm = app->reglog_format == GbsRegLogFormat_VGM;
+    char path[512];
+    get_song_path(app, dir, song, "", vgm ? "vgm" : "gbrl", path, sizeof(path));
+
+    const size_t size = gbs_recorder_export(r->recorder, app->reglog_format, NULL, 0);
+    void* data = size ? SDL_malloc(size) : NULL;
+    if (!data) {
+        SDL_SetError("failed to record song: %u", song);
+        return false;
+    }
+
+    gbs_recorder_export(r->recorder, app->reglog_format, data, size);
+
+    SDL_RWops* rw = SDL_RWFromFile(path, "wb");
+    bool result = rw && SDL_RWwrite(rw, data, 1, size) == size;
+    if (rw && SDL_RWclose(rw)) {
+        result = false;
+    }
+    if (!result) {
+        SDL_SetError("failed to write register log: %s", path);
+    }
+
+    SDL_free(data);
+    return result;
+}
+
+// sinks that are closed in the reverse order they were opened, so that each flushes into the next.
+struct SinkStack {
+    Sink* sinks[(RENDER_MAX_OUTPUTS + GbsStem_MAX) * 2 + 3];
+    size_t count;
+};
+
+static Sink* sink_stack_push(struct SinkStack* stack, Sink* sink)
+{
+    if (sink) {
+        stack->sinks[stack->count++] = sink;
+    }
+    return sink;
+}
+
+static bool sink_stack_close(struct SinkStack* stack)
+{
+    bool result = true;
+    while (stack->count) {
+        result &= sink_close(stack->sinks[--stack->count]);
+    }
+    return result;
+}
+
+// returns what to render into for an output at freq, a resampler if it isn't the render rate.
+static Sink* open_render_input(App* app, struct SinkStack* stack, Sink* sink, int freq, uint8_t channels)
+{
+    if (freq == app->render_freq) {
+        return sink;
+    }
+
+    const struct SinkConfig config = {
+        .sample_rate = app->render_freq,
+        .channels = channels,
+    };
+
+    Sink* resample = sink_stack_push(stack, sink_open_resample(sink, &config));
+    if (!resample) {
+        SDL_SetError("failed to open resampler: %d -> %d", app->render_freq, freq);
+    }
+    return resample;
+}
+
+// renders a song once, into its files in dir (if set), the raw, shm and null sink.
+// the song is emulated once at render_freq, and resampled for each output at another rate.
+static bool do_render_song(App* app, struct Renderer* r, const char* dir, int freq, unsigned char song)
+{
+    struct SinkStack stack = {0};
+    struct StemSinks stems = {0};
+    Sink* inputs[RENDER_MAX_OUTPUTS + 1];
+    size_t count = 0;
+    bool result = false;
+
+    if (dir) {
+        for (unsigned i = 0; i < app->output_count; i++) {
+            const struct RenderOutput* output = &app->outputs[i];
+            Sink* file = sink_stack_push(&stack, open_song_sink(app, dir, output, song, NULL, 2));
+            if (!file || !(inputs[count++] = open_render_input(app, &stack, file, output->freq, 2))) {
+                goto done;
+            }
+        }
+
+        const struct RenderOutput* output = &app->outputs[0];
+        if (app->stem_mode == StemMode_MULTI) {
+            Sink* file = sink_stack_push(&stack, open_song_sink(app, dir, output, song, "stems", STEMS_MULTI_CHANNELS));
+            if (!file || !(stems.multi = open_render_input(app, &stack, file, output->freq, STEMS_MULTI_CHANNELS))) {
+                goto done;
+            }
+        }
+        else if (app->stem_mode == StemMode_FILES) {
+            for (unsigned i = 0; i < GbsStem_MAX; i++) {
+                Sink* file = sink_stack_push(&stack, open_song_sink(app, dir, output, song, STEM_NAMES[i], 2));
+                if (!file || !(stems.stems[i] = open_render_input(app, &stack, file, output->freq, 2))) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+    // raw, shm and null outlive the song, so they aren't on the stack.
+    Sink* shared[3];
+    size_t shared_count = 0;
+    if (app->raw_sink) {
+        shared[shared_count++] = app->raw_sink;
+    }
+    if (app->shm_sink) {
+        shared[shared_count++] = app->shm_sink;
+    }
+    if (r->null_sink) {
+        shared[shared_count++] = r->null_sink;
+    }
+
+    if (shared_count) {
+        const struct SinkConfig config = {
+            .sample_rate = freq,
+            .channels = 2,
+        };
+
+        Sink* sink = shared[0];
+        if (shared_count > 1 && !(sink = sink_stack_push(&stack, sink_open_tee(shared, shared_count, &config)))) {
+            SDL_SetError("failed to open tee");
+            goto done;
+        }
+        if (!(inputs[count++] = open_render_input(app, &stack, sink, freq, 2))) {
+            goto done;
+        }
+    }
+
+    // a single output is rendered into directly.
+    Sink* input = inputs[0];
+    if (count > 1) {
+        const struct SinkConfig config = {
+            .sample_rate = app->render_freq,
+            .channels = 2,
+        };
+
+        if (!(input = sink_stack_push(&stack, sink_open_tee(inputs, count, &config)))) {
+            SDL_SetError("failed to open tee");
+            goto done;
+        }
+    }
+
+    if (dir && r->levels.frames) {
+        char path[512];
+        get_song_path(app, dir, song, " - levels", "csv", path, sizeof(path));
+        static const char header[] = "time,pulse1,pulse2,wave,noise\n";
+        if (!(r->levels_file = SDL_RWFromFile(path, "wb")) || SDL_RWwrite(r->levels_file, header, 1, sizeof(header) - 1) != sizeof(header) - 1) {
+            SDL_SetError("failed to open levels: %s", path);
+            goto done;
+        }
+    }
+
+    result = render_song(app, r, input, dir && app->stem_mode ? &stems : NULL, app->render_freq, song);
+
+    if (result && dir && r->recorder && !app->pipeline) {
+        result = write_reglog(app, r, dir, song);
+    }
+
+done:
+    if (r->levels_file) {
+        if (SDL_RWclose(r->levels_file) && result) {
+            SDL_SetError("failed to write levels of song: %u", song);
+            result = false;
+        }
+        r->levels_file = NULL;
+    }
+    if (!sink_stack_close(&stack) && result) {
+        SDL_SetError("failed to write song: %u", song);
+        result = false;
+    }
+    return result;
+}
+
+static void print_song_rendered(const App* app, unsigned index, unsigned count, unsigned char song)
+{
+    const struct M3uEntry* info = m3u_playlist_find(&app->archive.playlist, song);
+    if (info) {
+        printf("rendered [%u/%u] %u - %s\n", index + 1, count, song, info->title);
+    }
+    else {
+        printf("rendered [%u/%u] %u\n", index + 1, count, song);
+    }
+}
+
+// songs rendered by a pool of threads, each with its own renderer.
+struct RenderPool {
+    App* app;
+    const char* dir;
+    int freq;
+    unsigned first;
+    unsigned count;
+
+    SDL_mutex* lock;
+    SDL_cond* changed;
+
+    // everything below is guarded by lock.
+    // next song a thread takes, none are taken once one has failed.
+    unsigned next;
+    bool failed;
+    // per song.
+    bool* done;
+    bool* ok;
+    char (*errors)[256];
+};
+
+struct RenderThread {
+    struct RenderPool* pool;
+    struct Renderer* renderer;
+};
+
+static int render_thread(void* user)
+{
+    struct RenderThread* t = user;
+    struct RenderPool* pool = t->pool;
+
+    SDL_LockMutex(pool->lock);
+    while (!pool->failed && pool->next < pool->count) {
+        const unsigned index = pool->next++;
+        SDL_UnlockMutex(pool->lock);
+
+        const bool ok = do_render_song(pool->app, t->renderer, pool->dir, pool->freq, pool->first + index);
+
+        SDL_LockMutex(pool->lock);
+        if (!ok) {
+            // errors are per thread, so it's passed on to be reported in order.
+            SDL_strlcpy(pool->errors[index], SDL_GetError(), sizeof(pool->errors[index]));
+            pool->failed = true;
+        }
+        pool->ok[index] = ok;
+        pool->done[index] = true;
+        SDL_CondBroadcast(pool->changed);
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+// renders count songs at once on every renderer, the output is the same as one at a time.
+static bool render_songs_parallel(App* app, const char* dir, int freq, unsigned first, unsigned count)
+{
+    struct RenderPool pool = {
+        .app = app,
+        .dir = dir,
+        .freq = freq,
+        .first = first,
+        .count = count,
+    };
+
+    struct RenderThread threads[RENDER_MAX_JOBS];
+    SDL_Thread* handles[RENDER_MAX_JOBS];
+    unsigned thread_count = 0;
+    bool result = false;
+
+    pool.done = SDL_calloc(count, sizeof(*pool.done));
+    pool.ok = SDL_calloc(count, sizeof(*pool.ok));
+    pool.errors = SDL_calloc(count, sizeof(*pool.errors));
+    if (!pool.done || !pool.ok || !pool.errors || !(pool.lock = SDL_CreateMutex()) || !(pool.changed = SDL_CreateCond())) {
+        SDL_SetError("failed to start render threads");
+        goto done;
+    }
+
+    // a thread without a song would only hold its renderer.
+    const unsigned wanted = SDL_min(app->renderer_count, count);
+    for (unsigned i = 0; i < wanted; i++) {
+        threads[i] = (struct RenderThread){ .pool = &pool, .renderer = &app->renderers[i] };
+        if (!(handles[thread_count] = SDL_CreateThread(render_thread, "render", &threads[i]))) {
+            break;
+        }
+        thread_count++;
+    }
+
+    if (!thread_count) {
+        SDL_SetError("failed to start render threads");
+        goto done;
+    }
+
+    // songs are reported in order, so the output doesn't depend on timing.
+    result = true;
+    SDL_LockMutex(pool.lock);
+    for (unsigned i = 0; i < count && result; i++) {
+        // a song that was never taken won't be done.
+        while (!pool.done[i] && !(pool.failed && i >= pool.next)) {
+            SDL_CondWait(pool.changed, pool.lock);
+        }
+        if (!pool.done[i]) {
+            break;
+        }
+        if (!pool.ok[i]) {
+            SDL_SetError("%s", pool.errors[i]);
+            result = false;
+        }
+        else {
+            print_song_rendered(app, i, count, first + i);
+        }
+    }
+    SDL_UnlockMutex(pool.lock);
+
+done:
+    for (unsigned i = 0; i < thread_count; i++) {
+        SDL_WaitThread(handles[i], NULL);
+    }
+
+    if (pool.changed) {
+        SDL_DestroyCond(pool.changed);
+    }
+    if (pool.lock) {
+        SDL_DestroyMutex(pool.lock);
+    }
+    SDL_free(pool.done);
+    SDL_free(pool.ok);
+    SDL_free(pool.errors);
+    return result;
+}
+
+// song < 0 renders every song.
+static bool do_render(App* app, const char* dir, int freq, int song)
+{
+    const Uint64 start = SDL_GetTicks64();
+    const unsigned first = song >= 0 ? (unsigned)song : app->gbs_meta.first_song;
+    const unsigned count = song >= 0 ? 1 : app->gbs_meta.max_song;
+    bool result = true;
+
+    if (app->renderer_count > 1 && count > 1) {
+        result = render_songs_parallel(app, dir, freq, first, count);
+    }
+    else {
+        for (unsigned i = 0; i < count && result; i++) {
+            if ((result = do_render_song(app, &app->renderers[0], dir, freq, first + i))) {
+                print_song_rendered(app, i, count, first + i);
+            }
+        }
+    }
+
+    if (app->raw_sink) {
+        if (!sink_close(app->raw_sink) && result) {
+            SDL_SetError("failed to write raw output");
+            result = false;
+        }
+        app->raw_sink = NULL;
+    }
+
+    if (app->shm_sink) {
+        if (!sink_close(app->shm_sink) && result) {
+            SDL_SetError("the shared memory ring had no consumer");
+            result = false;
+        }
+        app->shm_sink = NULL;
+    }
+
+    if (app->null_sink) {
+        uint64_t frames = 0;
+        for (unsigned i = 0; i < app->renderer_count; i++) {
+            sink_close(app->renderers[i].null_sink);
+            app->renderers[i].null_sink = NULL;
+            frames += app->renderers[i].rendered_frames;
+        }
+        app->null_sink = NULL;
+
+        const unsigned ms = SDL_max((unsigned)(SDL_GetTicks64() - start), 1);
+        printf("rendered %llu frames in %ums (%.1fx realtime)\n", (unsigned long long)frames, ms, (double)frames * 1000.0 / app->render_freq / ms);
+    }
+
+    return result;
+}
+
+// fnv-1a, used to key the snapshots on disk.
+static uint64_t hash_archive(const Archive* archive)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint8_t buf[GBS_BANK_SIZE];
+    const size_t size = archive->io.user ? archive->io.size(archive->io.user) : archive->gbs_size;
+
+    for (size_t off = 0; off < size; off += sizeof(buf)) {
+        const size_t chunk = SDL_min(sizeof(buf), size - off);
+        const uint8_t* data = (const uint8_t*)archive->gbs_data + off;
+        if (archive->io.user) {
+            if (archive->io.read(archive->io.user, buf, chunk, off) != chunk) {
+                break;
+            }
+            data = buf;
+        }
+
+        for (size_t i = 0; i < chunk; i++) {
+            hash = (hash ^ data[i]) * 0x100000001B3ULL;
+        }
+    }
+
+    return hash;
+}
+
+static void get_snapshot_path(const App* app, uint8_t song, char* path, size_t size)
+{
+    SDL_snprintf(path, size, "%s/%016llx-%d-%u.snap", app->snapshot_dir, (unsigned long long)app->file_hash, app->obtained_spec.freq, song);
+}
+
+static bool snapshot_io_load(void* user, uint8_t song, void* data, size_t size)
+{
+    char path[1024];
+    get_snapshot_path(user, song, path, sizeof(path));
+
+    SDL_RWops* rw = SDL_RWFromFile(path, "rb");
+    if (!rw) {
+        return false;
+    }
+
+    // a partly written snapshot is caught by the size check.
+    const bool result = SDL_RWsize(rw) == (Sint64)size && SDL_RWread(rw, data, 1, size) == size;
+    SDL_RWclose(rw);
+    return result;
+}
+
+static void snapshot_io_store(void* user, uint8_t song, const void* data, size_t size)
+{
+    char path[1024];
+    get_snapshot_path(user, song, path, sizeof(path));
+
+    SDL_RWops* rw = SDL_RWFromFile(path, "wb");
+    if (rw) {
+        SDL_RWwrite(rw, data, 1, size);
+        SDL_RWclose(rw);
+    }
+}
+
+// s16, s24, f32 or flac.
+static bool parse_output_format(const char* str, enum WavFormat* format, bool* flac) {
+    *flac = false;
+    if (!SDL_strcmp(str, "s16")) {
+        *format = WavFormat_S16;
+    }
+    else if (!SDL_strcmp(str, "s24")) {
+        *format = WavFormat_S24;
+    }
+    else if (!SDL_strcmp(str, "f32")) {
+        *format = WavFormat_F32;
+    }
+    else if (!SDL_strcmp(str, "flac")) {
+        *flac = true;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// rate[:format], the format defaults to s16.
+static bool parse_output(const char* str, struct RenderOutput* output) {
+    char* end;
+    output->freq = SDL_strtol(str, &end, 10);
+    output->format = WavFormat_S16;
+    output->flac = false;
+
+    if (output->freq <= 0) {
+        return false;
+    }
+    if (*end == ':') {
+        return parse_output_format(end + 1, &output->format, &output->flac);
+    }
+    return !*end;
+}
+
+static int print_usage(int code) {
+    printf("\
+[TotalGBS " LIBGBS_VERSION_STR " By TotalJustice] \n\n\
+Usage\n\n\
+    -h, --help      = Display help.\n\
+    -v, --version   = Display version.\n\
+    -r, --rom       = Set GBS rom.\n\
+    -i, --info      = Log info.\n\
+    -s, --song      = Set song.\n\
+    -f, --freq      = Set output frequency.\n\
+    -w, --wav       = Output folder to convert song(s) to wav.\n\
+    -g, --gbs2gb    = Output folder to convert GBS rom to gb rom.\n\
+        --stream    = Stream banks from disk instead of loading the whole file.\n\
+        --cache     = Folder to keep song start snapshots in, to skip slow inits.\n\
+        --format    = Output format for --wav: s16 (default), s24, f32 or flac.\n\
+        --raw       = Write raw 16-bit stereo pcm of the song(s) to a file, - for stdout.\n\
+        --shm       = Publish raw pcm of the song(s) to a shared memory ring with this name,\n\
+                      that another process attaches to. rendering waits while it's full,\n\
+                      and fails if no consumer is attached for 10 seconds.\n\
+        --null      = Render the song(s) without output, to time emulation.\n\
+                      --wav, --raw, --shm and --null can be combined, they share one render.\n\
+        --render-freq = Emulate at this rate and resample to --freq, for --wav, --raw, --shm and --null.\n\
+        --output    = Add a file for --wav as rate[:format], can be given up to 8 times.\n\
+                      all of them share one render, and replace the --freq / --format file.\n\
+        --stems     = Also write each channel for --wav, files (one per channel) or multi\n\
+                      (one 10 channel wav of the mix, pulse1, pulse2, wave and noise).\n\
+        --reglog    = Also write the apu register writes of each song for --wav, vgm or native.\n\
+        --levels    = Also write the 4-bit level of each channel for --wav, this many times a second,\n\
+                      to a csv per song.\n\
+        --pipeline  = Emulate the cpu and synthesize the apu on separate threads when rendering.\n\
+        --segments  = Render each song as 30 second segments on this many threads, from snapshots\n\
+                      taken by a scan of the song. the output is the same as a serial render.\n\
+    -j, --jobs      = Render this many songs at once, 0 for the cpu count. songs are still\n\
+                      reported in order, and the output is the same as one at a time.\n\
+\n\
+Catalog\n\n\
+    TotalGBS catalog -o catalog.bin [-j jobs] [--] dirs...\n\
+    TotalGBS catalog -o catalog.bin -q text [--prefix]\n\n\
+    -o, --output    = Catalog file to create, update or search.\n\
+    -j, --jobs      = Number of scan threads, defaults to the cpu count.\n\
+    -q, --query     = Search titles and authors in the catalog.\n\
+        --prefix    = Only match the start of the title or author.\n\
+\n\
+Replay\n\n\
+    TotalGBS replay -o out.wav [-f freq] [--start secs] [--time secs] log\n\n\
+    -o, --output    = Wav file to write.\n\
+    -f, --freq      = Output frequency, the log is synthesized at this rate.\n\
+        --start     = Seconds into the log to start from.\n\
+        --time      = Seconds to write, defaults to the rest of the log.\n\
+\n\
+Batch\n\n\
+    TotalGBS batch -o folder [--null] [-j jobs] [--] paths...\n\n\
+    -o, --output    = Output folder, songs are named after the path of their file\n\
+                      under the folder that all of the files are in.\n\
+        --null      = Render without output, to time emulation.\n\
+        --format    = Output format: s16 (default), s24, f32 or flac.\n\
+    -f, --freq      = Output frequency.\n\
+        --render-freq = Emulate at this rate and resample to --freq.\n\
+    -j, --jobs      = Number of render threads, defaults to the cpu count.\n\
+    paths are .gbs, .zip and .7z files, folders (searched recursively) or globs.\n\
+    the songs of every file are shared out between the threads.\n\
+\n\
+Serve\n\n\
+    TotalGBS serve --unix path | -p port [--root folder] [-f freq] [-j jobs]\n\n\
+        --unix      = Listen on a unix socket.\n\
+    -p, --port      = Listen on this port of 127.0.0.1.\n\
+        --root      = Folder that requested files are relative to, defaults to the current one.\n\
+    -f, --freq      = Output frequency.\n\
+    -j, --jobs      = Number of render threads, defaults to the cpu count.\n\
+    songs are streamed over http until the client disconnects, for example\n\
+    GET /folder/file.gbs?song=3&format=wav (the default) or format=raw for pcm.\n\
+\n\
+Jobs\n\n\
+    TotalGBS jobs [-f freq] [-j jobs] < jobs.ndjson\n\n\
+    -f, --freq      = Output frequency of jobs that don't give a rate.\n\
+    -j, --jobs      = Number of render threads, defaults to the cpu count.\n\
+    reads a json object per line from stdin, for example\n\
+    {\"id\": 1, \"file\": \"a.zip\", \"song\": 2, \"start\": 30, \"duration\": 60, \"rate\": 44100, \"sink\": \"wav\", \"output\": \"a.wav\"}\n\
+    sink is wav (the default), flac, raw or null, and only file is required. a json result\n\
+    line is written to stdout as each job finishes, files and instances are kept between jobs.\n\
+    the song is played up to start, later jobs of the same song resume from checkpoints.\n\
+    \n");
+
+    return code;
+}
+
+static bool do_catalog_query(const char* path, const char* query, unsigned flags)
+{
+    Catalog* catalog = catalog_open(path);
+    if (!catalog) {
+        SDL_SetError("failed to open catalog: %s", path);
+        return false;
+    }
+
+    const size_t count = catalog_get_file_count(catalog);
+    size_t matches = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct CatalogFile* file = catalog_get_file(catalog, i);
+        if (!catalog_match(catalog, file, query, flags)) {
+            continue;
+        }
+
+        printf("%s\n", catalog_get_string(catalog, file->path));
+        printf("\t%s - %s (%u songs)\n", catalog_get_string(catalog, file->title), catalog_get_string(catalog, file->author), file->max_song);
+
+        const struct CatalogSong* songs = catalog_get_songs(catalog, file);
+        for (size_t j = 0; j < file->song_count; j++) {
+            printf("\t[%u] %s %u\n", songs[j].songno, catalog_get_string(catalog, songs[j].title), songs[j].time);
+        }
+        matches++;
+    }
+
+    printf("%zu of %zu files matched\n", matches, count);
+    catalog_close(catalog);
+    return true;
+}
+
+// TotalGBS replay [options] log
+static bool do_replay(int argc, char** argv)
+{
+    const char* output = NULL;
+    int freq = 48000;
+    int start = 0;
+    int time = -1;
+
+    int arg_index = 2;
+    struct ArgsData arg_data;
+    enum ArgsResult arg_result;
+    while (!(arg_result = args_parse(&arg_index, argc, argv, REPLAY_ARGS_META, SDL_arraysize(REPLAY_ARGS_META), &arg_data))) {
+        switch (REPLAY_ARGS_META[arg_data.meta_index].id) {
+            case ReplayArgsId_help:
+                print_usage(0);
+                return true;
+            case ReplayArgsId_output:
+                output = arg_data.value.s;
+                break;
+            case ReplayArgsId_freq:
+                freq = arg_data.value.i;
+                break;
+            case ReplayArgsId_start:
+                start = arg_data.value.i;
+                break;
+            case ReplayArgsId_time:
+                time = arg_data.value.i;
+                break;
+        }
+    }
+
+    if (arg_result < 0) {
+        SDL_SetError("bad replay args: %d", arg_result);
+        return false;
+    }
+
+    if (!output || arg_index >= argc) {
+        SDL_SetError("replay requires --output and a log");
+        return false;
+    }
+
+    if (freq <= 0 || start < 0) {
+        SDL_SetError("bad replay freq or start");
+        return false;
+    }
+
+    size_t size;
+    void* data = SDL_LoadFile(argv[arg_index], &size);
+    if (!data) {
+        return false;
+    }
+
+    GbsRegLogPlayer* player = gbs_reglog_player_init(data, size, freq);
+    SDL_free(data);
+    if (!player) {
+        SDL_SetError("failed to load log: %s", argv[arg_index]);
+        return false;
+    }
+
+    const uint64_t start_cycle = (uint64_t)start * GBS_CPU_CLOCK;
+    if (!gbs_reglog_player_seek(player, start_cycle)) {
+        SDL_SetError("start is past the end of the log: %d", start);
+        gbs_reglog_player_quit(player);
+        return false;
+    }
+
+    const uint64_t cycles = time >= 0 ? (uint64_t)time * GBS_CPU_CLOCK : gbs_reglog_player_get_length(player) - start_cycle;
+    const struct SinkConfig config = { .sample_rate = freq, .channels = 2 };
+    Sink* sink = sink_open_wav(output, WavFormat_S16, &config);
+    if (!sink) {
+        gbs_reglog_player_quit(player);
+        return false;
+    }
+
+    // rendered straight into the sink's batch buffer, like render_song().
+    size_t remaining = (size_t)(cycles * freq / GBS_CPU_CLOCK) * 2;
+    while (remaining) {
+        size_t count;
+        int16_t* samples = sink_get_buffer(sink, &count);
+        count = SDL_min(count, remaining);
+
+        gbs_reglog_player_run(player, gbs_reglog_player_clocks_needed(player, count));
+        gbs_reglog_player_read_samples(player, samples, count);
+        sink_commit(sink, count);
+        remaining -= count;
+    }
+
+    gbs_reglog_player_quit(player);
+    if (!sink_close(sink)) {
+        SDL_SetError("failed to write: %s", output);
+        return false;
+    }
+
+    printf("replay: %s\n", output);
+    return true;
+}
+
+// TotalGBS catalog [options] [--] dirs...
+static bool do_catalog(int argc, char** argv)
+{
+    const char* output = NULL;
+    const char* query = NULL;
+    unsigned flags = 0;
+    int jobs = 0;
+
+    int arg_index = 2;
+    struct ArgsData arg_data;
+    enum ArgsResult arg_result;
+    while (!(arg_result = args_parse(&arg_index, argc, argv, CATALOG_ARGS_META, SDL_arraysize(CATALOG_ARGS_META), &arg_data))) {
+        switch (CATALOG_ARGS_META[arg_data.meta_index].id) {
+            case CatalogArgsId_help:
+                print_usage(0);
+                return true;
+            case CatalogArgsId_output:
+                output = arg_data.value.s;
+                break;
+            case CatalogArgsId_jobs:
+                jobs = arg_data.value.i;
+                break;
+            case CatalogArgsId_query:
+                query = arg_data.value.s;
+                break;
+            case CatalogArgsId_prefix:
+                flags |= CatalogMatch_PREFIX;
+                break;
+        }
+    }
+
+    if (arg_result < 0) {
+        SDL_SetError("bad catalog args: %d", arg_result);
+        return false;
+    }
+
+    if (!output) {
+        SDL_SetError("catalog requires --output");
+        return false;
+    }
+
+    if (query) {
+        return do_catalog_query(output, query, flags);
+    }
+
+    // dirs are either everything after "--" or a single trailing arg.
+    if (arg_index >= argc) {
+        SDL_SetError("no dirs to scan");
+        return false;
+    }
+
+    const Uint64 start = SDL_GetTicks64();
+    struct CatalogScanStats stats;
+    if (!catalog_scan(output, (const char* const*)argv + arg_index, argc - arg_index, jobs < 0 ? 0 : jobs, &stats)) {
+        return false;
+    }
+
+    printf("catalog: %s\n", output);
+    printf("\tfound: %u scanned: %u reused: %u failed: %u\n", stats.found, stats.scanned, stats.reused, stats.failed);
+    printf("\ttime: %ums\n", (unsigned)(SDL_GetTicks64() - start));
+    return true;
+}
+
+// each worker keeps its gbs loaded with the file it last rendered a song of.
+struct BatchWorker {
+    struct Renderer renderer;
+    // index + 1 of the file loaded, 0 if none.
+    size_t file;
+};
+
+struct Batch {
+    // output settings shared by every file.
+    const App* settings;
+    const char* dir;
+    int freq;
+    char** paths;
+    // output name of each path, see batch_make_names().
+    char** names;
+    struct BatchWorker workers[BATCH_RENDER_MAX_WORKERS];
+};
+
+struct BatchName {
+    char* name;
+    size_t index;
+};
+
+static int compare_batch_names(const void* a, const void* b)
+{
+    // case insensitive, as the output folder may be.
+    return SDL_strcasecmp(((const struct BatchName*)a)->name, ((const struct BatchName*)b)->name);
+}
+
+// the first len chars of a path, with each '/' written as " - ".
+static char* batch_name(const char* path, size_t len)
+{
+    char* name = SDL_malloc(len * 3 + 1);
+    if (!name) {
+        return NULL;
+    }
+
+    char* dst = name;
+    for (size_t i = 0; i < len; i++) {
+        if (path[i] == '/') {
+            SDL_memcpy(dst, " - ", 3);
+            dst += 3;
+        }
+        else {
+            *dst++ = path[i];
+        }
+    }
+    *dst = '\0';
+    return name;
+}
+
+static void batch_free_names(struct BatchName* names, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        SDL_free(names[i].name);
+    }
+    SDL_free(names);
+}
+
+// names the output of each file after its path under the dir that every file is in,
+// so that files of the same name in different dirs don't overwrite each other's songs.
+// the extension is kept only where it's needed to tell files apart, and names that
+// still collide are an error, rather than files being overwritten.
+static bool batch_make_names(char** paths, size_t count, char*** out)
+{
+    // length of the dir shared by every path, up to and including its last '/'.
+    const char* slash = count ? SDL_strrchr(paths[0], '/') : NULL;
+    size_t root = slash ? (size_t)(slash - paths[0]) + 1 : 0;
+    for (size_t i = 1; i < count && root; i++) {
+        size_t len = 0;
+        while (len < root && paths[i][len] == paths[0][len]) {
+            len++;
+        }
+        while (len && paths[0][len - 1] != '/') {
+            len--;
+        }
+        root = len;
+    }
+
+    struct BatchName* names = SDL_calloc(SDL_max(count, 1), sizeof(*names));
+    if (!names) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const char* path = paths[i] + root;
+        const char* ext = SDL_strrchr(path, '.');
+        const char* dir = SDL_strrchr(path, '/');
+        const size_t len = ext && ext > (dir ? dir : path) ? (size_t)(ext - path) : SDL_strlen(path);
+
+        names[i].index = i;
+        if (!(names[i].name = batch_name(path, len))) {
+            batch_free_names(names, count);
+            return false;
+        }
+    }
+
+    // files that only differ by extension, such as a.gbs and a.zip, keep it.
+    SDL_qsort(names, count, sizeof(*names), compare_batch_names);
+    for (size_t i = 0; i < count; ) {
+        size_t end = i + 1;
+        while (end < count && !compare_batch_names(&names[i], &names[end])) {
+            end++;
+        }
+
+        for (size_t j = i; end - i > 1 && j < end; j++) {
+            const char* path = paths[names[j].index] + root;
+            SDL_free(names[j].name);
+            if (!(names[j].name = batch_name(path, SDL_strlen(path)))) {
+                batch_free_names(names, count);
+                return false;
+            }
+        }
+        i = end;
+    }
+
+    SDL_qsort(names, count, sizeof(*names), compare_batch_names);
+    for (size_t i = 1; i < count; i++) {
+        if (!compare_batch_names(&names[i - 1], &names[i])) {
+            SDL_SetError("%s and %s would be written to the same files", paths[names[i - 1].index], paths[names[i].index]);
+            batch_free_names(names, count);
+            return false;
+        }
+    }
+
+    char** result = SDL_malloc(SDL_max(count, 1) * sizeof(*result));
+    if (!result) {
+        batch_free_names(names, count);
+        return false;
+    }
+
+    // owned by the result now.
+    for (size_t i = 0; i < count; i++) {
+        result[names[i].index] = names[i].name;
+    }
+    SDL_free(names);
+
+    *out = result;
+    return true;
+}
+
+static void* batch_load(void* user, size_t index, unsigned* song_count)
+{
+    struct Batch* batch = user;
+    const char* path = batch->paths[index];
+
+    App* app = SDL_malloc(sizeof(*app));
+    if (!app) {
+        return NULL;
+    }
+    SDL_memcpy(app, batch->settings, sizeof(*app));
+
+    if (!load_archive(path, &app->archive, false) || !archive_inflate(&app->archive) || !gbs_get_meta_data(app->archive.gbs_data, app->archive.gbs_size, &app->gbs_meta)) {
+        printf("failed: %s\n", path);
+        archive_close(&app->archive);
+        SDL_free(app);
+        return NULL;
+    }
+
+    // named after the file rather than its title, which other files may share.
+    SDL_strlcpy(app->output_name, batch->names[index], sizeof(app->output_name));
+
+    *song_count = app->gbs_meta.max_song;
+    return app;
+}
+
+static bool batch_render(void* user, unsigned worker, size_t index, void* file, unsigned song)
+{
+    struct Batch* batch = user;
+    struct BatchWorker* w = &batch->workers[worker];
+    App* app = file;
+
+    // compared by index, as a later file may be loaded at the same address.
+    if (w->file != index + 1) {
+        w->file = 0;
+        if (!gbs_load_mem(w->renderer.gbs, app->archive.gbs_data, app->archive.gbs_size)) {
+            printf("failed: %s\n", batch->paths[index]);
+            return false;
+        }
+        gbs_set_master_volume(w->renderer.gbs, 1.0);
+        w->file = index + 1;
+    }
+
+    song += app->gbs_meta.first_song;
+    if (!do_render_song(app, &w->renderer, batch->dir, batch->freq, song)) {
+        printf("failed: %s song %u: %s\n", batch->paths[index], song, SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+static void batch_unload(void* user, void* file)
+{
+    (void)user;
+    App* app = file;
+    archive_close(&app->archive);
+    SDL_free(app);
+}
+
+static bool batch_run(struct Batch* batch, size_t file_count, unsigned jobs, int render_freq)
+{
+    static const struct BatchRenderInterface iface = {
+        .load = batch_load,
+        .render = batch_render,
+        .unload = batch_unload,
+    };
+
+    const Uint64 start = SDL_GetTicks64();
+    struct BatchRenderStats stats;
+    if (!batch_render_run(&iface, batch, file_count, jobs, &stats)) {
+        return false;
+    }
+
+    uint64_t frames = 0;
+    for (unsigned i = 0; i < jobs; i++) {
+        frames += batch->workers[i].renderer.rendered_frames;
+    }
+
+    const unsigned ms = SDL_max((unsigned)(SDL_GetTicks64() - start), 1);
+    printf("batch: %u files (%u failed), %u songs (%u failed) in %ums\n", stats.files + stats.failed_files, stats.failed_files, stats.songs, stats.failed_songs, ms);
+    printf("\t%.1f songs/s, %.1f emulated seconds/s, %u steals\n", stats.songs * 1000.0 / ms, (double)frames * 1000.0 / render_freq / ms, stats.steals);
+
+    if (stats.failed_files || stats.failed_songs) {
+        SDL_SetError("%u files and %u songs failed", stats.failed_files, stats.failed_songs);
+        return false;
+    }
+    return true;
+}
+
+// TotalGBS batch [options] [--] paths...
+static bool do_batch(int argc, char** argv)
+{
+    App* settings = SDL_calloc(1, sizeof(*settings));
+    if (!settings) {
+        return false;
+    }
+
+    const char* dir = NULL;
+    bool null = false;
+    int freq = 48000;
+    int render_freq = 0;
+    int jobs = 0;
+
+    settings->wav_format = WavFormat_S16;
+
+    int arg_index = 2;
+    struct ArgsData arg_data;
+    enum ArgsResult arg_result;
+    while (!(arg_result = args_parse(&arg_index, argc, argv, BATCH_ARGS_META, SDL_arraysize(BATCH_ARGS_META), &arg_data))) {
+        switch (BATCH_ARGS_META[arg_data.meta_index].id) {
+            case BatchArgsId_help:
+                print_usage(0);
+                SDL_free(settings);
+                return true;
+            case BatchArgsId_output:
+                dir = arg_data.value.s;
+                break;
+            case BatchArgsId_null:
+                null = true;
+                break;
+            case BatchArgsId_format:
+                if (!parse_output_format(arg_data.value.s, &settings->wav_format, &settings->flac)) {
+                    SDL_SetError("unknown output format [%s]", arg_data.value.s);
+                    SDL_free(settings);
+                    return false;
+                }
+                break;
+            case BatchArgsId_freq:
+                freq = arg_data.value.i;
+                break;
+            case BatchArgsId_render_freq:
+                render_freq = arg_data.value.i;
+                break;
+            case BatchArgsId_jobs:
+                jobs = arg_data.value.i;
+                break;
+        }
+    }
+
+    if (arg_result < 0) {
+        SDL_SetError("bad batch args: %d", arg_result);
+        SDL_free(settings);
+        return false;
+    }
+
+    if ((!dir && !null) || arg_index >= argc) {
+        SDL_SetError("batch requires --output or --null, and paths");
+        SDL_free(settings);
+        return false;
+    }
+
+    if (freq <= 0) {
+        SDL_SetError("bad batch freq");
+        SDL_free(settings);
+        return false;
+    }
+
+    settings->render_freq = render_freq > 0 ? render_freq : freq;
+    settings->outputs[settings->output_count++] = (struct RenderOutput){
+        .freq = freq,
+        .format = settings->wav_format,
+        .flac = settings->flac,
+        // the files are rendered on every cpu already.
+        .flac_jobs = 1,
+    };
+
+    // paths are either everything after "--" or a single trailing arg.
+    char** paths;
+    size_t file_count;
+    if (!catalog_scan_find((const char* const*)argv + arg_index, argc - arg_index, &paths, &file_count)) {
+        SDL_free(settings);
+        return false;
+    }
+
+    if (jobs <= 0) {
+        jobs = SDL_GetCPUCount();
+    }
+    jobs = SDL_clamp(jobs, 1, BATCH_RENDER_MAX_WORKERS);
+
+    char** names;
+    if (!batch_make_names(paths, file_count, &names)) {
+        catalog_scan_free_files(paths, file_count);
+        SDL_free(settings);
+        return false;
+    }
+
+    struct Batch* batch = SDL_calloc(1, sizeof(*batch));
+    bool result = batch != NULL;
+    if (batch) {
+        batch->settings = settings;
+        batch->dir = dir;
+        batch->freq = freq;
+        batch->paths = paths;
+        batch->names = names;
+
+        const struct SinkConfig sink_config = {
+            .sample_rate = freq,
+            .channels = 2,
+        };
+
+        for (int i = 0; i < jobs && result; i++) {
+            struct Renderer* r = &batch->workers[i].renderer;
+            result = (r->gbs = gbs_init(settings->render_freq)) && (!null || (r->null_sink = sink_open_null(&sink_config)));
+        }
+
+        if (!result) {
+            SDL_SetError("failed to init batch workers");
+        }
+        else {
+            printf("batch: %zu files on %d threads\n", file_count, jobs);
+            result = batch_run(batch, file_count, (unsigned)jobs, settings->render_freq);
+        }
+
+        for (int i = 0; i < jobs; i++) {
+            sink_close(batch->workers[i].renderer.null_sink);
+            gbs_quit(batch->workers[i].renderer.gbs);
+        }
+        SDL_free(batch);
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        SDL_free(names[i]);
+    }
+    SDL_free(names);
+    catalog_scan_free_files(paths, file_count);
+    SDL_free(settings);
+    return result;
+}
+
+// loaded files are kept for later streams, the least recently used past this are dropped.
+enum { SERVE_MAX_FILES = 64 };
+
+struct ServeFile {
+    struct Serve* serve;
+    char* path;
+    Archive archive;
+    // streams playing it, as their gbs reads it in place.
+    unsigned refs;
+    uint64_t used;
+};
+
+// files are opened on the server's loader thread, and released from the pool's threads.
+struct Serve {
+    const char* root;
+    int freq;
+    SDL_mutex* lock;
+    // guarded by lock.
+    struct ServeFile** files;
+    size_t file_count;
+    uint64_t clock;
+};
+
+static void serve_file_free(struct ServeFile* file)
+{
+    archive_close(&file->archive);
+    SDL_free(file->path);
+    SDL_free(file);
+}
+
+// drops the least recently used file no stream is playing, called with the lock held.
+static void serve_evict_file(struct Serve* serve)
+{
+    size_t lru = serve->file_count;
+    for (size_t i = 0; i < serve->file_count; i++) {
+        if (!serve->files[i]->refs && (lru == serve->file_count || serve->files[i]->used < serve->files[lru]->used)) {
+            lru = i;
+        }
+    }
+
+    if (lru != serve->file_count) {
+        serve_file_free(serve->files[lru]);
+        serve->files[lru] = serve->files[--serve->file_count];
+    }
+}
+
+// returns the file with a reference taken, loading it outside of the lock if it's new.
+static struct ServeFile* serve_acquire_file(struct Serve* serve, const char* path)
+{
+    SDL_LockMutex(serve->lock);
+    for (size_t i = 0; i < serve->file_count; i++) {
+        struct ServeFile* file = serve->files[i];
+        if (!SDL_strcmp(file->path, path)) {
+            file->refs++;
+            file->used = ++serve->clock;
+            SDL_UnlockMutex(serve->lock);
+            return file;
+        }
+    }
+    SDL_UnlockMutex(serve->lock);
+
+    struct ServeFile* file = SDL_calloc(1, sizeof(*file));
+    if (!file || !(file->path = SDL_strdup(path))) {
+        SDL_free(file);
+        return NULL;
+    }
+    file->serve = serve;
+
+    // only the loader thread adds files, so it can't have been loaded meanwhile.
+    // a path too long for full fails, rather than opening a truncated one.
+    char full[1024];
+    const int len = SDL_snprintf(full, sizeof(full), "%s/%s", serve->root, path);
+    if (len < 0 || (size_t)len >= sizeof(full) || !load_archive(full, &file->archive, false) || !archive_inflate(&file->archive)) {
+        serve_file_free(file);
+        return NULL;
+    }
+
+    SDL_LockMutex(serve->lock);
+    struct ServeFile** files = SDL_realloc(serve->files, (serve->file_count + 1) * sizeof(*files));
+    if (files) {
+        serve->files = files;
+        serve->files[serve->file_count++] = file;
+        // referenced before evicting, so that it isn't the one dropped.
+        file->refs++;
+        file->used = ++serve->clock;
+        if (serve->file_count > SERVE_MAX_FILES) {
+            serve_evict_file(serve);
+        }
+    }
+    SDL_UnlockMutex(serve->lock);
+
+    if (!files) {
+        serve_file_free(file);
+        return NULL;
+    }
+    return file;
+}
+
+// called by the pool once a stream's gbs is freed, files left past the limit go then.
+static void serve_release_file(void* user)
+{
+    struct ServeFile* file = user;
+    struct Serve* serve = file->serve;
+
+    SDL_LockMutex(serve->lock);
+    file->refs--;
+    if (serve->file_count > SERVE_MAX_FILES) {
+        serve_evict_file(serve);
+    }
+    SDL_UnlockMutex(serve->lock);
+}
+
+static Gbs* serve_open(void* user, const char* path, int song, void** out)
+{
+    struct Serve* serve = user;
+    struct ServeFile* file = serve_acquire_file(serve, path);
+    if (!file) {
+        printf("serve: failed to load: %s\n", path);
+        return NULL;
+    }
+
+    struct GbsMeta meta;
+    Gbs* gbs = gbs_init(serve->freq);
+    if (!gbs || !gbs_load_mem(gbs, file->archive.gbs_data, file->archive.gbs_size) || !gbs_get_meta(gbs, &meta) || !gbs_set_song(gbs, song >= 0 ? (unsigned)song : meta.first_song)) {
+        printf("serve: failed to open song %d of: %s\n", song, path);
+        gbs_quit(gbs);
+        serve_release_file(file);
+        return NULL;
+    }
+
+    gbs_set_master_volume(gbs, 1.0);
+    *out = file;
+    return gbs;
+}
+
+// TotalGBS serve [--unix path | --port port] [options]
+static bool do_serve(int argc, char** argv)
+{
+    struct Serve serve = {
+        .root = ".",
+        .freq = 48000,
+    };
+    const char* unix_path = NULL;
+    int port = 0;
+    int jobs = 0;
+
+    int arg_index = 2;
+    struct ArgsData arg_data;
+    enum ArgsResult arg_result;
+    while (!(arg_result = args_parse(&arg_index, argc, argv, SERVE_ARGS_META, SDL_arraysize(SERVE_ARGS_META), &arg_data))) {
+        switch (SERVE_ARGS_META[arg_data.meta_index].id) {
+            case ServeArgsId_help:
+                print_usage(0);
+                return true;
+            case ServeArgsId_unix:
+                unix_path = arg_data.value.s;
+                break;
+            case ServeArgsId_port:
+                port = arg_data.value.i;
+                break;
+            case ServeArgsId_root:
+                serve.root = arg_data.value.s;
+                break;
+            case ServeArgsId_freq:
+                serve.freq = arg_data.value.i;
+                break;
+            case ServeArgsId_jobs:
+                jobs = arg_data.value.i;
+                break;
+        }
+    }
+
+    if (arg_result < 0) {
+        SDL_SetError("bad serve args: %d", arg_result);
+        return false;
+    }
+
+    if (!unix_path == !port || port < 0 || port > 65535) {
+        SDL_SetError("serve requires one of --unix or --port");
+        return false;
+    }
+
+    if (serve.freq <= 0) {
+        SDL_SetError("bad serve freq");
+        return false;
+    }
+
+    // half a second of audio per stream, rendered 1024 frames at a time.
+    const struct StreamPoolConfig pool_config = {
+        .threads = jobs > 0 ? (unsigned)jobs : 0,
+        .sample_rate = (unsigned)serve.freq,
+        .buffer_frames = (unsigned)serve.freq / 2,
+        .chunk_frames = 1024,
+    };
+
+    if (!(serve.lock = SDL_CreateMutex())) {
+        return false;
+    }
+
+    StreamPool* pool = stream_pool_init(&pool_config);
+    if (!pool) {
+        SDL_DestroyMutex(serve.lock);
+        return false;
+    }
+
+    static const struct StreamServerInterface iface = {
+        .open = serve_open,
+        .release = serve_release_file,
+    };
+
+    const struct StreamServerConfig config = {
+        .unix_path = unix_path,
+        .port = (unsigned)port,
+        .pool = pool,
+        .sample_rate = (unsigned)serve.freq,
+    };
+
+    struct StreamPoolStats pool_stats;
+    stream_pool_get_stats(pool, &pool_stats);
+    if (unix_path) {
+        printf("serve: %s on %u threads\n", unix_path, pool_stats.threads);
+    }
+    else {
+        printf("serve: http://127.0.0.1:%d on %u threads\n", port, pool_stats.threads);
+    }
+    fflush(stdout);
+
+    struct StreamServerStats stats;
+    const bool result = stream_server_run(&config, &iface, &serve, &stats);
+
+    stream_pool_get_stats(pool, &pool_stats);
+    printf("serve: accepted: %u rejected: %u peak: %u sent: %llu bytes steals: %u\n", stats.accepted, stats.rejected, stats.peak_clients, stats.bytes_sent, pool_stats.steals);
+
+    // every stream has released its file once the pool is gone.
+    stream_pool_quit(pool);
+    for (size_t i = 0; i < serve.file_count; i++) {
+        serve_file_free(serve.files[i]);
+    }
+    SDL_free(serve.files);
+    SDL_DestroyMutex(serve.lock);
+    return result;
+}
+
+// loaded files are kept for later jobs, the least recently used past this are dropped.
+enum { JOBS_MAX_FILES = 64 };
+// a pre-roll to a job's start leaves a snapshot this often, and at most this many per file.
+enum { JOBS_CHECKPOINT_SECONDS = 60 };
+enum { JOBS_MAX_CHECKPOINTS = 64 };
+// rendered after restoring a checkpoint, see snapshot_grid.h.
+enum { JOBS_CHECKPOINT_PREROLL_MS = 500 };
+
+// where a song was at a frame, the frame is on the grid where frames and cycles line up.
+struct JobCheckpoint {
+    unsigned song;
+    unsigned rate;
+    size_t frame;
+    void* snapshot;
+};
+
+struct JobFile {
+    char* path;
+    Archive archive;
+    struct GbsMeta meta;
+    // workers with it loaded, as their gbs reads it in place.
+    unsigned refs;
+    uint64_t used;
+    // guarded by the jobs lock, each snapshot is kept until the file is freed.
+    struct JobCheckpoint* checkpoints;
+    size_t checkpoint_count;
+};
+
+// each worker keeps its gbs, at the rate and with the file of its last job.
+struct JobWorker {
+    Gbs* gbs;
+    unsigned rate;
+    struct JobFile* file;
+};
+
+struct Jobs {
+    int freq;
+    SDL_mutex* lock;
+    // guarded by lock.
+    struct JobFile** files;
+    size_t file_count;
+    uint64_t clock;
+    struct JobWorker workers[JOB_RUNNER_MAX_WORKERS];
+};
+
+static void job_file_free(struct JobFile* file)
+{
+    for (size_t i = 0; i < file->checkpoint_count; i++) {
+        SDL_free(file->checkpoints[i].snapshot);
+    }
+    SDL_free(file->checkpoints);
+    archive_close(&file->archive);
+    SDL_free(file->path);
+    SDL_free(file);
+}
+
+static struct JobFile* jobs_find_file(struct Jobs* jobs, const char* path)
+{
+    for (size_t i = 0; i < jobs->file_count; i++) {
+        if (!SDL_strcmp(jobs->files[i]->path, path)) {
+            return jobs->files[i];
+        }
+    }
+    return NULL;
+}
+
+// drops the least recently used file no worker has loaded, called with the lock held.
+static void jobs_evict_file(struct Jobs* jobs)
 {
-    archive->gbs_data = SDL_LoadFile(path, &archive->gbs_size);
-    if (!archive->gbs_data) {
-        goto fail;
+    size_t lru = jobs->file_count;
+    for (size_t i = 0; i < jobs->file_count; i++) {
+        if (!jobs->files[i]->refs && (lru == jobs->file_count || jobs->files[i]->used < jobs->files[lru]->used)) {
+            lru = i;
+        }
     }
 
-    return true;
-fail:
-    if (archive->gbs_data) {
-        SDL_free(archive->gbs_data);
-        archive->gbs_data = NULL;
+    if (lru != jobs->file_count) {
+        job_file_free(jobs->files[lru]);
+        jobs->files[lru] = jobs->files[--jobs->file_count];
     }
-
-    return false;
 }
 
-static bool load_archive(zlib_filefunc_def* ff, const char* path, Archive* archive)
+// returns the file with a reference taken, loading it outside of the lock if it's new.
+static struct JobFile* jobs_acquire_file(struct Jobs* jobs, const char* path, bool* cached)
 {
-    SDL_memset(archive, 0, sizeof(*archive));
+    SDL_LockMutex(jobs->lock);
+    struct JobFile* file = jobs_find_file(jobs, path);
+    if (file) {
+        file->refs++;
+        file->used = ++jobs->clock;
+    }
+    SDL_UnlockMutex(jobs->lock);
 
-    const char* ext = SDL_strrchr(path, '.');
+    if ((*cached = file != NULL)) {
+        return file;
+    }
+
+    if (!(file = SDL_calloc(1, sizeof(*file))) || !(file->path = SDL_strdup(path))) {
+        SDL_free(file);
+        SDL_SetError("out of memory");
+        return NULL;
+    }
+
+    if (!load_archive(path, &file->archive, false) || !archive_inflate(&file->archive) || !gbs_get_meta_data(file->archive.gbs_data, file->archive.gbs_size, &file->meta)) {
+        job_file_free(file);
+        SDL_SetError("failed to load: %s", path);
+        return NULL;
+    }
 
-    if (!SDL_strcasecmp(ext, ".gbs")) {
-        return parse_file(path, archive);
+    SDL_LockMutex(jobs->lock);
+    // another worker may have loaded it meanwhile.
+    struct JobFile* other = jobs_find_file(jobs, path);
+    struct JobFile** files = other ? NULL : SDL_realloc(jobs->files, (jobs->file_count + 1) * sizeof(*files));
+    if (other) {
+        job_file_free(file);
+        file = other;
     }
-    else if (!SDL_strcasecmp(ext, ".zip")) {
-        return parse_zip(ff, path, archive);
+    else if (files) {
+        jobs->files = files;
+        jobs->files[jobs->file_count++] = file;
     }
-    // todo: gbs files are commonly distributed in 7zip format
-    else if (!SDL_strcasecmp(ext, ".7z")) {
+    else {
+        job_file_free(file);
+        file = NULL;
+        SDL_SetError("out of memory");
     }
 
-    return false;
+    // referenced before evicting, so that it isn't the one dropped.
+    if (file) {
+        file->refs++;
+        file->used = ++jobs->clock;
+    }
+    if (jobs->file_count > JOBS_MAX_FILES) {
+        jobs_evict_file(jobs);
+    }
+    SDL_UnlockMutex(jobs->lock);
+    return file;
 }
 
-static int cmpfunc(const void* a, const void* b)
+static void jobs_release_file(struct Jobs* jobs, struct JobFile* file)
 {
-    const struct M3uSongInfo* info_a = a;
-    const struct M3uSongInfo* info_b = b;
-    return (int)info_a->songno - (int)info_b->songno;
+    if (file) {
+        SDL_LockMutex(jobs->lock);
+        file->refs--;
+        SDL_UnlockMutex(jobs->lock);
+    }
 }
 
-static void archive_close(Archive* archive)
+// points the worker's gbs at file at rate, reusing what it already has.
+static bool jobs_prepare_worker(struct Jobs* jobs, struct JobWorker* w, struct JobFile* file, unsigned rate, bool* reused)
 {
-    if (archive->gbs_data) {
-        SDL_free(archive->gbs_data);
+    *reused = w->gbs && w->rate == rate && w->file == file;
+    if (*reused) {
+        // the worker already holds a reference.
+        jobs_release_file(jobs, file);
+        return true;
     }
 
-    for (size_t i = 0; i < archive->m3u_count; i++) {
-        m3u_info_free(&archive->infos[i]);
+    if (!w->gbs || w->rate != rate) {
+        gbs_quit(w->gbs);
+        w->rate = rate;
+        if (!(w->gbs = gbs_init(rate))) {
+            SDL_SetError("failed to init gbs");
+        }
     }
-    SDL_memset(archive, 0, sizeof(*archive));
+
+    jobs_release_file(jobs, w->file);
+    w->file = NULL;
+    if (!w->gbs || !gbs_load_mem(w->gbs, file->archive.gbs_data, file->archive.gbs_size)) {
+        jobs_release_file(jobs, file);
+        SDL_SetError("failed to load: %s", file->path);
+        return false;
+    }
+
+    gbs_set_master_volume(w->gbs, 1.0);
+    w->file = file;
+    return true;
 }
 
-static void convert_str_to_printable_chars(char* str)
+static Sink* jobs_open_sink(const struct Job* job, unsigned rate)
 {
-    const size_t len = SDL_strlen(str);
-    for (size_t i = 0; i < len; i++) {
-        if (str[i] < 32) {
-            str[i] = '-';
+    const struct SinkConfig config = {
+        .sample_rate = rate,
+        .channels = 2,
+    };
+
+    Sink* sink = NULL;
+    switch (job->sink) {
+        case JobSink_WAV:
+        case JobSink_FLAC: {
+            const struct RenderOutput output = {
+                .freq = (int)rate,
+                .format = WavFormat_S16,
+                .flac = job->sink == JobSink_FLAC,
+                // the jobs are run on every cpu already.
+                .flac_jobs = 1,
+            };
+            return open_file_sink(job->output, &output, &config);
         }
+        case JobSink_RAW:
+            sink = sink_open_raw(job->output, &config);
+            break;
+        case JobSink_NULL:
+            sink = sink_open_null(&config);
+            break;
     }
+
+    if (!sink) {
+        SDL_SetError("failed to open output: %s", job->output);
+    }
+    return sink;
 }
 
-static bool do_gbs2gb(App* app, const char* dir)
+// copies out the latest checkpoint of song that leaves room for the pre-roll before start.
+static bool jobs_find_checkpoint(struct Jobs* jobs, struct JobFile* file, unsigned song, unsigned rate, size_t start, size_t preroll, struct JobCheckpoint* out)
 {
-    char path[512];
-    SDL_snprintf(path, sizeof(path), "%s/%s.%s", dir, app->output_name, gbs2gb_get_system_type(app->gbs) == Gbs2GbSystem_DMG ? "gb" : "gbc");
+    bool found = false;
+    SDL_LockMutex(jobs->lock);
+    for (size_t i = 0; i < file->checkpoint_count; i++) {
+        const struct JobCheckpoint* cp = &file->checkpoints[i];
+        if (cp->song == song && cp->rate == rate && cp->frame + preroll <= start && (!found || cp->frame > out->frame)) {
+            *out = *cp;
+            found = true;
+        }
+    }
+    SDL_UnlockMutex(jobs->lock);
+    return found;
+}
 
-    struct GbsWriteIo write_io;
-    write_io.user = SDL_RWFromFile(path, "wb");
-    if (!write_io.user){
-        return false;
+// keeps a snapshot of gbs at frame, unless the file has enough or another worker beat us to it.
+static void jobs_add_checkpoint(struct Jobs* jobs, struct JobFile* file, Gbs* gbs, unsigned song, unsigned rate, size_t frame)
+{
+    void* snapshot = snapshot_grid_take(gbs);
+    if (!snapshot) {
+        return;
     }
 
-    write_io.write = gbs_io_write;
-    const bool result = gbs2gb_io(app->gbs, &write_io);
-    SDL_RWclose(write_io.user);
+    SDL_LockMutex(jobs->lock);
+    bool keep = file->checkpoint_count < JOBS_MAX_CHECKPOINTS;
+    for (size_t i = 0; i < file->checkpoint_count && keep; i++) {
+        const struct JobCheckpoint* cp = &file->checkpoints[i];
+        keep = cp->song != song || cp->rate != rate || cp->frame != frame;
+    }
 
-    if (!result) {
-        SDL_SetError("\nfailed to write gbc file!\n");
+    struct JobCheckpoint* checkpoints = keep ? SDL_realloc(file->checkpoints, (file->checkpoint_count + 1) * sizeof(*checkpoints)) : NULL;
+    if (checkpoints) {
+        file->checkpoints = checkpoints;
+        file->checkpoints[file->checkpoint_count++] = (struct JobCheckpoint){
+            .song = song,
+            .rate = rate,
+            .frame = frame,
+            .snapshot = snapshot,
+        };
+        snapshot = NULL;
     }
-    else {
-        printf("output: \"%s\"\n", path);
+    SDL_UnlockMutex(jobs->lock);
+    SDL_free(snapshot);
+}
+
+/*
+* runs gbs, which has just had song set, to start frames into the song, throwing
+* the samples away. that costs about as much as rendering them, so it starts from
+* the latest checkpoint that an earlier job left, and leaves new ones on the way.
+* a checkpoint is restored a pre-roll early, so that the output is the same.
+*/
+static bool jobs_preroll(struct Jobs* jobs, struct JobFile* file, Gbs* gbs, unsigned song, unsigned rate, size_t start)
+{
+    const size_t grid = snapshot_grid_step(rate);
+    const size_t preroll = snapshot_grid_round_up((size_t)JOBS_CHECKPOINT_PREROLL_MS * rate / 1000, grid);
+    const size_t spacing = snapshot_grid_round_up((size_t)JOBS_CHECKPOINT_SECONDS * rate, grid);
+    const uint64_t origin = gbs_get_cycles(gbs);
+    size_t frame = 0;
+
+    // snapshots are only freed with the file, which the job holds.
+    struct JobCheckpoint cp = { 0 };
+    if (jobs_find_checkpoint(jobs, file, song, rate, start, preroll, &cp)) {
+        if (!gbs_load_snapshot(gbs, cp.snapshot, gbs_snapshot_size(gbs))) {
+            SDL_SetError("failed to restore checkpoint");
+            return false;
+        }
+        frame = cp.frame;
     }
-    return result;
+
+    for (size_t next = (frame / spacing + 1) * spacing; next + grid <= start; next += spacing) {
+        for (size_t at = next; at + grid <= start && at < next + spacing; at += grid) {
+            if (snapshot_grid_run_to(gbs, snapshot_grid_cycle(origin, at, rate), &frame) && frame == at) {
+                jobs_add_checkpoint(jobs, file, gbs, song, rate, at);
+                break;
+            }
+        }
+    }
+
+    int16_t skipped[4096];
+    for (size_t remaining = (start - frame) * 2; remaining;) {
+        const size_t count = SDL_min(remaining, SDL_arraysize(skipped));
+        gbs_run(gbs, gbs_clocks_needed(gbs, (int)count));
+        gbs_read_samples(gbs, skipped, (int)count);
+        remaining -= count;
+    }
+    return true;
 }
 
-static bool do_wav_song(App* app, const char* dir, int freq, unsigned char song)
+static bool jobs_run(void* user, unsigned worker, const struct Job* job, struct JobResult* result)
 {
-    if (!gbs_set_song(app->gbs, song)) {
-        SDL_SetError("failed to set song: %u", song);
+    struct Jobs* jobs = user;
+    struct JobWorker* w = &jobs->workers[worker];
+    const Uint64 start = SDL_GetPerformanceCounter();
+    const unsigned rate = job->rate ? job->rate : (unsigned)jobs->freq;
+
+    struct JobFile* file = jobs_acquire_file(jobs, job->file, &result->file_cached);
+    if (!file || !jobs_prepare_worker(jobs, w, file, rate, &result->gbs_reused)) {
         return false;
     }
 
-    char path[512];
-    const struct M3uSongInfo* info = find_info_from_song(&app->archive, song);
-    if (info) {
-        SDL_snprintf(path, sizeof(path), "%s/%s - %u - %s.wav", dir, app->output_name, song, info->song_tile);
+    const unsigned song = job->song >= 0 ? (unsigned)job->song : file->meta.first_song;
+    if (song >= file->meta.max_song || !gbs_set_song(w->gbs, song)) {
+        SDL_SetError("failed to set song: %u", song);
+        return false;
     }
-    else {
-        SDL_snprintf(path, sizeof(path), "%s/%s - %u.wav", dir, app->output_name, song);
+    result->song = song;
+
+    double duration = job->duration;
+    if (duration < 0) {
+        const struct M3uEntry* info = m3u_playlist_find(&file->archive.playlist, song);
+        duration = info ? info->time : 60*3;
     }
 
-    if (!wav_open(path, freq, 2, 16)) {
-        SDL_SetError("failed to open wav: %s", path);
+    const Uint64 loaded = SDL_GetPerformanceCounter();
+    result->load_ms = (double)(loaded - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    Sink* sink = jobs_open_sink(job, rate);
+    if (!sink) {
         return false;
     }
 
-    unsigned time = 60*3;
-    if (info) {
-        time = info->time;
+    if (!jobs_preroll(jobs, file, w->gbs, song, rate, (size_t)(job->start * rate))) {
+        sink_close(sink);
+        return false;
     }
 
-    static short samples[48000*2/10];
-    const unsigned number_of_samples = sizeof(samples) / sizeof(short);
+    result->frames = (uint64_t)(duration * rate);
+    render_samples(w->gbs, sink, (size_t)result->frames * 2);
 
-    for (unsigned i = 0; i < time; i++) {
-        for (unsigned j = 0; j < 10; j++) {
-            gbs_run(app->gbs, gbs_clocks_needed(app->gbs, number_of_samples));
-            gbs_read_samples(app->gbs, samples, number_of_samples);
-            wav_write(samples, sizeof(samples));
-        }
+    if (!sink_close(sink)) {
+        SDL_SetError("failed to write output: %s", job->output);
+        return false;
     }
 
-    wav_close();
+    result->render_ms = (double)(SDL_GetPerformanceCounter() - loaded) * 1000.0 / (double)SDL_GetPerformanceFrequency();
     return true;
 }
 
-static bool do_wav(App* app, const char* dir, int freq)
+// TotalGBS jobs [-f freq] [-j jobs] < jobs.ndjson
+static bool do_jobs(int argc, char** argv)
 {
-    for (unsigned i = 0; i < app->gbs_meta.max_song; i++) {
-        if (!do_wav_song(app, dir, freq, app->gbs_meta.first_song + i)) {
-            return false;
+    int freq = 48000;
+    int threads = 0;
+
+    int arg_index = 2;
+    struct ArgsData arg_data;
+    enum ArgsResult arg_result;
+    while (!(arg_result = args_parse(&arg_index, argc, argv, JOBS_ARGS_META, SDL_arraysize(JOBS_ARGS_META), &arg_data))) {
+        switch (JOBS_ARGS_META[arg_data.meta_index].id) {
+            case JobsArgsId_help:
+                print_usage(0);
+                return true;
+            case JobsArgsId_freq:
+                freq = arg_data.value.i;
+                break;
+            case JobsArgsId_jobs:
+                threads = arg_data.value.i;
+                break;
         }
     }
 
-    return true;
-}
+    if (arg_result < 0) {
+        SDL_SetError("bad jobs args: %d", arg_result);
+        return false;
+    }
 
-static int print_usage(int code) {
-    printf("\
-[TotalGBS " LIBGBS_VERSION_STR " By TotalJustice] \n\n\
-Usage\n\n\
-    -h, --help      = Display help.\n\
-    -v, --version   = Display version.\n\
-    -r, --rom       = Set GBS rom.\n\
-    -i, --info      = Log info.\n\
-    -s, --song      = Set song.\n\
-    -f, --freq      = Set output frequency.\n\
-    -w, --wav       = Output folder to convert song(s) to wav.\n\
-    -g, --gbs2gb    = Output folder to convert GBS rom to gb rom.\n\
-    \n");
+    if (freq <= 0) {
+        SDL_SetError("bad jobs freq");
+        return false;
+    }
 
-    return code;
+    if (threads <= 0) {
+        threads = SDL_GetCPUCount();
+    }
+    threads = SDL_clamp(threads, 1, JOB_RUNNER_MAX_WORKERS);
+
+    struct Jobs* jobs = SDL_calloc(1, sizeof(*jobs));
+    if (!jobs || !(jobs->lock = SDL_CreateMutex())) {
+        SDL_SetError("failed to init jobs");
+        SDL_free(jobs);
+        return false;
+    }
+    jobs->freq = freq;
+
+    static const struct JobRunnerInterface iface = {
+        .run = jobs_run,
+    };
+
+    // stdout only carries results, so the summary goes to stderr.
+    struct JobRunnerStats stats;
+    const Uint64 start = SDL_GetTicks64();
+    const bool result = job_runner_run(stdin, stdout, &iface, jobs, (unsigned)threads, &stats);
+    fprintf(stderr, "jobs: %u (%u failed) in %ums on %d threads, %zu files loaded\n", stats.jobs, stats.failed, (unsigned)(SDL_GetTicks64() - start), threads, jobs->file_count);
+
+    for (int i = 0; i < threads; i++) {
+        gbs_quit(jobs->workers[i].gbs);
+    }
+    for (size_t i = 0; i < jobs->file_count; i++) {
+        job_file_free(jobs->files[i]);
+    }
+    SDL_free(jobs->files);
+    SDL_DestroyMutex(jobs->lock);
+    SDL_free(jobs);
+    return result;
 }
 
 static AppResult app_init(void** appstate, int argc, char** argv)
@@ -401,12 +2774,40 @@ static AppResult app_init(void** appstate, int argc, char** argv)
         return AppResult_FALIURE;
     }
 
+    if (!SDL_strcmp(argv[1], "catalog")) {
+        return do_catalog(argc, argv) ? AppResult_SUCCESS : AppResult_FALIURE;
+    }
+
+    if (!SDL_strcmp(argv[1], "replay")) {
+        return do_replay(argc, argv) ? AppResult_SUCCESS : AppResult_FALIURE;
+    }
+
+    if (!SDL_strcmp(argv[1], "batch")) {
+        return do_batch(argc, argv) ? AppResult_SUCCESS : AppResult_FALIURE;
+    }
+
+    if (!SDL_strcmp(argv[1], "serve")) {
+        return do_serve(argc, argv) ? AppResult_SUCCESS : AppResult_FALIURE;
+    }
+
+    if (!SDL_strcmp(argv[1], "jobs")) {
+        return do_jobs(argc, argv) ? AppResult_SUCCESS : AppResult_FALIURE;
+    }
+
     const char* rom_file = NULL;
     const char* gbs2gb = NULL;
     const char* wav = NULL;
+    const char* raw = NULL;
+    const char* shm = NULL;
+    bool null = false;
     int freq = 48000;
+    int render_freq = 0;
+    bool reglog = false;
+    int segments = 0;
+    int jobs = 1;
     int song = -1;
     bool info = false;
+    bool stream = false;
 
     int arg_index = 1;
     struct ArgsData arg_data;
@@ -435,6 +2836,82 @@ static AppResult app_init(void** appstate, int argc, char** argv)
             case ArgsId_gbs2gb:
                 gbs2gb = arg_data.value.s;
                 break;
+            case ArgsId_stream:
+                stream = true;
+                break;
+            case ArgsId_cache:
+                app->snapshot_dir = arg_data.value.s;
+                break;
+            case ArgsId_raw:
+                raw = arg_data.value.s;
+                break;
+            case ArgsId_shm:
+                shm = arg_data.value.s;
+                break;
+            case ArgsId_null:
+                null = true;
+                break;
+            case ArgsId_render_freq:
+                render_freq = arg_data.value.i;
+                break;
+            case ArgsId_format:
+                if (!parse_output_format(arg_data.value.s, &app->wav_format, &app->flac)) {
+                    SDL_SetError("unknown output format [%s]", arg_data.value.s);
+                    return AppResult_FALIURE;
+                }
+                break;
+            case ArgsId_stems:
+                if (!SDL_strcmp(arg_data.value.s, "files")) {
+                    app->stem_mode = StemMode_FILES;
+                }
+                else if (!SDL_strcmp(arg_data.value.s, "multi")) {
+                    app->stem_mode = StemMode_MULTI;
+                }
+                else {
+                    SDL_SetError("unknown stems mode [%s], expected files or multi", arg_data.value.s);
+                    return AppResult_FALIURE;
+                }
+                break;
+            case ArgsId_reglog:
+                if (!SDL_strcmp(arg_data.value.s, "vgm")) {
+                    app->reglog_format = GbsRegLogFormat_VGM;
+                }
+                else if (!SDL_strcmp(arg_data.value.s, "native")) {
+                    app->reglog_format = GbsRegLogFormat_NATIVE;
+                }
+                else {
+                    SDL_SetError("unknown register log format [%s], expected vgm or native", arg_data.value.s);
+                    return AppResult_FALIURE;
+                }
+                reglog = true;
+                break;
+            case ArgsId_levels:
+                if (arg_data.value.i <= 0) {
+                    SDL_SetError("bad levels rate: %d", arg_data.value.i);
+                    return AppResult_FALIURE;
+                }
+                app->levels_rate = (unsigned)arg_data.value.i;
+                break;
+            case ArgsId_pipeline:
+                app->pipeline = true;
+                break;
+            case ArgsId_segments:
+                segments = arg_data.value.i;
+                break;
+            case ArgsId_jobs:
+                jobs = arg_data.value.i;
+                break;
+            case ArgsId_output:
+                if (app->output_count == RENDER_MAX_OUTPUTS) {
+                    SDL_SetError("too many outputs, max is %d", RENDER_MAX_OUTPUTS);
+                    return AppResult_FALIURE;
+                }
+                if (!parse_output(arg_data.value.s, &app->outputs[app->output_count])) {
+                    SDL_SetError("bad output [%s], expected rate[:format]", arg_data.value.s);
+                    return AppResult_FALIURE;
+                }
+                app->output_count++;
+                break;
         }
     }
 
@@ -469,30 +2946,185 @@ static AppResult app_init(void** appstate, int argc, char** argv)
         return AppResult_FALIURE;
     }
 
-    if (!load_archive(NULL, rom_file, &app->archive)) {
+    // opened first, so that nothing is printed to stdout when it's the output.
+    const struct SinkConfig sink_config = {
+        .sample_rate = freq,
+        .channels = 2,
+    };
+
+    if (raw && !(app->raw_sink = sink_open_raw(raw, &sink_config))) {
+        SDL_SetError("failed to open raw output: %s", raw);
+        return AppResult_FALIURE;
+    }
+
+    if (shm && !(app->shm_sink = open_shm_sink(shm, &sink_config))) {
+        return AppResult_FALIURE;
+    }
+
+    if (null && !(app->null_sink = sink_open_null(&sink_config))) {
+        SDL_SetError("failed to open null output");
+        return AppResult_FALIURE;
+    }
+
+    if (!load_archive(rom_file, &app->archive, stream)) {
         SDL_SetError("bad m3u\n");
         return AppResult_FALIURE;
     }
 
-    SDL_qsort(app->archive.infos, app->archive.m3u_count, sizeof(*app->archive.infos), cmpfunc);
+    // playback always runs at the device rate.
+    const bool render = wav || app->raw_sink || app->shm_sink || app->null_sink;
+    app->render_freq = render && render_freq > 0 ? render_freq : freq;
+
+    if (!app->output_count) {
+        app->outputs[app->output_count++] = (struct RenderOutput){
+            .freq = freq,
+            .format = app->wav_format,
+            .flac = app->flac,
+        };
+    }
 
-    app->gbs = gbs_init(freq);
+    app->gbs = gbs_init(app->render_freq);
     if (!app->gbs) {
         SDL_SetError("failed to init gbs...\n");
         return AppResult_FALIURE;
     }
 
-    if (!gbs_load_mem(app->gbs, app->archive.gbs_data, app->archive.gbs_size)) {
+    if (render && app->stem_mode) {
+        if (app->stem_mode == StemMode_MULTI && app->outputs[0].flac) {
+            SDL_SetError("flac is limited to 8 channels, --stems multi needs a wav format");
+            return AppResult_FALIURE;
+        }
+        if (!gbs_enable_stems(app->gbs, true)) {
+            SDL_SetError("failed to enable stems");
+            return AppResult_FALIURE;
+        }
+    }
+
+    if (render && app->pipeline && (app->stem_mode || reglog)) {
+        SDL_SetError("--pipeline can't be combined with --stems or --reglog");
+        return AppResult_FALIURE;
+    }
+
+    // the levels are captured while the song is emulated by its own renderer.
+    if (render && app->levels_rate && (app->stem_mode || app->pipeline || segments > 0)) {
+        SDL_SetError("--levels can't be combined with --stems, --pipeline or --segments");
+        return AppResult_FALIURE;
+    }
+
+    if (render && jobs == 0) {
+        jobs = SDL_GetCPUCount();
+    }
+
+    // every worker needs its own instance, so a gbs inflated from a zip is read whole first.
+    if (render && (segments > 0 || jobs > 1) && !stream && !archive_inflate(&app->archive)) {
+        SDL_SetError("failed to inflate: %s", rom_file);
+        return AppResult_FALIURE;
+    }
+
+    // only --stream is left streamed.
+    if (render && segments > 0 && (app->archive.io.user || app->pipeline || app->stem_mode || reglog)) {
+        SDL_SetError("--segments can't be combined with --stream, --pipeline, --stems or --reglog");
+        return AppResult_FALIURE;
+    }
+
+    // every song writes its own files, but --raw and --shm are shared by all of them.
+    if (render && jobs > 1 && (app->archive.io.user || app->raw_sink || app->shm_sink || app->pipeline || segments > 0)) {
+        SDL_SetError("--jobs can't be combined with --stream, --raw, --shm, --pipeline or --segments");
+        return AppResult_FALIURE;
+    }
+
+    if (render && (reglog || app->pipeline)) {
+        if (!(app->recorder = gbs_recorder_init())) {
+            SDL_SetError("failed to init recorder");
+            return AppResult_FALIURE;
+        }
+        gbs_set_recorder(app->gbs, app->recorder);
+        // the synth thread makes the samples.
+        gbs_set_synthesis(app->gbs, !app->pipeline);
+    }
+
+    bool loaded;
+    if (app->archive.io.user) {
+        loaded = gbs_load_io(app->gbs, &app->archive.io);
+    }
+    else {
+        loaded = gbs_load_mem(app->gbs, app->archive.gbs_data, app->archive.gbs_size);
+    }
+
+    if (!loaded) {
         SDL_SetError("invalid movie file at: %s\n", rom_file);
         return AppResult_FALIURE;
     }
 
     gbs_set_master_volume(app->gbs, 1.0);
+
+    if (render && segments > 0) {
+        const unsigned count = SDL_min((unsigned)segments, SEGMENT_RENDER_MAX_WORKERS);
+        for (unsigned i = 0; i < count; i++) {
+            Gbs* gbs = gbs_init(app->render_freq);
+            if (!gbs || !gbs_load_mem(gbs, app->archive.gbs_data, app->archive.gbs_size)) {
+                gbs_quit(gbs);
+                SDL_SetError("failed to init segment worker\n");
+                return AppResult_FALIURE;
+            }
+            gbs_set_master_volume(gbs, 1.0);
+            app->segment_gbs[app->segment_count++] = gbs;
+        }
+    }
+
     if (!gbs_get_meta(app->gbs, &app->gbs_meta)) {
         SDL_SetError("failed to get gbs meta\n");
         return AppResult_FALIURE;
     }
 
+    app->renderers[app->renderer_count++] = (struct Renderer){
+        .gbs = app->gbs,
+        .recorder = app->recorder,
+        .null_sink = app->null_sink,
+    };
+    if (wav && app->levels_rate && !renderer_enable_levels(&app->renderers[0], app->levels_rate)) {
+        return AppResult_FALIURE;
+    }
+
+    // no more are made than there are songs to render.
+    const unsigned song_count = song >= 0 ? 1 : app->gbs_meta.max_song;
+    const unsigned job_count = SDL_min((unsigned)SDL_max(jobs, 1), SDL_min(song_count, RENDER_MAX_JOBS));
+    while (render && app->renderer_count < job_count) {
+        // counted first, so that app_exit() frees it on failure.
+        struct Renderer* r = &app->renderers[app->renderer_count++];
+        if (!(r->gbs = gbs_init(app->render_freq)) || !gbs_load_mem(r->gbs, app->archive.gbs_data, app->archive.gbs_size)) {
+            SDL_SetError("failed to init render job\n");
+            return AppResult_FALIURE;
+        }
+        gbs_set_master_volume(r->gbs, 1.0);
+
+        if (app->stem_mode && !gbs_enable_stems(r->gbs, true)) {
+            SDL_SetError("failed to enable stems");
+            return AppResult_FALIURE;
+        }
+        if (app->recorder) {
+            if (!(r->recorder = gbs_recorder_init())) {
+                SDL_SetError("failed to init recorder");
+                return AppResult_FALIURE;
+            }
+            gbs_set_recorder(r->gbs, r->recorder);
+        }
+        if (app->null_sink && !(r->null_sink = sink_open_null(&sink_config))) {
+            SDL_SetError("failed to open null output");
+            return AppResult_FALIURE;
+        }
+        if (wav && app->levels_rate && !renderer_enable_levels(r, app->levels_rate)) {
+            return AppResult_FALIURE;
+        }
+    }
+
+    // each render thread would start an encoder thread per cpu.
+    if (app->renderer_count > 1) {
+        for (unsigned i = 0; i < app->output_count; i++) {
+            app->outputs[i].flac_jobs = 1;
+        }
+    }
+
     convert_str_to_printable_chars(app->gbs_meta.title_string);
     convert_str_to_printable_chars(app->gbs_meta.author_string);
     convert_str_to_printable_chars(app->gbs_meta.copyright_string);
@@ -507,32 +3139,49 @@ static AppResult app_init(void** appstate, int argc, char** argv)
     SDL_snprintf(app->output_name, sizeof(app->output_name), "TotalGBS - %s By %s", app->gbs_meta.title_string, app->gbs_meta.author_string);
 
     if (info) {
-        for (unsigned i = 0; i < app->archive.m3u_count; i++) {
-            printf("M3u info [%u]\n", i);
-            printf("\tfilename: %s\n", app->archive.infos[i].filename);
-            printf("\tsong_tile: %s\n", app->archive.infos[i].song_tile);
-            printf("\ttime: %u\n", app->archive.infos[i].time);
-            printf("\tloop: %u\n", app->archive.infos[i].loop);
-            printf("\tfade: %u\n", app->archive.infos[i].fade);
-            printf("\tsongno: %u\n", app->archive.infos[i].songno);
-            printf("\tloopcount: %u\n", app->archive.infos[i].loopcount);
+        // the playlist is indexed by songno, so this is already in song order.
+        unsigned index = 0;
+        for (unsigned i = 0; i < SDL_arraysize(app->archive.playlist.songs); i++) {
+            const struct M3uEntry* entry = app->archive.playlist.songs[i];
+            if (!entry) {
+                continue;
+            }
+
+            printf("M3u info [%u]\n", index++);
+            printf("\tfilename: %s\n", entry->filename);
+            printf("\ttitle: %s\n", entry->title);
+            printf("\ttime: %u\n", entry->time);
+            printf("\tloop: %u\n", entry->loop);
+            printf("\tfade: %u\n", entry->fade);
+            printf("\tsongno: %u\n", entry->songno);
+            printf("\tloopcount: %u\n", entry->loopcount);
         }
         return AppResult_SUCCESS;
     }
-    else if (wav) {
-        if (song >= 0) {
-            return do_wav_song(app, wav, freq, song) ? AppResult_SUCCESS : AppResult_FALIURE;
-        }
-        return do_wav(app, wav, freq) ? AppResult_SUCCESS : AppResult_FALIURE;
+    else if (render) {
+        return do_render(app, wav, freq, song) ? AppResult_SUCCESS : AppResult_FALIURE;
     }
     else if (gbs2gb) {
         return do_gbs2gb(app, gbs2gb) ? AppResult_SUCCESS : AppResult_FALIURE;
     }
 
-    if (SDL_Init(SDL_INIT_AUDIO)) {
+    if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_EVENTS)) {
         return AppResult_FALIURE;
     }
 
+    // streamed banks can't be shared between instances, so songs are only cued when the gbs is in memory.
+    if (!app->archive.io.user) {
+        for (unsigned i = 0; i < AUDIO_PRODUCER_MAX_CUES; i++) {
+            Gbs* gbs = gbs_init(freq);
+            if (!gbs || !gbs_load_mem(gbs, app->archive.gbs_data, app->archive.gbs_size)) {
+                gbs_quit(gbs);
+                break;
+            }
+            gbs_set_master_volume(gbs, 1.0);
+            app->cue_gbs[app->cue_count++] = gbs;
+        }
+    }
+
     const SDL_AudioSpec wanted_spec = {
         .freq = freq,
         .format = AUDIO_S16SYS,
@@ -547,6 +3196,31 @@ static AppResult app_init(void** appstate, int argc, char** argv)
         return AppResult_FALIURE;
     }
 
+    // a song started more than once restores the state after its init.
+    const struct GbsSnapshotIo snapshot_io = {
+        .user = app,
+        .load = snapshot_io_load,
+        .store = snapshot_io_store,
+    };
+
+    if (app->snapshot_dir) {
+        app->file_hash = hash_archive(&app->archive);
+    }
+
+    app->snapshot_cache = gbs_snapshot_cache_init(app->snapshot_dir ? &snapshot_io : NULL);
+    if (app->snapshot_cache) {
+        gbs_set_snapshot_cache(app->gbs, app->snapshot_cache);
+        for (unsigned i = 0; i < app->cue_count; i++) {
+            gbs_set_snapshot_cache(app->cue_gbs[i], app->snapshot_cache);
+        }
+    }
+
+    app->producer = audio_producer_init(app->gbs, app->cue_gbs, app->cue_count, app->obtained_spec.freq, app->obtained_spec.samples);
+    if (!app->producer) {
+        SDL_SetError("failed to start audio producer\n");
+        return AppResult_FALIURE;
+    }
+
     app->song_number = app->gbs_meta.first_song;
     if (song >= 0) {
         app->song_number = song;
@@ -562,6 +3236,13 @@ static AppResult app_init(void** appstate, int argc, char** argv)
     printf("\tr = Play Random song.\n");
     printf("\tq = Quit.\n\n");
 
+    SDL_Thread* thread = SDL_CreateThread(input_thread, "input", NULL);
+    if (!thread) {
+        return AppResult_FALIURE;
+    }
+    // it's left blocked in getchar() on exit.
+    SDL_DetachThread(thread);
+
     return AppResult_CONTINUE;
 }
 
@@ -569,13 +3250,17 @@ static AppResult app_loop(void *appstate)
 {
     App* app = appstate;
 
-    const int c = getchar();
-    switch (c) {
-        case 'n': play_song(app, app->song_number + 1); break;
-        case 'p': play_song(app, app->song_number > app->gbs_meta.first_song ? app->song_number - 1 : app->gbs_meta.max_song - 1); break;
-        case 'r': play_song(app, rand()); break;
-        case 'q': app->quit = true; break;
+    SDL_Event e;
+    if (SDL_WaitEventTimeout(&e, POLL_INTERVAL_MS) && e.type == SDL_USEREVENT) {
+        switch (e.user.code) {
+            case 'n': play_song(app, app->song_number + 1); break;
+            case 'p': play_song(app, app->song_number > app->gbs_meta.first_song ? app->song_number - 1 : app->gbs_meta.max_song - 1); break;
+            case 'r': play_song(app, app->random_song); break;
+            case 'q': app->quit = true; break;
+        }
     }
+
+    check_song_advanced(app);
     return app->quit ? AppResult_SUCCESS : AppResult_CONTINUE;
 }
 
@@ -589,10 +3274,45 @@ static void app_exit(void *appstate, AppResult result)
     if (app) {
         SDL_PauseAudioDevice(app->audio_device_id, 1);
         SDL_CloseAudioDevice(app->audio_device_id);
+
+        if (app->producer) {
+            struct AudioProducerStats stats;
+            audio_producer_get_stats(app->producer, &stats);
+            printf("audio: underruns: %u depth: %u max_render_us: %u max_callback_us: %u cue_hits: %u cue_misses: %u\n", stats.underruns, stats.depth, stats.max_render_us, stats.max_callback_us, stats.cue_hits, stats.cue_misses);
+            audio_producer_quit(app->producer);
+        }
+        gbs_snapshot_cache_quit(app->snapshot_cache);
         SDL_Quit();
 
+        if (app->archive.io_close == prefetch_io_close) {
+            struct PrefetchIoStats stats;
+            prefetch_io_get_stats(&app->archive.io, &stats);
+            printf("io: hits: %u prefetch_hits: %u late: %u misses: %u prefetches: %u\n", stats.hits, stats.prefetch_hits, stats.late, stats.misses, stats.prefetches);
+        }
+
+        // only left open if rendering never started.
+        sink_close(app->raw_sink);
+        sink_close(app->shm_sink);
+        sink_close(app->null_sink);
+
         archive_close(&app->archive);
         gbs_quit(app->gbs);
+        for (unsigned i = 0; i < app->cue_count; i++) {
+            gbs_quit(app->cue_gbs[i]);
+        }
+        for (unsigned i = 0; i < app->segment_count; i++) {
+            gbs_quit(app->segment_gbs[i]);
+        }
+        for (unsigned i = 0; i < app->renderer_count; i++) {
+            SDL_free(app->renderers[i].levels.frames);
+        }
+        // the first is borrowed from the app.
+        for (unsigned i = 1; i < app->renderer_count; i++) {
+            sink_close(app->renderers[i].null_sink);
+            gbs_quit(app->renderers[i].gbs);
+            gbs_recorder_quit(app->renderers[i].recorder);
+        }
+        gbs_recorder_quit(app->recorder);
         SDL_free(app);
     }
 }
@@ -0,0 +1,387 @@
+#include "prefetch_io.h"
+
+#include <SDL.h>
+
+// max_rom_bank is capped at 127 by gbs_load_io().
+enum { MAX_BANKS = 128 };
+// number of recent successors remembered per bank.
+enum { PREDICT_WAYS = 2 };
+enum { QUEUE_SIZE = 16 };
+
+enum SlotState {
+    SlotState_EMPTY,
+    SlotState_LOADING,
+    SlotState_READY,
+};
+
+struct Slot {
+    Uint8* data;
+    int bank;
+    enum SlotState state;
+    // loaded by the io thread and not yet returned by pointer().
+    bool prefetched;
+    unsigned last_used;
+};
+
+struct Request {
+    size_t addr;
+    Uint8 bank;
+};
+
+struct PrefetchIo {
+    SDL_RWops* rw;
+    size_t size;
+    // guards rw, which is shared between read(), misses and the io thread.
+    SDL_mutex* rw_lock;
+
+    // guards everything below.
+    SDL_mutex* lock;
+    SDL_cond* cond_io;
+    SDL_cond* cond_ready;
+    SDL_Thread* thread;
+    bool quit;
+
+    struct Slot* slots;
+    size_t slot_count;
+    // slot last returned by pointer(), gbs reads from it until the next bank switch.
+    int pinned;
+    unsigned tick;
+
+    struct Request queue[QUEUE_SIZE];
+    unsigned queue_head;
+    unsigned queue_count;
+
+    // most recent successors of each bank, 0 = none (bank0 is never paged).
+    Uint8 successors[MAX_BANKS][PREDICT_WAYS];
+    size_t bank_addr[MAX_BANKS];
+    int last_bank;
+
+    struct PrefetchIoStats stats;
+};
+
+static size_t read_at(struct PrefetchIo* io, void* dst, size_t size, size_t addr)
+{
+    size_t result = 0;
+
+    SDL_LockMutex(io->rw_lock);
+    if (SDL_RWseek(io->rw, addr, RW_SEEK_SET) >= 0) {
+        result = SDL_RWread(io->rw, dst, 1, size);
+    }
+    SDL_UnlockMutex(io->rw_lock);
+
+    return result;
+}
+
+static void read_bank(struct PrefetchIo* io, Uint8* dst, size_t addr)
+{
+    const size_t result = read_at(io, dst, GBS_BANK_SIZE, addr);
+    // the spec states that short banks are padded with zeros.
+    if (result < GBS_BANK_SIZE) {
+        SDL_memset(dst + result, 0, GBS_BANK_SIZE - result);
+    }
+}
+
+static int find_slot(const struct PrefetchIo* io, int bank)
+{
+    for (size_t i = 0; i < io->slot_count; i++) {
+        if (io->slots[i].bank == bank && io->slots[i].state != SlotState_EMPTY) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+// least recently used slot that is not being loaded, optionally skipping the pinned slot.
+static int find_victim(const struct PrefetchIo* io, bool allow_pinned)
+{
+    int victim = -1;
+
+    for (size_t i = 0; i < io->slot_count; i++) {
+        const struct Slot* slot = &io->slots[i];
+        if (slot->state == SlotState_LOADING || (!allow_pinned && (int)i == io->pinned)) {
+            continue;
+        }
+        if (slot->state == SlotState_EMPTY) {
+            return (int)i;
+        }
+        if (victim < 0 || slot->last_used < io->slots[victim].last_used) {
+            victim = (int)i;
+        }
+    }
+
+    return victim;
+}
+
+static bool is_queued(const struct PrefetchIo* io, Uint8 bank)
+{
+    for (unsigned i = 0; i < io->queue_count; i++) {
+        if (io->queue[(io->queue_head + i) % QUEUE_SIZE].bank == bank) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void queue_prefetch(struct PrefetchIo* io, Uint8 bank, size_t addr)
+{
+    if (!bank || addr >= io->size || find_slot(io, bank) >= 0 || is_queued(io, bank)) {
+        return;
+    }
+
+    // drop the oldest prediction if full, newer ones are more relevant.
+    if (io->queue_count == QUEUE_SIZE) {
+        io->queue_head = (io->queue_head + 1) % QUEUE_SIZE;
+        io->queue_count--;
+    }
+
+    struct Request* req = &io->queue[(io->queue_head + io->queue_count) % QUEUE_SIZE];
+    req->bank = bank;
+    req->addr = addr;
+    io->queue_count++;
+}
+
+static void record_switch(struct PrefetchIo* io, Uint8 bank, size_t addr)
+{
+    io->bank_addr[bank] = addr;
+
+    if (io->last_bank > 0 && io->last_bank != bank) {
+        Uint8* s = io->successors[io->last_bank];
+        if (s[0] != bank) {
+            SDL_memmove(s + 1, s, PREDICT_WAYS - 1);
+            s[0] = bank;
+        }
+    }
+    io->last_bank = bank;
+
+    // predict from what followed this bank last time, otherwise assume linear access.
+    const Uint8* s = io->successors[bank];
+    if (s[0]) {
+        for (unsigned i = 0; i < PREDICT_WAYS && s[i]; i++) {
+            queue_prefetch(io, s[i], io->bank_addr[s[i]]);
+        }
+    }
+    else if (bank + 1 < MAX_BANKS) {
+        queue_prefetch(io, bank + 1, addr + GBS_BANK_SIZE);
+    }
+
+    if (io->queue_count) {
+        SDL_CondSignal(io->cond_io);
+    }
+}
+
+static int io_thread(void* user)
+{
+    struct PrefetchIo* io = user;
+
+    SDL_LockMutex(io->lock);
+    while (!io->quit) {
+        if (!io->queue_count) {
+            SDL_CondWait(io->cond_io, io->lock);
+            continue;
+        }
+
+        const struct Request req = io->queue[io->queue_head];
+        io->queue_head = (io->queue_head + 1) % QUEUE_SIZE;
+        io->queue_count--;
+
+        if (find_slot(io, req.bank) >= 0) {
+            continue;
+        }
+
+        const int victim = find_victim(io, false);
+        if (victim < 0) {
+            continue;
+        }
+
+        struct Slot* slot = &io->slots[victim];
+        slot->bank = req.bank;
+        slot->state = SlotState_LOADING;
+        slot->prefetched = true;
+        slot->last_used = io->tick;
+
+        SDL_UnlockMutex(io->lock);
+            read_bank(io, slot->data, req.addr);
+        SDL_LockMutex(io->lock);
+
+        slot->state = SlotState_READY;
+        io->stats.prefetches++;
+        SDL_CondBroadcast(io->cond_ready);
+    }
+    SDL_UnlockMutex(io->lock);
+
+    return 0;
+}
+
+static size_t io_read(void* user, void* dst, size_t size, size_t addr)
+{
+    return read_at(user, dst, size, addr);
+}
+
+static size_t io_size(void* user)
+{
+    const struct PrefetchIo* io = user;
+    return io->size;
+}
+
+static const uint8_t* io_pointer(void* user, size_t addr, uint8_t bank)
+{
+    struct PrefetchIo* io = user;
+    bool waited = false;
+    int i;
+
+    SDL_LockMutex(io->lock);
+
+    // wait for an in-flight prefetch rather than reading the bank twice.
+    while ((i = find_slot(io, bank)) >= 0 && io->slots[i].state == SlotState_LOADING) {
+        waited = true;
+        SDL_CondWait(io->cond_ready, io->lock);
+    }
+
+    if (i >= 0) {
+        struct Slot* slot = &io->slots[i];
+        if (waited) {
+            io->stats.late++;
+        }
+        else if (slot->prefetched) {
+            io->stats.prefetch_hits++;
+        }
+        else {
+            io->stats.hits++;
+        }
+        slot->prefetched = false;
+    }
+    else {
+        // the previous bank is no longer mapped once we return, so it can be reused.
+        i = find_victim(io, false);
+        if (i < 0) {
+            i = find_victim(io, true);
+        }
+
+        struct Slot* slot = &io->slots[i];
+        slot->bank = bank;
+        slot->state = SlotState_LOADING;
+        slot->prefetched = false;
+        io->stats.misses++;
+
+        SDL_UnlockMutex(io->lock);
+            read_bank(io, slot->data, addr);
+        SDL_LockMutex(io->lock);
+
+        slot->state = SlotState_READY;
+        SDL_CondBroadcast(io->cond_ready);
+    }
+
+    io->slots[i].last_used = ++io->tick;
+    io->pinned = i;
+    record_switch(io, bank, addr);
+
+    const Uint8* data = io->slots[i].data;
+    SDL_UnlockMutex(io->lock);
+
+    return data;
+}
+
+static const struct GbsIo PREFETCH_IO = {
+    .user = NULL,
+    .read = io_read,
+    .size = io_size,
+    .pointer = io_pointer,
+};
+
+static void prefetch_io_free(struct PrefetchIo* io)
+{
+    if (io->thread) {
+        SDL_LockMutex(io->lock);
+            io->quit = true;
+            SDL_CondSignal(io->cond_io);
+        SDL_UnlockMutex(io->lock);
+        SDL_WaitThread(io->thread, NULL);
+    }
+
+    if (io->slots) {
+        for (size_t i = 0; i < io->slot_count; i++) {
+            SDL_free(io->slots[i].data);
+        }
+        SDL_free(io->slots);
+    }
+
+    SDL_DestroyCond(io->cond_ready);
+    SDL_DestroyCond(io->cond_io);
+    SDL_DestroyMutex(io->lock);
+    SDL_DestroyMutex(io->rw_lock);
+
+    if (io->rw) {
+        SDL_RWclose(io->rw);
+    }
+
+    SDL_free(io);
+}
+
+bool prefetch_io_open(const char* path, size_t slot_count, struct GbsIo* io_out)
+{
+    struct PrefetchIo* io = SDL_calloc(1, sizeof(*io));
+    if (!io) {
+        return false;
+    }
+
+    io->pinned = -1;
+    io->last_bank = -1;
+    io->slot_count = slot_count < 2 ? 2 : slot_count;
+
+    if (!(io->rw = SDL_RWFromFile(path, "rb"))) {
+        goto fail;
+    }
+
+    const Sint64 size = SDL_RWsize(io->rw);
+    if (size <= 0) {
+        goto fail;
+    }
+    io->size = (size_t)size;
+
+    io->rw_lock = SDL_CreateMutex();
+    io->lock = SDL_CreateMutex();
+    io->cond_io = SDL_CreateCond();
+    io->cond_ready = SDL_CreateCond();
+    io->slots = SDL_calloc(io->slot_count, sizeof(*io->slots));
+    if (!io->rw_lock || !io->lock || !io->cond_io || !io->cond_ready || !io->slots) {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < io->slot_count; i++) {
+        io->slots[i].bank = -1;
+        if (!(io->slots[i].data = SDL_malloc(GBS_BANK_SIZE))) {
+            goto fail;
+        }
+    }
+
+    if (!(io->thread = SDL_CreateThread(io_thread, "gbs_prefetch", io))) {
+        goto fail;
+    }
+
+    *io_out = PREFETCH_IO;
+    io_out->user = io;
+    return true;
+
+fail:
+    prefetch_io_free(io);
+    return false;
+}
+
+void prefetch_io_close(struct GbsIo* io)
+{
+    if (io->user) {
+        prefetch_io_free(io->user);
+        SDL_memset(io, 0, sizeof(*io));
+    }
+}
+
+void prefetch_io_get_stats(const struct GbsIo* io, struct PrefetchIoStats* stats)
+{
+    struct PrefetchIo* pio = io->user;
+
+    SDL_LockMutex(pio->lock);
+        *stats = pio->stats;
+    SDL_UnlockMutex(pio->lock);
+}
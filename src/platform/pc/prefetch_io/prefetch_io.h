@@ -0,0 +1,40 @@
+#ifndef PREFETCH_IO_H
+#define PREFETCH_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* file backed GbsIo which keeps a small set of banks resident and
+* loads predicted banks on a background thread.
+*
+* pointer() only blocks on disk if the bank was not resident and
+* no prefetch for it was in flight (a true miss).
+*/
+
+enum { PREFETCH_IO_DEFAULT_SLOTS = 8 };
+
+struct PrefetchIoStats {
+    unsigned hits; // bank was already resident.
+    unsigned prefetch_hits; // first use of a bank that was loaded by the io thread.
+    unsigned late; // bank was still being prefetched, waited for it.
+    unsigned misses; // synchronous read in pointer().
+    unsigned prefetches; // banks loaded by the io thread.
+};
+
+/* slot_count is the number of banks kept resident, min 2. */
+bool prefetch_io_open(const char* path, size_t slot_count, struct GbsIo* io_out);
+void prefetch_io_close(struct GbsIo* io);
+void prefetch_io_get_stats(const struct GbsIo* io, struct PrefetchIoStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PREFETCH_IO_H
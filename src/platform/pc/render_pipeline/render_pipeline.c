@@ -0,0 +1,237 @@
+#include "render_pipeline.h"
+
+#include <SDL.h>
+
+// must be a power of 2, positions are free running counters masked into the queue.
+enum { QUEUE_SIZE = 16 };
+enum { QUEUE_MASK = QUEUE_SIZE - 1 };
+// cycles emulated per chunk, one frame of the lcd.
+enum { CHUNK_CYCLES = 70224 };
+// how long a stage sleeps on the queue, if not woken sooner.
+enum { WAIT_TIMEOUT_MS = 5 };
+
+// the apu writes of one frame.
+struct Chunk {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    uint64_t end_time;
+};
+
+struct RenderPipeline {
+    Sink* sink;
+    GbsRegLogPlayer* player;
+    size_t remaining;
+
+    struct Chunk chunks[QUEUE_SIZE];
+    // chunks written, only written by the cpu thread.
+    SDL_atomic_t head;
+    // chunks read, only written by the synth thread.
+    SDL_atomic_t tail;
+    // set once the cpu thread has written its last chunk, or failed.
+    SDL_atomic_t done;
+    // set by the synth thread if it failed, the cpu thread stops early.
+    SDL_atomic_t error;
+
+    // each stage posts the other's sem once, if it's sleeping.
+    SDL_sem* filled;
+    SDL_sem* drained;
+    SDL_atomic_t synth_waiting;
+    SDL_atomic_t cpu_waiting;
+};
+
+static void wake(SDL_atomic_t* waiting, SDL_sem* sem)
+{
+    if (SDL_AtomicCAS(waiting, 1, 0)) {
+        SDL_SemPost(sem);
+    }
+}
+
+static bool synth_chunk(struct RenderPipeline* p, const struct Chunk* chunk)
+{
+    if (!gbs_reglog_player_feed(p->player, chunk->data, chunk->size, chunk->end_time)) {
+        return false;
+    }
+
+    gbs_reglog_player_run(p->player, (unsigned)(chunk->end_time - gbs_reglog_player_get_time(p->player)));
+
+    // rendered straight into the sink's batch buffer.
+    while (p->remaining) {
+        size_t count;
+        int16_t* samples = sink_get_buffer(p->sink, &count);
+        count = SDL_min(count, p->remaining);
+
+        count = (size_t)gbs_reglog_player_read_samples(p->player, samples, (int)count);
+        if (!count) {
+            break;
+        }
+
+        sink_commit(p->sink, count);
+        p->remaining -= count;
+    }
+
+    return true;
+}
+
+static int synth_thread(void* user)
+{
+    struct RenderPipeline* p = user;
+
+    for (;;) {
+        const int tail = SDL_AtomicGet(&p->tail);
+        if (SDL_AtomicGet(&p->head) == tail) {
+            // head is read again, the last chunk may have been written just before done.
+            if (SDL_AtomicGet(&p->done) && SDL_AtomicGet(&p->head) == tail) {
+                break;
+            }
+
+            // done is checked again, as it may have been set before waiting was.
+            SDL_AtomicSet(&p->synth_waiting, 1);
+            if (SDL_AtomicGet(&p->head) == tail && !SDL_AtomicGet(&p->done)) {
+                SDL_SemWaitTimeout(p->filled, WAIT_TIMEOUT_MS);
+            }
+            SDL_AtomicSet(&p->synth_waiting, 0);
+            continue;
+        }
+
+        if (!synth_chunk(p, &p->chunks[(unsigned)tail & QUEUE_MASK])) {
+            SDL_AtomicSet(&p->error, 1);
+        }
+
+        SDL_AtomicSet(&p->tail, tail + 1);
+        wake(&p->cpu_waiting, p->drained);
+
+        if (SDL_AtomicGet(&p->error) || !p->remaining) {
+            break;
+        }
+    }
+
+    // the cpu thread may be waiting for room.
+    SDL_AtomicSet(&p->done, 1);
+    SDL_SemPost(p->drained);
+    return 0;
+}
+
+// waits for room in the queue, returns NULL if the synth thread stopped.
+static struct Chunk* next_chunk(struct RenderPipeline* p)
+{
+    const int head = SDL_AtomicGet(&p->head);
+
+    while (head - SDL_AtomicGet(&p->tail) >= QUEUE_SIZE) {
+        if (SDL_AtomicGet(&p->done)) {
+            return NULL;
+        }
+
+        SDL_AtomicSet(&p->cpu_waiting, 1);
+        if (head - SDL_AtomicGet(&p->tail) >= QUEUE_SIZE && !SDL_AtomicGet(&p->done)) {
+            SDL_SemWaitTimeout(p->drained, WAIT_TIMEOUT_MS);
+        }
+        SDL_AtomicSet(&p->cpu_waiting, 0);
+    }
+
+    return SDL_AtomicGet(&p->done) ? NULL : &p->chunks[(unsigned)head & QUEUE_MASK];
+}
+
+static bool take_chunk(struct Chunk* chunk, GbsRecorder* recorder)
+{
+    size_t size;
+    if (!gbs_recorder_take(recorder, NULL, 0, &size)) {
+        return false;
+    }
+
+    if (size > chunk->capacity) {
+        uint8_t* data = SDL_realloc(chunk->data, size);
+        if (!data) {
+            return false;
+        }
+        chunk->data = data;
+        chunk->capacity = size;
+    }
+
+    if (!gbs_recorder_take(recorder, chunk->data, chunk->capacity, &chunk->size)) {
+        return false;
+    }
+
+    chunk->end_time = gbs_recorder_get_end_time(recorder);
+    return true;
+}
+
+static bool cpu_run(struct RenderPipeline* p, Gbs* gbs, GbsRecorder* recorder, unsigned freq, size_t count)
+{
+    // a chunk of slack, as the synth thread stops once it has count samples.
+    const uint64_t cycles = (uint64_t)count / 2 * GBS_CPU_CLOCK / freq + CHUNK_CYCLES * 2;
+
+    // the song init has already been recorded, so it goes out first.
+    for (uint64_t ran = 0; ; ran += CHUNK_CYCLES) {
+        struct Chunk* chunk = next_chunk(p);
+        if (!chunk) {
+            return true;
+        }
+
+        if (!take_chunk(chunk, recorder)) {
+            return false;
+        }
+
+        SDL_AtomicAdd(&p->head, 1);
+        wake(&p->synth_waiting, p->filled);
+
+        if (ran >= cycles) {
+            return true;
+        }
+
+        // synthesis is off, so this is only the cpu and timers.
+        gbs_run(gbs, CHUNK_CYCLES);
+    }
+}
+
+bool render_pipeline_run(Gbs* gbs, GbsRecorder* recorder, Sink* sink, unsigned freq, size_t count)
+{
+    struct RenderPipeline* p = SDL_calloc(1, sizeof(*p));
+    if (!p) {
+        return false;
+    }
+
+    bool result = false;
+    p->sink = sink;
+    p->remaining = count;
+
+    if (!(p->player = gbs_reglog_player_init_stream(freq))) {
+        SDL_SetError("failed to init register log player");
+        goto done;
+    }
+    // same as the gbs.
+    gbs_reglog_player_set_master_volume(p->player, 1.0);
+
+    if (!(p->filled = SDL_CreateSemaphore(0)) || !(p->drained = SDL_CreateSemaphore(0))) {
+        goto done;
+    }
+
+    SDL_Thread* thread = SDL_CreateThread(synth_thread, "render_pipeline", p);
+    if (!thread) {
+        goto done;
+    }
+
+    const bool ran = cpu_run(p, gbs, recorder, freq, count);
+    SDL_AtomicSet(&p->done, 1);
+    wake(&p->synth_waiting, p->filled);
+    SDL_WaitThread(thread, NULL);
+
+    result = ran && !SDL_AtomicGet(&p->error) && !p->remaining;
+    if (!result) {
+        SDL_SetError("pipelined render failed");
+    }
+
+done:
+    if (p->filled) {
+        SDL_DestroySemaphore(p->filled);
+    }
+    if (p->drained) {
+        SDL_DestroySemaphore(p->drained);
+    }
+    for (unsigned i = 0; i < QUEUE_SIZE; i++) {
+        SDL_free(p->chunks[i].data);
+    }
+    gbs_reglog_player_quit(p->player);
+    SDL_free(p);
+    return result;
+}
@@ -0,0 +1,38 @@
+#ifndef RENDER_PIPELINE_H
+#define RENDER_PIPELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+#include "sink/sink.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* renders a song on two threads. the calling thread runs the cpu and timers
+* a frame at a time, taking the apu writes of each frame from the recorder
+* and passing them through a lock-free single producer / single consumer
+* queue. a synth thread feeds them to a register log player and writes its
+* samples to the sink, so the slower of the two sets the speed.
+*
+* the gbs doesn't synthesize, the cpu's reads of the apu are answered by
+* its model of the registers, so each sample is only made once. the output
+* is the same as rendering normally for songs that don't read wave ram while
+* the wave channel plays, as the model returns what was written there.
+*/
+
+/*
+* gbs must have had the song set with recorder attached and synthesis off,
+* see gbs_set_synthesis(). nothing else may take from the recorder while
+* this runs. count is in samples.
+*/
+bool render_pipeline_run(Gbs* gbs, GbsRecorder* recorder, Sink* sink, unsigned freq, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RENDER_PIPELINE_H
@@ -0,0 +1,285 @@
+#include "segment_render.h"
+#include "snapshot_grid/snapshot_grid.h"
+
+#include <SDL.h>
+
+// frames in a segment, rounded up to the grid.
+enum { SEGMENT_SECONDS = 30 };
+// frames rendered and thrown away before a segment, and the least allowed.
+enum { PREROLL_MS = 500 };
+enum { MIN_PREROLL_MS = 100 };
+// frames rendered per gbs_run().
+enum { CHUNK_FRAMES = 4096 };
+// segments that may be rendered ahead of the one being written, per worker.
+enum { MAX_AHEAD_PER_WORKER = 2 };
+
+struct Segment {
+    // in frames, start is from the song start.
+    size_t start;
+    size_t frames;
+    size_t preroll;
+    // taken where the pre-roll starts.
+    void* snapshot;
+    // frames * 2 samples, NULL until a worker takes the segment.
+    int16_t* samples;
+    bool done;
+};
+
+struct SegmentRender {
+    Gbs* scan;
+    unsigned freq;
+    size_t frames;
+
+    SDL_mutex* lock;
+    SDL_cond* changed;
+
+    // everything below is guarded by lock.
+    struct Segment* segments;
+    // segments published by the scan.
+    size_t ready;
+    // next segment a worker takes.
+    size_t next;
+    // segments written to the sink.
+    size_t written;
+    size_t max_ahead;
+    bool scan_done;
+    bool error;
+};
+
+struct Worker {
+    struct SegmentRender* r;
+    Gbs* gbs;
+};
+
+static void set_error(struct SegmentRender* r)
+{
+    SDL_LockMutex(r->lock);
+    r->error = true;
+    SDL_CondBroadcast(r->changed);
+    SDL_UnlockMutex(r->lock);
+}
+
+static void publish(struct SegmentRender* r, size_t start, size_t end, size_t preroll, void* snapshot)
+{
+    SDL_LockMutex(r->lock);
+    r->segments[r->ready++] = (struct Segment){
+        .start = start,
+        .frames = end - start,
+        .preroll = preroll,
+        .snapshot = snapshot,
+    };
+    SDL_CondBroadcast(r->changed);
+    SDL_UnlockMutex(r->lock);
+}
+
+static int scan_thread(void* user)
+{
+    struct SegmentRender* r = user;
+    Gbs* gbs = r->scan;
+
+    const size_t grid = snapshot_grid_step(r->freq);
+    const size_t segment_frames = snapshot_grid_round_up((size_t)SEGMENT_SECONDS * r->freq, grid);
+    const size_t preroll_frames = snapshot_grid_round_up((size_t)PREROLL_MS * r->freq / 1000, grid);
+    const size_t min_preroll = (size_t)MIN_PREROLL_MS * r->freq / 1000;
+
+    void* snapshot = NULL;
+    bool ok = (snapshot = snapshot_grid_take(gbs)) != NULL;
+    const uint64_t origin = gbs_get_cycles(gbs);
+    size_t start = 0;
+    size_t preroll = 0;
+
+    for (size_t boundary = segment_frames; ok && boundary < r->frames; boundary += segment_frames) {
+        SDL_LockMutex(r->lock);
+        ok = !r->error;
+        SDL_UnlockMutex(r->lock);
+
+        for (size_t pre = boundary - preroll_frames; ok && pre + min_preroll <= boundary; pre += grid) {
+            const uint64_t cycle = snapshot_grid_cycle(origin, pre, r->freq);
+            if (gbs_get_cycles(gbs) > cycle || !snapshot_grid_run_to(gbs, cycle, NULL)) {
+                continue;
+            }
+
+            void* next = snapshot_grid_take(gbs);
+            if (!next) {
+                ok = false;
+                break;
+            }
+
+            publish(r, start, boundary, preroll, snapshot);
+            start = boundary;
+            preroll = boundary - pre;
+            snapshot = next;
+            break;
+        }
+    }
+
+    if (ok) {
+        publish(r, start, r->frames, preroll, snapshot);
+    }
+    else {
+        SDL_free(snapshot);
+    }
+
+    SDL_LockMutex(r->lock);
+    r->scan_done = true;
+    r->error |= !ok;
+    SDL_CondBroadcast(r->changed);
+    SDL_UnlockMutex(r->lock);
+    return 0;
+}
+
+static bool render_segment(Gbs* gbs, struct Segment* seg)
+{
+    const size_t count = seg->frames * 2;
+    if (!gbs_load_snapshot(gbs, seg->snapshot, gbs_snapshot_size(gbs)) || !(seg->samples = SDL_malloc(count * sizeof(int16_t)))) {
+        return false;
+    }
+
+    // the pre-roll is rendered into the start of the segment, then overwritten.
+    const size_t chunk = SDL_min(count, (size_t)CHUNK_FRAMES * 2);
+    for (size_t remaining = seg->preroll * 2; remaining;) {
+        const size_t n = SDL_min(remaining, chunk);
+        gbs_run(gbs, gbs_clocks_needed(gbs, (int)n));
+        gbs_read_samples(gbs, seg->samples, (int)n);
+        remaining -= n;
+    }
+
+    for (size_t i = 0; i < count;) {
+        const size_t n = SDL_min(count - i, chunk);
+        gbs_run(gbs, gbs_clocks_needed(gbs, (int)n));
+        gbs_read_samples(gbs, seg->samples + i, (int)n);
+        i += n;
+    }
+
+    return true;
+}
+
+static int worker_thread(void* user)
+{
+    struct Worker* w = user;
+    struct SegmentRender* r = w->r;
+
+    SDL_LockMutex(r->lock);
+    for (;;) {
+        if (r->error || (r->scan_done && r->next >= r->ready)) {
+            break;
+        }
+
+        if (r->next >= r->ready || r->next - r->written >= r->max_ahead) {
+            SDL_CondWait(r->changed, r->lock);
+            continue;
+        }
+
+        // segments is never reallocated, so this stays valid unlocked.
+        struct Segment* seg = &r->segments[r->next++];
+        SDL_UnlockMutex(r->lock);
+
+        const bool ok = render_segment(w->gbs, seg);
+
+        SDL_LockMutex(r->lock);
+        seg->done = true;
+        r->error |= !ok;
+        SDL_CondBroadcast(r->changed);
+    }
+    SDL_UnlockMutex(r->lock);
+    return 0;
+}
+
+// writes the segments to the sink in order as they are done.
+static void write_segments(struct SegmentRender* r, Sink* sink)
+{
+    SDL_LockMutex(r->lock);
+    for (;;) {
+        if (r->written < r->ready && r->segments[r->written].done) {
+            struct Segment* seg = &r->segments[r->written];
+            SDL_UnlockMutex(r->lock);
+
+            const bool ok = sink_write(sink, seg->samples, seg->frames * 2);
+            SDL_free(seg->samples);
+            SDL_free(seg->snapshot);
+            seg->samples = NULL;
+            seg->snapshot = NULL;
+
+            SDL_LockMutex(r->lock);
+            r->written++;
+            r->error |= !ok;
+            SDL_CondBroadcast(r->changed);
+        }
+        else if (r->error || (r->scan_done && r->written >= r->ready)) {
+            break;
+        }
+        else {
+            SDL_CondWait(r->changed, r->lock);
+        }
+    }
+    SDL_UnlockMutex(r->lock);
+}
+
+bool segment_render_song(Gbs* scan, Gbs* const* workers, unsigned worker_count, Sink* sink, unsigned freq, size_t count)
+{
+    struct SegmentRender r = {
+        .scan = scan,
+        .freq = freq,
+        .frames = count / 2,
+        .max_ahead = (size_t)worker_count * MAX_AHEAD_PER_WORKER,
+    };
+
+    struct Worker w[SEGMENT_RENDER_MAX_WORKERS];
+    SDL_Thread* threads[SEGMENT_RENDER_MAX_WORKERS + 1];
+    unsigned thread_count = 0;
+    bool wrote = false;
+
+    worker_count = SDL_min(worker_count, SEGMENT_RENDER_MAX_WORKERS);
+    if (!worker_count || !r.frames) {
+        SDL_SetError("nothing to render in segments");
+        return false;
+    }
+
+    // the scan publishes at most one segment per SEGMENT_SECONDS.
+    const size_t max_segments = r.frames / ((size_t)SEGMENT_SECONDS * freq) + 1;
+    if (!(r.segments = SDL_calloc(max_segments, sizeof(*r.segments))) || !(r.lock = SDL_CreateMutex()) || !(r.changed = SDL_CreateCond())) {
+        goto done;
+    }
+
+    if (!(threads[thread_count] = SDL_CreateThread(scan_thread, "segment_scan", &r))) {
+        goto done;
+    }
+    thread_count++;
+
+    for (unsigned i = 0; i < worker_count; i++) {
+        w[i] = (struct Worker){ .r = &r, .gbs = workers[i] };
+        if (!(threads[thread_count] = SDL_CreateThread(worker_thread, "segment_worker", &w[i]))) {
+            set_error(&r);
+            break;
+        }
+        thread_count++;
+    }
+
+    write_segments(&r, sink);
+    wrote = true;
+
+done:
+    for (unsigned i = 0; i < thread_count; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+
+    const bool result = wrote && !r.error;
+    if (!result) {
+        SDL_SetError("segmented render failed");
+    }
+
+    if (r.segments) {
+        for (size_t i = 0; i < r.ready; i++) {
+            SDL_free(r.segments[i].samples);
+            SDL_free(r.segments[i].snapshot);
+        }
+        SDL_free(r.segments);
+    }
+    if (r.changed) {
+        SDL_DestroyCond(r.changed);
+    }
+    if (r.lock) {
+        SDL_DestroyMutex(r.lock);
+    }
+    return result;
+}
@@ -0,0 +1,42 @@
+#ifndef SEGMENT_RENDER_H
+#define SEGMENT_RENDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+#include "sink/sink.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* renders one long song on several threads.
+*
+* a scan thread runs the song without output, taking a snapshot where the
+* pre-roll of each segment starts. workers take the segments in order, load
+* the snapshot and render the pre-roll, which is thrown away once the blip
+* buffer and high-pass filter have settled, then render the segment itself.
+* the calling thread writes the segments to the sink in order.
+*
+* snapshots are taken on the grid of snapshot_grid.h, so that the segments
+* line up with a serial render. if the scan lands mid instruction, the
+* pre-roll start moves forward to the next grid point, and the boundary is
+* dropped if the pre-roll gets too short.
+*/
+
+enum { SEGMENT_RENDER_MAX_WORKERS = 64 };
+
+/*
+* scan must have had the song set, the workers must be loaded with the same
+* file and have the same settings. none of them may be used by any other
+* thread until this returns. count is in samples.
+*/
+bool segment_render_song(Gbs* scan, Gbs* const* workers, unsigned worker_count, Sink* sink, unsigned freq, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SEGMENT_RENDER_H
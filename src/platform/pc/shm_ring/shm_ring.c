@@ -0,0 +1,394 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // for syscall().
+    #define _GNU_SOURCE
+#endif
+
+#include "shm_ring.h"
+
+#include <SDL.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+    #include <limits.h>
+    #include <time.h>
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+enum { SHM_RING_MAGIC = 0x52534247 }; // "GBSR"
+enum { SHM_RING_VERSION = 2 };
+enum { CACHE_LINE = 64 };
+enum { NAME_MAX_SIZE = 256 };
+// waits are cut into slices, as closing the ring doesn't change the position waited on.
+enum { WAIT_SLICE_MS = 100 };
+
+// the start of the shared memory, the samples follow it.
+struct ShmRingShared {
+    // set by the producer before ready, and never again.
+    SDL_atomic_t ready;
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t frames;
+    SDL_atomic_t closed;
+    // pid of the attached consumer, 0 if none.
+    SDL_atomic_t consumer;
+    char pad0[CACHE_LINE - 7 * 4];
+
+    // frames written, free running, and set while the consumer waits on it.
+    SDL_atomic_t write;
+    SDL_atomic_t consumer_waiting;
+    char pad1[CACHE_LINE - 2 * 4];
+
+    // frames read, free running, and set while the producer waits on it.
+    SDL_atomic_t read;
+    SDL_atomic_t producer_waiting;
+    char pad2[CACHE_LINE - 2 * 4];
+};
+
+struct ShmRing {
+    struct ShmRingShared* shared;
+    int16_t* samples;
+    size_t map_size;
+    // copied out of shared, so the other process can't change them under us.
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t frames;
+    bool producer;
+    // set once the producer gave up on a consumer.
+    bool failed;
+    char name[NAME_MAX_SIZE];
+};
+
+// sleeps until word may no longer be value, or timeout_ms passed.
+static void wait_word(SDL_atomic_t* word, int value, int timeout_ms)
+{
+#if defined(__linux__)
+    const struct timespec timeout = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000 };
+    // not private, the other side is another process.
+    syscall(SYS_futex, &word->value, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+    (void)word; (void)value; (void)timeout_ms;
+    SDL_Delay(1);
+#endif
+}
+
+static void wake_word(SDL_atomic_t* word)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, &word->value, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+/*
+* waits for word to move on from value. the flag is raised with a full
+* barrier before word is checked again, and the other side reads the flag
+* after its own full barrier, so one of the two always sees the other.
+*/
+static void wait_change(SDL_atomic_t* word, SDL_atomic_t* waiting, int value, int timeout_ms)
+{
+    SDL_AtomicCAS(waiting, 0, 1);
+    if (SDL_AtomicGet(word) == value) {
+        wait_word(word, value, timeout_ms);
+    }
+    SDL_AtomicSet(waiting, 0);
+}
+
+// a pid that's still running, EPERM means it exists as another user.
+static bool pid_alive(int pid)
+{
+    return pid > 0 && (!kill((pid_t)pid, 0) || errno == EPERM);
+}
+
+static bool make_name(const char* name, char* out)
+{
+    const int size = SDL_snprintf(out, NAME_MAX_SIZE, "%s%s", name[0] == '/' ? "" : "/", name);
+    if (size <= 1 || size >= NAME_MAX_SIZE) {
+        SDL_SetError("bad shared memory name: %s", name);
+        return false;
+    }
+    return true;
+}
+
+static ShmRing* map_ring(int fd, size_t size, const char* name, bool producer)
+{
+    ShmRing* ring = SDL_calloc(1, sizeof(*ring));
+    void* map = MAP_FAILED;
+
+    if (!ring || (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        SDL_SetError("failed to map shared memory: %s", name);
+        SDL_free(ring);
+        return NULL;
+    }
+
+    ring->shared = map;
+    ring->samples = (int16_t*)(ring->shared + 1);
+    ring->map_size = size;
+    ring->producer = producer;
+    SDL_strlcpy(ring->name, name, sizeof(ring->name));
+    return ring;
+}
+
+ShmRing* shm_ring_create(const char* name, const struct ShmRingConfig* config)
+{
+    char path[NAME_MAX_SIZE];
+    if (!make_name(name, path)) {
+        return NULL;
+    }
+
+    uint32_t frames = 1;
+    while (frames < config->frames && frames < 1u << 30) {
+        frames *= 2;
+    }
+
+    if (!config->channels || !config->sample_rate) {
+        SDL_SetError("bad shared memory ring config");
+        return NULL;
+    }
+
+    // left behind by a producer that never closed.
+    shm_unlink(path);
+
+    const int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        SDL_SetError("failed to create shared memory: %s", path);
+        return NULL;
+    }
+
+    // the memory starts zeroed, so both positions are 0.
+    const size_t size = sizeof(struct ShmRingShared) + (size_t)frames * config->channels * sizeof(int16_t);
+    ShmRing* ring = NULL;
+    if (ftruncate(fd, (off_t)size)) {
+        SDL_SetError("failed to size shared memory: %s", path);
+    }
+    else {
+        ring = map_ring(fd, size, path, true);
+    }
+
+    close(fd);
+    if (!ring) {
+        shm_unlink(path);
+        return NULL;
+    }
+
+    ring->sample_rate = config->sample_rate;
+    ring->channels = config->channels;
+    ring->frames = frames;
+
+    struct ShmRingShared* shared = ring->shared;
+    shared->version = SHM_RING_VERSION;
+    shared->sample_rate = ring->sample_rate;
+    shared->channels = ring->channels;
+    shared->frames = ring->frames;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&shared->ready, SHM_RING_MAGIC);
+    return ring;
+}
+
+ShmRing* shm_ring_attach(const char* name)
+{
+    char path[NAME_MAX_SIZE];
+    if (!make_name(name, path)) {
+        return NULL;
+    }
+
+    const int fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) {
+        SDL_SetError("failed to open shared memory: %s", path);
+        return NULL;
+    }
+
+    struct stat st;
+    ShmRing* ring = NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct ShmRingShared)) {
+        SDL_SetError("shared memory is too small: %s", path);
+    }
+    else {
+        ring = map_ring(fd, (size_t)st.st_size, path, false);
+    }
+
+    close(fd);
+    if (!ring) {
+        return NULL;
+    }
+
+    // ready is set last, so it's read first.
+    const struct ShmRingShared* shared = ring->shared;
+    const bool valid = SDL_AtomicGet(&ring->shared->ready) == SHM_RING_MAGIC && shared->version == SHM_RING_VERSION;
+    ring->sample_rate = shared->sample_rate;
+    ring->channels = shared->channels;
+    ring->frames = shared->frames;
+
+    const bool pow2 = ring->frames && !(ring->frames & (ring->frames - 1));
+    if (!valid || !pow2 || !ring->channels || ring->map_size < sizeof(*shared) + (size_t)ring->frames * ring->channels * sizeof(int16_t)) {
+        SDL_SetError("not a ready shared memory ring: %s", path);
+        shm_ring_close(ring);
+        return NULL;
+    }
+
+    // one that exited without detaching is replaced.
+    const int pid = (int)getpid();
+    const int other = SDL_AtomicGet(&ring->shared->consumer);
+    if ((other && pid_alive(other)) || !SDL_AtomicCAS(&ring->shared->consumer, other, pid)) {
+        SDL_SetError("shared memory ring already has a consumer: %s", path);
+        munmap(ring->shared, ring->map_size);
+        SDL_free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void shm_ring_close(ShmRing* ring)
+{
+    if (!ring) {
+        return;
+    }
+
+    if (ring->producer) {
+        SDL_AtomicSet(&ring->shared->closed, 1);
+        wake_word(&ring->shared->write);
+        // a consumer that has it mapped keeps it until it detaches.
+        shm_unlink(ring->name);
+    }
+    else if (SDL_AtomicCAS(&ring->shared->consumer, (int)getpid(), 0)) {
+        // a producer waiting for room starts its timeout.
+        wake_word(&ring->shared->read);
+    }
+
+    munmap(ring->shared, ring->map_size);
+    SDL_free(ring);
+}
+
+void shm_ring_get_config(const ShmRing* ring, struct ShmRingConfig* config)
+{
+    config->sample_rate = ring->sample_rate;
+    config->channels = ring->channels;
+    config->frames = ring->frames;
+}
+
+int16_t* shm_ring_reserve(ShmRing* ring, size_t* frames, int timeout_ms)
+{
+    struct ShmRingShared* shared = ring->shared;
+    const unsigned write = (unsigned)SDL_AtomicGet(&shared->write);
+    const unsigned offset = write & (ring->frames - 1);
+    const size_t want = SDL_min(*frames, ring->frames - offset);
+    // when the consumer was last seen, the timeout only runs while there's none.
+    Uint64 seen = SDL_GetTicks64();
+
+    while (!ring->failed) {
+        const int read = SDL_AtomicGet(&shared->read);
+        if (ring->frames - (write - (unsigned)read) >= want) {
+            *frames = want;
+            return ring->samples + (size_t)offset * ring->channels;
+        }
+
+        const Uint64 now = SDL_GetTicks64();
+        int slice = WAIT_SLICE_MS;
+        if (pid_alive(SDL_AtomicGet(&shared->consumer))) {
+            seen = now;
+        }
+        else if (timeout_ms >= 0) {
+            if (now - seen >= (Uint64)timeout_ms) {
+                ring->failed = true;
+                break;
+            }
+            slice = (int)SDL_min((Uint64)timeout_ms - (now - seen), WAIT_SLICE_MS);
+        }
+        wait_change(&shared->read, &shared->producer_waiting, read, slice);
+    }
+
+    SDL_SetError("shared memory ring has no consumer: %s", ring->name);
+    *frames = 0;
+    return NULL;
+}
+
+void shm_ring_publish(ShmRing* ring, size_t frames)
+{
+    struct ShmRingShared* shared = ring->shared;
+    // a full barrier, so the samples land first and the flag is read after.
+    SDL_AtomicAdd(&shared->write, (int)frames);
+    if (SDL_AtomicGet(&shared->consumer_waiting)) {
+        wake_word(&shared->write);
+    }
+}
+
+size_t shm_ring_peek(ShmRing* ring, const int16_t** samples, int timeout_ms)
+{
+    struct ShmRingShared* shared = ring->shared;
+    const unsigned read = (unsigned)SDL_AtomicGet(&shared->read);
+    const Uint64 start = SDL_GetTicks64();
+
+    for (;;) {
+        // closed is set after the last publish, so it's read first.
+        const bool closed = SDL_AtomicGet(&shared->closed);
+        const int write = SDL_AtomicGet(&shared->write);
+        const unsigned available = (unsigned)write - read;
+        if (available) {
+            const unsigned offset = read & (ring->frames - 1);
+            *samples = ring->samples + (size_t)offset * ring->channels;
+            return SDL_min(available, ring->frames - offset);
+        }
+
+        const Uint64 waited = SDL_GetTicks64() - start;
+        if (closed || (timeout_ms >= 0 && waited >= (Uint64)timeout_ms)) {
+            return 0;
+        }
+
+        const int slice = timeout_ms < 0 ? WAIT_SLICE_MS : (int)SDL_min((Uint64)timeout_ms - waited, WAIT_SLICE_MS);
+        wait_change(&shared->write, &shared->consumer_waiting, write, slice);
+    }
+}
+
+void shm_ring_release(ShmRing* ring, size_t frames)
+{
+    struct ShmRingShared* shared = ring->shared;
+    SDL_AtomicAdd(&shared->read, (int)frames);
+    if (SDL_AtomicGet(&shared->producer_waiting)) {
+        wake_word(&shared->read);
+    }
+}
+
+bool shm_ring_is_done(ShmRing* ring)
+{
+    struct ShmRingShared* shared = ring->shared;
+    return SDL_AtomicGet(&shared->closed) && SDL_AtomicGet(&shared->write) == SDL_AtomicGet(&shared->read);
+}
+
+#else
+
+ShmRing* shm_ring_create(const char* name, const struct ShmRingConfig* config)
+{
+    (void)name; (void)config;
+    SDL_SetError("shared memory rings aren't available on this platform");
+    return NULL;
+}
+
+ShmRing* shm_ring_attach(const char* name)
+{
+    (void)name;
+    SDL_SetError("shared memory rings aren't available on this platform");
+    return NULL;
+}
+
+void shm_ring_close(ShmRing* ring) { (void)ring; }
+void shm_ring_get_config(const ShmRing* ring, struct ShmRingConfig* config) { (void)ring; SDL_zerop(config); }
+int16_t* shm_ring_reserve(ShmRing* ring, size_t* frames, int timeout_ms) { (void)ring; (void)timeout_ms; *frames = 0; return NULL; }
+void shm_ring_publish(ShmRing* ring, size_t frames) { (void)ring; (void)frames; }
+size_t shm_ring_peek(ShmRing* ring, const int16_t** samples, int timeout_ms) { (void)ring; (void)samples; (void)timeout_ms; return 0; }
+void shm_ring_release(ShmRing* ring, size_t frames) { (void)ring; (void)frames; }
+bool shm_ring_is_done(ShmRing* ring) { (void)ring; return true; }
+
+#endif
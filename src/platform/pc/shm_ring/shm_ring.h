@@ -0,0 +1,78 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* a single producer / single consumer ring of 16-bit pcm in posix shared
+* memory, so that another process can take the audio without a pipe. the
+* producer creates it by name and the consumer attaches to that name.
+*
+* both sides work on the ring in place, the producer renders into space
+* from shm_ring_reserve() and the consumer reads from shm_ring_peek(), so
+* the samples are never copied. the read and write positions are on their
+* own cache lines, so the two sides don't bounce a line between them.
+*
+* a side that has to wait sleeps on the other's position with a futex on
+* linux, and is woken only if it said that it's waiting, so a consumer that
+* polls from an audio callback costs the producer nothing. elsewhere the
+* waits poll instead.
+*
+* the consumer puts its pid in the ring while it's attached, so that a
+* producer waiting for room can tell when there's no one left to make it,
+* both processes must share a pid namespace.
+*
+* not available on windows.
+*/
+
+typedef struct ShmRing ShmRing;
+
+struct ShmRingConfig {
+    uint32_t sample_rate;
+    uint32_t channels;
+    // rounded up to a power of 2.
+    uint32_t frames;
+};
+
+/* replaces any ring left with the same name, which is unlinked on close. */
+ShmRing* shm_ring_create(const char* name, const struct ShmRingConfig* config);
+/* fails if the ring already has a live consumer. */
+ShmRing* shm_ring_attach(const char* name);
+/* the producer marks the ring closed, so that the consumer sees the end. */
+void shm_ring_close(ShmRing* ring);
+
+void shm_ring_get_config(const ShmRing* ring, struct ShmRingConfig* config);
+
+/*
+* producer, waits until there's room for up to frames and returns it,
+* frames is set to how many fit before the end of the ring. a live consumer
+* is waited on for as long as it takes, but if none is attached, or it has
+* exited, it's only waited for up to timeout_ms (-1 forever). returns NULL
+* after that, as do all later calls.
+*/
+int16_t* shm_ring_reserve(ShmRing* ring, size_t* frames, int timeout_ms);
+/* makes frames written to the reserved space visible to the consumer. */
+void shm_ring_publish(ShmRing* ring, size_t frames);
+
+/*
+* consumer, waits up to timeout_ms (0 to poll, -1 forever) for audio and
+* returns the frames that can be read in one piece, 0 on a timeout or once
+* the ring is closed and drained.
+*/
+size_t shm_ring_peek(ShmRing* ring, const int16_t** samples, int timeout_ms);
+/* hands frames from shm_ring_peek() back to the producer. */
+void shm_ring_release(ShmRing* ring, size_t frames);
+/* true once the producer closed and everything was read. */
+bool shm_ring_is_done(ShmRing* ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHM_RING_H
@@ -0,0 +1,64 @@
+#include "snapshot_grid.h"
+
+#include <SDL.h>
+
+// cycles per gbs_run(), so that the samples thrown away don't overflow.
+enum { SCAN_CYCLES = 70224 };
+
+static size_t gcd(size_t a, size_t b)
+{
+    while (b) {
+        const size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+size_t snapshot_grid_step(unsigned freq)
+{
+    return freq / gcd(freq, GBS_CPU_CLOCK);
+}
+
+size_t snapshot_grid_round_up(size_t frames, size_t step)
+{
+    return (frames + step - 1) / step * step;
+}
+
+uint64_t snapshot_grid_cycle(uint64_t origin, size_t frame, unsigned freq)
+{
+    return origin + (uint64_t)frame * GBS_CPU_CLOCK / freq;
+}
+
+bool snapshot_grid_run_to(Gbs* gbs, uint64_t cycle, size_t* frames)
+{
+    int16_t skipped[4096];
+    uint64_t now;
+
+    while ((now = gbs_get_cycles(gbs)) < cycle) {
+        gbs_run(gbs, (unsigned)SDL_min(cycle - now, SCAN_CYCLES));
+
+        if (!frames) {
+            gbs_clear_samples(gbs);
+            continue;
+        }
+
+        int count;
+        while ((count = SDL_min(gbs_samples_avaliable(gbs), (int)SDL_arraysize(skipped))) > 0) {
+            *frames += (size_t)gbs_read_samples(gbs, skipped, count) / 2;
+        }
+    }
+
+    return now == cycle;
+}
+
+void* snapshot_grid_take(Gbs* gbs)
+{
+    const size_t size = gbs_snapshot_size(gbs);
+    void* snapshot = SDL_malloc(size);
+    if (snapshot && !gbs_save_snapshot(gbs, snapshot, size)) {
+        SDL_free(snapshot);
+        snapshot = NULL;
+    }
+    return snapshot;
+}
@@ -0,0 +1,45 @@
+#ifndef SNAPSHOT_GRID_H
+#define SNAPSHOT_GRID_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* runs a song to points that it can be snapshotted at, so that rendering on
+* from a restored snapshot lines up with a serial render.
+*
+* the resampler isn't in a snapshot, so one is only taken on a cycle that is
+* a whole number of frames from the song start, the grid, and a pre-roll is
+* rendered after restoring it, which is thrown away once the blip buffer and
+* high-pass filter have settled. the cpu only stops between instructions, so
+* a scan tries the grid points after the one it wants until it lands on one.
+*/
+
+// frames in a step of the grid, which is a whole number of both frames and cycles.
+size_t snapshot_grid_step(unsigned freq);
+size_t snapshot_grid_round_up(size_t frames, size_t step);
+// origin is the cycles at the song start.
+uint64_t snapshot_grid_cycle(uint64_t origin, size_t frame, unsigned freq);
+
+/*
+* runs gbs without output until cycle, returns true if it landed on it exactly.
+* if frames isn't NULL the samples made are read and counted into it, so that
+* the output carries on from them, otherwise they are cleared.
+*/
+bool snapshot_grid_run_to(Gbs* gbs, uint64_t cycle, size_t* frames);
+
+// returns a snapshot of gbs, freed with SDL_free(), or NULL.
+void* snapshot_grid_take(Gbs* gbs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SNAPSHOT_GRID_H
@@ -0,0 +1,467 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // for pthread_setaffinity_np().
+    #define _GNU_SOURCE
+#endif
+
+#include "stream_pool.h"
+
+#include <SDL.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+enum { MAX_THREADS = 64 };
+// longest a thread sleeps, so that it notices others falling behind and new streams.
+enum { MAX_SLEEP_MS = 10 };
+// a waiting stream with less than this part of its ring buffered may be stolen.
+enum { STEAL_HEADROOM_DIV = 4 };
+
+struct StreamPoolStream {
+    Gbs* gbs;
+    void (*release)(void* user);
+    void* user;
+    // capacity frames of stereo s16, a copy of the pool's for the listener.
+    int16_t* ring;
+    size_t capacity;
+    // free running frame counters, write is only moved by the owner, read by the listener.
+    SDL_atomic_t write;
+    SDL_atomic_t read;
+    SDL_atomic_t underruns;
+    // index of the thread that renders it, only changed with both threads locked.
+    SDL_atomic_t owner;
+
+    // everything below is guarded by the owner's lock.
+    struct StreamPoolStream* prev;
+    struct StreamPoolStream* next;
+    bool rendering;
+    // freed by the owner once it's done rendering.
+    bool removed;
+    uint64_t ticks;
+    uint64_t frames;
+    unsigned migrations;
+};
+
+struct Worker {
+    StreamPool* pool;
+    unsigned index;
+    // chunk_frames of stereo s16, only used by the thread.
+    int16_t* chunk;
+
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    // guarded by lock.
+    StreamPoolStream* streams;
+    unsigned count;
+};
+
+struct StreamPool {
+    unsigned sample_rate;
+    // a power of 2, so that the counters wrap cleanly.
+    size_t capacity;
+    size_t chunk_frames;
+
+    struct Worker workers[MAX_THREADS];
+    SDL_Thread* threads[MAX_THREADS];
+    unsigned thread_count;
+
+    SDL_atomic_t quit;
+    SDL_atomic_t streams;
+    SDL_atomic_t steals;
+};
+
+static size_t buffered(StreamPoolStream* s)
+{
+    return (unsigned)SDL_AtomicGet(&s->write) - (unsigned)SDL_AtomicGet(&s->read);
+}
+
+static void free_stream(StreamPoolStream* s)
+{
+    gbs_quit(s->gbs);
+    if (s->release) {
+        s->release(s->user);
+    }
+    SDL_free(s->ring);
+    SDL_free(s);
+}
+
+static void link_stream(struct Worker* w, StreamPoolStream* s)
+{
+    s->prev = NULL;
+    s->next = w->streams;
+    if (w->streams) {
+        w->streams->prev = s;
+    }
+    w->streams = s;
+    w->count++;
+    SDL_AtomicSet(&s->owner, (int)w->index);
+}
+
+static void unlink_stream(struct Worker* w, StreamPoolStream* s)
+{
+    if (s->prev) {
+        s->prev->next = s->next;
+    }
+    else {
+        w->streams = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+    w->count--;
+}
+
+// returns the stream's owner locked.
+static struct Worker* lock_owner(StreamPool* pool, StreamPoolStream* s)
+{
+    for (;;) {
+        struct Worker* w = &pool->workers[SDL_AtomicGet(&s->owner)];
+        SDL_LockMutex(w->lock);
+        if (SDL_AtomicGet(&s->owner) == (int)w->index) {
+            return w;
+        }
+        SDL_UnlockMutex(w->lock);
+    }
+}
+
+static void pin_thread(unsigned core)
+{
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
+
+/*
+* earliest deadline first, the deadline of a stream is when its ring runs
+* dry, so it's the one with the least buffered that has room for a chunk.
+* the keys move every time a listener reads, so the streams are scanned
+* rather than kept in a heap, which is cheap next to rendering a chunk.
+* called with the lock held, sleep_ms is set to when the next one is due.
+*/
+static StreamPoolStream* pick_stream(StreamPool* pool, struct Worker* w, unsigned* sleep_ms)
+{
+    StreamPoolStream* best = NULL;
+    size_t best_buffered = 0;
+    size_t min_wait = SIZE_MAX;
+
+    for (StreamPoolStream* s = w->streams; s; s = s->next) {
+        if (s->removed) {
+            continue;
+        }
+
+        const size_t b = buffered(s);
+        if (pool->capacity - b >= pool->chunk_frames) {
+            if (!best || b < best_buffered) {
+                best = s;
+                best_buffered = b;
+            }
+        }
+        else {
+            min_wait = SDL_min(min_wait, b + pool->chunk_frames - pool->capacity);
+        }
+    }
+
+    const size_t ms = min_wait == SIZE_MAX ? MAX_SLEEP_MS : min_wait * 1000 / pool->sample_rate;
+    *sleep_ms = (unsigned)SDL_clamp(ms, 1, MAX_SLEEP_MS);
+    return best;
+}
+
+// called with the lock held, which is dropped while rendering.
+static void render_chunk(StreamPool* pool, struct Worker* w, StreamPoolStream* s)
+{
+    s->rendering = true;
+    SDL_UnlockMutex(w->lock);
+
+    const Uint64 start = SDL_GetPerformanceCounter();
+    const size_t count = pool->chunk_frames * 2;
+    gbs_run(s->gbs, gbs_clocks_needed(s->gbs, (int)count));
+    gbs_read_samples(s->gbs, w->chunk, (int)count);
+
+    // the ring only wraps between frames, as its size is a power of 2.
+    const size_t pos = (unsigned)SDL_AtomicGet(&s->write) & (pool->capacity - 1);
+    const size_t first = SDL_min(pool->chunk_frames, pool->capacity - pos);
+    SDL_memcpy(s->ring + pos * 2, w->chunk, first * 2 * sizeof(int16_t));
+    SDL_memcpy(s->ring, w->chunk + first * 2, (pool->chunk_frames - first) * 2 * sizeof(int16_t));
+    SDL_AtomicAdd(&s->write, (int)pool->chunk_frames);
+
+    const Uint64 ticks = SDL_GetPerformanceCounter() - start;
+
+    SDL_LockMutex(w->lock);
+    s->rendering = false;
+    s->ticks += ticks;
+    s->frames += pool->chunk_frames;
+    if (s->removed) {
+        unlink_stream(w, s);
+        free_stream(s);
+    }
+}
+
+/*
+* takes the most urgent waiting stream of a thread that has more than one
+* stream, and has let it fall below the steal headroom.
+*/
+static bool steal_stream(StreamPool* pool, struct Worker* thief)
+{
+    const size_t headroom = pool->capacity / STEAL_HEADROOM_DIV;
+
+    for (unsigned i = 1; i < pool->thread_count; i++) {
+        struct Worker* victim = &pool->workers[(thief->index + i) % pool->thread_count];
+
+        // locked in index order, so two thieves can't deadlock.
+        struct Worker* first = victim->index < thief->index ? victim : thief;
+        struct Worker* second = first == victim ? thief : victim;
+        SDL_LockMutex(first->lock);
+        SDL_LockMutex(second->lock);
+
+        StreamPoolStream* best = NULL;
+        size_t best_buffered = 0;
+        if (victim->count > 1) {
+            for (StreamPoolStream* s = victim->streams; s; s = s->next) {
+                const size_t b = buffered(s);
+                if (!s->rendering && !s->removed && b < headroom && (!best || b < best_buffered)) {
+                    best = s;
+                    best_buffered = b;
+                }
+            }
+        }
+
+        if (best) {
+            unlink_stream(victim, best);
+            link_stream(thief, best);
+            best->migrations++;
+            SDL_AtomicAdd(&pool->steals, 1);
+        }
+
+        SDL_UnlockMutex(second->lock);
+        SDL_UnlockMutex(first->lock);
+
+        if (best) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int worker_thread(void* user)
+{
+    struct Worker* w = user;
+    StreamPool* pool = w->pool;
+
+    pin_thread(w->index);
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    SDL_LockMutex(w->lock);
+    while (!SDL_AtomicGet(&pool->quit)) {
+        unsigned sleep_ms;
+        StreamPoolStream* s = pick_stream(pool, w, &sleep_ms);
+        if (s) {
+            render_chunk(pool, w, s);
+            continue;
+        }
+
+        // every ring it owns is full, so it helps out before sleeping.
+        SDL_UnlockMutex(w->lock);
+        const bool stole = steal_stream(pool, w);
+        SDL_LockMutex(w->lock);
+
+        if (!stole && !SDL_AtomicGet(&pool->quit)) {
+            SDL_CondWaitTimeout(w->wake, w->lock, sleep_ms);
+        }
+    }
+    SDL_UnlockMutex(w->lock);
+    return 0;
+}
+
+StreamPool* stream_pool_init(const struct StreamPoolConfig* config)
+{
+    if (!config->sample_rate || !config->chunk_frames || config->chunk_frames > config->buffer_frames) {
+        SDL_SetError("bad stream pool config");
+        return NULL;
+    }
+
+    StreamPool* pool = SDL_calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->sample_rate = config->sample_rate;
+    pool->chunk_frames = config->chunk_frames;
+    pool->capacity = 1;
+    while (pool->capacity < config->buffer_frames) {
+        pool->capacity *= 2;
+    }
+
+    const unsigned threads = config->threads ? config->threads : (unsigned)SDL_GetCPUCount();
+    const unsigned thread_count = SDL_clamp(threads, 1, MAX_THREADS);
+
+    // workers are set up first, as a thread may steal from any of them.
+    for (unsigned i = 0; i < thread_count; i++) {
+        struct Worker* w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        if (!(w->chunk = SDL_malloc(pool->chunk_frames * 2 * sizeof(int16_t))) || !(w->lock = SDL_CreateMutex()) || !(w->wake = SDL_CreateCond())) {
+            goto fail;
+        }
+    }
+
+    pool->thread_count = thread_count;
+    for (unsigned i = 0; i < thread_count; i++) {
+        if (!(pool->threads[i] = SDL_CreateThread(worker_thread, "stream_pool", &pool->workers[i]))) {
+            goto fail;
+        }
+    }
+
+    return pool;
+
+fail:
+    SDL_SetError("failed to start stream pool");
+    stream_pool_quit(pool);
+    return NULL;
+}
+
+void stream_pool_quit(StreamPool* pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    SDL_AtomicSet(&pool->quit, 1);
+    for (unsigned i = 0; i < pool->thread_count; i++) {
+        struct Worker* w = &pool->workers[i];
+        SDL_LockMutex(w->lock);
+        SDL_CondSignal(w->wake);
+        SDL_UnlockMutex(w->lock);
+    }
+
+    for (unsigned i = 0; i < pool->thread_count; i++) {
+        if (pool->threads[i]) {
+            SDL_WaitThread(pool->threads[i], NULL);
+        }
+    }
+
+    for (unsigned i = 0; i < MAX_THREADS; i++) {
+        struct Worker* w = &pool->workers[i];
+        while (w->streams) {
+            StreamPoolStream* s = w->streams;
+            unlink_stream(w, s);
+            free_stream(s);
+        }
+        if (w->wake) {
+            SDL_DestroyCond(w->wake);
+        }
+        if (w->lock) {
+            SDL_DestroyMutex(w->lock);
+        }
+        SDL_free(w->chunk);
+    }
+
+    SDL_free(pool);
+}
+
+StreamPoolStream* stream_pool_add(StreamPool* pool, Gbs* gbs, void (*release)(void* user), void* user)
+{
+    StreamPoolStream* s = SDL_calloc(1, sizeof(*s));
+    if (!s || !(s->ring = SDL_calloc(pool->capacity * 2, sizeof(int16_t)))) {
+        SDL_free(s);
+        gbs_quit(gbs);
+        if (release) {
+            release(user);
+        }
+        SDL_SetError("failed to add stream");
+        return NULL;
+    }
+    s->gbs = gbs;
+    s->release = release;
+    s->user = user;
+    s->capacity = pool->capacity;
+
+    // the thread with the fewest streams, stealing evens out the cost of each.
+    struct Worker* w = &pool->workers[0];
+    unsigned min_count = UINT32_MAX;
+    for (unsigned i = 0; i < pool->thread_count; i++) {
+        SDL_LockMutex(pool->workers[i].lock);
+        const unsigned count = pool->workers[i].count;
+        SDL_UnlockMutex(pool->workers[i].lock);
+        if (count < min_count) {
+            w = &pool->workers[i];
+            min_count = count;
+        }
+    }
+
+    SDL_LockMutex(w->lock);
+    link_stream(w, s);
+    SDL_CondSignal(w->wake);
+    SDL_UnlockMutex(w->lock);
+
+    SDL_AtomicAdd(&pool->streams, 1);
+    return s;
+}
+
+void stream_pool_remove(StreamPool* pool, StreamPoolStream* stream)
+{
+    struct Worker* w = lock_owner(pool, stream);
+    if (stream->rendering) {
+        stream->removed = true;
+    }
+    else {
+        unlink_stream(w, stream);
+        free_stream(stream);
+    }
+    SDL_UnlockMutex(w->lock);
+
+    SDL_AtomicAdd(&pool->streams, -1);
+}
+
+size_t stream_pool_available(StreamPoolStream* stream)
+{
+    return buffered(stream);
+}
+
+size_t stream_pool_read(StreamPoolStream* stream, int16_t* samples, size_t frames)
+{
+    const size_t count = SDL_min(frames, buffered(stream));
+    const size_t pos = (unsigned)SDL_AtomicGet(&stream->read) & (stream->capacity - 1);
+    const size_t first = SDL_min(count, stream->capacity - pos);
+    SDL_memcpy(samples, stream->ring + pos * 2, first * 2 * sizeof(int16_t));
+    SDL_memcpy(samples + first * 2, stream->ring, (count - first) * 2 * sizeof(int16_t));
+
+    if (count < frames) {
+        SDL_memset(samples + count * 2, 0, (frames - count) * 2 * sizeof(int16_t));
+        SDL_AtomicAdd(&stream->underruns, 1);
+    }
+
+    // frees the room only once it's been copied out.
+    SDL_AtomicAdd(&stream->read, (int)count);
+    return count;
+}
+
+void stream_pool_get_stream_stats(StreamPool* pool, StreamPoolStream* stream, struct StreamPoolStreamStats* stats)
+{
+    struct Worker* w = lock_owner(pool, stream);
+    stats->cpu_us = stream->ticks * 1000000 / SDL_GetPerformanceFrequency();
+    stats->frames = stream->frames;
+    stats->migrations = stream->migrations;
+    SDL_UnlockMutex(w->lock);
+
+    stats->headroom_ms = (unsigned)(buffered(stream) * 1000 / pool->sample_rate);
+    stats->underruns = (unsigned)SDL_AtomicGet(&stream->underruns);
+}
+
+void stream_pool_get_stats(StreamPool* pool, struct StreamPoolStats* stats)
+{
+    stats->threads = pool->thread_count;
+    stats->streams = (unsigned)SDL_AtomicGet(&pool->streams);
+    stats->steals = (unsigned)SDL_AtomicGet(&pool->steals);
+}
@@ -0,0 +1,83 @@
+#ifndef STREAM_POOL_H
+#define STREAM_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* renders many real-time streams on a render thread per core, each pinned
+* to its core where the os allows it.
+*
+* every stream is a gbs with a ring of samples in front of it, filled by
+* the render threads and drained by a listener through stream_pool_read().
+* a stream's deadline is when its ring would run dry, and each thread
+* renders a chunk for its stream with the earliest deadline, sleeping once
+* every ring it owns is full. a thread with nothing to do steals the most
+* urgent stream from a thread that has fallen behind, so load that's skewed
+* by songs of different cost evens out.
+*/
+
+typedef struct StreamPool StreamPool;
+typedef struct StreamPoolStream StreamPoolStream;
+
+struct StreamPoolConfig {
+    // render threads, 0 for one per cpu.
+    unsigned threads;
+    unsigned sample_rate;
+    // frames each stream's ring holds, and frames rendered at once.
+    unsigned buffer_frames;
+    unsigned chunk_frames;
+};
+
+struct StreamPoolStreamStats {
+    uint64_t cpu_us; // time spent rendering the stream.
+    uint64_t frames; // frames rendered.
+    unsigned headroom_ms; // audio buffered ahead of the listener.
+    unsigned underruns; // reads that asked for more than was buffered.
+    unsigned migrations; // times the stream was stolen by another thread.
+};
+
+struct StreamPoolStats {
+    unsigned threads;
+    unsigned streams;
+    unsigned steals;
+};
+
+StreamPool* stream_pool_init(const struct StreamPoolConfig* config);
+// removes and frees every stream left.
+void stream_pool_quit(StreamPool* pool);
+
+/*
+* takes ownership of gbs, which must have had the song set and render at
+* the sample rate of the pool. returns NULL on failure, and gbs is freed.
+* release, which may be NULL, is called with user once gbs has been freed,
+* from any thread, so that the memory it was loaded from can be freed too.
+*/
+StreamPoolStream* stream_pool_add(StreamPool* pool, Gbs* gbs, void (*release)(void* user), void* user);
+// stream must not be used after, the gbs is freed once it isn't rendering.
+void stream_pool_remove(StreamPool* pool, StreamPoolStream* stream);
+
+/*
+* copies up to frames of stereo s16 out of the stream's ring, only one
+* thread may read a stream. returns the frames copied, the rest of samples
+* is zeroed and counted as an underrun.
+*/
+size_t stream_pool_read(StreamPoolStream* stream, int16_t* samples, size_t frames);
+// frames that can be read without an underrun.
+size_t stream_pool_available(StreamPoolStream* stream);
+
+void stream_pool_get_stream_stats(StreamPool* pool, StreamPoolStream* stream, struct StreamPoolStreamStats* stats);
+void stream_pool_get_stats(StreamPool* pool, struct StreamPoolStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STREAM_POOL_H
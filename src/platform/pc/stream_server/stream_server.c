@@ -0,0 +1,721 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // for accept4().
+    #define _GNU_SOURCE
+#endif
+
+#include "stream_server.h"
+
+#include <SDL.h>
+
+#if defined(__linux__)
+    #include <errno.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <sys/epoll.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <sys/un.h>
+#endif
+
+#if defined(__linux__)
+
+// longest request line and headers read.
+enum { REQUEST_MAX = 4096 };
+// how often streaming clients are topped up.
+enum { TICK_MS = 10 };
+// audio a client is sent ahead of real time, so that it can buffer.
+enum { SEND_AHEAD_MS = 250 };
+// audio buffered in the pool before a stream starts sending.
+enum { PREBUFFER_MS = 100 };
+// audio taken from the pool at once, and the socket send buffer.
+enum { SEND_FRAMES = 2048 };
+enum { SEND_BUFFER_SIZE = SEND_FRAMES * 4 * 2 };
+enum { MAX_EVENTS = 256 };
+
+enum ClientState {
+    ClientState_REQUEST,
+    // waiting for the loader thread to open the file.
+    ClientState_OPEN,
+    // waiting for the pool to buffer.
+    ClientState_PREBUFFER,
+    ClientState_STREAM,
+    // sending an error, closed once it's out.
+    ClientState_ERROR,
+};
+
+// a request on its way through the loader thread.
+struct Load {
+    struct Load* next;
+    // NULL once the client has gone, guarded by the server's lock.
+    struct Client* client;
+    char path[REQUEST_MAX];
+    int song;
+    Gbs* gbs;
+    void* file;
+};
+
+struct Client {
+    int fd;
+    enum ClientState state;
+    struct Client* prev;
+    struct Client* next;
+
+    char request[REQUEST_MAX];
+    size_t request_size;
+    struct Load* load;
+    bool wav;
+
+    // the response header, with the wav header after it, then pcm taken from the stream.
+    char header[256];
+    size_t header_size;
+    size_t header_sent;
+    int16_t pcm[SEND_FRAMES * 2];
+    size_t pcm_size;
+    size_t pcm_sent;
+    // EPOLLOUT is only asked for while the socket is full.
+    bool blocked;
+
+    StreamPoolStream* stream;
+    Uint64 start;
+    uint64_t frames_sent;
+};
+
+struct Server {
+    const struct StreamServerConfig* config;
+    const struct StreamServerInterface* iface;
+    void* user;
+    struct StreamServerStats* stats;
+
+    int epoll;
+    int listen;
+    struct Client* clients;
+    unsigned client_count;
+
+    SDL_Thread* loader;
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    // guarded by lock. loads are queued first in first out, and handed back
+    // in any order, the loop picks them up on its next tick.
+    struct Load* queue_head;
+    struct Load* queue_tail;
+    struct Load* loaded;
+    bool quit;
+};
+
+static volatile sig_atomic_t g_quit;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    g_quit = 1;
+}
+
+static void put_le16(char* p, uint16_t v)
+{
+    p[0] = (char)(v & 0xFF);
+    p[1] = (char)(v >> 8);
+}
+
+static void put_le32(char* p, uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+// an endless stream has no size, so the riff and data sizes are left at the max.
+static size_t write_wav_header(char* p, unsigned rate)
+{
+    SDL_memcpy(p, "RIFF", 4);
+    put_le32(p + 4, 0xFFFFFFFF);
+    SDL_memcpy(p + 8, "WAVEfmt ", 8);
+    put_le32(p + 16, 16);
+    put_le16(p + 20, 1);
+    put_le16(p + 22, 2);
+    put_le32(p + 24, rate);
+    put_le32(p + 28, rate * 4);
+    put_le16(p + 32, 4);
+    put_le16(p + 34, 16);
+    SDL_memcpy(p + 36, "data", 4);
+    put_le32(p + 40, 0xFFFFFFFF);
+    return 44;
+}
+
+static void close_client(struct Server* s, struct Client* c)
+{
+    if (c->prev) {
+        c->prev->next = c->next;
+    }
+    else {
+        s->clients = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    s->client_count--;
+
+    // the loader thread still has it, so it's freed once it comes back.
+    if (c->load) {
+        SDL_LockMutex(s->lock);
+        c->load->client = NULL;
+        SDL_UnlockMutex(s->lock);
+    }
+    if (c->stream) {
+        stream_pool_remove(s->config->pool, c->stream);
+    }
+    close(c->fd);
+    SDL_free(c);
+}
+
+static void accept_clients(struct Server* s)
+{
+    for (;;) {
+        const int fd = accept4(s->listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        // kept small, so that pacing isn't undone by the kernel buffering seconds of audio.
+        const int size = SEND_BUFFER_SIZE;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+        struct Client* c = SDL_calloc(1, sizeof(*c));
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (!c || epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &ev)) {
+            SDL_free(c);
+            close(fd);
+            continue;
+        }
+
+        c->fd = fd;
+        c->next = s->clients;
+        if (s->clients) {
+            s->clients->prev = c;
+        }
+        s->clients = c;
+        s->client_count++;
+        s->stats->accepted++;
+        s->stats->peak_clients = SDL_max(s->stats->peak_clients, s->client_count);
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// decodes %XX in place, returns false if it's malformed.
+static bool url_decode(char* str)
+{
+    char* out = str;
+    for (const char* in = str; *in; in++) {
+        if (*in == '%') {
+            const int hi = hex_value(in[1]);
+            const int lo = hi >= 0 ? hex_value(in[2]) : -1;
+            if (lo < 0 || (!hi && !lo)) {
+                return false;
+            }
+            *out++ = (char)(hi * 16 + lo);
+            in += 2;
+        }
+        else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    return true;
+}
+
+// "/path?song=N&format=F", path is modified in place.
+static bool parse_target(char* target, const char** path, int* song, bool* wav)
+{
+    if (*target != '/') {
+        return false;
+    }
+
+    char* query = SDL_strchr(target, '?');
+    if (query) {
+        *query++ = '\0';
+    }
+
+    *song = -1;
+    *wav = true;
+    while (query && *query) {
+        char* next = SDL_strchr(query, '&');
+        if (next) {
+            *next++ = '\0';
+        }
+
+        if (!SDL_strncmp(query, "song=", 5)) {
+            char* end;
+            const long value = SDL_strtol(query + 5, &end, 10);
+            if (end == query + 5 || *end || value < 0 || value > 255) {
+                return false;
+            }
+            *song = (int)value;
+        }
+        else if (!SDL_strcmp(query, "format=wav")) {
+            *wav = true;
+        }
+        else if (!SDL_strcmp(query, "format=raw")) {
+            *wav = false;
+        }
+
+        query = next;
+    }
+
+    *path = target + 1;
+    if (!url_decode(target + 1) || !**path) {
+        return false;
+    }
+
+    // the path may not leave the root.
+    for (const char* p = *path; (p = SDL_strstr(p, "..")); p += 2) {
+        const bool start = p == *path || p[-1] == '/';
+        const bool end = !p[2] || p[2] == '/';
+        if (start && end) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void set_error(struct Server* s, struct Client* c, const char* status)
+{
+    c->state = ClientState_ERROR;
+    c->header_size = (size_t)SDL_snprintf(c->header, sizeof(c->header), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    c->header_sent = 0;
+    s->stats->rejected++;
+}
+
+static void handle_request(struct Server* s, struct Client* c)
+{
+    // only the request line matters, the headers are ignored.
+    char* line_end = SDL_strstr(c->request, "\r\n");
+    *line_end = '\0';
+
+    char* method = c->request;
+    char* target = SDL_strchr(method, ' ');
+    char* version = target ? SDL_strchr(target + 1, ' ') : NULL;
+    if (!version) {
+        set_error(s, c, "400 Bad Request");
+        return;
+    }
+    *target++ = '\0';
+    *version = '\0';
+
+    if (SDL_strcmp(method, "GET")) {
+        set_error(s, c, "405 Method Not Allowed");
+        return;
+    }
+
+    const char* path;
+    int song;
+    if (!parse_target(target, &path, &song, &c->wav)) {
+        set_error(s, c, "400 Bad Request");
+        return;
+    }
+
+    struct Load* load = SDL_calloc(1, sizeof(*load));
+    if (!load) {
+        set_error(s, c, "503 Service Unavailable");
+        return;
+    }
+    load->client = c;
+    load->song = song;
+    SDL_strlcpy(load->path, path, sizeof(load->path));
+
+    c->load = load;
+    c->state = ClientState_OPEN;
+
+    SDL_LockMutex(s->lock);
+    if (s->queue_tail) {
+        s->queue_tail->next = load;
+    }
+    else {
+        s->queue_head = load;
+    }
+    s->queue_tail = load;
+    SDL_CondSignal(s->wake);
+    SDL_UnlockMutex(s->lock);
+}
+
+static int loader_thread(void* user)
+{
+    struct Server* s = user;
+
+    SDL_LockMutex(s->lock);
+    for (;;) {
+        while (!s->queue_head && !s->quit) {
+            SDL_CondWait(s->wake, s->lock);
+        }
+        if (s->quit) {
+            break;
+        }
+
+        struct Load* load = s->queue_head;
+        if (!(s->queue_head = load->next)) {
+            s->queue_tail = NULL;
+        }
+
+        // not opened at all if the client went away while it was queued.
+        if (load->client) {
+            SDL_UnlockMutex(s->lock);
+            load->gbs = s->iface->open(s->user, load->path, load->song, &load->file);
+            SDL_LockMutex(s->lock);
+        }
+
+        load->next = s->loaded;
+        s->loaded = load;
+    }
+    SDL_UnlockMutex(s->lock);
+    return 0;
+}
+
+// frees a load whose gbs was never handed to the pool.
+static void free_load(struct Server* s, struct Load* load)
+{
+    if (load->gbs) {
+        gbs_quit(load->gbs);
+        if (s->iface->release) {
+            s->iface->release(load->file);
+        }
+    }
+    SDL_free(load);
+}
+
+// starts streaming to the client that made the load, or sends it an error.
+static void start_stream(struct Server* s, struct Client* c, struct Load* load)
+{
+    c->load = NULL;
+    Gbs* gbs = load->gbs;
+    void* file = load->file;
+    SDL_free(load);
+
+    if (!gbs) {
+        set_error(s, c, "404 Not Found");
+        return;
+    }
+
+    if (!(c->stream = stream_pool_add(s->config->pool, gbs, s->iface->release, file))) {
+        set_error(s, c, "503 Service Unavailable");
+        return;
+    }
+
+    c->header_size = (size_t)SDL_snprintf(c->header, sizeof(c->header), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n", c->wav ? "audio/wav" : "application/octet-stream");
+    if (c->wav) {
+        c->header_size += write_wav_header(c->header + c->header_size, s->config->sample_rate);
+    }
+    c->state = ClientState_PREBUFFER;
+}
+
+// returns false if the client went away.
+static bool read_request(struct Server* s, struct Client* c)
+{
+    for (;;) {
+        const size_t room = sizeof(c->request) - 1 - c->request_size;
+        if (!room) {
+            set_error(s, c, "431 Request Header Fields Too Large");
+            return true;
+        }
+
+        const ssize_t n = recv(c->fd, c->request + c->request_size, room, 0);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+
+        c->request_size += (size_t)n;
+        c->request[c->request_size] = '\0';
+        if (SDL_strstr(c->request, "\r\n\r\n")) {
+            handle_request(s, c);
+            return true;
+        }
+    }
+}
+
+// takes what's due from the pool, once the last of it has been sent.
+static void fill_client(struct Server* s, struct Client* c, Uint64 now)
+{
+    const unsigned rate = s->config->sample_rate;
+
+    if (c->state == ClientState_PREBUFFER) {
+        if (stream_pool_available(c->stream) < (size_t)PREBUFFER_MS * rate / 1000) {
+            return;
+        }
+        c->state = ClientState_STREAM;
+        c->start = now;
+    }
+
+    if (c->state != ClientState_STREAM || c->pcm_sent < c->pcm_size) {
+        return;
+    }
+
+    const uint64_t due = (now - c->start + SEND_AHEAD_MS) * rate / 1000;
+    if (due <= c->frames_sent) {
+        return;
+    }
+
+    // an underrun is sent as silence, so the client's clock keeps going.
+    const size_t frames = (size_t)SDL_min(due - c->frames_sent, SEND_FRAMES);
+    stream_pool_read(c->stream, c->pcm, frames);
+    c->pcm_size = frames * 4;
+    c->pcm_sent = 0;
+    c->frames_sent += frames;
+}
+
+static void set_blocked(struct Server* s, struct Client* c, bool blocked)
+{
+    if (c->blocked != blocked) {
+        struct epoll_event ev = { .events = EPOLLIN | (blocked ? EPOLLOUT : 0), .data.ptr = c };
+        epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+        c->blocked = blocked;
+    }
+}
+
+// the header and pcm go out in one writev, returns false once the client should close.
+static bool send_client(struct Server* s, struct Client* c)
+{
+    while (c->header_sent < c->header_size || c->pcm_sent < c->pcm_size) {
+        struct iovec iov[2];
+        int count = 0;
+        if (c->header_sent < c->header_size) {
+            iov[count++] = (struct iovec){ c->header + c->header_sent, c->header_size - c->header_sent };
+        }
+        if (c->pcm_sent < c->pcm_size) {
+            iov[count++] = (struct iovec){ (char*)c->pcm + c->pcm_sent, c->pcm_size - c->pcm_sent };
+        }
+
+        const ssize_t n = writev(c->fd, iov, count);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                set_blocked(s, c, true);
+                return true;
+            }
+            return errno == EINTR;
+        }
+
+        s->stats->bytes_sent += (unsigned long long)n;
+        size_t sent = (size_t)n;
+        const size_t header = SDL_min(sent, c->header_size - c->header_sent);
+        c->header_sent += header;
+        c->pcm_sent += sent - header;
+    }
+
+    set_blocked(s, c, false);
+    return c->state != ClientState_ERROR;
+}
+
+// hands back what the loader thread has opened since the last tick.
+static void finish_loads(struct Server* s)
+{
+    SDL_LockMutex(s->lock);
+    struct Load* load = s->loaded;
+    s->loaded = NULL;
+    SDL_UnlockMutex(s->lock);
+
+    // client is only ever cleared by this thread, so it can be read without the lock now.
+    for (struct Load* next; load; load = next) {
+        next = load->next;
+        struct Client* c = load->client;
+        if (!c) {
+            free_load(s, load);
+            continue;
+        }
+
+        start_stream(s, c, load);
+        if (!send_client(s, c)) {
+            close_client(s, c);
+        }
+    }
+}
+
+static bool start_loader(struct Server* s)
+{
+    if (!(s->lock = SDL_CreateMutex()) || !(s->wake = SDL_CreateCond()) || !(s->loader = SDL_CreateThread(loader_thread, "stream_server_loader", s))) {
+        SDL_SetError("failed to start the loader thread");
+        return false;
+    }
+    return true;
+}
+
+static void stop_loader(struct Server* s)
+{
+    if (s->loader) {
+        SDL_LockMutex(s->lock);
+        s->quit = true;
+        SDL_CondSignal(s->wake);
+        SDL_UnlockMutex(s->lock);
+        SDL_WaitThread(s->loader, NULL);
+    }
+
+    // every client is gone by now.
+    for (struct Load* load = s->queue_head, *next; load; load = next) {
+        next = load->next;
+        free_load(s, load);
+    }
+    for (struct Load* load = s->loaded, *next; load; load = next) {
+        next = load->next;
+        free_load(s, load);
+    }
+
+    if (s->wake) {
+        SDL_DestroyCond(s->wake);
+    }
+    if (s->lock) {
+        SDL_DestroyMutex(s->lock);
+    }
+}
+
+static bool start_listen(struct Server* s)
+{
+    const struct StreamServerConfig* config = s->config;
+
+    if (config->unix_path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (SDL_strlen(config->unix_path) >= sizeof(addr.sun_path)) {
+            SDL_SetError("unix socket path is too long");
+            return false;
+        }
+        SDL_strlcpy(addr.sun_path, config->unix_path, sizeof(addr.sun_path));
+
+        // a socket left behind by an earlier run would fail the bind.
+        unlink(config->unix_path);
+        if ((s->listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 || bind(s->listen, (struct sockaddr*)&addr, sizeof(addr))) {
+            SDL_SetError("failed to bind: %s", config->unix_path);
+            return false;
+        }
+    }
+    else {
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons((uint16_t)config->port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        const int yes = 1;
+        if ((s->listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 || setsockopt(s->listen, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) || bind(s->listen, (struct sockaddr*)&addr, sizeof(addr))) {
+            SDL_SetError("failed to bind: 127.0.0.1:%u", config->port);
+            return false;
+        }
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (listen(s->listen, SOMAXCONN) || (s->epoll = epoll_create1(EPOLL_CLOEXEC)) < 0 || epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->listen, &ev)) {
+        SDL_SetError("failed to listen");
+        return false;
+    }
+
+    return true;
+}
+
+bool stream_server_run(const struct StreamServerConfig* config, const struct StreamServerInterface* iface, void* user, struct StreamServerStats* stats)
+{
+    struct Server s = {
+        .config = config,
+        .iface = iface,
+        .user = user,
+        .stats = stats,
+        .epoll = -1,
+        .listen = -1,
+    };
+    SDL_memset(stats, 0, sizeof(*stats));
+
+    const bool result = start_listen(&s) && start_loader(&s);
+
+    // a client that goes away mid write is seen as an error, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+    g_quit = 0;
+    void (*old_int)(int) = signal(SIGINT, on_signal);
+    void (*old_term)(int) = signal(SIGTERM, on_signal);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (result && !g_quit) {
+        const int count = epoll_wait(s.epoll, events, MAX_EVENTS, TICK_MS);
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            struct Client* c = events[i].data.ptr;
+            if (!c) {
+                accept_clients(&s);
+                continue;
+            }
+
+            bool keep = true;
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                keep = false;
+            }
+            else if (c->state == ClientState_REQUEST && (events[i].events & EPOLLIN)) {
+                keep = read_request(&s, c) && send_client(&s, c);
+            }
+            else if (events[i].events & EPOLLIN) {
+                // nothing more is expected, so anything sent is dropped, and 0 is a close.
+                char discard[256];
+                keep = recv(c->fd, discard, sizeof(discard), 0) != 0;
+            }
+
+            if (keep && (events[i].events & EPOLLOUT)) {
+                keep = send_client(&s, c);
+            }
+            if (!keep) {
+                close_client(&s, c);
+            }
+        }
+
+        finish_loads(&s);
+
+        // every stream is topped up on each tick, those still sending wait for EPOLLOUT.
+        const Uint64 now = SDL_GetTicks64();
+        for (struct Client* c = s.clients, *next; c; c = next) {
+            next = c->next;
+            if (c->state == ClientState_PREBUFFER || (c->state == ClientState_STREAM && !c->blocked)) {
+                fill_client(&s, c, now);
+                if (!send_client(&s, c)) {
+                    close_client(&s, c);
+                }
+            }
+        }
+    }
+
+    signal(SIGINT, old_int);
+    signal(SIGTERM, old_term);
+
+    while (s.clients) {
+        close_client(&s, s.clients);
+    }
+    stop_loader(&s);
+    if (s.epoll >= 0) {
+        close(s.epoll);
+    }
+    if (s.listen >= 0) {
+        close(s.listen);
+        if (config->unix_path) {
+            unlink(config->unix_path);
+        }
+    }
+    return result;
+}
+
+#else
+
+bool stream_server_run(const struct StreamServerConfig* config, const struct StreamServerInterface* iface, void* user, struct StreamServerStats* stats)
+{
+    SDL_memset(stats, 0, sizeof(*stats));
+    SDL_SetError("serve is only available on linux");
+    return false;
+}
+
+#endif
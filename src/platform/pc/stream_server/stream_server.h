@@ -0,0 +1,65 @@
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gbs.h"
+#include "stream_pool/stream_pool.h"
+
+#include <stdbool.h>
+
+/*
+* serves songs as endless pcm or wav streams over http, on a unix socket or
+* a loopback tcp port. a request looks like:
+*
+*   GET /dir/file.gbs?song=3&format=wav HTTP/1.1
+*
+* the path is relative to the root the interface opens files from, song
+* defaults to the first song and format to wav, raw is 16-bit stereo pcm.
+*
+* every client is served from one thread with non-blocking sockets and
+* epoll, the songs are rendered by the stream pool. audio is sent paced to
+* real time, a little ahead so that the client can buffer, through a small
+* socket send buffer, so a client that stops reading holds up only itself.
+* files are opened on a loader thread, with the client waiting meanwhile,
+* so a slow load doesn't hold up the clients already streaming either.
+*
+* only available on linux.
+*/
+
+struct StreamServerConfig {
+    // a unix socket is used if set, otherwise port on 127.0.0.1.
+    const char* unix_path;
+    unsigned port;
+    // streams are added to it, it must outlive the server.
+    StreamPool* pool;
+    unsigned sample_rate;
+};
+
+struct StreamServerInterface {
+    // returns a gbs rendering at the sample rate with the song set, or NULL.
+    // song is -1 for the first song. path is decoded and has no "..".
+    // called on the loader thread, one request at a time.
+    Gbs* (*open)(void* user, const char* path, int song, void** file);
+    // called with the file set by open() once its gbs has been freed, from
+    // any thread. may be NULL.
+    void (*release)(void* file);
+};
+
+struct StreamServerStats {
+    unsigned accepted;
+    unsigned rejected; // bad requests and files that failed to open.
+    unsigned peak_clients;
+    unsigned long long bytes_sent;
+};
+
+/* runs until SIGINT or SIGTERM, returns false if it failed to start. */
+bool stream_server_run(const struct StreamServerConfig* config, const struct StreamServerInterface* iface, void* user, struct StreamServerStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STREAM_SERVER_H